@@ -21,6 +21,8 @@ void check_depricated_options(const char* parameter_name, const int line);
 void set_control_parameter(const char* parameter_name, const char* val, ControlInputs* const control_input, const int line)
 {
     if (strcmp("block_size", parameter_name) == 0) sscanf(val, "%d", &control_input->frames_per_traj_block);
+    else if (strcmp("checkpoint_interval", parameter_name) == 0) sscanf(val, "%d", &control_input->checkpoint_interval);
+    else if (strcmp("restart_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->restart_flag);
     else if (strcmp("use_statistical_reweighting", parameter_name) == 0) sscanf(val, "%d", &control_input->use_statistical_reweighting);
     else if (strcmp("dynamic_types", parameter_name) == 0) sscanf(val, "%d", &control_input->dynamic_types);
     else if (strcmp("dynamic_state_sampling", parameter_name) == 0) sscanf(val, "%d", &control_input->dynamic_state_sampling);
@@ -55,13 +57,16 @@ void set_control_parameter(const char* parameter_name, const char* val, ControlI
     else if (strcmp("rcond", parameter_name) == 0) sscanf(val, "%lf", &control_input->rcond);
 	else if (strcmp("sparse_safety_factor", parameter_name) == 0) sscanf(val, "%lf", &control_input->sparse_safety_factor);
 	else if (strcmp("num_sparse_threads", parameter_name) == 0) sscanf(val, "%d", &control_input->num_sparse_threads);
+	else if (strcmp("num_threads", parameter_name) == 0) sscanf(val, "%d", &control_input->num_threads);
     else if (strcmp("max_pair_bonds_per_site", parameter_name) == 0) sscanf(val, "%d", &control_input->max_pair_bonds_per_site);
     else if (strcmp("max_angles_per_site", parameter_name) == 0) sscanf(val, "%d", &control_input->max_angles_per_site);
     else if (strcmp("max_dihedrals_per_site", parameter_name) == 0) sscanf(val, "%d", &control_input->max_dihedrals_per_site);
     else if (strcmp("output_solution_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->output_solution_flag);
+    else if (strcmp("performance_output_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->performance_output_flag);
     else if (strcmp("lanyuan_iterative_method_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->iterative_calculation_flag);
     else if (strcmp("regularization_scalar", parameter_name) == 0) sscanf(val, "%lf", &control_input->tikhonov_regularization_param);
     else if (strcmp("regularization_style", parameter_name) == 0) sscanf(val, "%d", &control_input->regularization_style);
+    else if (strcmp("regularization_scan_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->regularization_scan_flag);
     else if (strcmp("angle_type", parameter_name) == 0) sscanf(val, "%d", &control_input->angle_interaction_style);
     else if (strcmp("dihedral_type", parameter_name) == 0) sscanf(val, "%d", &control_input->dihedral_interaction_style);
     else if (strcmp("three_body_nonbonded_style", parameter_name) == 0) sscanf(val, "%d", &control_input->three_body_flag);
@@ -77,12 +82,14 @@ void set_control_parameter(const char* parameter_name, const char* val, ControlI
     else if (strcmp("output_residual_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->output_residual);
     else if (strcmp("bayesian_mscg_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->bayesian_flag);
     else if (strcmp("bayesian_max_iterations", parameter_name) == 0) sscanf(val, "%d", &control_input->bayesian_max_iter);
+    else if (strcmp("bayesian_alpha_style", parameter_name) == 0) sscanf(val, "%d", &control_input->bayesian_alpha_style);
     else if (strcmp("stillinger_weber_gamma", parameter_name) == 0) sscanf(val, "%lf", &control_input->gamma);
     else if (strcmp("three_body_nonbonded_exclusion_type", parameter_name) == 0) sscanf(val, "%d", &control_input->three_body_nonbonded_exclusion_flag);
 	else if (strcmp("excluded_style", parameter_name) == 0) sscanf(val, "%d", &control_input->excluded_style);
 	else if (strcmp("density_excluded_style", parameter_name) == 0) sscanf(val, "%d", &control_input->density_excluded_style);
     else if (strcmp("output_spline_coeffs_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->output_spline_coeffs_flag);
     else if (strcmp("output_normal_equations_rhs_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->output_normal_equations_rhs_flag);
+    else if (strcmp("output_archive_flag", parameter_name) == 0) sscanf(val, "%d", &control_input->output_archive_flag);
     else if (strcmp("output_pair_nonbonded_parameter_distribution", parameter_name) == 0) sscanf(val, "%d", &control_input->output_pair_nonbonded_parameter_distribution);
     else if (strcmp("output_pair_bond_parameter_distribution", parameter_name) == 0) sscanf(val, "%d", &control_input->output_pair_bond_parameter_distribution);
     else if (strcmp("output_angle_parameter_distribution", parameter_name) == 0) sscanf(val, "%d", &control_input->output_angle_parameter_distribution);
@@ -115,6 +122,8 @@ ControlInputs::ControlInputs(void)
     // Set defaults for all control.in parameters
     
     frames_per_traj_block = 10;
+    checkpoint_interval = 0;
+    restart_flag = 0;
     use_statistical_reweighting = 0;
     pressure_constraint_flag = 0;
     volume_weighting_flag = 0;
@@ -150,13 +159,16 @@ ControlInputs::ControlInputs(void)
     rcond = -1.0;
 	sparse_safety_factor = 0.20;
     num_sparse_threads = 1;
+    num_threads = 0;
     max_pair_bonds_per_site = 4;
     max_angles_per_site = 12;
     max_dihedrals_per_site = 36;
     output_solution_flag = 0;
+    performance_output_flag = 0;
     iterative_calculation_flag = 0;
     tikhonov_regularization_param = 0.0;
     regularization_style = 0;
+    regularization_scan_flag = 0;
     angle_interaction_style = 0;
     dihedral_interaction_style = 0;
     three_body_flag = 0;
@@ -172,12 +184,14 @@ ControlInputs::ControlInputs(void)
     output_residual = 0;
     bayesian_flag = 0;
     bayesian_max_iter = 1;
+    bayesian_alpha_style = 0;
     gamma = 0.12;
     three_body_nonbonded_exclusion_flag = 0;
     excluded_style = 2;
 	density_excluded_style = 0;
     output_spline_coeffs_flag = 0;
     output_normal_equations_rhs_flag = 0;
+    output_archive_flag = 0;
     output_pair_nonbonded_parameter_distribution = 0;
     output_pair_bond_parameter_distribution = 0;
     output_angle_parameter_distribution = 0;
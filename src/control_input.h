@@ -18,6 +18,8 @@ typedef struct ControlInputs {
     int n_frames;
     int frames_per_traj_block;
     int volume_weighting_flag;
+    int checkpoint_interval;				// Number of frame blocks between checkpoints of the FM equations; 0 for no checkpoints
+    int restart_flag;						// 1 to resume FM from the last checkpoint; 0 otherwise
     
     // Input specifications
     int use_statistical_reweighting;
@@ -68,10 +70,13 @@ typedef struct ControlInputs {
     int output_style;
     int bayesian_flag;
 	int bayesian_max_iter;
+	int bayesian_alpha_style;				// 0 for one Bayesian alpha per basis function; 1 for a single alpha for all of them
     int output_solution_flag;    
     int output_residual;
     int output_spline_coeffs_flag;
     int output_normal_equations_rhs_flag;
+    int output_archive_flag;				// 0 for one file per table; 1 to write the interaction output files into tables.tar
+    int performance_output_flag;			// 0 for none; 1 to write phase timers and counters to perf.json; 2 to also write perf_trace.json
     double pair_nonbonded_output_binwidth;
     double pair_bond_output_binwidth;
     double angle_output_binwidth;
@@ -99,9 +104,11 @@ typedef struct ControlInputs {
     int iterative_calculation_flag;
     double tikhonov_regularization_param;
     int regularization_style;
+    int regularization_scan_flag;				// 1 to also solve for every scalar Tikhonov parameter in regularization_scan.in; 0 otherwise
     double rcond;
 	double sparse_safety_factor; 
 	int num_sparse_threads;
+	int num_threads;							// Worker threads for shared-memory routines; 0 to use all available cores
 	
 	ControlInputs(void);
 	~ControlInputs(void);
@@ -43,6 +43,20 @@ extern void dgelss_(int* m, int* n, int* nrhs, double* a, int* lda, double* b, i
 
 extern void dgetri_(const int* n, double* a, const int* lda, int* ipiv, double* work, const int* lwork, int *info);
 
+extern void dsyevd_(char* jobz, char* uplo, int* n, double* a, int* lda, double* w, double* lapack_temp_workspace,
+                    int* lapack_setup_flag, int* iwork, int* liwork, int* info);
+
+extern void dpotrf_(char* uplo, int* n, double* a, int* lda, int* info);
+
+extern void dpotrs_(char* uplo, int* n, int* nrhs, double* a, int* lda, double* b, int* ldb, int* info);
+
+extern void dpotri_(char* uplo, int* n, double* a, int* lda, int* info);
+
+extern void dtrtri_(char* uplo, char* diag, int* n, double* a, int* lda, int* info);
+
+extern void dtpqrt_(int* m, int* n, int* l, int* nb, double* a, int* lda, double* b, int* ldb,
+                    double* t, int* ldt, double* work, int* info);
+
 # endif
 					
 #ifdef __cplusplus
@@ -8,8 +8,12 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <list>
+#include <map>
 #include <string>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include "interaction_model.h"
 #include "interaction_hashing.h"
@@ -18,19 +22,52 @@
 
 #include "fm_output.h"
 
+//----------------------------------------------------------------------------
+// Buffered output files.
+//----------------------------------------------------------------------------
+
+// While an OutputFileScope is active on a thread, the files it opens with
+// open_output_file are formatted into memory instead of written. Each
+// interaction gets its own set of buffered files, so the interactions can be
+// tabulated on several threads; write_buffered_output_files then writes all
+// of the sets at once, in order.
+
+struct BufferedOutputFile {
+	std::string filename;
+	bool append;					// Opened with mode "a": the contents follow those of earlier sets
+	char* contents;					// Allocated by open_memstream; freed by write_buffered_output_files
+	size_t size;
+};
+
+struct OutputFileSet {
+	std::list<BufferedOutputFile> files;	// A list so open_memstream's pointers into it stay valid
+};
+
+class OutputFileScope {
+	OutputFileSet* previous_file_set;
+public:
+	OutputFileScope(OutputFileSet* const file_set);
+	~OutputFileScope();
+};
+
+FILE* open_output_file(const char* filename, const char* mode);
+void write_buffered_output_files(std::vector<OutputFileSet>& file_sets, const int n_threads, const int archive_flag);
+void write_output_archive(const char* archive_name, const std::vector<std::string>& filenames, const std::vector< std::vector<const BufferedOutputFile*> >& parts);
+
 //----------------------------------------------------------------------------
 // Prototypes for private implementation routines.
 //----------------------------------------------------------------------------
 
-void write_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
+void write_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, std::vector<OutputFileSet>& output_file_sets);
+void write_one_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, InteractionClassComputer* const icomp, const int index_among_defined);
 void write_three_body_interaction_data(ThreeBodyNonbondedClassComputer* const icomp, MATRIX_DATA* const mat, char ** const name);
 
-void pad_and_print_table_files(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, std::vector<double>& potential_vals, const double cutoff);
-void pad_and_print_single_table(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, const double cutoff);
+void pad_and_print_table_files(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, std::vector<double>& potential_vals, const double cutoff, InteractionTable* const table = NULL);
+void pad_and_print_single_table(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, const double cutoff, InteractionTable* const table = NULL);
 void print_table_files(const char char_id, std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, std::vector<double>& potential_vals);
 
-void write_one_param_table_files(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff);
-void write_one_param_table_files_energy(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff);
+void write_one_param_table_files(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff, InteractionTable* const table = NULL);
+void write_one_param_table_files_energy(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff, InteractionTable* const table = NULL);
 void write_two_param_bspline_table_file(InteractionClassComputer* const icomp, char ** const name, MATRIX_DATA* const mat, const int index_among_defined);
 
 void write_one_param_linear_spline_file(InteractionClassComputer* const icomp, char ** const name, MATRIX_DATA* const mat, const int index_among_defined_intrxns);
@@ -38,7 +75,7 @@ void write_one_param_bspline_file(InteractionClassComputer* const icomp, char **
 void write_output_solution(MATRIX_DATA* const mat);
 
 void write_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, const std::vector<double>& force);
-void write_LAMMPS_table_output_file(const char i_type, const std::string& interaction_name, std::vector<double>& axis_vals, std::vector<double>& potential_vals, std::vector<double>& force_vals);
+void write_LAMMPS_table_output_file(const char i_type, const std::string& interaction_name, std::vector<double>& axis_vals, std::vector<double>& potential_vals, std::vector<double>& force_vals, InteractionTable* const table = NULL);
 void write_full_bootstrapping_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, std::vector<double> const master_force, std::vector<double>* const force, int const bootstrapping_num_estimates);
 void write_bootstrapping_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, std::vector<double> const master_force, std::vector<double>* const force, int const bootstrapping_num_estimates);
 
@@ -48,7 +85,6 @@ void write_bootstrapping_one_param_bspline_file(InteractionClassComputer* const
 void write_bootstrapping_one_param_linear_spline_file(InteractionClassComputer* const icomp, char **name, MATRIX_DATA* const mat, const int index_among_defined_intrxns);
 std::vector<double> calculate_bootstrapping_standard_error(const std::vector<double> master_vals, const std::vector<double>* vals, const int bootstrapping_num_estimates);
 
-void reinsert_periodic_solution_coefficients(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
 void shift_remaining_indices(const int start, const int bspline_k, std::vector<unsigned> &interaction_column_indices, const int size);
 
 //------------------------------------------------------------------------
@@ -58,110 +94,185 @@ void shift_remaining_indices(const int start, const int bspline_k, std::vector<u
 void write_fm_interaction_output_files(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat)
 {
 	reinsert_periodic_solution_coefficients(cg, mat);
-
-    // Write a binary copy of the solution vector if desired.
-    if (mat->output_solution_flag == 1) {
-    	write_output_solution(mat);
-    }
-
-    // Write all interaction-by-interaction output files.
-    write_interaction_data_to_file(cg, mat);
+	write_fm_solution_output_files(cg, mat);
 }
 
-void write_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat)
+void write_fm_solution_output_files(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat)
 {
-    // Erase the "b-spline.out" file if it exists, create it empty if not.
-    // Move this to a b-spline output constructor.
-    FILE *spline_output_filep = open_file("b-spline.out", "w");
-    fclose(spline_output_filep);
+    std::vector<OutputFileSet> output_file_sets(1);
+    {
+    	OutputFileScope output_file_scope(&output_file_sets[0]);
+	    // Write a binary copy of the solution vector if desired.
+	    if (mat->output_solution_flag == 1) {
+	    	write_output_solution(mat);
+	    }
+	}
+
+    // Format all interaction-by-interaction output files.
+    write_interaction_data_to_file(cg, mat, output_file_sets);
     
+    // Write the files, separately or as one archive.
+    write_buffered_output_files(output_file_sets, get_num_worker_threads(mat), mat->output_archive_flag);
+	
+	printf("Done with output.\n"); fflush(stdout);
+
+    for (int i = 0; i < cg->n_cg_types; i++) delete [] cg->name[i];
+    delete [] cg->name;
+}
 
-    // For each class of interactions, perform output for the active 
-    // interactions in that class. For one-parameter interactions right now.
+void write_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, std::vector<OutputFileSet>& output_file_sets)
+{
+    // For each class of interactions, list the active interactions in that 
+    // class. For one-parameter interactions right now.
+    std::vector<InteractionClassComputer*> job_icomps;
+    std::vector<int> job_indices;
 	std::list<InteractionClassComputer*>::iterator icomp_iterator;
 	for(icomp_iterator = cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++) {
         // For every defined interaction,
         for (unsigned i = 0; i < (*icomp_iterator)->ispec->defined_to_matched_intrxn_index_map.size(); i++) {
             // If that interaction is being matched
             if ((*icomp_iterator)->ispec->defined_to_matched_intrxn_index_map[i] != 0) {
-            	    
-            	// Select the correct type name array for the interaction.
-				char** name = select_name((*icomp_iterator)->ispec, cg->name);
-
-				// Write output based on energy splines
-	        	if(mat->matrix_type == kDummy){
-	      	 		if(mat->matrix_type == kDummy && (*icomp_iterator)->ispec->output_parameter_distribution == 0) continue;
-		         	
-		         	if (mat->bootstrapping_flag == 1) {
-	                	// Write tabular output, regardless of spline type.
- 	   	            	write_bootstrapping_one_param_table_files_energy(*icomp_iterator, name, mat->fm_solution, mat->bootstrap_solutions, i, mat->bootstrapping_num_estimates, mat->bootstrapping_full_output_flag, cg->pair_nonbonded_cutoff);
-        	        	// Write special output files for the specific spline types.
-            	    	if ((*icomp_iterator)->ispec->get_basis_type() == kBSpline ||
-            	    	    (*icomp_iterator)->ispec->get_basis_type() == kBSplineAndDeriv ) {
-                		    write_bootstrapping_one_param_bspline_file(*icomp_iterator, name, mat, i);
-	                	} else if ((*icomp_iterator)->ispec->get_basis_type() == kLinearSpline) {
-    	            	    write_bootstrapping_one_param_linear_spline_file(*icomp_iterator, name, mat, i);
-        	        	} else {
-            	    	    printf("Unrecognized basis type.\n");
-                		    exit(EXIT_FAILURE);
-                		}
-   					} else {
-						// Write tabular output, regardless of spline type.
-						write_one_param_table_files_energy(*icomp_iterator, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff);
-					
-						// Write special output files for the specific spline types.	      
-						if ((*icomp_iterator)->ispec->get_basis_type() == kBSpline ||
-							(*icomp_iterator)->ispec->get_basis_type() == kBSplineAndDeriv ) {
-							write_one_param_bspline_file(*icomp_iterator, name, mat, i);
-						} else if ((*icomp_iterator)->ispec->get_basis_type() == kLinearSpline) {
-							write_one_param_linear_spline_file(*icomp_iterator, name, mat, i);
-						} else {
-							printf("Unrecognized basis type.\n");
-							exit(EXIT_FAILURE);
-						}
-					}
-	      		} else {	
-	      			// This is for force matching
-	      			// Write output based on force splines		
-   					if (mat->bootstrapping_flag == 1) {
-	                	// Write tabular output, regardless of spline type.
- 	   	            	write_bootstrapping_one_param_table_files(*icomp_iterator, name, mat->fm_solution, mat->bootstrap_solutions, i, mat->bootstrapping_num_estimates, mat->bootstrapping_full_output_flag);
-        	        	// Write special output files for the specific spline types.
-            	    	if ((*icomp_iterator)->ispec->get_basis_type() == kBSpline ||
-            	    	    (*icomp_iterator)->ispec->get_basis_type() == kBSplineAndDeriv ) {
-                		    write_bootstrapping_one_param_bspline_file(*icomp_iterator, name, mat, i);
-	                	} else if ((*icomp_iterator)->ispec->get_basis_type() == kLinearSpline) {
-    	            	    write_bootstrapping_one_param_linear_spline_file(*icomp_iterator, name, mat, i);
-        	        	} else {
-            	    	    printf("Unrecognized basis type.\n");
-                		    exit(EXIT_FAILURE);
-                		}
-   					} else {
-	                	// Write tabular output, regardless of spline type.
-				  		write_one_param_table_files(*icomp_iterator, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff);
-        	        	// Write special output files for the specific spline types.
-            	    	if ((*icomp_iterator)->ispec->get_basis_type() == kBSpline ||
-            	    	    (*icomp_iterator)->ispec->get_basis_type() == kBSplineAndDeriv ) {
-                		    write_one_param_bspline_file(*icomp_iterator, name, mat, i);
-		    			} else if ((*icomp_iterator)->ispec->get_basis_type() == kLinearSpline) {
-    	                	write_one_param_linear_spline_file(*icomp_iterator, name, mat, i);
-    	            	} else {
-            	        	printf("Unrecognized basis type.\n");
-                	    	exit(EXIT_FAILURE);
-                		}
-					}
-	      		}
-	    	}
+            	job_icomps.push_back(*icomp_iterator);
+            	job_indices.push_back(i);
+            }
         }
+    }
+    
+    // One set of files for the "b-spline.out" header, one per interaction, 
+    // and one for the three body nonbonded interactions.
+    int n_jobs = job_icomps.size();
+    int first_job_set = output_file_sets.size() + 1;
+    output_file_sets.resize(first_job_set + n_jobs + 1);
+
+    // Erase the "b-spline.out" file if it exists, create it empty if not.
+    // Move this to a b-spline output constructor.
+    {
+    	OutputFileScope output_file_scope(&output_file_sets[first_job_set - 1]);
+	    FILE *spline_output_filep = open_output_file("b-spline.out", "w");
+    	fclose(spline_output_filep);
+    }
+    
+    // Tabulate the interactions on the worker threads.
+    int n_threads = get_num_worker_threads(mat);
+    int n_workers = (n_threads < n_jobs) ? n_threads : n_jobs;
+	std::vector<std::thread> workers;
+	for (int w = 0; w < n_workers; w++) {
+		workers.push_back(std::thread([cg, mat, w, n_workers, n_jobs, first_job_set, &job_icomps, &job_indices, &output_file_sets]() {
+			for (int j = w; j < n_jobs; j += n_workers) {
+				OutputFileScope output_file_scope(&output_file_sets[first_job_set + j]);
+				write_one_interaction_data_to_file(cg, mat, job_icomps[j], job_indices[j]);
+			}
+		}));
 	}
+	for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
       
     // Write three body nonbonded interaction data.
+    OutputFileScope output_file_scope(&output_file_sets[first_job_set + n_jobs]);
 	write_three_body_interaction_data(&cg->three_body_nonbonded_computer, mat, cg->name);
-	
-	printf("Done with output.\n"); fflush(stdout);
+}
 
-    for (int i = 0; i < cg->n_cg_types; i++) delete [] cg->name[i];
-    delete [] cg->name;
+// Write the output files for one matched interaction.
+
+void write_one_interaction_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, InteractionClassComputer* const icomp, const int i)
+{
+	// Select the correct type name array for the interaction.
+	char** name = select_name(icomp->ispec, cg->name);
+
+	// Write output based on energy splines
+	if(mat->matrix_type == kDummy){
+		if(icomp->ispec->output_parameter_distribution == 0) return;
+		
+		if (mat->bootstrapping_flag == 1) {
+			// Write tabular output, regardless of spline type.
+			write_bootstrapping_one_param_table_files_energy(icomp, name, mat->fm_solution, mat->bootstrap_solutions, i, mat->bootstrapping_num_estimates, mat->bootstrapping_full_output_flag, cg->pair_nonbonded_cutoff);
+			// Write special output files for the specific spline types.
+			if (icomp->ispec->get_basis_type() == kBSpline ||
+				icomp->ispec->get_basis_type() == kBSplineAndDeriv ) {
+				write_bootstrapping_one_param_bspline_file(icomp, name, mat, i);
+			} else if (icomp->ispec->get_basis_type() == kLinearSpline) {
+				write_bootstrapping_one_param_linear_spline_file(icomp, name, mat, i);
+			} else {
+				printf("Unrecognized basis type.\n");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			// Write tabular output, regardless of spline type.
+			write_one_param_table_files_energy(icomp, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff);
+		
+			// Write special output files for the specific spline types.	      
+			if (icomp->ispec->get_basis_type() == kBSpline ||
+				icomp->ispec->get_basis_type() == kBSplineAndDeriv ) {
+				write_one_param_bspline_file(icomp, name, mat, i);
+			} else if (icomp->ispec->get_basis_type() == kLinearSpline) {
+				write_one_param_linear_spline_file(icomp, name, mat, i);
+			} else {
+				printf("Unrecognized basis type.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	} else {	
+		// This is for force matching
+		// Write output based on force splines		
+		if (mat->bootstrapping_flag == 1) {
+			// Write tabular output, regardless of spline type.
+			write_bootstrapping_one_param_table_files(icomp, name, mat->fm_solution, mat->bootstrap_solutions, i, mat->bootstrapping_num_estimates, mat->bootstrapping_full_output_flag);
+			// Write special output files for the specific spline types.
+			if (icomp->ispec->get_basis_type() == kBSpline ||
+				icomp->ispec->get_basis_type() == kBSplineAndDeriv ) {
+				write_bootstrapping_one_param_bspline_file(icomp, name, mat, i);
+			} else if (icomp->ispec->get_basis_type() == kLinearSpline) {
+				write_bootstrapping_one_param_linear_spline_file(icomp, name, mat, i);
+			} else {
+				printf("Unrecognized basis type.\n");
+				exit(EXIT_FAILURE);
+			}
+		} else {
+			// Write tabular output, regardless of spline type.
+			write_one_param_table_files(icomp, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff);
+			// Write special output files for the specific spline types.
+			if (icomp->ispec->get_basis_type() == kBSpline ||
+				icomp->ispec->get_basis_type() == kBSplineAndDeriv ) {
+				write_one_param_bspline_file(icomp, name, mat, i);
+			} else if (icomp->ispec->get_basis_type() == kLinearSpline) {
+				write_one_param_linear_spline_file(icomp, name, mat, i);
+			} else {
+				printf("Unrecognized basis type.\n");
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+}
+
+void calculate_interaction_results(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, std::vector<InteractionResult>& results)
+{
+	results.clear();
+	std::list<InteractionClassComputer*>::iterator icomp_iterator;
+	for(icomp_iterator = cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++) {
+		InteractionClassComputer* icomp = *icomp_iterator;
+		for (unsigned i = 0; i < icomp->ispec->defined_to_matched_intrxn_index_map.size(); i++) {
+			int index_among_matched = icomp->ispec->defined_to_matched_intrxn_index_map[i];
+			if (index_among_matched == 0) continue;
+			if (mat->matrix_type == kDummy && icomp->ispec->output_parameter_distribution == 0) continue;
+			char** name = select_name(icomp->ispec, cg->name);
+
+			InteractionResult result;
+			result.name = icomp->ispec->get_basename(name, i, "_");
+			result.char_id = icomp->ispec->get_char_id();
+			result.basis_type = icomp->ispec->get_basis_type();
+			result.bspline_k = icomp->ispec->get_bspline_k();
+			result.lower_cutoff = icomp->ispec->lower_cutoffs[i];
+			result.upper_cutoff = icomp->ispec->upper_cutoffs[i];
+			unsigned first_column = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched - 1];
+			unsigned end_column = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched];
+			result.coeffs.assign(mat->fm_solution.begin() + first_column, mat->fm_solution.begin() + end_column);
+			if (mat->matrix_type == kDummy) {
+				write_one_param_table_files_energy(icomp, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff, &result.table);
+			} else {
+				write_one_param_table_files(icomp, name, mat->fm_solution, i, cg->pair_nonbonded_cutoff, &result.table);
+			}
+			results.push_back(result);
+		}
+	}
 }
 
 // Write output for three-body non-bonded interactions.
@@ -172,7 +283,7 @@ void write_three_body_interaction_data(ThreeBodyNonbondedClassComputer* const ic
 	
 	ThreeBodyNonbondedClassSpec* iclass = static_cast<ThreeBodyNonbondedClassSpec*>(icomp->ispec);	
 	FILE* tb_out = NULL;	
-	if (iclass->class_subtype == 3) tb_out = open_file("3b.dat", "w");
+	if (iclass->class_subtype == 3) tb_out = open_output_file("3b.dat", "w");
 	
 	// For every defined interaction,
 	for (unsigned i = 0; i < iclass->defined_to_matched_intrxn_index_map.size(); i++) {
@@ -198,28 +309,35 @@ void write_three_body_interaction_data(ThreeBodyNonbondedClassComputer* const ic
 void write_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, const std::vector<double>& force) 
 {
 	std::string filename_tmp = filename_base + ".dat";
-    FILE *curr_table_output_file = open_file(filename_tmp.c_str(), "w");
+    FILE *curr_table_output_file = open_output_file(filename_tmp.c_str(), "w");
     for (unsigned i = 0; i < axis.size(); i++) {
         fprintf(curr_table_output_file, "%lf %.15le\n", axis[i], force[i]);
     }
     fclose(curr_table_output_file);
 }
 
-void write_LAMMPS_table_output_file(const char i_type, const std::string& interaction_name, std::vector<double>& axis_vals, std::vector<double>& potential_vals, std::vector<double>& force_vals) 
+void write_LAMMPS_table_output_file(const char i_type, const std::string& interaction_name, std::vector<double>& axis_vals, std::vector<double>& potential_vals, std::vector<double>& force_vals, InteractionTable* const table) 
 {
+    // Adjust bonded interactions so that the minimum potential is at 0.0.
+    if( (i_type == 'b') || (i_type == 'a') || (i_type == 'd') ) {
+        standardize_potential(potential_vals);
+    }
+
+	if (table != NULL) {
+		table->axis_vals = axis_vals;
+		table->potential_vals = potential_vals;
+		table->force_vals = force_vals;
+		return;
+	}
+
 	// Set-up LAMMPS table file
 	std::string filename = interaction_name + ".table";
-	FILE* curr_table_output_file = open_file(filename.c_str(), "w");
+	FILE* curr_table_output_file = open_output_file(filename.c_str(), "w");
 
 	// Write header
 	fprintf(curr_table_output_file, "# Header information on force file\n");
 	fprintf(curr_table_output_file, "\n");
 	fprintf(curr_table_output_file, "%s\n", interaction_name.c_str());
-	
-    // Adjust bonded interactions so that the minimum potential is at 0.0.
-    if( (i_type == 'b') || (i_type == 'a') || (i_type == 'd') ) {
-        standardize_potential(potential_vals);
-    }
 
     // Write special header lines for specific interaction types.
 	if ( (i_type == 'b') || (i_type == 'a') ) {
@@ -243,7 +361,9 @@ void write_LAMMPS_table_output_file(const char i_type, const std::string& intera
 }
 
 // Write the tabular output for a single interaction.
-void write_one_param_table_files_energy(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff) 
+// When table is not NULL, the final LAMMPS-style table is stored in it
+// instead and no files are written.
+void write_one_param_table_files_energy(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff, InteractionTable* const table) 
 {
   // Compute forces and potentials over a grid of parameter values.
   // Correct name is selected in calling function write_interaction_data_to_file
@@ -255,11 +375,13 @@ void write_one_param_table_files_energy(InteractionClassComputer* const icomp, c
   std::string basename = icomp->ispec->get_basename(name, index_among_defined_intrxns, "_");
 
   // Print out tabulated output files in MSCGFM style and LAMMPS style.
-  write_MSCGFM_table_output_file(basename, axis_vals, potential_vals);
-  pad_and_print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals, cutoff);
+  if (table == NULL) write_MSCGFM_table_output_file(basename, axis_vals, potential_vals);
+  pad_and_print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals, cutoff, table);
 }
 				 
-void write_one_param_table_files(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff) 
+// For tabulated interactions, the table stored in a non-NULL table
+// is the sum of the matched and tabulated forces.
+void write_one_param_table_files(InteractionClassComputer* const icomp, char ** const name, const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double cutoff, InteractionTable* const table) 
 {	
     // Compute forces over a grid of parameter values.
 	// Correct name is selected in calling function write_interaction_data_to_file
@@ -273,11 +395,11 @@ void write_one_param_table_files(InteractionClassComputer* const icomp, char **
     std::string basename = icomp->ispec->get_basename(name, index_among_defined_intrxns, "_");
 	
 	// Print out tabulated output files in MSCGFM style and LAMMPS style.
-    write_MSCGFM_table_output_file(basename, axis_vals, force_vals);
+    if (table == NULL) write_MSCGFM_table_output_file(basename, axis_vals, force_vals);
     if( index_among_tabulated == 0) {
-    	pad_and_print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals, cutoff);
+    	pad_and_print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals, cutoff, table);
     } else {
-    	print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals);
+    	if (table == NULL) print_table_files(icomp->ispec->get_char_id(), basename, axis_vals, force_vals, potential_vals);
 	
 		std::vector<double> tab_axis_vals, tab_force_vals;
 		icomp->calc_grid_of_table_force_vals(index_among_defined_intrxns, icomp->ispec->output_binwidth, tab_axis_vals, tab_force_vals);
@@ -286,19 +408,19 @@ void write_one_param_table_files(InteractionClassComputer* const icomp, char **
 		// Integrate force starting from cutoff
 		integrate_force(axis_vals, force_vals, potential_vals);
 		
-		write_MSCGFM_table_output_file(basename + "_sum", axis_vals, force_vals);
-		pad_and_print_table_files(icomp->ispec->get_char_id(), basename + "_sum", axis_vals, force_vals, potential_vals, cutoff);
+		if (table == NULL) write_MSCGFM_table_output_file(basename + "_sum", axis_vals, force_vals);
+		pad_and_print_table_files(icomp->ispec->get_char_id(), basename + "_sum", axis_vals, force_vals, potential_vals, cutoff, table);
     }
 }
 
-void pad_and_print_table_files(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, std::vector<double>& potential_vals, const double cutoff)
+void pad_and_print_table_files(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, std::vector<double>& potential_vals, const double cutoff, InteractionTable* const table)
 {	
 	if (char_id == 'n') {
-    	pad_and_print_single_table(char_id, basename, axis_vals, force_vals, 0.0);
+    	pad_and_print_single_table(char_id, basename, axis_vals, force_vals, 0.0, table);
 	} else if (char_id == 'b') {
-		pad_and_print_single_table(char_id, basename, axis_vals, force_vals, cutoff);
+		pad_and_print_single_table(char_id, basename, axis_vals, force_vals, cutoff, table);
 	} else if (char_id == 'a') {
-    	pad_and_print_single_table(char_id, basename, axis_vals, force_vals, 180.0);
+    	pad_and_print_single_table(char_id, basename, axis_vals, force_vals, 180.0, table);
 	} else if (char_id == 'd') {
    	 	double first_axis_wrapped = wrap_periodic_axis(-180.0, 180.0, axis_vals, force_vals);
    	 	trim_excess_axis(-180.0, 180.0, axis_vals, force_vals);
@@ -310,11 +432,11 @@ void pad_and_print_table_files(const char char_id, const std::string& basename,
 			force_vals[i]  /= DEGREES_PER_RADIAN;
    	 	}
    	 	// rewrite force file with wrapped forces
-   	 	write_MSCGFM_table_output_file(basename, axis_vals, force_vals);
+   	 	if (table == NULL) write_MSCGFM_table_output_file(basename, axis_vals, force_vals);
 		// wire LAMMPS table with force and potential
-   	 	write_LAMMPS_table_output_file(char_id, basename, axis_vals, corrected_potential_vals, force_vals); 
+   	 	write_LAMMPS_table_output_file(char_id, basename, axis_vals, corrected_potential_vals, force_vals, table); 
     } else {		
-    	write_LAMMPS_table_output_file(char_id, basename, axis_vals, potential_vals, force_vals);   
+    	write_LAMMPS_table_output_file(char_id, basename, axis_vals, potential_vals, force_vals, table);   
     }
 }
 
@@ -323,7 +445,7 @@ void print_table_files(const char char_id, std::string& basename, std::vector<do
 	write_LAMMPS_table_output_file(char_id, basename, axis_vals, potential_vals, force_vals);
 }
 
-void pad_and_print_single_table(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, const double cutoff)
+void pad_and_print_single_table(const char char_id, const std::string& basename, std::vector<double>& axis_vals, std::vector<double>& force_vals, const double cutoff, InteractionTable* const table)
 {
    std::vector<double> padded_potential_vals;
    
@@ -350,14 +472,14 @@ void pad_and_print_single_table(const char char_id, const std::string& basename,
    integrate_force(axis_vals, force_vals, padded_potential_vals);
    
    // write LAMMPS table using padded forces and potentials
-   write_LAMMPS_table_output_file(char_id, basename, axis_vals, padded_potential_vals, force_vals);
+   write_LAMMPS_table_output_file(char_id, basename, axis_vals, padded_potential_vals, force_vals, table);
 }
 
 void write_two_param_bspline_table_file(InteractionClassComputer* const icomp, char ** const name, MATRIX_DATA* const mat, const int index_among_defined)
 {
     // Print out a table of the interaction forces.
     std::string filename = icomp->ispec->get_basename(name, index_among_defined, "_") + ".dat";
-    FILE* curr_spline_output_file = open_file(filename.c_str(), "w");
+    FILE* curr_spline_output_file = open_output_file(filename.c_str(), "w");
 	std::vector<double> axis_vals, force_vals, deriv_vals;
 	icomp->calc_grid_of_force_and_deriv_vals(mat->fm_solution, index_among_defined, icomp->ispec->output_binwidth, axis_vals, force_vals, deriv_vals);
 	for (unsigned i = 0; i < axis_vals.size(); i++) {
@@ -386,7 +508,7 @@ void write_one_param_linear_spline_file(InteractionClassComputer* const icomp, c
 
         // Output the linear spline bin points and coefficients.
         sprintf(name_tmp1, "%s.b", basename.c_str());
-        raw_rhs_output_file = open_file(name_tmp1, "w");
+        raw_rhs_output_file = open_output_file(name_tmp1, "w");
         for (unsigned i = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]; i < icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions]; i++) {
             fprintf(raw_rhs_output_file, "%lf %.15le\n", icomp->ispec->lower_cutoffs[index_among_defined_intrxns] + icomp->ispec->get_fm_binwidth() * (i - icomp->interaction_class_column_index - icomp->ispec->interaction_column_indices[index_among_matched_interactions]), mat->fm_solution[i]);
         }
@@ -395,7 +517,7 @@ void write_one_param_linear_spline_file(InteractionClassComputer* const icomp, c
         // Output normal equation right hand side for this interaction.
         if (mat->output_normal_equations_rhs_flag == 1) {
             sprintf(name_tmp2, "%s.dense_fm_normal_rhs_vector", basename.c_str());
-            normal_form_rhs_output_file = open_file(name_tmp2, "w");
+            normal_form_rhs_output_file = open_output_file(name_tmp2, "w");
             for (unsigned i = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]; i < icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions]; i++) {
             	fprintf(normal_form_rhs_output_file, "%lf %.15le\n", icomp->ispec->lower_cutoffs[index_among_defined_intrxns] + icomp->ispec->get_fm_binwidth() * (i - icomp->interaction_class_column_index - icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]), mat->dense_fm_normal_rhs_vector[i]);
             }
@@ -416,7 +538,7 @@ void write_one_param_bspline_file(InteractionClassComputer* const icomp, char **
    	    type_names = icomp->ispec->get_interaction_name(name, index_among_defined, " ");
 	}
 
-	FILE* spline_output_filep = open_file("b-spline.out", "a");
+	FILE* spline_output_filep = open_output_file("b-spline.out", "a");
 	
 	fprintf(spline_output_filep, "%c: ", icomp->ispec->get_char_id());
 	fprintf(spline_output_filep, "%s ", type_names.c_str());
@@ -440,7 +562,7 @@ void write_one_param_bspline_file(InteractionClassComputer* const icomp, char **
 
 void write_output_solution(MATRIX_DATA* const mat)
 {
-	FILE* xout = open_file("x.out", "wb");
+	FILE* xout = open_output_file("x.out", "wb");
 	if (mat->bootstrapping_flag == 1) {
 		for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
 			fwrite(&(mat->bootstrap_solutions[i][0]), sizeof(double), mat->fm_matrix_columns, xout);
@@ -454,7 +576,7 @@ void write_output_solution(MATRIX_DATA* const mat)
 void write_full_bootstrapping_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, std::vector<double> const master_force, std::vector<double>* const force, int const bootstrapping_num_estimates) 
 {
 	std::string filename_tmp = filename_base + ".dat";
-    FILE *curr_table_output_file = open_file(filename_tmp.c_str(), "w");
+    FILE *curr_table_output_file = open_output_file(filename_tmp.c_str(), "w");
     for (unsigned i = 0; i < axis.size(); i++) {
         fprintf(curr_table_output_file, "%lf\t", axis[i]);
         fprintf(curr_table_output_file, "%lf\t", master_force[i]);
@@ -485,7 +607,7 @@ std::vector<double> calculate_bootstrapping_standard_error(const std::vector<dou
 void write_bootstrapping_MSCGFM_table_output_file(const std::string& filename_base, const std::vector<double>& axis, std::vector<double> const master_force, std::vector<double>* const force, int const bootstrapping_num_estimates) 
 {
 	std::string filename_tmp = filename_base + ".dat";
-    FILE *curr_table_output_file = open_file(filename_tmp.c_str(), "w");
+    FILE *curr_table_output_file = open_output_file(filename_tmp.c_str(), "w");
 
     // Calculate standard error for all samples
     std::vector<double> standard_error = calculate_bootstrapping_standard_error(master_force, force, bootstrapping_num_estimates);
@@ -508,13 +630,19 @@ void write_bootstrapping_one_param_table_files(InteractionClassComputer* const i
     std::vector<double>* potential_vals = new std::vector<double>[bootstrapping_num_estimates];	
     int i;
     
+    // Evaluate the master and all bootstrap estimates together.
+    std::vector<const std::vector<double>*> spline_coeff_sets(1, &master_coeffs);
+    for (i = 0; i < bootstrapping_num_estimates; i++) spline_coeff_sets.push_back(&spline_coeffs[i]);
+    std::vector< std::vector<double> > set_force_vals;
+	icomp->calc_grids_of_force_vals(spline_coeff_sets, index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, set_force_vals);
+    
     // Master
-	icomp->calc_grid_of_force_vals(master_coeffs, index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, master_force_vals);
+    master_force_vals.swap(set_force_vals[0]);
     integrate_force(axis_vals, master_force_vals, master_potential_vals);
     
     // Bootstrap estimates
     for (i = 0; i < bootstrapping_num_estimates; i++) {
-	    icomp->calc_grid_of_force_vals(spline_coeffs[i], index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, force_vals[i]);
+	    force_vals[i].swap(set_force_vals[i + 1]);
 		// Integrate force starting from cutoff = 0.0 potential.
     	integrate_force(axis_vals, force_vals[i], potential_vals[i]);		
 	}
@@ -545,13 +673,21 @@ void write_bootstrapping_one_param_table_files_energy(InteractionClassComputer*
     std::vector<double>* potential_vals = new std::vector<double>[bootstrapping_num_estimates];	
     int i;
     
+    // Evaluate the master and all bootstrap estimates together.
+    std::vector<const std::vector<double>*> spline_coeff_sets(1, &master_coeffs);
+    for (i = 0; i < bootstrapping_num_estimates; i++) spline_coeff_sets.push_back(&spline_coeffs[i]);
+    std::vector< std::vector<double> > set_potential_vals, set_force_vals;
+	icomp->calc_grids_of_force_and_deriv_vals(spline_coeff_sets, index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, set_potential_vals, set_force_vals);
+    
     // Master
-	icomp->calc_grid_of_force_and_deriv_vals(master_coeffs, index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, master_potential_vals, master_force_vals);
+    master_potential_vals.swap(set_potential_vals[0]);
+    master_force_vals.swap(set_force_vals[0]);
 	make_negative(master_force_vals);
     
     // Bootstrap estimates
     for (i = 0; i < bootstrapping_num_estimates; i++) {
-	    icomp->calc_grid_of_force_and_deriv_vals(spline_coeffs[i], index_among_defined_intrxns, icomp->ispec->output_binwidth, axis_vals, potential_vals[i], force_vals[i]);
+	    potential_vals[i].swap(set_potential_vals[i + 1]);
+	    force_vals[i].swap(set_force_vals[i + 1]);
 		make_negative(force_vals[i]);
 	}
 
@@ -582,7 +718,7 @@ void write_bootstrapping_one_param_table_files_energy(InteractionClassComputer*
 
 void write_bootstrapping_one_param_bspline_file(InteractionClassComputer* const icomp, char **name, MATRIX_DATA* const mat, const int index_among_defined_intrxns)
 {
-    FILE *spline_output_filep = open_file("b-spline.out", "a");
+    FILE *spline_output_filep = open_output_file("b-spline.out", "a");
 
     // Print out class character & the types involved.
     fprintf(spline_output_filep, "%c: ", icomp->ispec->get_char_id());
@@ -620,7 +756,7 @@ void write_bootstrapping_one_param_linear_spline_file(InteractionClassComputer*
 
         // Output the linear spline bin points and coefficients.
         sprintf(name_tmp1, "%s.b", basename.c_str());
-        raw_rhs_output_file = open_file(name_tmp1, "w");
+        raw_rhs_output_file = open_output_file(name_tmp1, "w");
         for (unsigned i = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]; i < icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions]; i++) {
                fprintf(raw_rhs_output_file, "%lf", icomp->ispec->lower_cutoffs[index_among_defined_intrxns] + icomp->ispec->get_fm_binwidth() * (i - icomp->interaction_class_column_index - icomp->ispec->interaction_column_indices[index_among_matched_interactions]));
                for (int j = 0; j < mat->bootstrapping_num_estimates; j++) {               
@@ -633,7 +769,7 @@ void write_bootstrapping_one_param_linear_spline_file(InteractionClassComputer*
         // Output normal equation right hand side for this interaction.
         if (mat->output_normal_equations_rhs_flag == 1) {
             sprintf(name_tmp2, "%s.dense_fm_normal_rhs_vector", basename.c_str());
-            normal_form_rhs_output_file = open_file(name_tmp2, "w");
+            normal_form_rhs_output_file = open_output_file(name_tmp2, "w");
             for (unsigned i = icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]; i < icomp->interaction_class_column_index + icomp->ispec->interaction_column_indices[index_among_matched_interactions]; i++) {
                 fprintf(normal_form_rhs_output_file, "%lf", icomp->ispec->lower_cutoffs[index_among_defined_intrxns] + icomp->ispec->get_fm_binwidth() * (i - icomp->interaction_class_column_index - icomp->ispec->interaction_column_indices[index_among_matched_interactions - 1]));
             	for (int j = 0; j < mat->bootstrapping_num_estimates; j++) {
@@ -682,3 +818,165 @@ void shift_remaining_indices(const int start, const int bspline_k, std::vector<u
 {
 	for(int i = start; i < size; i++) interaction_column_indices[i] += bspline_k;
 }
+
+//------------------------------------------------------------------------
+//    Buffered output files
+//------------------------------------------------------------------------
+
+static thread_local OutputFileSet* current_output_file_set = NULL;
+
+void write_tar_header(FILE* archive, const std::string& name, const size_t size, const char type, const long mtime);
+void write_tar_padding(FILE* archive, const size_t size);
+
+OutputFileScope::OutputFileScope(OutputFileSet* const file_set) : previous_file_set(current_output_file_set)
+{
+	current_output_file_set = file_set;
+}
+
+OutputFileScope::~OutputFileScope()
+{
+	current_output_file_set = previous_file_set;
+}
+
+FILE* open_output_file(const char* filename, const char* mode)
+{
+	if (current_output_file_set == NULL) return open_file(filename, mode);
+	
+	BufferedOutputFile buffered_file;
+	buffered_file.filename = filename;
+	buffered_file.append = (mode[0] == 'a');
+	buffered_file.contents = NULL;
+	buffered_file.size = 0;
+	current_output_file_set->files.push_back(buffered_file);
+	
+	BufferedOutputFile& new_file = current_output_file_set->files.back();
+	FILE* filepointer = open_memstream(&new_file.contents, &new_file.size);
+	if (filepointer == NULL) {
+		fprintf(stderr, "Failed to buffer output file %s.\n", filename);
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+	return filepointer;
+}
+
+// Write the buffered files of all of the sets and free them. A file opened
+// in more than one set is written once: the contents from a set that opened
+// it with mode "a" follow the earlier contents, and those from a set that
+// opened it with mode "w" replace them.
+
+void write_buffered_output_files(std::vector<OutputFileSet>& file_sets, const int n_threads, const int archive_flag)
+{
+	std::map<std::string, int> file_indices;
+	std::vector<std::string> filenames;
+	std::vector<int> append_flags;
+	std::vector< std::vector<const BufferedOutputFile*> > parts;
+	for (unsigned i = 0; i < file_sets.size(); i++) {
+		std::list<BufferedOutputFile>::const_iterator file_iterator;
+		for (file_iterator = file_sets[i].files.begin(); file_iterator != file_sets[i].files.end(); file_iterator++) {
+			std::map<std::string, int>::iterator found = file_indices.find(file_iterator->filename);
+			if (found == file_indices.end()) {
+				file_indices[file_iterator->filename] = filenames.size();
+				filenames.push_back(file_iterator->filename);
+				append_flags.push_back(file_iterator->append ? 1 : 0);
+				parts.push_back(std::vector<const BufferedOutputFile*>(1, &(*file_iterator)));
+			} else {
+				if (!file_iterator->append) {
+					parts[found->second].clear();
+					append_flags[found->second] = 0;
+				}
+				parts[found->second].push_back(&(*file_iterator));
+			}
+		}
+	}
+	
+	if (archive_flag == 1) {
+		write_output_archive("tables.tar", filenames, parts);
+	} else {
+		// Resolve the paths here, since the file directory is set per thread.
+		int n_files = filenames.size();
+		std::vector<std::string> paths(n_files);
+		for (int f = 0; f < n_files; f++) paths[f] = get_file_path(filenames[f].c_str());
+		
+		int n_workers = (n_threads < n_files) ? n_threads : n_files;
+		std::vector<std::thread> workers;
+		for (int w = 0; w < n_workers; w++) {
+			workers.push_back(std::thread([w, n_workers, n_files, &paths, &append_flags, &parts]() {
+				for (int f = w; f < n_files; f += n_workers) {
+					FILE* output_file = open_file(paths[f].c_str(), (append_flags[f] == 1) ? "ab" : "wb");
+					for (unsigned k = 0; k < parts[f].size(); k++) {
+						fwrite(parts[f][k]->contents, 1, parts[f][k]->size, output_file);
+					}
+					fclose(output_file);
+				}
+			}));
+		}
+		for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	}
+	
+	for (unsigned i = 0; i < file_sets.size(); i++) {
+		std::list<BufferedOutputFile>::iterator file_iterator;
+		for (file_iterator = file_sets[i].files.begin(); file_iterator != file_sets[i].files.end(); file_iterator++) {
+			free(file_iterator->contents);
+		}
+	}
+	file_sets.clear();
+}
+
+// Write the files as the members of a tar archive. Names longer than the
+// 100 characters that fit in a tar header are stored in GNU long name
+// records, which GNU tar, bsdtar, and Python's tarfile all read.
+
+void write_output_archive(const char* archive_name, const std::vector<std::string>& filenames, const std::vector< std::vector<const BufferedOutputFile*> >& parts)
+{
+	FILE* archive = open_file(archive_name, "wb");
+	long mtime = (long)time(NULL);
+	for (unsigned f = 0; f < filenames.size(); f++) {
+		if (filenames[f].size() > 100) {
+			write_tar_header(archive, "././@LongLink", filenames[f].size() + 1, 'L', mtime);
+			fwrite(filenames[f].c_str(), 1, filenames[f].size() + 1, archive);
+			write_tar_padding(archive, filenames[f].size() + 1);
+		}
+		size_t size = 0;
+		for (unsigned k = 0; k < parts[f].size(); k++) size += parts[f][k]->size;
+		write_tar_header(archive, filenames[f], size, '0', mtime);
+		for (unsigned k = 0; k < parts[f].size(); k++) {
+			fwrite(parts[f][k]->contents, 1, parts[f][k]->size, archive);
+		}
+		write_tar_padding(archive, size);
+	}
+	// An archive ends with two empty records.
+	char end_records[1024];
+	memset(end_records, 0, 1024);
+	fwrite(end_records, 1, 1024, archive);
+	fclose(archive);
+}
+
+void write_tar_header(FILE* archive, const std::string& name, const size_t size, const char type, const long mtime)
+{
+	char header[512];
+	memset(header, 0, 512);
+	memcpy(header, name.c_str(), (name.size() < 100) ? name.size() : 100);
+	sprintf(header + 100, "%07o", 0644);			// mode
+	sprintf(header + 108, "%07o", 0);				// uid
+	sprintf(header + 116, "%07o", 0);				// gid
+	sprintf(header + 124, "%011lo", (unsigned long)size);
+	sprintf(header + 136, "%011lo", (unsigned long)mtime);
+	header[156] = type;
+	memcpy(header + 257, "ustar  ", 8);			// GNU magic and version
+	
+	// The checksum is computed with its own field filled with spaces.
+	memset(header + 148, ' ', 8);
+	unsigned checksum = 0;
+	for (int i = 0; i < 512; i++) checksum += (unsigned char)header[i];
+	sprintf(header + 148, "%06o", checksum);
+	fwrite(header, 1, 512, archive);
+}
+
+// Pad a member's data to a whole number of 512-byte records.
+
+void write_tar_padding(FILE* archive, const size_t size)
+{
+	char padding[512];
+	memset(padding, 0, 512);
+	if (size % 512 != 0) fwrite(padding, 1, 512 - size % 512, archive);
+}
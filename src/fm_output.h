@@ -8,9 +8,40 @@
 #ifndef _fm_output_h
 #define _fm_output_h
 
+#include <string>
+#include <vector>
+
 struct CG_MODEL_DATA;
 struct MATRIX_DATA;
 
+// The potential and force of one interaction over the grid of its
+// LAMMPS-style .table file, at full precision.
+struct InteractionTable {
+	std::vector<double> axis_vals;
+	std::vector<double> potential_vals;
+	std::vector<double> force_vals;
+};
+
+// The solution for one matched one-parameter interaction.
+struct InteractionResult {
+	std::string name;					// Base name of the interaction's output files
+	char char_id;						// Interaction class ('n', 'b', 'a', 'd', 'r', ...)
+	int basis_type;						// As for basis_type in control.in
+	int bspline_k;
+	double lower_cutoff;
+	double upper_cutoff;
+	std::vector<double> coeffs;			// Basis function coefficients
+	InteractionTable table;				// Including any tabulated force, as used to re-simulate
+};
+
 void write_fm_interaction_output_files(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
 
+// The two steps of write_fm_interaction_output_files, for callers that also
+// keep the results in memory with calculate_interaction_results in between.
+void reinsert_periodic_solution_coefficients(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
+void write_fm_solution_output_files(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
+
+// Tabulate every matched one-parameter interaction without writing files.
+void calculate_interaction_results(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, std::vector<InteractionResult>& results);
+
 #endif
@@ -5,6 +5,7 @@
 //  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
 //
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cmath>
@@ -14,6 +15,7 @@
 #include "interaction_model.h"
 #include "matrix.h"
 #include "misc.h"
+#include "performance.h"
 #include "trajectory_input.h"
 #include "splines.h"
 
@@ -30,31 +32,37 @@ bool check_density_excluded_list(const TopologyData* const topo_data, const int
 // differing by the way that potentially interacting particles are found in 
 // each frame and possibly found not to interact after.
 
-void order_pair_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
-void order_bonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
-void order_three_body_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
-void density_fm_matrix_element_calculation(InteractionClassComputer* const iclass, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+void order_pair_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+void order_three_body_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+void density_fm_matrix_element_calculation(InteractionClassComputer* const iclass, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+void density_accumulation_and_pair_storage(InteractionClassComputer* const iclass, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
 
 // Helper functions for the above
 
-void process_completed_density(DensityClassComputer* const info, calc_pair_matrix_elements process_density, const int n_cg_types, int* const cg_site_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
-inline void decode_density_interaction_and_calculate(DensityClassComputer* info, unsigned long interaction_flags, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+void process_completed_density(DensityClassComputer* const info, calc_pair_matrix_elements process_density, const int n_cg_types, int* const cg_site_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+inline void decode_density_interaction_and_calculate(DensityClassComputer* info, unsigned long interaction_flags, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths);
+inline void accumulate_density_pair_terms(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const int first_term, const int last_term, const int site, const double distance2, const double distance);
+inline void calc_stored_density_pair_terms(DensityClassComputer* const icomp, const int first_term, const int last_term, int* particle_ids, std::array<double, DIMENSION>* derivatives, const double distance, unsigned &weight_derivative_index, MATRIX_DATA* const mat);
 void process_normal_interaction_matrix_elements(InteractionClassComputer* const info, MATRIX_DATA* const mat, const int n_body, int* particle_ids, std::array<double, DIMENSION>* derivatives, const double param_value, const int virial_flag, const double param_deriv, const double distance);
 void process_density_matrix_elements(InteractionClassComputer* const info, MATRIX_DATA* const mat, const int n_body, int* particle_ids, std::array<double, DIMENSION>* derivatives, const double density_value, const int virial_flag, const double density_derivative, const double distance);
 
 // Functions for calculating individual 3-component matrix elements.
 
-void calc_isotropic_two_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_angular_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_dihedral_four_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_density_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_nonbonded_1_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_nonbonded_2_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_isotropic_two_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_angular_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_dihedral_four_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_density_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_nonbonded_1_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_nonbonded_2_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+double calc_gaussian_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2);
+double calc_switching_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2);
+double calc_lucy_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2);
+double calc_re_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2);
 double calc_gaussian_density_derivative(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance);
 double calc_switching_density_derivative(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance);
 double calc_lucy_density_derivative(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance);
 double calc_re_density_derivative(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance);
-void do_nothing(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void do_nothing(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
 void accumulate_matching_order_parameter_forces(InteractionClassComputer* const info, const int first_nonzero_basis_index, double extra_derivative_value, std::vector<double> &basis_fn_vals, const int n_body, const int* particle_ids, std::array<double, DIMENSION>* const &derivatives, MATRIX_DATA * const mat);
 
 //--------------------------------------------------------------------
@@ -78,6 +86,18 @@ void set_up_force_computers(CG_MODEL_DATA* const cg)
     cg->three_body_nonbonded_computer.special_set_up_computer(&cg->three_body_nonbonded_interactions, &curr_iclass_col_index);
 }
 
+// The phases are numbered from kNumFixedPhases in the order the classes
+// are visited by calculate_frame_fm_matrix.
+
+void add_interaction_class_phases(CG_MODEL_DATA* const cg, PerformanceProfile* const profile)
+{
+	std::list<InteractionClassComputer*>::iterator icomp_iterator;
+	for(icomp_iterator=cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++) {
+		profile->add_phase("calculate_interactions: " + (*icomp_iterator)->ispec->get_full_name());
+	}
+	profile->add_phase("calculate_interactions: " + cg->three_body_nonbonded_computer.ispec->get_full_name());
+}
+
 void InteractionClassComputer::set_up_computer(InteractionClassSpec* const ispec_pt, int *curr_iclass_col_index) 
 {
     // Store the pointer to the spec.
@@ -103,6 +123,9 @@ void InteractionClassComputer::set_up_computer(InteractionClassSpec* const ispec
 	process_interaction_matrix_elements = process_normal_interaction_matrix_elements;
     // Define the interaction class's geometric definition.
     cutoff2 = ispec->cutoff * ispec->cutoff;
+    // Every matrix element calculation for pairs found in the cell list
+    // rejects pairs beyond the cutoff, so these can be skipped during the walk.
+    neighbor_cutoff2 = cutoff2 * (1.0 + 1.0e-12);
     class_set_up_computer();
 }
 
@@ -114,18 +137,34 @@ void PairNonbondedClassComputer::class_set_up_computer(void)
 void PairBondedClassComputer::class_set_up_computer(void) 
 {
     calculate_fm_matrix_elements = calc_isotropic_two_body_fm_matrix_elements;
+    calculate_bonded_geometry = conditionally_calc_distance_and_derivatives;
+    geometry_n_body = 2;
 }
 
 void AngularClassComputer::class_set_up_computer(void) 
 {
-    if (ispec->class_subtype == 1) calculate_fm_matrix_elements = calc_isotropic_two_body_fm_matrix_elements;
-    else calculate_fm_matrix_elements = calc_angular_three_body_fm_matrix_elements;
+    if (ispec->class_subtype == 1) {
+    	calculate_fm_matrix_elements = calc_isotropic_two_body_fm_matrix_elements;
+    	calculate_bonded_geometry = conditionally_calc_distance_and_derivatives;
+    	geometry_n_body = 2;
+    } else {
+    	calculate_fm_matrix_elements = calc_angular_three_body_fm_matrix_elements;
+    	calculate_bonded_geometry = conditionally_calc_angle_and_derivatives;
+    	geometry_n_body = 3;
+    }
 }
 
 void DihedralClassComputer::class_set_up_computer(void) 
 {
-    if (ispec->class_subtype == 1) calculate_fm_matrix_elements = calc_isotropic_two_body_fm_matrix_elements;
-    else calculate_fm_matrix_elements = calc_dihedral_four_body_fm_matrix_elements;
+    if (ispec->class_subtype == 1) {
+    	calculate_fm_matrix_elements = calc_isotropic_two_body_fm_matrix_elements;
+    	calculate_bonded_geometry = conditionally_calc_distance_and_derivatives;
+    	geometry_n_body = 2;
+    } else {
+    	calculate_fm_matrix_elements = calc_dihedral_four_body_fm_matrix_elements;
+    	calculate_bonded_geometry = conditionally_calc_dihedral_and_derivatives;
+    	geometry_n_body = 4;
+    }
 }
 
 void DensityClassComputer::class_set_up_computer(void) 
@@ -137,28 +176,29 @@ void DensityClassComputer::class_set_up_computer(void)
 	if(iclass->class_subtype == 1) {
 		printf("Will calculate density using shifted-force Gaussian weight functions.\n");
 		calculate_density_values = calc_gaussian_density_values;
+		calculate_density_weight = calc_gaussian_density_weight;
 		calculate_density_derivative = calc_gaussian_density_derivative;
 	} else if(iclass->class_subtype == 2) {
 		printf("Will calculate density using shifted-force switching (tanh) weight functions.\n");
 		calculate_density_values = calc_switching_density_values;
+		calculate_density_weight = calc_switching_density_weight;
 		calculate_density_derivative = calc_switching_density_derivative;
 	} else if(iclass->class_subtype == 3) {
 		printf("Will calculate density using Lucy-style weight functions.\n");
 		calculate_density_values = calc_lucy_density_values;
+		calculate_density_weight = calc_lucy_density_weight;
 		calculate_density_derivative = calc_lucy_density_derivative;
 	}  else if(iclass->class_subtype == 4) {
 		printf("Will calculate density using Relative Entropy-style weight functions.\n");
 		calculate_density_values = calc_re_density_values;
+		calculate_density_weight = calc_re_density_weight;
 		calculate_density_derivative = calc_re_density_derivative;
 	}
 	calculate_fm_matrix_elements = calc_density_fm_matrix_elements;
 	process_density = do_nothing;
 	
-	// Allocate space to store density intermediate.
-	// This approach grabs enough memory for all cg sites to have all density values for all density groups.
-	// A more memory-efficient, but harder approach would be allocate each site's array based on the number of density groups needed at that site.
-	// The problem with this other approach is efficiently looking up which i to use.
-	density_values = new double[iclass->get_n_defined() * iclass->n_cg_sites]();
+	// Determine which densities are stored at sites of each type.
+	set_up_density_storage();
 	
 	// Allocate and compute constant calculation intermediates.
 	denomenator = new double[iclass->get_n_defined()];
@@ -174,11 +214,11 @@ void DensityClassComputer::class_set_up_computer(void)
 			denomenator[ii] = 2.0 * iclass->density_sigma[ii] * iclass->density_sigma[ii];
 			u_cutoff[ii] = - exp( - cutoff2 / denomenator[ii] );
 			f_cutoff[ii] = - 2.0 * iclass->cutoff * u_cutoff[ii] / denomenator[ii];
-			printf("%d: density_sigma %lf, cutoff %lf, u_cutoff %lf, f_cutoff %lf, denom %lf\n", i, iclass->density_sigma[i], iclass->cutoff, u_cutoff[i], f_cutoff[i], denomenator[i]); fflush(stdout);
+			printf("%d: density_sigma %lf, cutoff %lf, u_cutoff %lf, f_cutoff %lf, denom %lf\n", ii, iclass->density_sigma[ii], iclass->cutoff, u_cutoff[ii], f_cutoff[ii], denomenator[ii]); fflush(stdout);
 		}
 	} else if (iclass->class_subtype == 2) {
 		for(int ii = 0; ii < iclass->get_n_defined(); ii++) {
-			if (iclass->density_sigma[i] < VERYSMALL_F) {
+			if (iclass->density_sigma[ii] < VERYSMALL_F) {
 				printf("Density sigma parameter (%lf) is too small!\n", iclass->density_sigma[ii]);
 				exit(EXIT_FAILURE);
 			}
@@ -213,13 +253,96 @@ void DensityClassComputer::class_set_up_computer(void)
 		fflush(stdout);
 		exit(EXIT_FAILURE);
 	}
+	set_up_pair_terms();
 }
 
-void DensityClassComputer::reset_density_array(void) 
+// A site of a given type only needs the densities of interactions whose second density group contains that type,
+// so each site stores n_density_slots[type] values instead of one for every defined interaction.
+
+void DensityClassComputer::set_up_density_storage(void)
+{
+	DensityClassSpec* iclass = static_cast<DensityClassSpec*>(ispec);
+	int n_defined = iclass->get_n_defined();
+	
+	density_slots = std::vector<int>(iclass->n_cg_types * n_defined, -1);
+	n_density_slots = std::vector<int>(iclass->n_cg_types, 0);
+	for (int type = 0; type < iclass->n_cg_types; type++) {
+		for (int index_among_defined = 0; index_among_defined < n_defined; index_among_defined++) {
+			std::vector<int> types = iclass->get_interaction_types(index_among_defined);
+			if (iclass->density_groups[(types[1] - 1) * iclass->n_cg_types + type] == false) continue;
+			density_slots[type * n_defined + index_among_defined] = n_density_slots[type]++;
+		}
+	}
+	density_value_offsets = std::vector<int>(iclass->n_cg_sites + 1, 0);
+	density_site_types = NULL;
+}
+
+// Lay out the densities for this frame's site types (which may change between frames) and zero them.
+
+void DensityClassComputer::reset_density_array(int* const cg_site_types) 
 {
 	DensityClassSpec* iclass = static_cast<DensityClassSpec*>(ispec);
-	for(int ii = 0; ii < iclass->get_n_defined() * iclass->n_cg_sites; ii++) {
-		density_values[ii] = 0.0;
+	int n_values = 0;
+	for (int site = 0; site < iclass->n_cg_sites; site++) {
+		density_value_offsets[site] = n_values;
+		n_values += n_density_slots[cg_site_types[site] - 1];
+	}
+	density_value_offsets[iclass->n_cg_sites] = n_values;
+	density_values.assign(n_values, 0.0);
+	density_site_types = cg_site_types;
+}
+
+// Decode the density interactions active between each ordered pair of site types,
+// following decode_density_interaction_and_calculate, so that each frame can look them up directly.
+
+void DensityClassComputer::set_up_pair_terms(void)
+{
+	DensityClassSpec* iclass = static_cast<DensityClassSpec*>(ispec);
+	int n_cg_types = iclass->n_cg_types;
+	if (iclass->get_n_defined() <= 0) return;
+	
+	pair_term_offsets = std::vector<int>(n_cg_types * n_cg_types + 1, 0);
+	pair_terms.clear();
+	for (int type_k = 0; type_k < n_cg_types; type_k++) {
+		for (int type_l = 0; type_l < n_cg_types; type_l++) {
+			unsigned long interaction_flags = iclass->site_to_density_group_intrxn_index_map[type_k * n_cg_types + type_l];
+			for (int index_counter = 0; interaction_flags != 0; index_counter++, interaction_flags = interaction_flags >> 1) {
+				if (interaction_flags % 2 == 0) continue;
+				if (iclass->defined_to_matched_intrxn_index_map[index_counter] == 0 && iclass->defined_to_tabulated_intrxn_index_map[index_counter] == 0) continue;
+				std::vector<int> types = iclass->get_interaction_types(index_counter);
+				int group_type_index = (types[1] - 1) * n_cg_types + type_k;
+				if (iclass->density_groups[group_type_index] == false) continue;
+				PairTerm term = {index_counter, iclass->density_weights[group_type_index]};
+				pair_terms.push_back(term);
+			}
+			pair_term_offsets[type_k * n_cg_types + type_l + 1] = int(pair_terms.size());
+		}
+	}
+}
+
+// Calculate the matrix elements for the pairs stored while accumulating the density of this frame.
+// Each stored pair is visited in the order it was found, with the (k, l) terms before the (l, k) terms.
+
+void DensityClassComputer::calculate_stored_pair_matrix_elements(MATRIX_DATA* const mat, int* const cg_site_types, const int n_cg_types)
+{
+	unsigned weight_derivative_index = 0;
+	std::array<double, DIMENSION> derivative[1];
+	for (unsigned p = 0; p < neighbor_pairs.size(); p++) {
+		const NeighborPair& pair = neighbor_pairs[p];
+		int type_k = cg_site_types[pair.k] - 1;
+		int type_l = cg_site_types[pair.l] - 1;
+		
+		k = pair.k;
+		l = pair.l;
+		int particle_ids[2] = {k, l};
+		derivative[0] = pair.derivative;
+		calc_stored_density_pair_terms(this, pair_term_offsets[type_k * n_cg_types + type_l], pair_term_offsets[type_k * n_cg_types + type_l + 1], particle_ids, derivative, pair.distance, weight_derivative_index, mat);
+		
+		// Repeat this for the reversed pair of types.
+		swap_pair(k, l);
+		swap_pair(particle_ids[0], particle_ids[1]);
+		for (int i = 0; i < DIMENSION; i++) derivative[0][i] = -pair.derivative[i];
+		calc_stored_density_pair_terms(this, pair_term_offsets[type_l * n_cg_types + type_k], pair_term_offsets[type_l * n_cg_types + type_k + 1], particle_ids, derivative, pair.distance, weight_derivative_index, mat);
 	}
 }
 
@@ -252,38 +375,61 @@ void ThreeBodyNonbondedClassComputer::special_set_up_computer(InteractionClassSp
         *curr_iclass_col_index += ispec->interaction_column_indices[ispec->n_to_force_match];
     }
     fm_s_comp = new BSplineAndDerivComputer(ispec);
+    fm_basis_fn_vals = std::vector<double>(fm_s_comp->get_n_coef());
 }
 
 //--------------------------------------------------------------------
 // Main routine calling all other matrix element calculation routines
 //--------------------------------------------------------------------
 
-void calculate_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList pair_cell_list, ThreeBCellList three_body_cell_list, int trajectory_block_frame_index)
+void calculate_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, int trajectory_block_frame_index)
+{
+    prepare_frame_for_fm(cg, frame_config, pair_cell_list, three_body_cell_list, mat->profile);
+    calculate_prepared_frame_fm_matrix(cg, mat, frame_config, pair_cell_list, three_body_cell_list, trajectory_block_frame_index);
+}
+
+// Wrap all coordinates to ensure they are within a single image of
+// the periodic domain and sort the sites into the cell lists.
+// This only touches the frame and its cell lists, so the next frame
+// can be prepared while the matrix elements of the last are calculated.
+
+void prepare_frame_for_fm(CG_MODEL_DATA* const cg, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, PerformanceProfile* const profile)
 {
-    // Each frame is a set of contiguous rows in the FM matrix; get the starting row for this frame.
-    int current_frame_starting_row = trajectory_block_frame_index * cg->n_cg_sites; //shift row number after each frame within one block
-    
-    // Wrap all coordinates to ensure they are within a single image of
-    // the periodic domain and get the target forces for the calculation.
     for (unsigned l = 0; l < cg->topo_data.n_cg_sites; l++) {
         // Enforce consequences of periodic boundary conditions.
         get_minimum_image(l, frame_config->x, frame_config->simulation_box_half_lengths);
-        add_target_force_from_trajectory(current_frame_starting_row, l, mat, frame_config->f);
     }
     
     // Set up a cell list and initialize the calculation temps for pair 
     // nonbonded matrix element computations.
+    PhaseTimer cell_list_timer(profile, kPhaseCellList);
     pair_cell_list.populateList(frame_config->current_n_sites, frame_config->x);
     if (cg->three_body_nonbonded_interactions.class_subtype > 0) {
         three_body_cell_list.populateList(frame_config->current_n_sites, frame_config->x);
     }
+}
+
+void calculate_prepared_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, int trajectory_block_frame_index)
+{
+    // Each frame is a set of contiguous rows in the FM matrix; get the starting row for this frame.
+    int current_frame_starting_row = trajectory_block_frame_index * cg->n_cg_sites; //shift row number after each frame within one block
+    
+    // Get the target forces for the calculation.
+    for (unsigned l = 0; l < cg->topo_data.n_cg_sites; l++) {
+        add_target_force_from_trajectory(current_frame_starting_row, l, mat, frame_config->f);
+    }
     
     // Calculate matrix elements by looking through interaction (cell and topology) lists to find active (and non-excluded) interactions.
+    PhaseTimer interactions_timer(mat->profile, kPhaseInteractions);
+    int class_phase = kNumFixedPhases;
     std::list<InteractionClassComputer*>::iterator icomp_iterator;
-	for(icomp_iterator=cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++) {
+	for(icomp_iterator=cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++, class_phase++) {
+        PhaseTimer class_timer(mat->profile, class_phase);
         (*icomp_iterator)->calculate_interactions(mat, trajectory_block_frame_index, current_frame_starting_row, cg->n_cg_types, cg->topo_data, pair_cell_list, frame_config->x, frame_config->simulation_box_half_lengths);
     }
+    PhaseTimer three_body_timer(mat->profile, class_phase);
     cg->three_body_nonbonded_computer.calculate_3B_interactions(mat, trajectory_block_frame_index, current_frame_starting_row, cg->n_cg_types, cg->topo_data, three_body_cell_list, frame_config->x, frame_config->simulation_box_half_lengths);
+    count_performance_event(mat->profile, kCounterFrames);
 }
 
 //--------------------------------------------------------------------
@@ -293,7 +439,7 @@ void calculate_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat,
 
 // Find all neighbors of all particles and call nonbonded matrix element computations for any pairs that interact. 
 
-void PairNonbondedClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void PairNonbondedClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     trajectory_block_frame_index = traj_block_frame_index;
@@ -301,100 +447,93 @@ void PairNonbondedClassComputer::calculate_interactions(MATRIX_DATA* const mat,
     walk_neighbor_list(mat, calculate_fm_matrix_elements, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
 }
 
-inline void InteractionClassComputer::walk_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void InteractionClassComputer::walk_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     int stencil_size = pair_cell_list.get_stencil_size();
-    for (int kk = 0; kk < pair_cell_list.size; kk++) {
-        k = pair_cell_list.head[kk];
-        while (k >= 0) {
-            l = pair_cell_list.list[k];
-            while (l >= 0) {
+    uint64_t n_pairs_visited = 0;
+    // Walk the cells along the curve, comparing the positions stored in cell
+    // order before touching any per-particle data by its original index.
+    for (int p = 0; p < pair_cell_list.size; p++) {
+        int kk = pair_cell_list.cell_order[p];
+        for (int a = pair_cell_list.cell_offsets[p]; a < pair_cell_list.cell_offsets[p + 1]; a++) {
+            k = pair_cell_list.sorted_sites[a];
+            for (int b = a + 1; b < pair_cell_list.cell_offsets[p + 1]; b++) {
+                n_pairs_visited++;
+                if (neighbor_cutoff2 >= 0.0 && pair_cell_list.get_sorted_squared_distance(a, b, simulation_box_half_lengths) > neighbor_cutoff2) continue;
+                l = pair_cell_list.sorted_sites[b];
                 if (check_excluded_list(&topo_data, k, l) == false) {
                     order_pair_nonbonded_fm_matrix_element_calculation(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
                 }
-                l = pair_cell_list.list[l];
             }
             //do the above the 2nd time for neiboring cells
             for (int nei = 0; nei < stencil_size; nei++) {
-                int ll = pair_cell_list.stencil[stencil_size * kk + nei];
-                l = pair_cell_list.head[ll];
-                while (l >= 0) {
+                int q = pair_cell_list.cell_curve_position[pair_cell_list.stencil[stencil_size * kk + nei]];
+                for (int b = pair_cell_list.cell_offsets[q]; b < pair_cell_list.cell_offsets[q + 1]; b++) {
+                    n_pairs_visited++;
+                    if (neighbor_cutoff2 >= 0.0 && pair_cell_list.get_sorted_squared_distance(a, b, simulation_box_half_lengths) > neighbor_cutoff2) continue;
+                    l = pair_cell_list.sorted_sites[b];
                     if (check_excluded_list(&topo_data, k, l) == false) {
                         order_pair_nonbonded_fm_matrix_element_calculation(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
                     }
-                    l = pair_cell_list.list[l];
                 }
             }
-            k = pair_cell_list.list[k];
         }
     }
+    count_performance_event(mat->profile, kCounterPairsVisited, n_pairs_visited);
 }
 
-inline void DensityClassComputer::walk_density_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+inline void DensityClassComputer::walk_density_neighbor_list(MATRIX_DATA* const mat, calc_density_pair_elements calc_pair_elements, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     int stencil_size = pair_cell_list.get_stencil_size();
-    for (int kk = 0; kk < pair_cell_list.size; kk++) {
-        k = pair_cell_list.head[kk];
-        while (k >= 0) {
-            l = pair_cell_list.list[k];
-            while (l >= 0) {
+    for (int p = 0; p < pair_cell_list.size; p++) {
+        int kk = pair_cell_list.cell_order[p];
+        for (int a = pair_cell_list.cell_offsets[p]; a < pair_cell_list.cell_offsets[p + 1]; a++) {
+            k = pair_cell_list.sorted_sites[a];
+            for (int b = a + 1; b < pair_cell_list.cell_offsets[p + 1]; b++) {
+                if (neighbor_cutoff2 >= 0.0 && pair_cell_list.get_sorted_squared_distance(a, b, simulation_box_half_lengths) > neighbor_cutoff2) continue;
+                l = pair_cell_list.sorted_sites[b];
                 if (check_density_excluded_list(&topo_data, k, l) == false) {
-                    density_fm_matrix_element_calculation(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
+                    (*calc_pair_elements)(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
                 }
-                l = pair_cell_list.list[l];
             }
             //do the above the 2nd time for neiboring cells
             for (int nei = 0; nei < stencil_size; nei++) {
-                int ll = pair_cell_list.stencil[stencil_size * kk + nei];
-                l = pair_cell_list.head[ll];
-                while (l >= 0) {
+                int q = pair_cell_list.cell_curve_position[pair_cell_list.stencil[stencil_size * kk + nei]];
+                for (int b = pair_cell_list.cell_offsets[q]; b < pair_cell_list.cell_offsets[q + 1]; b++) {
+                    if (neighbor_cutoff2 >= 0.0 && pair_cell_list.get_sorted_squared_distance(a, b, simulation_box_half_lengths) > neighbor_cutoff2) continue;
+                    l = pair_cell_list.sorted_sites[b];
                     if (check_density_excluded_list(&topo_data, k, l) == false) {
-                        density_fm_matrix_element_calculation(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
+                        (*calc_pair_elements)(this, calc_matrix_elements, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
                     }
-                    l = pair_cell_list.list[l];
                 }
             }
-            k = pair_cell_list.list[k];
         }
     }
 }
 
-// Calculate matrix elements for all bonded interactions by looping over the approriate topology lists. 
+// Calculate matrix elements for all bonded interactions by streaming through the rows compiled from the approriate topology lists. 
 
-void PairBondedClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void PairBondedClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     trajectory_block_frame_index = traj_block_frame_index;
     current_frame_starting_row = curr_frame_starting_row;
-    for (k = 0; k < int(topo_data.n_cg_sites); k++) {
-        for (unsigned kk = 0; kk < topo_data.bond_list->partner_numbers_[k]; kk++) {
-            l = topo_data.bond_list->partners_[k][kk];
-            if (k < l) order_bonded_fm_matrix_element_calculation(this, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
-        }
-    }
+    compile_bonded_interactions(topo_data, n_cg_types);
+    calculate_bonded_interactions(mat, topo_data, x, simulation_box_half_lengths);
 }
 
-void AngularClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void AngularClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     trajectory_block_frame_index = traj_block_frame_index;
     current_frame_starting_row = curr_frame_starting_row;
-    for (k = 0; k < int(topo_data.n_cg_sites); k++) {
-        for (unsigned kk = 0; kk < topo_data.angle_list->partner_numbers_[k]; kk++) {
-        	// Grab partners from angle list (organization of angle_list described in topology files).
-        	// j is the "center" index while l and k are the "ends" of the angle.
-        	// To avoid double counting, the interaction is only counted if the ends are
-        	// ordered such that k < l.
-            l = topo_data.angle_list->partners_[k][2 * kk + 1];
-            j = topo_data.angle_list->partners_[k][2 * kk];
-            if (k < l) order_bonded_fm_matrix_element_calculation(this, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
-        }
-    }
+    compile_bonded_interactions(topo_data, n_cg_types);
+    calculate_bonded_interactions(mat, topo_data, x, simulation_box_half_lengths);
 }
 
-void DihedralClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void DihedralClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     
@@ -405,51 +544,178 @@ void DihedralClassComputer::calculate_interactions(MATRIX_DATA* const mat, int t
 
     trajectory_block_frame_index = traj_block_frame_index;
     current_frame_starting_row = curr_frame_starting_row;
-    for (k = 0; k < int(topo_data.n_cg_sites); k++) {
-        for (unsigned kk = 0; kk < topo_data.dihedral_list->partner_numbers_[k]; kk++) {
-        	// Grab partners from dihedral list (organization of dihedral_list described in topology files).
-        	// i and j are the indices for the "central bond" index while l and k are the "ends" of the dihedral.
-        	// To avoid double counting, the interaction is only counted if the ends are
-        	// ordered such that k < l.
-            l = topo_data.dihedral_list->partners_[k][3 * kk + 2];
-            i = topo_data.dihedral_list->partners_[k][3 * kk];
-            j = topo_data.dihedral_list->partners_[k][3 * kk + 1];
-            if (k < l) order_bonded_fm_matrix_element_calculation(this, topo_data.cg_site_types, n_cg_types, mat, x, simulation_box_half_lengths);
-        }
-    }
+    compile_bonded_interactions(topo_data, n_cg_types);
+    calculate_bonded_interactions(mat, topo_data, x, simulation_box_half_lengths);
+}
+
+// Compile the rows of a bonded class's interactions from its topology list, if
+// the topology has changed since they were last compiled, and sort them into
+// batches by type. The sort is a counting sort over the defined interactions,
+// so interactions of one type stay in the order of the topology list.
+// Interactions whose types are not defined in the model are dropped.
+
+void BondedClassComputer::compile_bonded_interactions(const TopologyData& topo_data, const int n_cg_types)
+{
+	TopoList const* topo_list = get_topo_list(topo_data);
+	bool topology_changed = (compiled_revision != topo_data.revision);
+	if (!topology_changed && topo_list->modified == 1) {
+		// The caller may have edited shared arrays in place, so compile them
+		// again and compare.
+		compile_bonded_interaction_list(topo_list, topo_data.n_cg_sites, shared_topology_sites);
+		if (shared_topology_sites != bonded_topology_sites) {
+			bonded_topology_sites.swap(shared_topology_sites);
+			topology_changed = true;
+		}
+	} else if (topology_changed) {
+		compile_bonded_interaction_list(topo_list, topo_data.n_cg_sites, bonded_topology_sites);
+		compiled_revision = topo_data.revision;
+	}
+	if (!topology_changed && topo_data.site_types_vary == 0) return;
+	int n_body = topo_list->partners_per_ + 1;
+	
+	int n_defined = ispec->get_n_defined();
+	size_t n_interactions = bonded_topology_sites.size() / n_body;
+	std::vector<int> row_defined_indices(n_interactions);
+	bonded_type_offsets.assign(n_defined + 1, 0);
+	for (size_t row = 0; row < n_interactions; row++) {
+		set_bonded_sites(&bonded_topology_sites[row * n_body], n_body);
+		int index = ispec->get_index_from_hash(calculate_hash_number(topo_data.cg_site_types, n_cg_types));
+		if (index < 0 || index >= n_defined) index = -1;
+		else bonded_type_offsets[index + 1]++;
+		row_defined_indices[row] = index;
+	}
+	for (int index = 0; index < n_defined; index++) bonded_type_offsets[index + 1] += bonded_type_offsets[index];
+	
+	std::vector<size_t> next_rows(bonded_type_offsets.begin(), bonded_type_offsets.end() - 1);
+	bonded_sites.resize(bonded_type_offsets[n_defined] * n_body);
+	for (size_t row = 0; row < n_interactions; row++) {
+		int index = row_defined_indices[row];
+		if (index < 0) continue;
+		size_t sorted_row = next_rows[index]++;
+		std::copy(bonded_topology_sites.data() + row * n_body, bonded_topology_sites.data() + (row + 1) * n_body, bonded_sites.data() + sorted_row * n_body);
+	}
+}
+
+// Calculate the interactions batch by batch, so the indices of each type are
+// only looked up once. Without a geometry function (e.g. when finding ranges),
+// each interaction is handed to calculate_fm_matrix_elements in turn.
+
+void BondedClassComputer::calculate_bonded_interactions(MATRIX_DATA* const mat, const TopologyData& topo_data, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths)
+{
+	int n_body = get_topo_list(topo_data)->partners_per_ + 1;
+	for (int index = 0; index + 1 < int(bonded_type_offsets.size()); index++) {
+		if (bonded_type_offsets[index] == bonded_type_offsets[index + 1]) continue;
+		index_among_defined_intrxns = index;
+		set_indices();
+		if (calculate_bonded_geometry != NULL) {
+			calculate_bonded_batch(mat, n_body, bonded_type_offsets[index], bonded_type_offsets[index + 1], x, simulation_box_half_lengths);
+			continue;
+		}
+		for (size_t row = bonded_type_offsets[index]; row < bonded_type_offsets[index + 1]; row++) {
+			set_bonded_sites(&bonded_sites[row * n_body], n_body);
+			(*calculate_fm_matrix_elements)(this, x, simulation_box_half_lengths, mat);
+		}
+	}
+}
+
+// Calculate the matrix elements for one batch of interactions of the current
+// type. The geometry of every interaction in the batch is found first, keeping
+// those within the cutoffs, and then their basis functions are evaluated and
+// added to the matrix in the order of the batch. This gives the same matrix
+// elements, in the same order, as calc_isotropic_two_body_fm_matrix_elements,
+// calc_angular_three_body_fm_matrix_elements, or
+// calc_dihedral_four_body_fm_matrix_elements called for each interaction.
+
+void BondedClassComputer::calculate_bonded_batch(MATRIX_DATA* const mat, const int n_body, const size_t first_row, const size_t last_row, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths)
+{
+	if (index_among_matched_interactions == 0 && index_among_tabulated_interactions == 0) return;
+	
+	int n_derivatives = geometry_n_body - 1;
+	double lower_cutoff = ispec->lower_cutoffs[index_among_defined_intrxns];
+	double upper_cutoff = ispec->upper_cutoffs[index_among_defined_intrxns];
+	// Dihedrals of interactions treated as fully periodic are shifted into their range.
+	bool shift_periodic = (ispec->class_type == kDihedralBonded && ispec->class_subtype == 0 &&
+						   ispec->defined_to_periodic_intrxn_index_map[index_among_defined_intrxns] == 2);
+	
+	size_t batch_size = last_row - first_row;
+	if (batch_rows.size() < batch_size) {
+		batch_rows.resize(batch_size);
+		batch_param_vals.resize(batch_size);
+	}
+	if (batch_derivatives.size() < batch_size * n_derivatives) batch_derivatives.resize(batch_size * n_derivatives);
+	
+	// Find the geometry of each interaction.
+	size_t n_kept = 0;
+	for (size_t row = first_row; row < last_row; row++) {
+		std::array<double, DIMENSION>* derivatives = &batch_derivatives[n_kept * n_derivatives];
+		double param_val;
+		if ( !(*calculate_bonded_geometry)(&bonded_sites[row * n_body], x, simulation_box_half_lengths, cutoff2, param_val, derivatives) ) continue;
+		if (shift_periodic && param_val < lower_cutoff) param_val += 360.0;
+		if (param_val < lower_cutoff || param_val > upper_cutoff) continue;
+		batch_rows[n_kept] = row;
+		batch_param_vals[n_kept] = param_val;
+		n_kept++;
+	}
+	
+	// Evaluate the basis functions and add them to the matrix.
+	// Only pair distances contribute to the scalar virial.
+	int virial_flag = (geometry_n_body == 2) ? 1 : 0;
+	int particle_ids[4];
+	for (size_t kept = 0; kept < n_kept; kept++) {
+		std::copy(&bonded_sites[batch_rows[kept] * n_body], &bonded_sites[batch_rows[kept] * n_body] + geometry_n_body, particle_ids);
+		process_interaction_matrix_elements(this, mat, geometry_n_body, particle_ids, &batch_derivatives[kept * n_derivatives], batch_param_vals[kept], virial_flag, 0.0, 0.0);
+	}
 }
 
 // Calculate matrix elements for density non-bonded interactions.
 // First, find the density at each site by calculating weight functions between all pairs of neighbors for all particles and call weight function calculation
 // for each pair of density groups that interact. Exclusion lists are handled in the called subroutines.
 // Then, calculate the matrix elements by looking through the neighbor list (for all pairs of neighbors for all particles) to calculate matrix elements.
+// When force matching, the pairs found within the cutoff in the first pass are stored with their distances and weight function derivatives,
+// and the matrix elements are calculated from those instead of from a second pass through the neighbor list.
 
-void DensityClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void DensityClassComputer::calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
 	if (ispec->get_n_defined() == 0) return;
 	
 	// Reset density array before accumulating weight function contributions;
-	reset_density_array();
+	reset_density_array(topo_data.cg_site_types);
 	
 	// Set computer variables about matrix position
 	trajectory_block_frame_index = traj_block_frame_index;
     current_frame_starting_row = curr_frame_starting_row;
     
-	// First, pass through the neighbor list to compute the value of each density_group at every relavent CG site.
-	walk_density_neighbor_list(mat, calculate_density_values, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
+	// Range finding does not set up pair terms, so it takes two passes through the neighbor list.
+	if (pair_term_offsets.empty()) {
+		// First, pass through the neighbor list to compute the value of each density_group at every relavent CG site.
+		walk_density_neighbor_list(mat, density_fm_matrix_element_calculation, calculate_density_values, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
+
+		// Do intermediate processing (if necessary).
+		process_completed_density(this, process_density, n_cg_types, topo_data.cg_site_types, mat, x, simulation_box_half_lengths);
+
+		// Finally, calculate the matrix elements by combining the density, density derivative, pair distance, and pair derivative.
+		walk_density_neighbor_list(mat, density_fm_matrix_element_calculation, calculate_fm_matrix_elements, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
+		return;
+	}
+
+	// First, pass through the neighbor list to compute the value of each density_group at every relavent CG site,
+	// storing each pair within the cutoff.
+	neighbor_pairs.clear();
+	neighbor_weight_derivatives.clear();
+	walk_density_neighbor_list(mat, density_accumulation_and_pair_storage, calculate_density_values, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
 
 	// Do intermediate processing (if necessary).
 	process_completed_density(this, process_density, n_cg_types, topo_data.cg_site_types, mat, x, simulation_box_half_lengths);
 
-	// Finally, calculate the matrix elements by combining the density, density derivative, pair distance, and pair derivative.
-	walk_density_neighbor_list(mat, calculate_fm_matrix_elements, n_cg_types, topo_data, pair_cell_list, x, simulation_box_half_lengths);
+	// Finally, calculate the matrix elements by combining the density with the stored density derivative, pair distance, and pair derivative.
+	calculate_stored_pair_matrix_elements(mat, topo_data.cg_site_types, n_cg_types);
 }
   
 // Calculate matrix elements for three body non-bonded interactions.
 // Find all pairs of neighbors of all particles and call nonbonded matrix element computations
 // for any triples that interact. Exclusion lists are handled in the called subroutines.
 
-void ThreeBodyNonbondedClassComputer::calculate_3B_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+void ThreeBodyNonbondedClassComputer::calculate_3B_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
     if (ispec->n_defined == 0) return;
     if (ispec->class_subtype > 0) {                    
@@ -459,7 +725,7 @@ void ThreeBodyNonbondedClassComputer::calculate_3B_interactions(MATRIX_DATA* con
 	}
 }
 
-inline void InteractionClassComputer::walk_3B_neighbor_list(MATRIX_DATA* const mat, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
+inline void InteractionClassComputer::walk_3B_neighbor_list(MATRIX_DATA* const mat, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) 
 {
 	int stencil_size = three_body_cell_list.get_stencil_size();
     for (int kk = 0; kk < three_body_cell_list.size; kk++) {
@@ -553,7 +819,7 @@ inline bool check_density_excluded_list(const TopologyData* const topo_data, con
 // each frame and possibly found not to interact after.
 //--------------------------------------------------------------------
 
-void order_pair_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths)
+void order_pair_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths)
 {
     // Calculate the appropriate matrix elements.
     info->index_among_defined_intrxns = info->ispec->get_index_from_hash(calc_two_body_interaction_hash(cg_site_types[info->k], cg_site_types[info->l], n_cg_types));
@@ -562,16 +828,7 @@ void order_pair_nonbonded_fm_matrix_element_calculation(InteractionClassComputer
     calc_matrix_elements(info, x, simulation_box_half_lengths, mat);
 }
 
-void order_bonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths)
-{
-     // Calculate the appropriate matrix elements.    
-    info->index_among_defined_intrxns = info->ispec->get_index_from_hash(info->calculate_hash_number(cg_site_types, n_cg_types));
-    info->set_indices();
-
-    (*info->calculate_fm_matrix_elements)(info, x, simulation_box_half_lengths, mat);
-}
-
-void order_three_body_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths)
+void order_three_body_nonbonded_fm_matrix_element_calculation(InteractionClassComputer* const info, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths)
 {
     ThreeBodyNonbondedClassComputer* icomp = static_cast<ThreeBodyNonbondedClassComputer*>(info);
     ThreeBodyNonbondedClassSpec* ispec = static_cast<ThreeBodyNonbondedClassSpec*>(icomp->ispec);
@@ -589,7 +846,7 @@ void order_three_body_nonbonded_fm_matrix_element_calculation(InteractionClassCo
     (*icomp->calculate_fm_matrix_elements)(icomp, x, simulation_box_half_lengths, mat); 
 }
 
-void density_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths)
+void density_fm_matrix_element_calculation(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
@@ -607,11 +864,45 @@ void density_fm_matrix_element_calculation(InteractionClassComputer* const info,
 	swap_pair(info->k, info->l);
 }
 
+// Accumulate the weight function contributions of a pair to the density at both sites, as the first pass
+// through density_fm_matrix_element_calculation would, and store the pair if it is within the cutoff.
+
+void density_accumulation_and_pair_storage(InteractionClassComputer* const info, calc_pair_matrix_elements calc_matrix_elements, int* const cg_site_types, const int n_cg_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths)
+{
+	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
+	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
+	int type_k = cg_site_types[info->k] - 1;
+	int type_l = cg_site_types[info->l] - 1;
+	int kl_first_term = icomp->pair_term_offsets[type_k * n_cg_types + type_l];
+	int kl_last_term = icomp->pair_term_offsets[type_k * n_cg_types + type_l + 1];
+	int lk_first_term = icomp->pair_term_offsets[type_l * n_cg_types + type_k];
+	int lk_last_term = icomp->pair_term_offsets[type_l * n_cg_types + type_k + 1];
+	if (kl_first_term == kl_last_term && lk_first_term == lk_last_term) return;
+	
+	double distance2;
+	int particle_ids[2] = {info->k, info->l};
+	std::array<double, DIMENSION> derivative[1];
+	std::array<double, DIMENSION>* derivatives = derivative;
+	if (conditionally_calc_squared_distance_and_derivatives(particle_ids, x, simulation_box_half_lengths, info->cutoff2, distance2, derivatives) == false) return;
+	
+	DensityClassComputer::NeighborPair pair;
+	pair.k = info->k;
+	pair.l = info->l;
+	pair.distance = sqrt(distance2);
+	for (int i = 0; i < DIMENSION; i++) {
+		pair.derivative[i] = 0.5 * derivative[0][i] / pair.distance;
+	}
+	icomp->neighbor_pairs.push_back(pair);
+	
+	accumulate_density_pair_terms(icomp, ispec, kl_first_term, kl_last_term, info->k, distance2, pair.distance);
+	accumulate_density_pair_terms(icomp, ispec, lk_first_term, lk_last_term, info->l, distance2, pair.distance);
+}
+
 //---------------------------------------------------------------------
 // Helper functions of functions in the above section.
 //---------------------------------------------------------------------
 
-void process_completed_density(DensityClassComputer* const info, calc_pair_matrix_elements process_density, const int n_cg_types, int *const cg_site_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths) 
+void process_completed_density(DensityClassComputer* const info, calc_pair_matrix_elements process_density, const int n_cg_types, int *const cg_site_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths) 
 {	
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(info->ispec);
 	
@@ -635,7 +926,7 @@ void process_completed_density(DensityClassComputer* const info, calc_pair_matri
 	}
 }
 
-inline void decode_density_interaction_and_calculate(DensityClassComputer* info, unsigned long interaction_flags, calc_pair_matrix_elements calc_matrix_elements, int *const cg_site_types, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths)
+inline void decode_density_interaction_and_calculate(DensityClassComputer* info, unsigned long interaction_flags, calc_pair_matrix_elements calc_matrix_elements, int *const cg_site_types, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths)
 {
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(info->ispec);
 	// Loop through to determine which bits are non-zero.
@@ -660,6 +951,28 @@ inline void decode_density_interaction_and_calculate(DensityClassComputer* info,
 	}
 }
 
+inline void accumulate_density_pair_terms(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const int first_term, const int last_term, const int site, const double distance2, const double distance)
+{
+	for (int t = first_term; t < last_term; t++) {
+		icomp->index_among_defined_intrxns = icomp->pair_terms[t].index_among_defined;
+		icomp->curr_weight = icomp->pair_terms[t].weight;
+		if (distance2 < icomp->cutoff2) {
+			icomp->get_density_value(site, icomp->index_among_defined_intrxns) += (*icomp->calculate_density_weight)(icomp, ispec, distance2);
+		}
+		icomp->neighbor_weight_derivatives.push_back((*icomp->calculate_density_derivative)(icomp, ispec, distance) * icomp->curr_weight);
+	}
+}
+
+inline void calc_stored_density_pair_terms(DensityClassComputer* const icomp, const int first_term, const int last_term, int* particle_ids, std::array<double, DIMENSION>* derivatives, const double distance, unsigned &weight_derivative_index, MATRIX_DATA* const mat)
+{
+	for (int t = first_term; t < last_term; t++, weight_derivative_index++) {
+		icomp->index_among_defined_intrxns = icomp->pair_terms[t].index_among_defined;
+		icomp->set_indices();
+		double density_value = icomp->get_density_value(particle_ids[0], icomp->index_among_defined_intrxns);
+		icomp->process_interaction_matrix_elements(icomp, mat, 2, particle_ids, derivatives, density_value, 1, icomp->neighbor_weight_derivatives[weight_derivative_index], distance);
+	}
+}
+
 void accumulate_matching_order_parameter_forces(InteractionClassComputer* const info, const int first_nonzero_basis_index, double extra_derivative_value, std::vector<double> &basis_fn_vals, const int n_body, const int* particle_ids, std::array<double, DIMENSION>* const &derivatives, MATRIX_DATA * const mat) 
 {
 	for (unsigned k = 0; k < basis_fn_vals.size(); k++) {
@@ -705,10 +1018,16 @@ inline void process_normal_interaction_matrix_elements(InteractionClassComputer*
 
     if (index_among_matched > 0) {
 	    // Compute the strength of each basis function.
+	    double phase_start_time = (mat->profile != NULL) ? get_wall_time() : 0.0;
 	    info->fm_s_comp->calculate_basis_fn_vals(index_among_defined, param_value, first_nonzero_basis_index, info->fm_basis_fn_vals);
+	    if (mat->profile != NULL) phase_start_time = add_phase_wall_time(mat->profile, kPhaseBasisEvaluation, phase_start_time);
     	
     	// Add to the force matching.       
     	mat->accumulate_matching_forces(info, first_nonzero_basis_index, info->fm_basis_fn_vals, n_body, particle_ids, derivatives, mat);
+    	if (mat->profile != NULL) {
+    		add_phase_wall_time(mat->profile, kPhaseMatrixInsertion, phase_start_time);
+    		count_performance_event(mat->profile, kCounterMatrixElements, info->fm_basis_fn_vals.size() * n_body * DIMENSION);
+    	}
  			
     	// Add to virial matching if virial_flag is non-zero.
     	switch (virial_flag) {
@@ -748,9 +1067,15 @@ inline void process_density_matrix_elements(InteractionClassComputer* const info
     
     if (index_among_matched > 0) {
         // Compute the strength of each basis function.
+        double phase_start_time = (mat->profile != NULL) ? get_wall_time() : 0.0;
         info->fm_s_comp->calculate_basis_fn_vals(index_among_defined, density_value, first_nonzero_basis_index, info->fm_basis_fn_vals);
+        if (mat->profile != NULL) phase_start_time = add_phase_wall_time(mat->profile, kPhaseBasisEvaluation, phase_start_time);
 		// Add to the force matching.
         accumulate_matching_order_parameter_forces(info, first_nonzero_basis_index, density_derivative, info->fm_basis_fn_vals, 2, particle_ids, derivatives, mat);
+        if (mat->profile != NULL) {
+        	add_phase_wall_time(mat->profile, kPhaseMatrixInsertion, phase_start_time);
+        	count_performance_event(mat->profile, kCounterMatrixElements, info->fm_basis_fn_vals.size() * 2 * DIMENSION);
+        }
         // Add to virial matching.
         int temp_column_index = info->interaction_class_column_index + info->ispec->interaction_column_indices[index_among_matched - 1] + first_nonzero_basis_index;
         for (unsigned i = 0; i < info->fm_basis_fn_vals.size(); i++) {
@@ -768,12 +1093,13 @@ inline void process_density_matrix_elements(InteractionClassComputer* const info
 
 // Each of these functions follows the idiom of calc_isotropic_two_body_fm_matrix_elements.
 
-void calc_isotropic_two_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_isotropic_two_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[2] = {info->k, info->l};
     std::array<double, DIMENSION>* derivatives = new std::array<double, DIMENSION>[1];
 	double distance;
 	if ( conditionally_calc_distance_and_derivatives(particle_ids, x, simulation_box_half_lengths, info->cutoff2, distance, derivatives) ) {
+        if (info->ispec->class_type == kPairNonbonded) count_performance_event(mat->profile, kCounterPairsInCutoff);
         int index_among_defined = info->index_among_defined_intrxns;
     	if (distance < info->ispec->lower_cutoffs[index_among_defined] ||
         	distance > info->ispec->upper_cutoffs[index_among_defined]) {
@@ -785,7 +1111,7 @@ void calc_isotropic_two_body_fm_matrix_elements(InteractionClassComputer* const
     delete [] derivatives;
 }
 
-void calc_angular_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_angular_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[3] = {info->k, info->l, info->j}; // end indices (k, l), followed by center index (j)
     std::array<double, DIMENSION>* derivatives = new std::array<double, DIMENSION>[2];
@@ -803,7 +1129,7 @@ void calc_angular_three_body_fm_matrix_elements(InteractionClassComputer* const
     delete [] derivatives;
 }
 
-void calc_dihedral_four_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_dihedral_four_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[4] = {info->k, info->l, info->i, info->j}; // end indices (k, l) followed by central bond indices (i, j)
     std::array<double, DIMENSION>* derivatives = new std::array<double, DIMENSION>[3];
@@ -826,7 +1152,7 @@ void calc_dihedral_four_body_fm_matrix_elements(InteractionClassComputer* const
 	delete [] derivatives;
 }
 
-void calc_nonbonded_1_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_nonbonded_1_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[3] = {info->k, info->l, info->j}; // end indices (k, l) followed by center index (j).    
     ThreeBodyNonbondedClassComputer* icomp = static_cast<ThreeBodyNonbondedClassComputer*>(info);
@@ -879,7 +1205,7 @@ void calc_nonbonded_1_three_body_fm_matrix_elements(InteractionClassComputer* co
     delete [] derivatives;
 }
 
-void calc_nonbonded_2_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_nonbonded_2_three_body_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[3] = {info->k, info->l, info->j}; // end indices (k, l) followed by center index (j).    
     ThreeBodyNonbondedClassComputer* icomp = static_cast<ThreeBodyNonbondedClassComputer*>(info);
@@ -929,95 +1255,104 @@ void calc_nonbonded_2_three_body_fm_matrix_elements(InteractionClassComputer* co
 	delete [] derivatives;
 }
 
-void calc_gaussian_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_gaussian_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
 	int particle_ids[2] = {icomp->k, icomp->l};
-	int index_among_defined = icomp->index_among_defined_intrxns;
     double distance2;
     
 	//Calculate the distance
 	calc_squared_distance(particle_ids, x, simulation_box_half_lengths, distance2);
 	if (distance2 < icomp->cutoff2) {
-		// Calculate the weight function
-		double distance = sqrt(distance2);
-		icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites + icomp->k] +=
-										icomp->curr_weight * ( exp( - distance2 / icomp->denomenator[index_among_defined]) + icomp->u_cutoff[index_among_defined]
-										+ icomp->f_cutoff[index_among_defined] * (distance - ispec->cutoff) ) / icomp->denomenator[index_among_defined];
+		icomp->get_density_value(icomp->k, icomp->index_among_defined_intrxns) += calc_gaussian_density_weight(icomp, ispec, distance2);
 	}
 }
 
-void calc_switching_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_switching_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
 	int particle_ids[2] = {icomp->k, icomp->l};
-    int index_among_defined = icomp->index_among_defined_intrxns;
     double distance2;
     
 	//Calculate the distance
 	calc_squared_distance(particle_ids, x, simulation_box_half_lengths, distance2);
-	
 	if (distance2 < icomp->cutoff2) {
-	
-		// Calculate the weight function
-		double distance = sqrt(distance2);
-		icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites  + icomp->k] +=
-										icomp->curr_weight * -0.5 * tanh( (distance - ispec->density_switch[index_among_defined])/ispec->density_sigma[index_among_defined] )
-										+ icomp->u_cutoff[index_among_defined] + icomp->f_cutoff[index_among_defined] * (distance - ispec->cutoff);
+		icomp->get_density_value(icomp->k, icomp->index_among_defined_intrxns) += calc_switching_density_weight(icomp, ispec, distance2);
 	}
 }
 
-void calc_lucy_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_lucy_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
 	int particle_ids[2] = {icomp->k, icomp->l};
-    int index_among_defined = icomp->index_among_defined_intrxns;
     double distance2;
     
 	//Calculate the distance
 	calc_squared_distance(particle_ids, x, simulation_box_half_lengths, distance2);
-	
 	if (distance2 < icomp->cutoff2) {
-	
-		// Calculate the weight function
-		double distance = sqrt(distance2);
-		double cutoff_minus_distance = ispec->cutoff - distance;
-		icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites + icomp->k] +=
-										icomp->curr_weight * cutoff_minus_distance * cutoff_minus_distance * cutoff_minus_distance 
-										* (ispec->cutoff + 3.0*distance) / icomp->denomenator[index_among_defined];
+		icomp->get_density_value(icomp->k, icomp->index_among_defined_intrxns) += calc_lucy_density_weight(icomp, ispec, distance2);
 	}
 }
 
-void calc_re_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_re_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
 	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
 	int particle_ids[2] = {icomp->k, icomp->l};
-    int index_among_defined = icomp->index_among_defined_intrxns;
     double distance2;
     
 	//Calculate the distance
 	calc_squared_distance(particle_ids, x, simulation_box_half_lengths, distance2);
-	
 	if (distance2 < icomp->cutoff2) {
-	
-		// Calculate the weight function
-		if (distance2 > ispec->density_sigma[index_among_defined] * ispec->density_sigma[index_among_defined]) {
-			icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites + icomp->k] +=
-										icomp->curr_weight * (icomp->c0[index_among_defined] +
-										distance2 * icomp->c2[index_among_defined] - 
-										distance2 * distance2 * icomp->c4[index_among_defined] +
-										distance2 * distance2 * distance2 * icomp->c6[index_among_defined]);
-		} else {
-			icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites + icomp->k] += 1.0 * icomp->curr_weight;
-		}
+		icomp->get_density_value(icomp->k, icomp->index_among_defined_intrxns) += calc_re_density_weight(icomp, ispec, distance2);
+	}
+}
+
+// Weight function contributions to a density for a pair within the cutoff,
+// including the density weight of the current interaction.
+
+double calc_gaussian_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2)
+{
+	int index_among_defined = icomp->index_among_defined_intrxns;
+	double distance = sqrt(distance2);
+	return icomp->curr_weight * ( exp( - distance2 / icomp->denomenator[index_among_defined]) + icomp->u_cutoff[index_among_defined]
+			+ icomp->f_cutoff[index_among_defined] * (distance - ispec->cutoff) ) / icomp->denomenator[index_among_defined];
+}
+
+double calc_switching_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2)
+{
+	int index_among_defined = icomp->index_among_defined_intrxns;
+	double distance = sqrt(distance2);
+	return icomp->curr_weight * -0.5 * tanh( (distance - ispec->density_switch[index_among_defined])/ispec->density_sigma[index_among_defined] )
+			+ icomp->u_cutoff[index_among_defined] + icomp->f_cutoff[index_among_defined] * (distance - ispec->cutoff);
+}
+
+double calc_lucy_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2)
+{
+	int index_among_defined = icomp->index_among_defined_intrxns;
+	double distance = sqrt(distance2);
+	double cutoff_minus_distance = ispec->cutoff - distance;
+	return icomp->curr_weight * cutoff_minus_distance * cutoff_minus_distance * cutoff_minus_distance 
+			* (ispec->cutoff + 3.0*distance) / icomp->denomenator[index_among_defined];
+}
+
+double calc_re_density_weight(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2)
+{
+	int index_among_defined = icomp->index_among_defined_intrxns;
+	if (distance2 > ispec->density_sigma[index_among_defined] * ispec->density_sigma[index_among_defined]) {
+		return icomp->curr_weight * (icomp->c0[index_among_defined] +
+				distance2 * icomp->c2[index_among_defined] - 
+				distance2 * distance2 * icomp->c4[index_among_defined] +
+				distance2 * distance2 * distance2 * icomp->c6[index_among_defined]);
+	} else {
+		return 1.0 * icomp->curr_weight;
 	}
 }
 
-void calc_density_fm_matrix_elements(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_density_fm_matrix_elements(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	info->index_among_matched_interactions = info->ispec->defined_to_matched_intrxn_index_map[info->index_among_defined_intrxns];
 	info->index_among_tabulated_interactions = info->ispec->defined_to_tabulated_intrxn_index_map[info->index_among_defined_intrxns];
@@ -1032,7 +1367,7 @@ void calc_density_fm_matrix_elements(InteractionClassComputer* const info, std::
 		DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);
 	
 		// Look-up this particular interaction's density.
-		double density_value = icomp->density_values[info->index_among_defined_intrxns * ispec->n_cg_sites + info->k];
+		double density_value = icomp->get_density_value(info->k, info->index_among_defined_intrxns);
 		
 		// Calculate the weight function derivative.
 		double density_derivative = (*icomp->calculate_density_derivative)(icomp, ispec, distance);
@@ -1077,6 +1412,6 @@ double calc_re_density_derivative(DensityClassComputer* const icomp, DensityClas
 	return density_derivative;
 }
 
-void do_nothing(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat) 
+void do_nothing(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat) 
 {
 }
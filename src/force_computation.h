@@ -14,17 +14,26 @@
 #include "interaction_model.h"
 
 struct MATRIX_DATA;
+struct PerformanceProfile;
 
 // Initialization routines to start the FM matrix calculation
 void set_up_force_computers(CG_MODEL_DATA* const cg);
 
+// Add a profiling phase for each interaction class, in the order they are calculated
+void add_interaction_class_phases(CG_MODEL_DATA* const cg, PerformanceProfile* const profile);
+
 // Main routine calling all other matrix element calculation routines
-void calculate_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList pair_cell_list, ThreeBCellList three_body_cell_list, int trajectory_block_frame_index);
+void calculate_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, int trajectory_block_frame_index);
+
+// The two halves of calculate_frame_fm_matrix: wrapping the positions and
+// populating the cell lists, then calculating the matrix elements
+void prepare_frame_for_fm(CG_MODEL_DATA* const cg, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, PerformanceProfile* const profile);
+void calculate_prepared_frame_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameConfig* const frame_config, PairCellList& pair_cell_list, ThreeBCellList& three_body_cell_list, int trajectory_block_frame_index);
 
 // Functions for calculating density values
-void calc_gaussian_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_switching_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_lucy_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_re_density_values(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_gaussian_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_switching_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_lucy_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_re_density_values(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
 
 #endif
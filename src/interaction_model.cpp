@@ -550,7 +550,7 @@ void InteractionClassSpec::setup_indices_in_fm_matrix(void)
 void ThreeBodyNonbondedClassSpec::setup_indices_in_fm_matrix(void)
 { 
     if (class_subtype > 0) {
-		interaction_column_indices = std::vector<unsigned>(get_n_defined(), 0);
+		interaction_column_indices = std::vector<unsigned>(get_n_defined() + 1, 0);
 		interaction_column_indices[0] = 0;
 
 		n_tabulated = 0;
@@ -877,113 +877,68 @@ void InteractionClassSpec::copy_table(const int base_defined, const int target_d
 	}
 }
 
-void InteractionClassComputer::calc_grid_of_table_force_vals(const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals) 
+// Fill axis_vals with the output grid for an interaction.
+void InteractionClassComputer::calc_grid_axis_vals(const int index_among_defined, const double binwidth, const bool use_midpoint_if_empty, std::vector<double> &axis_vals)
 {
-    // Calculate forces by iterating over the grid points from low to high.
+    // Iterate over the grid points from low to high.
     // The lower value is adjusted so that the difference between the output upper cutoff and output lower cutoff is divisible by the output binwidth and that the lower cutoff is always greater than basis lower cutoff.
     double max = ispec->upper_cutoffs[index_among_defined];
     double min = max - ((int)((max - ispec->lower_cutoffs[index_among_defined]) / binwidth)) * binwidth;
-
-    // Size the output vectors of positions and forces conservatively.
-    unsigned num_entries = int((max - min)/binwidth) + 2;
+    
+    // Size the output vector of positions conservatively.
+    int num_entries = int((max - min)/binwidth) + 2;
     if (num_entries <= 0) { 
     	num_entries = 1;
     	fprintf(stderr, "No output will be generated for this interaction since the rounded lower cutoff is greater than or equal to the upper cutoff!\n");
 	}
 	
-    axis_vals = std::vector<double>(num_entries);
-    force_vals = std::vector<double>(num_entries);    
-    
-    unsigned counter = 0;
-    std::vector<double> junk_vector; // The external spline coefficients are grabed internally through evaluate_spline and calculate_basis_fn_vals.
-    								 // So, they don't need to be converted from double* to std::vector<double> to be passed in here. (junk instead).
-    for (double axis = min; axis <= max+VERYSMALL_F; axis += binwidth) {
-        force_vals[counter] = table_s_comp->evaluate_spline(index_among_defined, interaction_class_column_index, junk_vector, axis);
-        axis_vals[counter] = axis;
-        counter++;
-    }
-    if (counter == 0) {
-    	double axis = (ispec->upper_cutoffs[index_among_defined] + ispec->lower_cutoffs[index_among_defined]) * 0.5;
-    	force_vals[counter] = table_s_comp->evaluate_spline(index_among_defined, interaction_class_column_index, junk_vector, axis);
-        axis_vals[counter] = axis;
-        counter++;
+    axis_vals.clear();
+    axis_vals.reserve(num_entries);
+    for (double axis = min; axis <= max + VERYSMALL_F; axis += binwidth) {
+        axis_vals.push_back(axis);
     }
-    // Set the correct size for the output vectors of positions and forces.
-    if (counter > num_entries) printf("Grid evaluation vector was undersized\n"); 
-    else {
-    	axis_vals.resize(counter);
-    	force_vals.resize(counter);
+    if (axis_vals.empty() && use_midpoint_if_empty) {
+    	axis_vals.push_back((ispec->upper_cutoffs[index_among_defined] + ispec->lower_cutoffs[index_among_defined]) * 0.5);
     }
 }
 
+// The grid evaluations below use no shared spline temporaries, so different
+// interactions of a class can be tabulated at the same time.
+
+void InteractionClassComputer::calc_grid_of_table_force_vals(const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals) 
+{
+    calc_grid_axis_vals(index_among_defined, binwidth, true, axis_vals);
+    std::vector<double> junk_vector; // The external spline coefficients are grabed internally through evaluate_spline and calculate_basis_fn_vals.
+    								 // So, they don't need to be converted from double* to std::vector<double> to be passed in here. (junk instead).
+    table_s_comp->evaluate_spline_on_grid(index_among_defined, interaction_class_column_index, junk_vector, axis_vals, force_vals);
+}
+
 void InteractionClassComputer::calc_grid_of_force_vals(const std::vector<double> &spline_coeffs, const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals) 
 {
-    // Calculate forces by iterating over the grid points from low to high.
-    // The lower value is adjusted so that the difference between the output upper cutoff and output lower cutoff is divisible by the output binwidth and that the lower cutoff is always greater than basis lower cutoff.
-    double max = ispec->upper_cutoffs[index_among_defined];
-    double min = max - ((int)((max - ispec->lower_cutoffs[index_among_defined]) / binwidth)) * binwidth;
-    
-    // Size the output vectors of positions and forces conservatively.
-    unsigned num_entries = int((max - min)/binwidth) + 2;
-    if (num_entries <= 0) { 
-    	num_entries = 1;
-    	fprintf(stderr, "No output will be generated for this interaction since the rounded lower cutoff is greater than or equal to the upper cutoff!\n");
-	}
-    
-    axis_vals = std::vector<double>(num_entries);
-    force_vals = std::vector<double>(num_entries);    
-    unsigned counter = 0;
-    for (double axis = min; axis <= max + VERYSMALL_F; axis += binwidth) {
-        force_vals[counter] = fm_s_comp->evaluate_spline(index_among_defined, interaction_class_column_index, spline_coeffs, axis);
-        axis_vals[counter] = axis;
-        counter++;
-    }
-    if (counter == 0) {
-    	double axis = (ispec->upper_cutoffs[index_among_defined] + ispec->lower_cutoffs[index_among_defined]) * 0.5;
-    	force_vals[counter] = fm_s_comp->evaluate_spline(index_among_defined, interaction_class_column_index, spline_coeffs, axis);
-        axis_vals[counter] = axis;
-        counter++;
-    }
-    // Set the correct size for the output vectors of positions and forces.
-    if (counter > num_entries) printf("Grid evaluation vector was undersized\n"); 
-    else {
-    	axis_vals.resize(counter);
-    	force_vals.resize(counter);
-	}
+    calc_grid_axis_vals(index_among_defined, binwidth, true, axis_vals);
+    fm_s_comp->evaluate_spline_on_grid(index_among_defined, interaction_class_column_index, spline_coeffs, axis_vals, force_vals);
+}
+
+// Evaluate the forces for several sets of coefficients (such as the 
+// bootstrap estimates) on the same grid at once.
+void InteractionClassComputer::calc_grids_of_force_vals(const std::vector<const std::vector<double>*> &spline_coeff_sets, const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector< std::vector<double> > &force_vals) 
+{
+    calc_grid_axis_vals(index_among_defined, binwidth, true, axis_vals);
+    fm_s_comp->evaluate_splines_on_grid(index_among_defined, interaction_class_column_index, spline_coeff_sets, axis_vals, force_vals);
 }
 
 void InteractionClassComputer::calc_grid_of_force_and_deriv_vals(const std::vector<double> &spline_coeffs, const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals, std::vector<double> &deriv_vals)
+{
+    std::vector<const std::vector<double>*> spline_coeff_sets(1, &spline_coeffs);
+    std::vector< std::vector<double> > set_force_vals, set_deriv_vals;
+    calc_grids_of_force_and_deriv_vals(spline_coeff_sets, index_among_defined, binwidth, axis_vals, set_force_vals, set_deriv_vals);
+    force_vals.swap(set_force_vals[0]);
+    deriv_vals.swap(set_deriv_vals[0]);
+}
+
+void InteractionClassComputer::calc_grids_of_force_and_deriv_vals(const std::vector<const std::vector<double>*> &spline_coeff_sets, const int index_among_defined, const double binwidth, std::vector<double> &axis_vals, std::vector< std::vector<double> > &force_vals, std::vector< std::vector<double> > &deriv_vals)
 {
     BSplineAndDerivComputer* s_comp_ptr = static_cast<BSplineAndDerivComputer*>(fm_s_comp);	
-    
-    // Calculate forces by iterating over the grid points from low to high.
-    // The lower value is adjusted so that the difference between the output upper cutoff and output lower cutoff is divisible by the output binwidth and that the lower cutoff is always greater than basis lower cutoff.
-	double max = ispec->upper_cutoffs[index_among_defined];
-    double min = max - ((int)((max - ispec->lower_cutoffs[index_among_defined]) / binwidth)) * binwidth;
-    
-    // Size the output vectors of positions and forces conservatively.
-    unsigned num_entries = int((max - min)/binwidth) + 2;
-    if (num_entries <= 0) { 
-    	num_entries = 1;
-    	fprintf(stderr, "No output will be generated for this interaction since the rounded lower cutoff is greater than or equal to the upper cutoff!\n");
-	}
-	
-	axis_vals = std::vector<double>(num_entries);
-    force_vals = std::vector<double>(num_entries);
-    deriv_vals = std::vector<double>(num_entries);
-
-    unsigned counter = 0;
-    for (double axis = min; axis <= max+VERYSMALL_F; axis += binwidth) {
-    	axis_vals[counter] = axis;
-   		force_vals[counter] = s_comp_ptr->evaluate_spline(index_among_defined, interaction_class_column_index, spline_coeffs, axis);
-        deriv_vals[counter] = s_comp_ptr->evaluate_spline_deriv(index_among_defined, interaction_class_column_index, spline_coeffs, axis);   
-    	counter++;
-    }
-    
-    // Set the correct size for the output vectors of positions and forces.
-    if (counter > num_entries) printf("Grid evaluation vector was undersized\n"); 
-    else {
-    	axis_vals.resize(counter);
-    	force_vals.resize(counter);
-    }
+    calc_grid_axis_vals(index_among_defined, binwidth, false, axis_vals);
+    s_comp_ptr->evaluate_splines_and_derivs_on_grid(index_among_defined, interaction_class_column_index, spline_coeff_sets, axis_vals, force_vals, deriv_vals);
 }
\ No newline at end of file
@@ -30,6 +30,7 @@ class ThreeBCellList;
 struct InteractionClassComputer;
 struct ThreeBodyNonbondedClassComputer;
 struct DensityClassSpec;
+struct ParameterHistogram;
 
 // Function called externally
 void free_interaction_data(CG_MODEL_DATA* cg);
@@ -42,8 +43,12 @@ void check_input_values(CG_MODEL_DATA* cg);
 
 enum InteractionClassType {kPairNonbonded = 2, kPairBonded = -2, kAngularBonded = -3, kDihedralBonded = -4, kThreeBodyNonbonded = 3, kDensity = 4};
 // function pointer "type" used for polymorphism of matrix element calculation (for pair nonbonded types)
-typedef void (*calc_pair_matrix_elements)(InteractionClassComputer* const, std::array<double, DIMENSION>* const &, const real*, MATRIX_DATA* const);
+typedef void (*calc_pair_matrix_elements)(InteractionClassComputer* const, std::array<frame_real, DIMENSION>* const &, const real*, MATRIX_DATA* const);
 typedef void (*calc_interaction_matrix_elements)(InteractionClassComputer* const info, MATRIX_DATA* const mat, const int n_body, int* particle_ids, std::array<double, DIMENSION>* derivatives, const double param_value, const int virial_flag, const double param_deriv, const double distance);
+// function pointer "type" for the geometry of one bonded interaction (see geometry.h)
+typedef bool (*calc_bonded_geometry)(const int* particle_ids, const std::array<frame_real, DIMENSION>* const &particle_positions, const real *simulation_box_half_lengths, const double cutoff2, double &param_val, std::array<double, DIMENSION>* &derivatives);
+// function pointer "type" for the work done on each pair of neighbors found when walking the density cell list
+typedef void (*calc_density_pair_elements)(InteractionClassComputer* const, calc_pair_matrix_elements, int* const, const int, MATRIX_DATA* const, std::array<frame_real, DIMENSION>* const &, const real*);
 
 //-------------------------------------------------------------
 // Interaction-model-related type definitions
@@ -67,6 +72,7 @@ struct InteractionClassSpec {
     double output_binwidth;
 	int output_parameter_distribution;
 	FILE** output_range_file_handles;
+	ParameterHistogram* parameter_histograms;
 
 	// n_defined is the number of unique type combinations for n_cg_sites and the interaction type.
 	// defined_to_possible is used for bonded-type interactions and converts the type combination hash
@@ -163,6 +169,7 @@ struct InteractionClassSpec {
 		n_tabulated = n_to_force_match = n_from_table = 0;
 		n_defined = 0;
 		class_subtype = 0;
+		parameter_histograms = NULL;
 	};
 	
 	~InteractionClassSpec() {
@@ -186,6 +193,7 @@ struct InteractionClassComputer {
     // Raw interaction class specifications
     InteractionClassSpec *ispec;
     double cutoff2;                             // Squared cutoff; used only for nonbonded interactions
+    double neighbor_cutoff2;                    // Pairs found in the cell list farther apart than this are skipped without calculating their matrix elements; negative to visit every pair
 	
     // Matrix-locations for storing results of computation
     int trajectory_block_frame_index;           // Index of the current frame in the current block of frames
@@ -212,8 +220,14 @@ struct InteractionClassComputer {
     double intrxn_param_less_lower_cutoff;     // Pair distance from the pair_nonbonded_interaction_lower_cutoffs_XOR_lower_cutoffs
     double stillinger_weber_angle_parameter;   // Current interaction's SW angle param (three-body interactions only).
     
+    // Range finding results: the sampled range and parameter histogram of each defined interaction.
+    // These are the class specification's arrays, except for the computers of parallel range finding workers.
+    double* range_lower_cutoffs;
+    double* range_upper_cutoffs;
+    ParameterHistogram* range_histograms;
+    
     // Function called to calculate matrix elements corresponding to an interaction in the current class of interactions.
-    void (*calculate_fm_matrix_elements)(InteractionClassComputer* const self, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+    void (*calculate_fm_matrix_elements)(InteractionClassComputer* const self, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
     // Function called to evaluate the values of functions in an interaction's basis set
     void (*set_up_fm_bases)(void);
 	// Function called to accumulate the interactions into the matrix for the interaction.
@@ -224,17 +238,20 @@ struct InteractionClassComputer {
     // Function to calculate index of an actual interaction among all possible interactions for the current class
 	virtual int calculate_hash_number(int* const cg_site_types, const int n_cg_types) = 0;
 	
-	virtual void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) = 0;
+	virtual void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) = 0;
 	
 	void set_up_computer(InteractionClassSpec* const ispec_pt, int *curr_iclass_col_index);	
 
 	void calc_external_spline_interaction(void);
+	void calc_grid_axis_vals(const int index_among_defined_intrxns, const double binwidth, const bool use_midpoint_if_empty, std::vector<double> &axis_vals);
 	void calc_grid_of_table_force_vals(const int index_among_defined_intrxns, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals);
 	void calc_grid_of_force_vals(const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals);
 	void calc_grid_of_force_and_deriv_vals(const std::vector<double> &spline_coeffs, const int index_among_defined_intrxns, const double binwidth, std::vector<double> &axis_vals, std::vector<double> &force_vals, std::vector<double> &deriv_vals);
+	void calc_grids_of_force_vals(const std::vector<const std::vector<double>*> &spline_coeff_sets, const int index_among_defined_intrxns, const double binwidth, std::vector<double> &axis_vals, std::vector< std::vector<double> > &force_vals);
+	void calc_grids_of_force_and_deriv_vals(const std::vector<const std::vector<double>*> &spline_coeff_sets, const int index_among_defined_intrxns, const double binwidth, std::vector<double> &axis_vals, std::vector< std::vector<double> > &force_vals, std::vector< std::vector<double> > &deriv_vals);
 	
-	void walk_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
-	void walk_3B_neighbor_list(MATRIX_DATA* const mat, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void walk_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void walk_3B_neighbor_list(MATRIX_DATA* const mat, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 
 	void set_indices(void) {
 		index_among_matched_interactions   = ispec->defined_to_matched_intrxn_index_map[index_among_defined_intrxns];
@@ -253,7 +270,9 @@ struct InteractionClassComputer {
 	InteractionClassComputer() {
 		fm_s_comp = NULL;
 		table_s_comp = NULL;
+		neighbor_cutoff2 = -1.0;
 	}
+	virtual ~InteractionClassComputer() {}
 	
 	protected:
 	void calculate_bspline_matrix_elements(void);
@@ -538,41 +557,96 @@ struct DensityClassSpec: InteractionClassSpec {
 struct PairNonbondedClassComputer : InteractionClassComputer {
 	void class_set_up_computer(void);
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 
     int calculate_hash_number(int* const cg_site_types, const int n_cg_types) {
 	    return calc_two_body_interaction_hash(cg_site_types[k], cg_site_types[l], n_cg_types);
 	}
 };
 
-struct PairBondedClassComputer : InteractionClassComputer {
+// Bonded interaction classes find their interactions in a topology list.
+// Each interaction is compiled once into a row of site indices (see
+// compile_bonded_interaction_list), and the rows are sorted into one batch
+// per type among the defined interactions, keeping the order of the topology
+// list within each batch. The rows are compiled again when topo_data.revision
+// changes, or for every frame when the list shares the caller's arrays, which
+// may be edited in place; the batches are sorted again whenever the rows
+// change, and for every frame when the site types vary. When force matching, the geometry of a whole batch is found
+// before its basis functions are evaluated and added to the matrix.
+
+struct BondedClassComputer : InteractionClassComputer {
+	std::vector<int> bonded_topology_sites;		// Rows compiled from the topology list, in its order
+	std::vector<int> shared_topology_sites;		// Rows compiled again from shared arrays, to compare with bonded_topology_sites
+	std::vector<int> bonded_sites;				// Rows of the interactions defined in the model, sorted by type
+	std::vector<size_t> bonded_type_offsets;	// First row of each type's batch in bonded_sites, with the total number of rows at the end
+	int compiled_revision;						// topo_data.revision when the rows were compiled; -1 before the first frame
+	
+	// Geometry of one interaction and the number of sites it involves, or NULL
+	// to calculate each interaction with calculate_fm_matrix_elements instead.
+	calc_bonded_geometry calculate_bonded_geometry;
+	int geometry_n_body;
+	
+	// Per-batch temporaries for the interactions found within the cutoffs.
+	std::vector<size_t> batch_rows;
+	std::vector<double> batch_param_vals;
+	std::vector<std::array<double, DIMENSION> > batch_derivatives;
+	
+	BondedClassComputer() {
+		compiled_revision = -1;
+		calculate_bonded_geometry = NULL;
+		geometry_n_body = 2;
+	}
+	
+	// The topology list holding this class's interactions.
+	virtual TopoList const* get_topo_list(const TopologyData& topo_data) const = 0;
+	
+	void compile_bonded_interactions(const TopologyData& topo_data, const int n_cg_types);
+	void calculate_bonded_interactions(MATRIX_DATA* const mat, const TopologyData& topo_data, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_bonded_batch(MATRIX_DATA* const mat, const int n_body, const size_t first_row, const size_t last_row, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	
+	inline void set_bonded_sites(const int* row, const int n_body) {
+		k = row[0];
+		l = row[1];
+		if (n_body == 3) {
+			j = row[2];
+		} else if (n_body == 4) {
+			i = row[2];
+			j = row[3];
+		}
+	}
+};
+
+struct PairBondedClassComputer : BondedClassComputer {
 	void class_set_up_computer(void);
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths); 
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths); 
 
     int calculate_hash_number(int* const cg_site_types, const int n_cg_types) {
 	    return calc_two_body_interaction_hash(cg_site_types[k], cg_site_types[l], n_cg_types);
 	}
+	TopoList const* get_topo_list(const TopologyData& topo_data) const {return topo_data.bond_list;}
 };
 
-struct AngularClassComputer : InteractionClassComputer {
+struct AngularClassComputer : BondedClassComputer {
 	void class_set_up_computer(void);
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 
     int calculate_hash_number(int* const cg_site_types, const int n_cg_types) {
 	    return calc_three_body_interaction_hash(cg_site_types[j], cg_site_types[k], cg_site_types[l], n_cg_types);
 	}
+	TopoList const* get_topo_list(const TopologyData& topo_data) const {return topo_data.angle_list;}
 };
 
-struct DihedralClassComputer : InteractionClassComputer {
+struct DihedralClassComputer : BondedClassComputer {
 	void class_set_up_computer(void);
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 
     int calculate_hash_number(int* const cg_site_types, const int n_cg_types) {
 		return calc_four_body_interaction_hash(cg_site_types[i], cg_site_types[j], cg_site_types[k], cg_site_types[l], n_cg_types);
 	}
+	TopoList const* get_topo_list(const TopologyData& topo_data) const {return topo_data.dihedral_list;}
 };
 
 struct ThreeBodyNonbondedClassComputer : InteractionClassComputer {
@@ -581,8 +655,8 @@ struct ThreeBodyNonbondedClassComputer : InteractionClassComputer {
 	void special_set_up_computer(InteractionClassSpec* const ispec_pt, int *curr_iclass_col_index);
 	void class_set_up_computer(void) {} ;
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths) {};
-	void calculate_3B_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths) {};
+	void calculate_3B_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const ThreeBCellList& three_body_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 	
     void calculate_bspline_elements_and_deriv_elements(double* coef1);
 	void calculate_bspline_deriv_elements(double* coef1);
@@ -604,26 +678,60 @@ struct DensityClassComputer : InteractionClassComputer {
 	// Stores the density weight for the current interaction.
 	double curr_weight;
 	
-	// A "flattened" 2D-array that stores the density of each density group at each CG site. 
-	// Only the needed elements are calculated
-	double* density_values;		// It is "flattened" via the "hash" [matched_density_index * n_cg_sites + cg_site_index].
-								// First, this will hold the accumulating weight function contributions that determine 
-								// the density of each density group at every relavent CG site.
-								// Then, this holds the spline derivative evaluated at the density value 
-								// (since the density value itself is no longer needed).
+	// The density of each density group at each CG site, stored only where it can be nonzero:
+	// the density for interaction index_among_defined is calculated at a site only if the site's type 
+	// belongs to the second density group of that interaction.
+	std::vector<double> density_values;		// The densities at each site are stored contiguously, starting at density_value_offsets[site].
+											// This holds the accumulating weight function contributions that determine 
+											// the density of each density group at every relavent CG site.
+	std::vector<int> density_value_offsets;	// Start of each site's densities (n_cg_sites + 1 entries), laid out each frame from the site types.
+	std::vector<int> density_slots;			// Position of each density among those of a site, by [type_index * n_defined + index_among_defined]; -1 if not stored.
+	std::vector<int> n_density_slots;		// Number of densities stored at a site of each type.
+	int* density_site_types;				// The site types used to lay out density_values for the current frame.
+	
+	inline double& get_density_value(const int site, const int index_among_defined) {
+		return density_values[density_value_offsets[site] + density_slots[(density_site_types[site] - 1) * ispec->n_defined + index_among_defined]];
+	}
+
+	// The density interactions active between each ordered pair of site types, decoded once from 
+	// site_to_density_group_intrxn_index_map. The terms for a site of type_k (where the density is calculated)
+	// and a neighbor of type_l are pair_terms[pair_term_offsets[type_k * n_cg_types + type_l]] up to the next offset.
+	// Only interactions that are force matched or tabulated are listed.
+	struct PairTerm {
+		int index_among_defined;
+		double weight;			// The density weight of this term (density_weights for type_k in the second density_group)
+	};
+	std::vector<int> pair_term_offsets;
+	std::vector<PairTerm> pair_terms;
+
+	// Pairs found within the cutoff while accumulating the density of a frame, kept so that
+	// the matrix elements can be calculated without walking the cell list a second time.
+	struct NeighborPair {
+		int k;
+		int l;
+		double distance;
+		std::array<double, DIMENSION> derivative;	// Derivative of the distance for ordering (k, l); negated for (l, k)
+	};
+	std::vector<NeighborPair> neighbor_pairs;
+	std::vector<double> neighbor_weight_derivatives;	// Weight function derivative times the density weight for each term of each stored pair,
+														// the (k, l) terms followed by the (l, k) terms.
 
 	// Specific Implementaitons of InteractionClassComputer functions
 	void class_set_up_computer(void);
 	//void class_set_up_range(void);
-	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
-	void walk_density_neighbor_list(MATRIX_DATA* const mat, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<double, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void calculate_interactions(MATRIX_DATA* const mat, int traj_block_frame_index, int curr_frame_starting_row, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
+	void walk_density_neighbor_list(MATRIX_DATA* const mat, calc_density_pair_elements calc_pair_elements, calc_pair_matrix_elements calc_matrix_elements, const int n_cg_types, const TopologyData& topo_data, const PairCellList& pair_cell_list, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths);
 	
 	// Additional Computer functions specific to Density.
-	void reset_density_array(void);
+	void set_up_density_storage(void);
+	void reset_density_array(int* const cg_site_types);
+	void set_up_pair_terms(void);
+	void calculate_stored_pair_matrix_elements(MATRIX_DATA* const mat, int* const cg_site_types, const int n_cg_types);
 	
 	// Additional function pointer to calculate the density_values array before computing the interaction
-	void (*calculate_density_values)(InteractionClassComputer* const self, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-   	void (*process_density)(InteractionClassComputer* const self, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+	void (*calculate_density_values)(InteractionClassComputer* const self, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+   	void (*process_density)(InteractionClassComputer* const self, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+	double (*calculate_density_weight)(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance2);
 	double (*calculate_density_derivative)(DensityClassComputer* const icomp, DensityClassSpec* const ispec, const double distance);
 	
 	// Need to implement these functions
@@ -634,7 +742,6 @@ struct DensityClassComputer : InteractionClassComputer {
 			delete [] denomenator;
 			delete [] u_cutoff;
 			delete [] f_cutoff;
-			delete [] density_values;
 
 	    	if(ispec->class_subtype == 4) {
 	    		delete [] c0;
@@ -697,6 +804,8 @@ struct CG_MODEL_DATA {
 		output_spline_coeffs_flag(control_input->output_spline_coeffs_flag)
 {
     	topo_data.excluded_style = control_input->excluded_style;
+		topo_data.num_threads = control_input->num_threads;
+		topo_data.site_types_vary = (control_input->dynamic_types != 0) || (control_input->dynamic_state_sampling != 0);
 		topo_data.density_excluded_style = control_input->density_excluded_style;
 		pair_nonbonded_cutoff2 = pair_nonbonded_cutoff * pair_nonbonded_cutoff;
 		
@@ -6,18 +6,25 @@
 //
 
 #include <cassert>
+#include <cfloat>
 #include <cmath>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <algorithm>
 #include <array>
+#include <thread>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
 #include "control_input.h"
 #include "interaction_model.h"
 #include "external_matrix_routines.h"
 #include "misc.h"
 #include "matrix.h"
+#include "result_file.h"
 
 // Matrix implementation-specific routines that are properly
 // abstracted into the matrix data struct.
@@ -77,14 +84,17 @@ void accumulate_constraint_into_accumulation_target_vector(MATRIX_DATA *mat, int
 void calculate_target_virial_in_dense_vector(MATRIX_DATA* const mat, double *pressure_constraint_rhs_vector);
 void calculate_target_virial_in_accumulation_vector(MATRIX_DATA* const mat, double *pressure_constraint_rhs_vector);
 
-void calculate_target_force_dense_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f);
-void calculate_target_force_accumulation_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f);
+void calculate_target_force_dense_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f);
+void calculate_target_force_accumulation_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f);
 
 // Post-frame-block routines
 
 void convert_dense_fm_equation_to_normal_form_and_accumulate(MATRIX_DATA* const mat);
 void convert_dense_target_force_vector_to_normal_form_and_accumulate(MATRIX_DATA* const mat);
 void accumulate_accumulation_matrices(MATRIX_DATA* const mat);
+void reduce_accumulation_batch(MATRIX_DATA* const mat);
+void factor_accumulation_block(MATRIX_DATA* const mat, double* const block, double* const factor);
+void merge_triangular_factors(int n, double* const target, int target_stride, double* const source);
 void solve_sparse_matrix(MATRIX_DATA* const mat);
 void convert_sparse_fm_equation_to_sparse_normal_form_and_accumulate(MATRIX_DATA* const mat);
 void convert_sparse_fm_equation_to_dense_normal_form_and_accumulate(MATRIX_DATA* const mat);
@@ -109,6 +119,8 @@ inline double calculate_sparse_residual(MATRIX_DATA* const mat, csr_matrix* spar
 inline void calculate_and_apply_dense_preconditioning(MATRIX_DATA* mat, dense_matrix* dense_fm_normal_matrix, double* h);
 inline void calculate_dense_svd(MATRIX_DATA* mat, int fm_matrix_columns, dense_matrix* dense_fm_normal_matrix, double* dense_fm_normal_rhs_vector, double* singular_values);
 inline void calculate_dense_svd(MATRIX_DATA* mat, int fm_matrix_columns, int fm_matrix_rows, dense_matrix* dense_fm_normal_matrix, double* dense_fm_normal_rhs_vector, double* singular_values);
+inline void calculate_dense_eigendecomposition(int fm_matrix_columns, dense_matrix* const dense_fm_normal_matrix, double* const eigenvalues);
+inline double calculate_shifted_eigendecomposition_inverse(MATRIX_DATA* const mat, int fm_matrix_columns, dense_matrix* const eigenvectors, const double* const eigenvalues, const double shift, const double* const rhs, double* const solution, double* const inverse_diagonal, dense_matrix* const inverse);
 
 // After-full-trajectory routines
 
@@ -116,23 +128,45 @@ void average_sparse_block_fm_solutions(MATRIX_DATA* const mat);
 void solve_sparse_fm_normal_equations(MATRIX_DATA* const mat);
 void solve_dense_fm_normal_equations(MATRIX_DATA* const mat);
 void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat);
+double solve_accumulation_triangle(MATRIX_DATA* const mat, double* const values, int stride, double* const rhs, std::vector<double> &solution, double* const singular_values);
+void calculate_regularization_scan(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, const double* const rhs, double* const residual_rhs);
+void solve_dense_bayesian_equations(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, double* const rhs);
+double calculate_bayesian_cholesky_estimate(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, const double* const rhs, const double* const regularization, dense_matrix* const factor, double* const solution, double* const inverse_diagonal, dense_matrix* const inverse);
+void form_scaled_bayesian_normal_matrix(const int n, dense_matrix* const normal_matrix, const double* const regularization, const double* const scaling, dense_matrix* const scaled_matrix);
 
 // Bootstrapping routines
 
 void convert_dense_fm_equation_to_normal_form_and_bootstrap(MATRIX_DATA* const mat);
 void solve_sparse_matrix_for_bootstrap(MATRIX_DATA* const mat);
 void convert_sparse_fm_equation_to_sparse_normal_form_and_bootstrap(MATRIX_DATA* const mat);
-void accumulate_accumulation_matrices_for_bootstrap(MATRIX_DATA* const mat);
 void convert_sparse_fm_equation_to_dense_normal_form_and_bootstrap(MATRIX_DATA* const mat);
 void average_sparse_bootstrapping_solutions(MATRIX_DATA* const mat);
 void solve_sparse_fm_bootstrapping_equations(MATRIX_DATA* const mat);
 void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat);
+void solve_dense_bootstrapping_estimate(MATRIX_DATA* const mat, const int k, double* const backup_rhs, double* const singular_values);
 void solve_accumulation_form_bootstrapping_equations(MATRIX_DATA* const mat);
+void add_frame_to_bootstrapping_batch(MATRIX_DATA* const mat, const double* const normal_matrix);
+void add_sparse_frame_to_bootstrapping_batch(MATRIX_DATA* const mat, const csr_matrix* const normal_matrix);
+void add_frame_weights_to_bootstrapping_batch(MATRIX_DATA* const mat);
+void reduce_bootstrapping_batch(MATRIX_DATA* const mat);
+void unpack_bootstrapping_normal_matrix(MATRIX_DATA* const mat, const int estimate, dense_matrix* const normal_matrix);
 
 // Matrix-implementation-dependent functions for reading 
 // batches of FM matrices.
 
+typedef void (*accumulate_result_file)(MATRIX_DATA* const mat, const char* filename, double* const partial_sum);
+typedef void (*combine_partial_sums)(MATRIX_DATA* const mat, double* const target, double* const source, const size_t record_size);
+
 int read_res_av_file(std::string* &filenames);
+void warn_legacy_result_file_normalization(const char* filename);
+void accumulate_dense_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum);
+void accumulate_sparse_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum);
+void accumulate_accumulation_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum);
+void add_partial_sums(MATRIX_DATA* const mat, double* const target, double* const source, const size_t record_size);
+void merge_accumulation_partial_sums(MATRIX_DATA* const mat, double* const target, double* const source, const size_t record_size);
+void reduce_result_file_range(MATRIX_DATA* const mat, const std::string* filenames, const int first_file, const int last_file, accumulate_result_file accumulate_file, double* const partial_sum);
+void reduce_result_file_batch(MATRIX_DATA* const mat, const std::string* filenames, const int n_batch, const size_t record_size, accumulate_result_file accumulate_file, combine_partial_sums combine, double* const total);
+void read_iterative_reference_equations(MATRIX_DATA* const mat, double* const in_rhs);
 void read_binary_dense_fm_matrix(MATRIX_DATA* const mat);
 void read_binary_accumulation_fm_matrix(MATRIX_DATA* const mat);
 void read_binary_sparse_fm_matrix(MATRIX_DATA* const mat);
@@ -140,6 +174,8 @@ void read_regularization_vector(MATRIX_DATA* const mat);
 
 // Output functions.
 
+void write_packed_upper_triangle(ResultFileWriter* const mat_out, const ResultSectionType section_type, const int estimate, const double* values, const int n_cols, const int stride);
+void read_packed_upper_triangle(const double* packed, double* const values, const int n_cols, const int stride);
 void write_iteration(const double* alpha_vec, const double beta, std::vector<double> fm_solution, const double residual, const int iteration, FILE* alpha_fp, FILE* beta_fp, FILE* sol_fp, FILE* res_fp);
 
 //--------------------------------------------------------------------
@@ -157,11 +193,18 @@ MATRIX_DATA::MATRIX_DATA(ControlInputs* const control_input, CG_MODEL_DATA *cons
     output_style 					= control_input->output_style;
     output_normal_equations_rhs_flag= control_input->output_normal_equations_rhs_flag;
     output_solution_flag 			= control_input->output_solution_flag;
+    output_archive_flag 			= control_input->output_archive_flag;
     rcond							= control_input->rcond;
     itnlim 							= control_input->itnlim;
 	num_sparse_threads 				= control_input->num_sparse_threads;
+	num_threads						= control_input->num_threads;
 	position_dimension 				= control_input->position_dimension;
 	volume_weighting_flag 			= control_input->volume_weighting_flag;
+	n_frames						= control_input->n_frames;
+	checkpoint_interval				= control_input->checkpoint_interval;
+	restart_flag					= control_input->restart_flag;
+	basis_layout_hash				= calculate_basis_layout_hash(cg);
+	profile							= NULL;
 
 	// Copy iterative information.
     iterative_calculation_flag 		= control_input->iterative_calculation_flag;
@@ -174,9 +217,11 @@ MATRIX_DATA::MATRIX_DATA(ControlInputs* const control_input, CG_MODEL_DATA *cons
 	
 	// Copy residual, regularization, and bayesian options.
 	regularization_style 			= control_input->regularization_style;
+	regularization_scan_flag		= control_input->regularization_scan_flag;
     tikhonov_regularization_param 	= control_input->tikhonov_regularization_param;
 	bayesian_flag					= control_input->bayesian_flag;
 	bayesian_max_iter				= control_input->bayesian_max_iter;
+	bayesian_alpha_style			= control_input->bayesian_alpha_style;
     output_residual                 = control_input->output_residual;
     force_sq_total					= 0.0;
  
@@ -260,6 +305,18 @@ void matrix_sanity_checks(ControlInputs* const control_input) {
         exit(EXIT_FAILURE);
     }
     
+    if ( ((MatrixType)(control_input->matrix_type) != kDense) && ((MatrixType)(control_input->matrix_type) != kSparseNormal) && (control_input->regularization_scan_flag != 0) ) {
+        printf("Cannot scan regularization parameters if normal equations are not being calculated.\n");
+        printf("Use a different FM matrix format.\n");
+        exit(EXIT_FAILURE);
+    }
+    
+    if ( ((MatrixType)(control_input->matrix_type) != kDense) && ((MatrixType)(control_input->matrix_type) != kSparseNormal) && (control_input->bayesian_flag != 0) && (control_input->bayesian_alpha_style != 0) ) {
+        printf("A single Bayesian alpha is only implemented for dense normal equations.\n");
+        printf("Use a different FM matrix format or bayesian_alpha_style 0.\n");
+        exit(EXIT_FAILURE);
+    }
+    
     // Override a user's choice of block_size if it conflicts with use_statistical_reweighting flag
     if ( (control_input->use_statistical_reweighting == 1) && (control_input->frames_per_traj_block != 1) ) {
     	printf("Cannot use statistical reweighting with %d frames per trajectory block.\n", control_input->frames_per_traj_block);
@@ -290,6 +347,17 @@ void matrix_sanity_checks(ControlInputs* const control_input) {
 		exit(EXIT_FAILURE);
 	}
 	
+	if ( (control_input->checkpoint_interval > 0) || (control_input->restart_flag == 1) ) {
+		if ( ((MatrixType)(control_input->matrix_type) == kSparseNormal) || ((MatrixType)(control_input->matrix_type) == kSparseSparse) ) {
+			printf("Checkpointing and restarting are not supported for matrix_type %d.\n", control_input->matrix_type);
+			exit(EXIT_FAILURE);
+		}
+		if (control_input->dynamic_state_sampling == 1) {
+			printf("Checkpointing and restarting are not supported with dynamic_state_sampling.\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	
 	if (control_input->position_dimension <= 0) {
 		printf("Position dimension must be a positive integer\n");
 		exit(EXIT_FAILURE);
@@ -379,12 +447,7 @@ void initialize_accumulation_matrix(MATRIX_DATA* const mat, ControlInputs* const
     mat->accumulate_target_force_element = accumulate_force_into_accumulation_target_vector;
     mat->accumulate_target_constraint_element = accumulate_constraint_into_accumulation_target_vector;
     
-    if (control_input->bootstrapping_flag == 1) {
-    	mat->do_end_of_frameblock_matrix_manipulations = accumulate_accumulation_matrices_for_bootstrap;
-    } else {
-		mat->do_end_of_frameblock_matrix_manipulations = accumulate_accumulation_matrices;
-    }
-    
+    mat->do_end_of_frameblock_matrix_manipulations = accumulate_accumulation_matrices;
     mat->accumulate_virial_constraint_matrix_element = insert_accumulation_matrix_virial_element;
     
     if (control_input->bootstrapping_flag == 1) {
@@ -407,15 +470,20 @@ void initialize_accumulation_matrix(MATRIX_DATA* const mat, ControlInputs* const
     printf("Number of columns for accumulation matrix algorithm: %d \n", mat->accumulation_matrix_rows);
     
     // Allocate memory for the FM matrix and target vector as well as temp space for the accumulation operation.
+    // Each bootstrapping estimate keeps its own square R factor.
     if (control_input->bootstrapping_flag == 1) {
-		printf("Bootstrapping is not currently supported for accumulation matrix type.\n");
-		exit(EXIT_FAILURE);
- 		allocate_bootstrapping(mat, control_input, mat->fm_matrix_columns, mat->fm_matrix_columns);
+ 		allocate_bootstrapping(mat, control_input, mat->accumulation_matrix_columns, mat->accumulation_matrix_columns);
     }
 	mat->dense_fm_matrix = new dense_matrix(mat->accumulation_matrix_rows, mat->accumulation_matrix_columns);
 	mat->dense_fm_normal_rhs_vector = new double[mat->accumulation_matrix_columns]();
 
-    mat->lapack_tau = new double[mat->accumulation_matrix_columns]();
+	// One frame block is buffered per worker thread so that they can be factored concurrently,
+	// as many as fit with their R factors in the free memory.
+	mat->accumulation_batch_capacity = get_num_memory_bounded_threads(mat, ((size_t)mat->fm_matrix_rows + mat->accumulation_matrix_columns) * mat->accumulation_matrix_columns * sizeof(double));
+	mat->accumulation_batch_count = 0;
+	mat->accumulation_batch_block_indices = new int[mat->accumulation_batch_capacity];
+	mat->accumulation_frame_batch = new double[(size_t)mat->accumulation_batch_capacity * mat->fm_matrix_rows * mat->accumulation_matrix_columns];
+	mat->accumulation_batch_factors = new double[(size_t)mat->accumulation_batch_capacity * mat->accumulation_matrix_columns * mat->accumulation_matrix_columns];
 
     // Initialized the matrix to zero.
     printf("Size of per-frame matrix: %lu bytes \n", mat->accumulation_matrix_columns * mat->accumulation_matrix_rows * sizeof(double));
@@ -704,8 +772,8 @@ void initialize_first_BI_matrix(MATRIX_DATA* const mat, CG_MODEL_DATA* const cg)
   mat->accumulate_target_force_element = accumulate_scalar_into_dense_target_vector;
   
   // reset output files
-  FILE* BI_matrix = fopen("BI_matrix.dat","w");
-  FILE* BI_vector = fopen("BI_vector.dat","w");
+  FILE* BI_matrix = fopen(get_file_path("BI_matrix.dat").c_str(),"w");
+  FILE* BI_vector = fopen(get_file_path("BI_vector.dat").c_str(),"w");
   fclose(BI_matrix);
   fclose(BI_vector);
 }
@@ -820,9 +888,21 @@ void determine_BI_interaction_rows_and_cols(MATRIX_DATA* mat, InteractionClassCo
 void allocate_bootstrapping(MATRIX_DATA* mat, ControlInputs* const control_input, const int rows, const int cols)
 {
 	// matrices
-	mat->bootstrapping_dense_fm_normal_matrices = new dense_matrix*[control_input->bootstrapping_num_estimates];
-  	for (int i = 0; i < control_input->bootstrapping_num_estimates; i++) {
-		mat->bootstrapping_dense_fm_normal_matrices[i] = new dense_matrix(rows, cols);
+	if (mat->matrix_type == kDense || mat->matrix_type == kSparseNormal) {
+		// The batch never holds more frames than there are estimates, so that
+		// it takes at most as much memory as the estimates themselves.
+		mat->bootstrapping_packed_size = (size_t)cols * (cols + 1) / 2;
+		mat->bootstrapping_batch_capacity = std::min(32, control_input->bootstrapping_num_estimates);
+		mat->bootstrapping_batch_count = 0;
+		mat->bootstrapping_frame_batch = new double[mat->bootstrapping_packed_size * mat->bootstrapping_batch_capacity];
+		mat->bootstrapping_batch_weights = new double[mat->bootstrapping_batch_capacity * control_input->bootstrapping_num_estimates];
+		mat->bootstrapping_packed_normal_matrices = new double[mat->bootstrapping_packed_size * control_input->bootstrapping_num_estimates]();
+		mat->bootstrapping_frame_normal_matrix = new dense_matrix(cols, cols);
+	} else if (mat->matrix_type != kSparse) {
+		mat->bootstrapping_dense_fm_normal_matrices = new dense_matrix*[control_input->bootstrapping_num_estimates];
+	  	for (int i = 0; i < control_input->bootstrapping_num_estimates; i++) {
+			mat->bootstrapping_dense_fm_normal_matrices[i] = new dense_matrix(rows, cols);
+		}
 	}
 	
 	// rhs vectors
@@ -834,7 +914,7 @@ void allocate_bootstrapping(MATRIX_DATA* mat, ControlInputs* const control_input
 	// solutions
 	mat->bootstrap_solutions = new std::vector<double>[mat->bootstrapping_num_estimates];
    	for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
-  		mat->bootstrap_solutions[i] = std::vector<double>(cols);
+  		mat->bootstrap_solutions[i] = std::vector<double>(mat->fm_matrix_columns);
 	}
 }
     
@@ -1167,7 +1247,7 @@ void calculate_target_virial_in_accumulation_vector(MATRIX_DATA* const mat, doub
     }
 }
 
-void add_target_force_from_trajectory(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f) 
+void add_target_force_from_trajectory(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f) 
 {
     if (mat->matrix_type == kDense || mat->matrix_type == kSparse || mat->matrix_type == kSparseNormal || mat->matrix_type == kSparseSparse) {
         calculate_target_force_dense_vector(shift_i, site_i, mat, f);
@@ -1178,7 +1258,7 @@ void add_target_force_from_trajectory(int shift_i, int site_i, MATRIX_DATA* cons
 
 // Calculate the RHS vector for dense or sparse matrix calculations
 
-void calculate_target_force_dense_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f)
+void calculate_target_force_dense_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f)
 {
     int tn = DIMENSION * (site_i + shift_i);
     double force_sq = 0.0;
@@ -1193,7 +1273,7 @@ void calculate_target_force_dense_vector(int shift_i, int site_i, MATRIX_DATA* c
 
 // Calculate the RHS vector for accumulation matrix calculations
 
-inline void calculate_target_force_accumulation_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f)
+inline void calculate_target_force_accumulation_vector(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f)
 {
 	mat->dense_fm_matrix->assign_vector(DIMENSION * (site_i + shift_i) + mat->accumulation_row_shift, mat->fm_matrix_columns, f[site_i]);
 }
@@ -1249,8 +1329,9 @@ void convert_dense_fm_equation_to_normal_form_and_bootstrap(MATRIX_DATA* const m
 	int onei = 1.0;
 	int matrix_size = mat->fm_matrix_columns * mat->fm_matrix_columns;
 
-	// Create temp normal matrix and rhs vector.
-	dense_matrix* temp_normal_matrix = new dense_matrix(mat->fm_matrix_columns, mat->fm_matrix_columns);
+	// Clear the frame's normal matrix and create a temp rhs vector.
+	dense_matrix* temp_normal_matrix = mat->bootstrapping_frame_normal_matrix;
+	std::fill(temp_normal_matrix->values, temp_normal_matrix->values + matrix_size, 0.0);
 	double* temp_normal_rhs_vector = new double[mat->fm_matrix_columns]();
 
 	create_dense_normal_form(mat, 1.0, mat->dense_fm_matrix, temp_normal_matrix, mat->dense_fm_rhs_vector, temp_normal_rhs_vector);
@@ -1260,7 +1341,7 @@ void convert_dense_fm_equation_to_normal_form_and_bootstrap(MATRIX_DATA* const m
 	cblas_daxpy( matrix_size, frame_weight, temp_normal_matrix->values, onei, mat->dense_fm_normal_matrix->values, onei);	    
 	cblas_daxpy( mat->fm_matrix_columns, frame_weight, temp_normal_rhs_vector, onei, mat->dense_fm_normal_rhs_vector, onei);
 	
-	// Add the matrix and vector to each of the bootstrap samples based on the weight for that frame for each bootstrap estimate.
+	// Add the vector to each of the bootstrap samples based on the weight for that frame for each bootstrap estimate.
 	for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
 		
 		// traj_block_frame_index is the frame number processed since bootstrapping only allows a block size of 1.
@@ -1269,15 +1350,95 @@ void convert_dense_fm_equation_to_normal_form_and_bootstrap(MATRIX_DATA* const m
 		if(frame_weight == 0.0) continue;
 		frame_weight *= mat->bootstrapping_normalization[i];
 
-	   cblas_daxpy( matrix_size, frame_weight, temp_normal_matrix->values, onei, mat->bootstrapping_dense_fm_normal_matrices[i]->values, onei);
-
 	   cblas_daxpy( mat->fm_matrix_columns, frame_weight, temp_normal_rhs_vector, onei, mat->bootstrapping_dense_fm_normal_rhs_vectors[i], onei);
 	}
 	
-	delete temp_normal_matrix;
+	// The matrix is added to the bootstrap samples in batches of frames.
+	add_frame_to_bootstrapping_batch(mat, temp_normal_matrix->values);
+	
 	delete [] temp_normal_rhs_vector;
 }
 
+// Pack the upper triangle of the current frame's normal matrix into the
+// bootstrapping batch along with the frame's weight in each estimate.
+// The batch is reduced into the estimates once it is full.
+
+void add_frame_to_bootstrapping_batch(MATRIX_DATA* const mat, const double* const normal_matrix)
+{
+	int batch_index = mat->bootstrapping_batch_count;
+	double* packed = &mat->bootstrapping_frame_batch[batch_index * mat->bootstrapping_packed_size];
+	for (int j = 0; j < mat->fm_matrix_columns; j++) {
+		memcpy(packed, &normal_matrix[(size_t)j * mat->fm_matrix_columns], (j + 1) * sizeof(double));
+		packed += j + 1;
+	}
+	add_frame_weights_to_bootstrapping_batch(mat);
+}
+
+// Pack a frame's sparse normal matrix into the bootstrapping batch directly,
+// without expanding it to a dense matrix first. Its entries are indexed as
+// they are when the master normal matrix is accumulated.
+
+void add_sparse_frame_to_bootstrapping_batch(MATRIX_DATA* const mat, const csr_matrix* const normal_matrix)
+{
+	double* packed = &mat->bootstrapping_frame_batch[mat->bootstrapping_batch_count * mat->bootstrapping_packed_size];
+	std::fill(packed, packed + mat->bootstrapping_packed_size, 0.0);
+	for (int k = 0; k < mat->fm_matrix_columns; k++) {
+		size_t column_start = (size_t)k * (k + 1) / 2;
+		for (int l = normal_matrix->row_sizes[k] - 1; l < normal_matrix->row_sizes[k + 1] - 1; l++) {
+			int col = normal_matrix->column_indices[l];
+			if (col <= k) packed[column_start + col] = normal_matrix->values[l];
+		}
+	}
+	add_frame_weights_to_bootstrapping_batch(mat);
+}
+
+// Record the weight of the frame just packed into the batch in each estimate,
+// reducing the batch into the estimates once it is full.
+
+void add_frame_weights_to_bootstrapping_batch(MATRIX_DATA* const mat)
+{
+	int batch_index = mat->bootstrapping_batch_count;
+	for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
+		mat->bootstrapping_batch_weights[i * mat->bootstrapping_batch_capacity + batch_index] = mat->bootstrapping_weights[i][mat->trajectory_block_index] * mat->bootstrapping_normalization[i];
+	}
+	
+	mat->bootstrapping_batch_count++;
+	if (mat->bootstrapping_batch_count == mat->bootstrapping_batch_capacity) reduce_bootstrapping_batch(mat);
+}
+
+// Add every buffered frame to every estimate at once: the estimates' packed
+// matrices are incremented by the product of the batch (one column per frame)
+// and the frames' weights (one column per estimate). BLAS dimensions are ints,
+// so packed matrices with more than INT_MAX values are added frame by frame.
+
+void reduce_bootstrapping_batch(MATRIX_DATA* const mat)
+{
+	if (mat->bootstrapping_batch_count == 0) return;
+	size_t packed_size = mat->bootstrapping_packed_size;
+	if (packed_size <= (size_t)INT_MAX) {
+		cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, (int)packed_size, mat->bootstrapping_num_estimates, mat->bootstrapping_batch_count,
+			1.0, mat->bootstrapping_frame_batch, (int)packed_size, mat->bootstrapping_batch_weights, mat->bootstrapping_batch_capacity,
+			1.0, mat->bootstrapping_packed_normal_matrices, (int)packed_size);
+	} else {
+		for (int k = 0; k < mat->bootstrapping_num_estimates; k++) {
+			double* estimate_matrix = &mat->bootstrapping_packed_normal_matrices[k * packed_size];
+			for (int b = 0; b < mat->bootstrapping_batch_count; b++) {
+				double weight = mat->bootstrapping_batch_weights[k * mat->bootstrapping_batch_capacity + b];
+				const double* frame_matrix = &mat->bootstrapping_frame_batch[b * packed_size];
+				for (size_t i = 0; i < packed_size; i++) estimate_matrix[i] += weight * frame_matrix[i];
+			}
+		}
+	}
+	mat->bootstrapping_batch_count = 0;
+}
+
+// Copy the normal matrix of one bootstrapping estimate into the upper triangle of a dense matrix.
+
+void unpack_bootstrapping_normal_matrix(MATRIX_DATA* const mat, const int estimate, dense_matrix* const normal_matrix)
+{
+	read_packed_upper_triangle(&mat->bootstrapping_packed_normal_matrices[estimate * mat->bootstrapping_packed_size], normal_matrix->values, mat->fm_matrix_columns, mat->fm_matrix_columns);
+}
+
 // As above, but ignoring the FM matrix.
 // Used for Lanyuan's iterative method, in which only the FM target vector is recalculated.
 
@@ -1291,48 +1452,143 @@ void convert_dense_target_force_vector_to_normal_form_and_accumulate(MATRIX_DATA
     cblas_dgemv(CblasColMajor, CblasTrans, mat->fm_matrix_rows, mat->fm_matrix_columns, frame_weight, mat->dense_fm_matrix->values, mat->fm_matrix_rows, mat->dense_fm_rhs_vector, onei, oned, mat->dense_fm_normal_rhs_vector, onei);
 }
 
-// Perform the accumulation operation (QR decomposition followed by composition) to combine the
-// current frame's FM matrix with the growing accumulation matrix.
+// Buffer the current frame block's FM matrix rows for the accumulation
+// operation (QR decomposition followed by composition with the growing
+// accumulation matrix). The blocks are factored a batch at a time.
 
 void accumulate_accumulation_matrices(MATRIX_DATA* const mat)
 {
-    int info_in;
-
-    // Initialize the operation if this is the first block.
-    if (mat->trajectory_block_index == 0) {
-        mat->lapack_temp_workspace = new double[1];
-        mat->lapack_setup_flag = -1;
-        dgeqrf_(&mat->fm_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-        mat->lapack_setup_flag = mat->lapack_temp_workspace[0];
-        delete [] mat->lapack_temp_workspace;
-        mat->lapack_temp_workspace = new double[mat->lapack_setup_flag];
-        dgeqrf_(&mat->fm_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-        mat->accumulation_row_shift = mat->accumulation_matrix_columns;
-    } else {
-        dgeqrf_(&mat->accumulation_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-    }
+	size_t block_size = (size_t)mat->fm_matrix_rows * mat->accumulation_matrix_columns;
+	double* block = &mat->accumulation_frame_batch[mat->accumulation_batch_count * block_size];
+	for (int j = 0; j < mat->accumulation_matrix_columns; j++) {
+		memcpy(&block[(size_t)j * mat->fm_matrix_rows], &mat->dense_fm_matrix->values[(size_t)j * mat->accumulation_matrix_rows + mat->accumulation_row_shift], mat->fm_matrix_rows * sizeof(double));
+	}
+	mat->accumulation_batch_block_indices[mat->accumulation_batch_count] = mat->trajectory_block_index;
+	mat->accumulation_batch_count++;
+	
+	// The first block is built in the rows that hold the accumulated R factor afterwards.
+	if (mat->accumulation_row_shift == 0) {
+		for (int j = 0; j < mat->accumulation_matrix_columns; j++) {
+			memset(&mat->dense_fm_matrix->values[(size_t)j * mat->accumulation_matrix_rows], 0, mat->accumulation_matrix_columns * sizeof(double));
+		}
+		mat->accumulation_row_shift = mat->accumulation_matrix_columns;
+	}
+	
+	if (mat->accumulation_batch_count == mat->accumulation_batch_capacity) reduce_accumulation_batch(mat);
+}
+
+// Compose the buffered frame blocks with the accumulated R factor as a
+// tall-skinny QR: the blocks are QR factored concurrently, each bootstrapping
+// estimate takes its weighted share of every block's R factor, and the R factors
+// are combined in a binary tree with the pairs of each level combined
+// concurrently. The root is finally composed with the accumulated R factor.
+
+void reduce_accumulation_batch(MATRIX_DATA* const mat)
+{
+	int n_blocks = mat->accumulation_batch_count;
+	if (n_blocks == 0) return;
+	int n = mat->accumulation_matrix_columns;
+	size_t block_size = (size_t)mat->fm_matrix_rows * n;
+	size_t factor_size = (size_t)n * n;
+	int n_threads = get_num_worker_threads(mat);
+	std::vector<std::thread> workers;
+	
+	int n_workers = (n_threads < n_blocks) ? n_threads : n_blocks;
+	for (int w = 0; w < n_workers; w++) {
+		workers.push_back(std::thread([mat, w, n_workers, n_blocks, block_size, factor_size]() {
+			for (int b = w; b < n_blocks; b += n_workers) {
+				factor_accumulation_block(mat, &mat->accumulation_frame_batch[b * block_size], &mat->accumulation_batch_factors[b * factor_size]);
+			}
+		}));
+	}
+	for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	
+	// A frame block with bootstrapping weight w contributes its rows scaled by sqrt(w).
+	if (mat->bootstrapping_flag == 1) {
+		workers.clear();
+		// Each worker holds one weighted R factor.
+		int n_weighting_threads = get_num_memory_bounded_threads(mat, factor_size * sizeof(double));
+		n_workers = (n_weighting_threads < mat->bootstrapping_num_estimates) ? n_weighting_threads : mat->bootstrapping_num_estimates;
+		for (int w = 0; w < n_workers; w++) {
+			workers.push_back(std::thread([mat, w, n_workers, n_blocks, n, factor_size]() {
+				double* weighted_factor = new double[factor_size];
+				for (int k = w; k < mat->bootstrapping_num_estimates; k += n_workers) {
+					for (int b = 0; b < n_blocks; b++) {
+						double weight = mat->bootstrapping_weights[k][mat->accumulation_batch_block_indices[b]];
+						if (weight <= 0.0) continue;
+						double scale = sqrt(weight);
+						for (size_t i = 0; i < factor_size; i++) weighted_factor[i] = scale * mat->accumulation_batch_factors[b * factor_size + i];
+						merge_triangular_factors(n, mat->bootstrapping_dense_fm_normal_matrices[k]->values, n, weighted_factor);
+					}
+				}
+				delete [] weighted_factor;
+			}));
+		}
+		for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	}
+	
+	for (int stride = 1; stride < n_blocks; stride *= 2) {
+		workers.clear();
+		for (int b = 0; b + stride < n_blocks; b += 2 * stride) {
+			double* target = &mat->accumulation_batch_factors[b * factor_size];
+			double* source = &mat->accumulation_batch_factors[(b + stride) * factor_size];
+			workers.push_back(std::thread(merge_triangular_factors, n, target, n, source));
+		}
+		for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	}
+	merge_triangular_factors(n, mat->dense_fm_matrix->values, mat->accumulation_matrix_rows, mat->accumulation_batch_factors);
+	mat->accumulation_batch_count = 0;
 }
 
-void accumulate_accumulation_matrices_for_bootstrap(MATRIX_DATA* const mat)
+// QR factor the fm_matrix_rows by accumulation_matrix_columns rows of one frame
+// block (overwriting them) and copy its R factor into a square matrix.
+// A block with fewer rows than columns gives an upper trapezoidal R; the
+// remaining rows of the square matrix are zero.
+
+void factor_accumulation_block(MATRIX_DATA* const mat, double* const block, double* const factor)
 {
-	printf("Bootstrapping is not implemented for accumulation matrices.\n");
-	exit(EXIT_FAILURE);
+	int n = mat->accumulation_matrix_columns;
+	int info_in;
+	int lapack_setup_flag = -1;
+	double* lapack_tau = new double[n];
+	double* lapack_temp_workspace = new double[1];
+	dgeqrf_(&mat->fm_matrix_rows, &n, block, &mat->fm_matrix_rows, lapack_tau, lapack_temp_workspace, &lapack_setup_flag, &info_in);
+	lapack_setup_flag = lapack_temp_workspace[0];
+	delete [] lapack_temp_workspace;
+	lapack_temp_workspace = new double[lapack_setup_flag];
+	dgeqrf_(&mat->fm_matrix_rows, &n, block, &mat->fm_matrix_rows, lapack_tau, lapack_temp_workspace, &lapack_setup_flag, &info_in);
+	if (info_in != 0) {
+		printf("QR factorization of an FM matrix frame block failed (info %d).\n", info_in);
+		exit(EXIT_FAILURE);
+	}
 	
-    int info_in;
+	memset(factor, 0, (size_t)n * n * sizeof(double));
+	for (int j = 0; j < n; j++) {
+		int n_rows = (j + 1 < mat->fm_matrix_rows) ? j + 1 : mat->fm_matrix_rows;
+		memcpy(&factor[(size_t)j * n], &block[(size_t)j * mat->fm_matrix_rows], n_rows * sizeof(double));
+	}
+	delete [] lapack_tau;
+	delete [] lapack_temp_workspace;
+}
 
-    // Initialize the operation if this is the first block.
-    if (mat->trajectory_block_index == 0) {
-        mat->lapack_temp_workspace = new double[1];
-        mat->lapack_setup_flag = -1;
-        dgeqrf_(&mat->fm_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-        mat->lapack_setup_flag = mat->lapack_temp_workspace[0];
-        delete [] mat->lapack_temp_workspace;
-        mat->lapack_temp_workspace = new double[mat->lapack_setup_flag];
-        dgeqrf_(&mat->fm_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-        mat->accumulation_row_shift = mat->accumulation_matrix_columns;
-    } else {
-        dgeqrf_(&mat->accumulation_matrix_rows, &mat->accumulation_matrix_columns, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->lapack_tau, mat->lapack_temp_workspace, &mat->lapack_setup_flag, &info_in);
-    }
+// Replace the upper triangular n by n matrix target (leading dimension
+// target_stride) with the R factor of target stacked on the upper triangular
+// n by n matrix source, using the triangular structure of both. Source is
+// overwritten and the lower triangle of target is not referenced.
+
+void merge_triangular_factors(int n, double* const target, int target_stride, double* const source)
+{
+	int info_in;
+	int nb = (n < 32) ? n : 32;
+	double* t = new double[(size_t)nb * n];
+	double* work = new double[(size_t)nb * n];
+	dtpqrt_(&n, &n, &n, &nb, target, &target_stride, source, &n, t, &nb, work, &info_in);
+	if (info_in != 0) {
+		printf("Merging the R factors of FM matrix frame blocks failed (info %d).\n", info_in);
+		exit(EXIT_FAILURE);
+	}
+	delete [] t;
+	delete [] work;
 }
 
 // The sparse matrix is solved after every block, and the number of times each basis function coefficient is nonzero
@@ -1670,8 +1926,9 @@ void convert_sparse_fm_equation_to_dense_normal_form_and_bootstrap(MATRIX_DATA*
    // Either way frame weight is applied to normal matrix.
    if (nnzmax * 2 > mat->fm_matrix_columns * mat->fm_matrix_columns) {
       // Process intermediate using dense matrix
-	  // Allocate space for dense normal_form_matrix
-      double* normal_matrix = new double[mat->fm_matrix_columns * mat->fm_matrix_columns]();
+	  // Clear the dense normal_form_matrix kept for every frame
+      double* normal_matrix = mat->bootstrapping_frame_normal_matrix->values;
+      std::fill(normal_matrix, normal_matrix + num_elements, 0.0);
 	
 	  #if _mkl_flag == 1
 	  // Form dense normal form matrix using 
@@ -1687,16 +1944,7 @@ void convert_sparse_fm_equation_to_dense_normal_form_and_bootstrap(MATRIX_DATA*
 	  
 	  // Accumulate normal form matrix with previous/future normal form matrices.
 	  // This operation also applies the frame weight.
-	  for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
-		frame_weight = mat->bootstrapping_weights[i][mat->trajectory_block_index];
-		if(frame_weight == 0.0) continue;
-		frame_weight *= mat->bootstrapping_normalization[i];
-
-	  	cblas_daxpy(num_elements, frame_weight, normal_matrix, onei, mat->bootstrapping_dense_fm_normal_matrices[i]->values, onei);
-	  }
-	    
-	  // Free the temp normal matrix
-	  delete [] normal_matrix;
+	  add_frame_to_bootstrapping_batch(mat, normal_matrix);
 	  
    } else {
 	  // Process intermediate using sparse matrix
@@ -1724,20 +1972,8 @@ void convert_sparse_fm_equation_to_dense_normal_form_and_bootstrap(MATRIX_DATA*
 		}
 	  } 
       
-	  // Accumulate normal form matrix with previous/future normal form matrices
-	  // It would be nice to have a function that does mixed addition with sparse and dense matrices,
-	  // but for now it is being done manually.
-	  for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
-		frame_weight = mat->bootstrapping_weights[i][mat->trajectory_block_index];
-		if(frame_weight == 0.0) continue;
-		frame_weight *= mat->bootstrapping_normalization[i];
-
-	    for( k = 0; k < mat->fm_matrix_columns; k++) { // k is actually rows of normal matrix is this context
-			for( l = csr_normal_matrix.row_sizes[k] - 1; l < csr_normal_matrix.row_sizes[k+1] - 1; l++) {
-				mat->bootstrapping_dense_fm_normal_matrices[i]->values[ k * mat->fm_matrix_columns + csr_normal_matrix.column_indices[l] ] += csr_normal_matrix.values[l] * frame_weight;
-			}
-	  	}
-	  } 
+	  // Accumulate normal form matrix with previous/future normal form matrices.
+	  add_sparse_frame_to_bootstrapping_batch(mat, &csr_normal_matrix);
       // CSR formatted FM and normal temp matrices are freed by destructor at end of function
   	 }
 }
@@ -2400,6 +2636,88 @@ inline void calculate_dense_svd(MATRIX_DATA* mat, int fm_matrix_columns, int fm_
 	delete [] iwork;
 }  
 
+// Replace a symmetric matrix (upper triangle referenced) by its eigenvectors,
+// stored column by column, and return its eigenvalues in ascending order.
+
+inline void calculate_dense_eigendecomposition(int fm_matrix_columns, dense_matrix* const dense_fm_normal_matrix, double* const eigenvalues)
+{
+	char jobz = 'V';
+	char uplo = 'U';
+	int lapack_setup_flag = -1;
+	int liwork = -1;
+	int iwork_size, info_in;
+	double* lapack_temp_workspace = new double[1];
+
+	// As for the SVD, the workspace size is queried before the decomposition is performed.
+	dsyevd_(&jobz, &uplo, &fm_matrix_columns, dense_fm_normal_matrix->values, &fm_matrix_columns, eigenvalues, lapack_temp_workspace, &lapack_setup_flag, &iwork_size, &liwork, &info_in);
+	lapack_setup_flag = lapack_temp_workspace[0];
+	liwork = iwork_size;
+	delete [] lapack_temp_workspace;
+	lapack_temp_workspace = new double[lapack_setup_flag];
+	int* iwork = new int[liwork];
+	dsyevd_(&jobz, &uplo, &fm_matrix_columns, dense_fm_normal_matrix->values, &fm_matrix_columns, eigenvalues, lapack_temp_workspace, &lapack_setup_flag, iwork, &liwork, &info_in);
+	if (info_in != 0) {
+		printf("Eigendecomposition of the FM normal matrix failed (info %d).\n", info_in);
+		exit(EXIT_FAILURE);
+	}
+
+	// Clean up the heap-allocated temps.
+	delete [] lapack_temp_workspace;
+	delete [] iwork;
+}
+
+// Using the eigendecomposition of a symmetric matrix B from
+// calculate_dense_eigendecomposition, solve (B + shift I) y = rhs and find the
+// diagonal of (B + shift I)^-1 with O(n^2) work. As in the SVD solver, components
+// with shifted eigenvalues below rcond times the largest are discarded. The full
+// inverse is only formed if a matrix is given for it. Returns the trace of
+// (B + shift I)^-1 B.
+
+inline double calculate_shifted_eigendecomposition_inverse(MATRIX_DATA* const mat, int fm_matrix_columns, dense_matrix* const eigenvectors, const double* const eigenvalues, const double shift, const double* const rhs, double* const solution, double* const inverse_diagonal, dense_matrix* const inverse)
+{
+	int onei = 1;
+	double rcond = (mat->rcond > 0.0) ? mat->rcond : DBL_EPSILON;
+	double* inverse_eigenvalues = new double[fm_matrix_columns];
+	double* coefficients = new double[fm_matrix_columns];
+	
+	double max_eigenvalue = 0.0;
+	for (int k = 0; k < fm_matrix_columns; k++) max_eigenvalue = fmax(max_eigenvalue, fabs(eigenvalues[k] + shift));
+	double trace_product = 0.0;
+	for (int k = 0; k < fm_matrix_columns; k++) {
+		double shifted_eigenvalue = eigenvalues[k] + shift;
+		if (fabs(shifted_eigenvalue) > rcond * max_eigenvalue) inverse_eigenvalues[k] = 1.0 / shifted_eigenvalue;
+		else inverse_eigenvalues[k] = 0.0;
+		trace_product += eigenvalues[k] * inverse_eigenvalues[k];
+	}
+	
+	// y = V (Lambda + shift I)^-1 V^T rhs
+	cblas_dgemv(CblasColMajor, CblasTrans, fm_matrix_columns, fm_matrix_columns, 1.0, eigenvectors->values, fm_matrix_columns, rhs, onei, 0.0, coefficients, onei);
+	for (int k = 0; k < fm_matrix_columns; k++) coefficients[k] *= inverse_eigenvalues[k];
+	cblas_dgemv(CblasColMajor, CblasNoTrans, fm_matrix_columns, fm_matrix_columns, 1.0, eigenvectors->values, fm_matrix_columns, coefficients, onei, 0.0, solution, onei);
+	
+	for (int i = 0; i < fm_matrix_columns; i++) inverse_diagonal[i] = 0.0;
+	for (int k = 0; k < fm_matrix_columns; k++) {
+		const double* eigenvector = eigenvectors->values + (size_t)k * fm_matrix_columns;
+		for (int i = 0; i < fm_matrix_columns; i++) inverse_diagonal[i] += eigenvector[i] * eigenvector[i] * inverse_eigenvalues[k];
+	}
+	
+	if (inverse != NULL) {
+		dense_matrix* scaled_eigenvectors = new dense_matrix(fm_matrix_columns, fm_matrix_columns);
+		for (int k = 0; k < fm_matrix_columns; k++) {
+			for (int i = 0; i < fm_matrix_columns; i++) {
+				scaled_eigenvectors->values[(size_t)k * fm_matrix_columns + i] = eigenvectors->values[(size_t)k * fm_matrix_columns + i] * inverse_eigenvalues[k];
+			}
+		}
+		cblas_dgemm(CblasColMajor, CblasNoTrans, CblasTrans, fm_matrix_columns, fm_matrix_columns, fm_matrix_columns, 1.0,
+				scaled_eigenvectors->values, fm_matrix_columns, eigenvectors->values, fm_matrix_columns, 0.0, inverse->values, fm_matrix_columns);
+		delete scaled_eigenvectors;
+	}
+	
+	delete [] inverse_eigenvalues;
+	delete [] coefficients;
+	return trace_product;
+}
+
 //--------------------------------------------------------------------
 // End-of-trajectory routines
 //--------------------------------------------------------------------
@@ -2412,14 +2730,13 @@ void average_sparse_block_fm_solutions(MATRIX_DATA* const mat)
 {
     // Write a binary output of the coefficient vector if desired
     if (mat->output_style >= 2) {
-        FILE* mat_out;
         double inv_norm = 1.0/mat->normalization;
-        mat_out = open_file("result.out", "wb");
-        fwrite(&mat->fm_solution[0], sizeof(double), mat->fm_matrix_columns, mat_out);
-        fwrite(&mat->fm_solution_normalization_factors[0], sizeof(double), mat->fm_matrix_columns, mat_out);
-        fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-        fclose(mat_out);
+        ResultFileWriter mat_out("result.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, 0);
+        mat_out.write_section(kResultSolution, -1, &mat->fm_solution[0], mat->fm_matrix_columns);
+        mat_out.write_section(kResultNormalizationFactors, -1, &mat->fm_solution_normalization_factors[0], mat->fm_matrix_columns);
+        mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+        mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+        mat_out.close();
         // If no other output was desired, terminate the program successfully.
         if (mat->output_style == 3) exit(EXIT_SUCCESS);
     }
@@ -2437,16 +2754,15 @@ void average_sparse_bootstrapping_solutions(MATRIX_DATA* const mat)
 {
     // Write a binary output of the coefficient vector if desired
     if (mat->output_style >= 2) {
-        FILE* mat_out;
-        mat_out = open_file("result.out", "wb");
+        ResultFileWriter mat_out("result.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, mat->bootstrapping_num_estimates);
         for (int i = 0; i < mat->bootstrapping_num_estimates; i++) {
-	        fwrite(&mat->bootstrap_solutions[i][0], sizeof(double), mat->fm_matrix_columns, mat_out);
-    	    fwrite(&mat->fm_solution_normalization_factors[0], sizeof(double), mat->fm_matrix_columns, mat_out);
+	        mat_out.write_section(kResultSolution, i, &mat->bootstrap_solutions[i][0], mat->fm_matrix_columns);
+    	    mat_out.write_section(kResultNormalizationFactors, i, &mat->fm_solution_normalization_factors[0], mat->fm_matrix_columns);
         }
         double inv_norm = 1.0/mat->normalization;
-        fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-        fclose(mat_out);
+        mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+        mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+        mat_out.close();
         // If no other output was desired, terminate the program successfully.
         if (mat->output_style == 3) exit(EXIT_SUCCESS);
     }
@@ -2491,35 +2807,38 @@ void solve_sparse_fm_normal_equations(MATRIX_DATA* const mat)
 		FILE* csr_out = open_file("result_csr.out", "w");
 		mat->sparse_matrix->write_file(csr_out);
 		for (int i = 0; i < mat->fm_matrix_columns; i++) {
-			fprintf(csr_out, "%lf ", mat->dense_fm_normal_rhs_vector[i]);
+			fprintf(csr_out, "%.17g ", mat->dense_fm_normal_rhs_vector[i]);
 		}
 		fprintf(csr_out, "\n");
-        fprintf(csr_out, "%lf\n", mat->force_sq_total);
-        fprintf(csr_out, "%lf\n", 1.0/mat->normalization);
+        fprintf(csr_out, "%.17g\n", mat->force_sq_total);
+        fprintf(csr_out, "%.17g\n", 1.0/mat->normalization);
 		fclose(csr_out);
 	
-		FILE* mat_out = open_file("result.out", "wb");
+		ResultFileWriter mat_out("result.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, 0);
+		mat_out.begin_section(kResultNormalMatrix, -1, (uint64_t)mat->fm_matrix_columns * (mat->fm_matrix_columns + 1) / 2);
+		double* packed_column = new double[mat->fm_matrix_columns];
 		int counter = 0;
-		int low, high;
-		double zero = 0.0;
+		int low;
 		for (int i = 0; i < mat->fm_matrix_columns; i++) {
 			low = mat->sparse_matrix->row_sizes[i] - 1;
-			high = mat->sparse_matrix->row_sizes[i + 1] - 1;
 			counter = low;
 			for (int j = 0; j <= i; j++){
 			  if( (j + 1) == mat->sparse_matrix->column_indices[counter]) {
-			 	  fwrite(&mat->sparse_matrix->values[counter], sizeof(double), 1, mat_out);
+			 	  packed_column[j] = mat->sparse_matrix->values[counter];
 				  counter++;
 			   } else {
-				  fwrite(&zero, sizeof(double), 1, mat_out);
+				  packed_column[j] = 0.0;
 			   }
 			}
+			mat_out.write_values(packed_column, i + 1);
 		}
+		mat_out.end_section();
+		delete [] packed_column;
 		double inv_norm = 1.0/mat->normalization;
-		fwrite(&mat->dense_fm_normal_rhs_vector[0], sizeof(double), mat->fm_matrix_columns, mat_out);
-		fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-        fclose(mat_out);
+		mat_out.write_section(kResultNormalRHS, -1, &mat->dense_fm_normal_rhs_vector[0], mat->fm_matrix_columns);
+		mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+        mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+        mat_out.close();
 		
 		// If no other output was desired, terminate the program successfully.
 		if (mat->output_style == 3) exit(EXIT_SUCCESS);
@@ -2596,17 +2915,17 @@ void solve_sparse_fm_normal_equations(MATRIX_DATA* const mat)
 			alpha_vec[i] = alpha;
 		}
 				
-		FILE* alpha_fp = fopen("alpha.out", "w");
-		FILE* beta_fp  = fopen("beta.out",  "w");
-		FILE* sol_fp   = fopen("solution.out", "w");
-		FILE* res_fp   = fopen("residual.out", "w");
-		FILE* ext_fp   = fopen("ext_residual.out", "w");
+		FILE* alpha_fp = fopen(get_file_path("alpha.out").c_str(), "w");
+		FILE* beta_fp  = fopen(get_file_path("beta.out").c_str(),  "w");
+		FILE* sol_fp   = fopen(get_file_path("solution.out").c_str(), "w");
+		FILE* res_fp   = fopen(get_file_path("residual.out").c_str(), "w");
+		FILE* ext_fp   = fopen(get_file_path("ext_residual.out").c_str(), "w");
 		write_iteration(alpha_vec, beta, mat->fm_solution, residual, iteration, alpha_fp, beta_fp, sol_fp, res_fp);
 		FILE* mat_fp;
 		FILE* inv_fp;
 		if (mat->bayesian_flag == 2) {
-			mat_fp   = fopen("matrix.out", "w");
-			inv_fp   = fopen("inverse.out", "w");
+			mat_fp   = fopen(get_file_path("matrix.out").c_str(), "w");
+			inv_fp   = fopen(get_file_path("inverse.out").c_str(), "w");
 			backup_normal_matrix->print_matrix(mat_fp);
 		}
 		for (int i = 0; i < mat->fm_matrix_columns; i++) {
@@ -2801,7 +3120,7 @@ void solve_sparse_fm_bootstrapping_equations(MATRIX_DATA* const mat)
 
 void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
 {
-	int i,j,k;
+	int i,j;
 
     // At the time of solution, one can be sure that the raw dense matrix
     // is no longer needed.
@@ -2818,21 +3137,8 @@ void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
     if (mat->iterative_calculation_flag == 1) {
         // Read in a stored normal form matrix and normal form target vector for
         // iterative calculations
-		double ttx;
-        FILE* mat_in = open_file("result.in", "rb");
         double* in_rhs = new double[mat->fm_matrix_columns];
-        
-        for (j = 0; j < mat->fm_matrix_columns; j++) {
-            for (k = 0; k <= j; k++) {
-                fread(&ttx, sizeof(double), 1, mat_in);
-                mat->dense_fm_normal_matrix->assign_scalar(k, j, ttx);
-            }
-        }
-        for (j = 0; j < mat->fm_matrix_columns; j++) {
-            fread(&ttx, sizeof(double), 1, mat_in);
-            in_rhs[j] = ttx;
-        }
-        fclose(mat_in);
+        read_iterative_reference_equations(mat, in_rhs);
         
         // The target for an iterative calculation is the difference between the targets
         // for this trajectory and the previous trajectory.
@@ -2843,15 +3149,13 @@ void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
     } else {
         // Save the results in binary form for parallel runs.
         if (mat->output_style >= 2) {
-            FILE* mat_out = open_file("result.out", "wb");
-            for (i = 0; i < mat->fm_matrix_columns; i++) {
-                fwrite(&mat->dense_fm_normal_matrix->values[i * mat->fm_matrix_columns], sizeof(double), i + 1, mat_out);
-            }
+            ResultFileWriter mat_out("result.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, 0);
+            write_packed_upper_triangle(&mat_out, kResultNormalMatrix, -1, mat->dense_fm_normal_matrix->values, mat->fm_matrix_columns, mat->fm_matrix_columns);
        		double inv_norm = 1.0/mat->normalization;
-            fwrite(&mat->dense_fm_normal_rhs_vector[0], sizeof(double), mat->fm_matrix_columns, mat_out);
-        	fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        	fwrite(&inv_norm, sizeof(double), 1, mat_out);
-            fclose(mat_out);
+            mat_out.write_section(kResultNormalRHS, -1, &mat->dense_fm_normal_rhs_vector[0], mat->fm_matrix_columns);
+        	mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+        	mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+            mat_out.close();
             // If no other output was desired, terminate the program successfully.
             if (mat->output_style == 3) exit(EXIT_SUCCESS);
         }
@@ -2871,6 +3175,11 @@ void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
 			backup_normal_matrix->assign_scalar(z, i, mat->dense_fm_normal_matrix->get_scalar(z, i));
 		}
 	}
+	
+	// Solve for each parameter of a scalar Tikhonov regularization scan.
+	if (mat->regularization_scan_flag == 1) {
+		calculate_regularization_scan(mat, backup_normal_matrix, mat->dense_fm_normal_rhs_vector, backup_rhs);
+	}
     
     // Apply vector regularization if requested.
     if (mat->regularization_style == 2) {
@@ -2923,155 +3232,9 @@ void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
 	    printf ("residual %lf\n", residual);
     }
     
-    // Calculate First Bayesian Estimates
+    // Calculate Bayesian estimates of the regularization and the interactions.
     if (mat->bayesian_flag == 1 || mat->bayesian_flag == 2) {
-    	int iteration = 0;
-	    int onei = 1;
-    	dense_matrix* it_dense_normal_matrix = new dense_matrix(mat->fm_matrix_columns, mat->fm_matrix_columns);
-		dense_matrix* product_reg_normal_matrix_inv_normal_matrix = new dense_matrix(mat->fm_matrix_columns, mat->fm_matrix_columns);
-		double trace_product;
-    	double* alpha_vec = new double[mat->fm_matrix_columns];
-	    double* solution  = new double[mat->fm_matrix_columns];
-		
-    	for (i = 0; i < mat->fm_matrix_columns; i++) {
-			solution[i] = mat->fm_solution[i];
-	    }
-	    
-    	double residual = calculate_dense_residual(mat, backup_normal_matrix, backup_rhs, mat->fm_solution, mat->normalization);
-	    
-	    double n_cg_sites = (double)( mat->rows_less_constraint_rows/ mat->frames_per_traj_block / DIMENSION);
-		double n_frames = 1.0 / mat->normalization;
-		
-	    double alpha = (double)(mat->fm_matrix_columns) / cblas_ddot(mat->fm_matrix_columns, solution, onei, solution, onei);
-		double beta  = (double)(DIMENSION) * n_cg_sites * n_frames / residual;
-		
-		for (i = 0; i < mat->fm_matrix_columns; i++) {
-			alpha_vec[i] = alpha;
-		}
-				
-		FILE* alpha_fp = fopen("alpha.out", "w");
-		FILE* beta_fp  = fopen("beta.out",  "w");
-		FILE* sol_fp   = fopen("solution.out", "w");
-		FILE* res_fp   = fopen("residual.out", "w");
-		FILE* ext_fp   = fopen("ext_residual.out", "w");
-		write_iteration(alpha_vec, beta, mat->fm_solution, residual, iteration, alpha_fp, beta_fp, sol_fp, res_fp);
-		FILE* mat_fp;
-		FILE* inv_fp;
-		if (mat->bayesian_flag == 2) {
-			mat_fp   = fopen("matrix.out", "w");
-			inv_fp   = fopen("inverse.out", "w");
-		}
-			
-		while (iteration < mat->bayesian_max_iter) {
-		
-			// Initialize RHS vector and normal matrix from backups.
-			for(i = 0; i < mat->fm_matrix_columns; i++) {
-				mat->dense_fm_normal_rhs_vector[i] = backup_rhs[i];
-				for (j = 0; j < mat->fm_matrix_columns; j++) {
-					it_dense_normal_matrix->assign_scalar(i, j, backup_normal_matrix->get_scalar(i, j));
-				}
-			}
-			
-			// Solve matrix with regularization
-			// // First, apply regularization alpha/beta
-			for(i = 0; i < mat->fm_matrix_columns; i++) {
-				it_dense_normal_matrix->add_scalar(i, i, alpha_vec[i] * mat->normalization/ beta);
-			}
-			
-			// // Then, apply preconditioning
-			calculate_and_apply_dense_preconditioning(mat, it_dense_normal_matrix, h);
-
-			// // Now, compute the SVD.
-			for (i = 0; i < mat->fm_matrix_columns; i++) {
-				singular_values[i] = 0.0;
-			}
-			calculate_dense_svd(mat, mat->fm_matrix_columns, it_dense_normal_matrix, mat->dense_fm_normal_rhs_vector, singular_values);
-			
-			for (i = 0; i < mat->fm_matrix_columns; i++) {
-        		solution[i] = mat->dense_fm_normal_rhs_vector[i] * h[i];
-        		mat->fm_solution[i] = solution[i];
-    		}
-			
-			residual = calculate_dense_residual(mat, backup_normal_matrix, backup_rhs, mat->fm_solution, 1.0);
-			double* alpha_solution = new double[mat->fm_matrix_columns];
-			for (k = 0; k < mat->fm_matrix_columns; k++) {
-				alpha_solution[k] = alpha_vec[k] * solution[k];
-			}
-			double alpha_product = cblas_ddot(mat->fm_matrix_columns, solution, onei, alpha_solution, onei);
-			double extended_residual = beta * 0.5 * residual + 0.5 * alpha_product;
-			fprintf(ext_fp, "Iteration %d: %lf\n", iteration, -extended_residual);
-			printf("negative of extended residual %lf = (%lf / 2) * %lf + 1/2 * %lf\n", extended_residual, beta, residual, alpha_product);
-			delete [] alpha_solution;
-		
-			// Calculate the values for the next round.
-			iteration++;
-			residual = calculate_dense_residual(mat, backup_normal_matrix, backup_rhs, mat->fm_solution, mat->normalization);
-		
-			// Alpha needs matrix inverse and beta needs the product of the inverse with an unregularized normal matrix
-			it_dense_normal_matrix->reset_matrix();
-			product_reg_normal_matrix_inv_normal_matrix->reset_matrix();
-		
-			// Actually calculate the inverse of the regularized normal matrix
-			// // First, restore the normal matrix with regularization
-			for (i = 0; i < mat->fm_matrix_columns; i++) {
-				for (j = 0; j < mat->fm_matrix_columns; j++) {
-					it_dense_normal_matrix->assign_scalar(i, j, backup_normal_matrix->get_scalar(i, j));
-				}
-				it_dense_normal_matrix->add_scalar(i, i, alpha_vec[i] * mat->normalization / beta);
-			}
-	
-			// // Then, invert the matrix.
-			// // This routine overwrites the input matrix (it_dense_normal_matrix).
-			int* ipiv = new int[mat->fm_matrix_columns]();
-			double* work = new double[mat->fm_matrix_columns * mat->fm_matrix_columns];
-			int lwork = mat->fm_matrix_columns * mat->fm_matrix_columns;
-			int info = 0;			
-			dgetrf_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, it_dense_normal_matrix->values, &mat->fm_matrix_columns, ipiv, &info);
-			dgetri_(&mat->fm_matrix_columns, it_dense_normal_matrix->values, &mat->fm_matrix_columns, ipiv, work, &lwork, &info);
-			delete [] ipiv;
-			delete [] work;
-			if (mat->bayesian_flag == 2) {
-				it_dense_normal_matrix->print_matrix(inv_fp);
-			}
-					
-			// Calculate product using inverse of regularized matrix
-			// Note: it_dense_normal_matrix is now actually the inverse of that matrix.
-			double oned = 1.0;
-			cblas_dgemm(CblasColMajor, CblasNoTrans, CblasNoTrans, mat->fm_matrix_columns, mat->fm_matrix_columns, mat->fm_matrix_columns, oned,
-					it_dense_normal_matrix->values, mat->fm_matrix_columns, backup_normal_matrix->values, mat->fm_matrix_columns, oned,
-					product_reg_normal_matrix_inv_normal_matrix->values, mat->fm_matrix_columns);
-		
-			trace_product = 0.0;
-			for (i = 0; i < mat->fm_matrix_columns; i++) {
-				trace_product += product_reg_normal_matrix_inv_normal_matrix->get_scalar(i,i);
-			}
-			
-			// Alpha Vector
-			for (i = 0; i < mat->fm_matrix_columns; i++) {
-				// Note: it_dense_normal_matrix is now actually the inverse of that matrix.
-				alpha_vec[i] = 1.0 / (solution[i] * solution[i] + it_dense_normal_matrix->get_scalar(i,i) * mat->normalization / beta);
-			}
-			
-			// Beta Scalar
-			beta =  ((double)(DIMENSION) * n_cg_sites * n_frames - trace_product) / residual;				
-
-			write_iteration(alpha_vec, beta, mat->fm_solution, residual, iteration, alpha_fp, beta_fp, sol_fp, res_fp);
-		}
-		
-		// Clean-up bayesian allocated memory
-		fclose(alpha_fp);
-		fclose(beta_fp);
-		fclose(sol_fp);
-		fclose(res_fp);
-		fclose(ext_fp);
-		if (mat->bayesian_flag == 2) {
-			fclose(mat_fp);
-			fclose(inv_fp);
-		}
-		delete [] alpha_vec;
-		delete [] solution;
-		delete it_dense_normal_matrix;
-		delete product_reg_normal_matrix_inv_normal_matrix;
+    	solve_dense_bayesian_equations(mat, backup_normal_matrix, backup_rhs);
     }
     
     // For iterative calculations, the solution is a difference, so the computed quantity
@@ -3108,8 +3271,8 @@ void solve_dense_fm_normal_equations(MATRIX_DATA* const mat)
 void solve_this_BI_equation(MATRIX_DATA* const mat, int &solution_counter)
 {
   // Output BI matrix and vector before solving.
-  FILE* BI_matrix = fopen("BI_matrix.dat","a");
-  FILE* BI_vector = fopen("BI_vector.dat","a");
+  FILE* BI_matrix = fopen(get_file_path("BI_matrix.dat").c_str(),"a");
+  FILE* BI_vector = fopen(get_file_path("BI_vector.dat").c_str(),"a");
   mat->dense_fm_matrix->print_matrix(BI_matrix);
   for(int i = 0; i < mat->fm_matrix_rows;i++)  {
       fprintf(BI_vector,"%lf\n",mat->dense_fm_rhs_vector[i]);
@@ -3130,18 +3293,327 @@ void solve_this_BI_equation(MATRIX_DATA* const mat, int &solution_counter)
   delete mat->dense_fm_matrix;
 }
 
-void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
+// Solve the dense normal equations for every scalar Tikhonov parameter listed in
+// regularization_scan.in, one per line. Scalar regularization solves
+// (A H + lambda^2 I) y = b with x = H y, where H is the diagonal column
+// preconditioner. Writing S = H^1/2 A H^1/2, this is (S + lambda^2 I) z = H^1/2 b
+// with x = H^1/2 z, so a single eigendecomposition of S gives the solution for
+// every lambda with only matrix-vector products. The residual and norm of each
+// solution are written to regularization_scan.out (for an L-curve) and the
+// solutions to regularization_scan_solutions.out.
+
+void calculate_regularization_scan(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, const double* const rhs, double* const residual_rhs)
+{
+	int n = mat->fm_matrix_columns;
+	int onei = 1;
+	
+	std::vector<double> lambdas;
+	std::ifstream scan_in;
+	check_and_open_in_stream(scan_in, "regularization_scan.in");
+	double lambda;
+	while (scan_in >> lambda) lambdas.push_back(lambda);
+	scan_in.close();
+	printf("Scanning %d Tikhonov regularization parameters.\n", (int)lambdas.size()); fflush(stdout);
+	
+	// Form S from the (vector-regularized) normal matrix and decompose it.
+	dense_matrix* eigenvectors = new dense_matrix(n, n);
+	memcpy(eigenvectors->values, normal_matrix->values, (size_t)n * n * sizeof(double));
+	if (mat->regularization_style == 2) {
+		for (int i = 0; i < n; i++) eigenvectors->add_scalar(i, i, mat->regularization_vector[i]);
+	}
+	double* h = new double[n];
+	calculate_and_apply_dense_preconditioning(mat, eigenvectors, h);
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) eigenvectors->values[(size_t)j * n + i] *= sqrt(h[i] / h[j]);
+	}
+	double* eigenvalues = new double[n];
+	calculate_dense_eigendecomposition(n, eigenvectors, eigenvalues);
+	
+	// Project the scaled target vector onto the eigenvectors.
+	double* scaled_rhs = new double[n];
+	double* projected_rhs = new double[n];
+	for (int i = 0; i < n; i++) scaled_rhs[i] = sqrt(h[i]) * rhs[i];
+	cblas_dgemv(CblasColMajor, CblasTrans, n, n, 1.0, eigenvectors->values, n, scaled_rhs, onei, 0.0, projected_rhs, onei);
+	
+	FILE* scan_fp = open_file("regularization_scan.out", "w");
+	FILE* solution_fp = open_file("regularization_scan_solutions.out", "w");
+	fprintf(scan_fp, "# lambda residual solution_norm\n");
+	double* coefficients = new double[n];
+	double* solution = new double[n];
+	double* intermediate = new double[n];
+	double rcond = (mat->rcond > 0.0) ? mat->rcond : DBL_EPSILON;
+	for (unsigned l = 0; l < lambdas.size(); l++) {
+		double shift = lambdas[l] * lambdas[l];
+		
+		// As in the SVD solver, components with eigenvalues below rcond times the
+		// largest are discarded.
+		double max_eigenvalue = 0.0;
+		for (int i = 0; i < n; i++) max_eigenvalue = fmax(max_eigenvalue, fabs(eigenvalues[i] + shift));
+		for (int i = 0; i < n; i++) {
+			double shifted_eigenvalue = eigenvalues[i] + shift;
+			if (fabs(shifted_eigenvalue) > rcond * max_eigenvalue) coefficients[i] = projected_rhs[i] / shifted_eigenvalue;
+			else coefficients[i] = 0.0;
+		}
+		cblas_dgemv(CblasColMajor, CblasNoTrans, n, n, 1.0, eigenvectors->values, n, coefficients, onei, 0.0, solution, onei);
+		for (int i = 0; i < n; i++) solution[i] *= sqrt(h[i]);
+		
+		// Residual of the unregularized equations, as in calculate_dense_residual.
+		cblas_dgemv(CblasColMajor, CblasNoTrans, n, n, 1.0, normal_matrix->values, n, solution, onei, 0.0, intermediate, onei);
+		double residual = (cblas_ddot(n, intermediate, onei, solution, onei) - 2.0 * cblas_ddot(n, solution, onei, residual_rhs, onei)) / mat->normalization + mat->force_sq_total;
+		double solution_norm = sqrt(cblas_ddot(n, solution, onei, solution, onei));
+		
+		fprintf(scan_fp, "%le %le %le\n", lambdas[l], residual, solution_norm);
+		fprintf(solution_fp, "%le", lambdas[l]);
+		for (int i = 0; i < n; i++) fprintf(solution_fp, " %.15le", solution[i]);
+		fprintf(solution_fp, "\n");
+	}
+	fclose(scan_fp);
+	fclose(solution_fp);
+	
+	delete eigenvectors;
+	delete [] eigenvalues;
+	delete [] h;
+	delete [] scaled_rhs;
+	delete [] projected_rhs;
+	delete [] coefficients;
+	delete [] solution;
+	delete [] intermediate;
+}
+
+// Iterate the Bayesian MS-CG estimates of the interactions, the prior
+// precisions (alpha), and the force noise precision (beta). Each iteration
+// solves (A + (normalization / beta) diag(alpha)) x = b for the unregularized
+// normal matrix A; the next alpha uses the diagonal of the inverse of that
+// matrix and the next beta uses the trace of its inverse times A. Neither
+// needs the inverse itself. For bayesian_alpha_style 1, a single alpha only
+// shifts the eigenvalues of A, so A is decomposed once and every iteration is
+// O(n^2). Otherwise each iteration needs one Cholesky factorization.
+
+void solve_dense_bayesian_equations(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, double* const rhs)
+{
+	int n = mat->fm_matrix_columns;
+	int iteration = 0;
+	int onei = 1;
+	double* alpha_vec = new double[n];
+	double* solution  = new double[n];
+	double* inverse_diagonal = new double[n];
+	double* regularization = new double[n];
+	
+	for (int i = 0; i < n; i++) {
+		solution[i] = mat->fm_solution[i];
+	}
+	
+	double residual = calculate_dense_residual(mat, normal_matrix, rhs, mat->fm_solution, mat->normalization);
+	
+	double n_cg_sites = (double)( mat->rows_less_constraint_rows/ mat->frames_per_traj_block / DIMENSION);
+	double n_frames = 1.0 / mat->normalization;
+	
+	double alpha = (double)(n) / cblas_ddot(n, solution, onei, solution, onei);
+	double beta  = (double)(DIMENSION) * n_cg_sites * n_frames / residual;
+	
+	for (int i = 0; i < n; i++) {
+		alpha_vec[i] = alpha;
+	}
+	
+	FILE* alpha_fp = fopen(get_file_path("alpha.out").c_str(), "w");
+	FILE* beta_fp  = fopen(get_file_path("beta.out").c_str(),  "w");
+	FILE* sol_fp   = fopen(get_file_path("solution.out").c_str(), "w");
+	FILE* res_fp   = fopen(get_file_path("residual.out").c_str(), "w");
+	FILE* ext_fp   = fopen(get_file_path("ext_residual.out").c_str(), "w");
+	write_iteration(alpha_vec, beta, mat->fm_solution, residual, iteration, alpha_fp, beta_fp, sol_fp, res_fp);
+	FILE* mat_fp;
+	FILE* inv_fp;
+	dense_matrix* inverse = NULL;
+	if (mat->bayesian_flag == 2) {
+		mat_fp   = fopen(get_file_path("matrix.out").c_str(), "w");
+		inv_fp   = fopen(get_file_path("inverse.out").c_str(), "w");
+		inverse  = new dense_matrix(n, n);
+	}
+	
+	// With a single alpha, decompose the unregularized normal matrix once.
+	dense_matrix* factor = new dense_matrix(n, n);
+	double* eigenvalues = NULL;
+	if (mat->bayesian_alpha_style == 1) {
+		printf("Computing eigendecomposition of FM normal matrix for Bayesian iterations.\n"); fflush(stdout);
+		memcpy(factor->values, normal_matrix->values, (size_t)n * n * sizeof(double));
+		eigenvalues = new double[n];
+		calculate_dense_eigendecomposition(n, factor, eigenvalues);
+	}
+	
+	while (iteration < mat->bayesian_max_iter) {
+	
+		// Solve the equations regularized with alpha/beta.
+		double trace_product;
+		for (int i = 0; i < n; i++) {
+			regularization[i] = alpha_vec[i] * mat->normalization / beta;
+		}
+		if (mat->bayesian_alpha_style == 1) {
+			trace_product = calculate_shifted_eigendecomposition_inverse(mat, n, factor, eigenvalues, regularization[0], rhs, solution, inverse_diagonal, inverse);
+		} else {
+			trace_product = calculate_bayesian_cholesky_estimate(mat, normal_matrix, rhs, regularization, factor, solution, inverse_diagonal, inverse);
+		}
+		for (int i = 0; i < n; i++) {
+			mat->fm_solution[i] = solution[i];
+		}
+		if (mat->bayesian_flag == 2) {
+			inverse->print_matrix(inv_fp);
+		}
+		
+		residual = calculate_dense_residual(mat, normal_matrix, rhs, mat->fm_solution, 1.0);
+		double* alpha_solution = new double[n];
+		for (int k = 0; k < n; k++) {
+			alpha_solution[k] = alpha_vec[k] * solution[k];
+		}
+		double alpha_product = cblas_ddot(n, solution, onei, alpha_solution, onei);
+		double extended_residual = beta * 0.5 * residual + 0.5 * alpha_product;
+		fprintf(ext_fp, "Iteration %d: %lf\n", iteration, -extended_residual);
+		printf("negative of extended residual %lf = (%lf / 2) * %lf + 1/2 * %lf\n", extended_residual, beta, residual, alpha_product);
+		delete [] alpha_solution;
+	
+		// Calculate the values for the next round.
+		iteration++;
+		residual = calculate_dense_residual(mat, normal_matrix, rhs, mat->fm_solution, mat->normalization);
+		
+		// Alpha Vector
+		if (mat->bayesian_alpha_style == 1) {
+			double inverse_trace = 0.0;
+			for (int i = 0; i < n; i++) inverse_trace += inverse_diagonal[i];
+			alpha = (double)(n) / (cblas_ddot(n, solution, onei, solution, onei) + inverse_trace * mat->normalization / beta);
+			for (int i = 0; i < n; i++) {
+				alpha_vec[i] = alpha;
+			}
+		} else {
+			for (int i = 0; i < n; i++) {
+				alpha_vec[i] = 1.0 / (solution[i] * solution[i] + inverse_diagonal[i] * mat->normalization / beta);
+			}
+		}
+		
+		// Beta Scalar
+		beta = ((double)(DIMENSION) * n_cg_sites * n_frames - trace_product) / residual;
+		
+		write_iteration(alpha_vec, beta, mat->fm_solution, residual, iteration, alpha_fp, beta_fp, sol_fp, res_fp);
+	}
+	
+	// Clean-up bayesian allocated memory
+	fclose(alpha_fp);
+	fclose(beta_fp);
+	fclose(sol_fp);
+	fclose(res_fp);
+	fclose(ext_fp);
+	if (mat->bayesian_flag == 2) {
+		fclose(mat_fp);
+		fclose(inv_fp);
+		delete inverse;
+	}
+	if (eigenvalues != NULL) delete [] eigenvalues;
+	delete factor;
+	delete [] alpha_vec;
+	delete [] solution;
+	delete [] inverse_diagonal;
+	delete [] regularization;
+}
+
+// Solve (A + diag(regularization)) x = rhs and find the diagonal of the inverse
+// of that matrix using a Cholesky factorization U^T U of the matrix scaled to a
+// unit diagonal. The diagonal of (U^T U)^-1 = U^-1 U^-T is the squared row norms
+// of U^-1, so the full inverse is only formed if a matrix is given for it.
+// U^-1 itself is still formed (dtrtri, about n^3/3 flops, the cost of the
+// factorization): the per-coefficient alpha update needs every diagonal element
+// exactly, which a stochastic trace estimator built on triangular solves would
+// only approximate, making the iterations depend on the random probes.
+// Returns the trace of (A + diag(regularization))^-1 A, which equals
+// n - sum_i regularization_i [(A + diag(regularization))^-1]_ii.
+
+double calculate_bayesian_cholesky_estimate(MATRIX_DATA* const mat, dense_matrix* const normal_matrix, const double* const rhs, const double* const regularization, dense_matrix* const factor, double* const solution, double* const inverse_diagonal, dense_matrix* const inverse)
+{
+	int n = mat->fm_matrix_columns;
+	int onei = 1;
+	int info_in;
+	char uplo = 'U';
+	char diag = 'N';
+	double* scaling = new double[n];
+	
+	for (int i = 0; i < n; i++) {
+		double diagonal = normal_matrix->get_scalar(i, i) + regularization[i];
+		scaling[i] = (diagonal > VERYSMALL) ? 1.0 / sqrt(diagonal) : 1.0;
+		solution[i] = rhs[i] * scaling[i];
+	}
+	form_scaled_bayesian_normal_matrix(n, normal_matrix, regularization, scaling, factor);
+	
+	dpotrf_(&uplo, &n, factor->values, &n, &info_in);
+	if (info_in == 0) {
+		dpotrs_(&uplo, &n, &onei, factor->values, &n, solution, &n, &info_in);
+		if (inverse != NULL) {
+			dpotri_(&uplo, &n, factor->values, &n, &info_in);
+			for (int j = 0; j < n; j++) {
+				for (int i = 0; i <= j; i++) {
+					inverse->values[(size_t)j * n + i] = factor->values[(size_t)j * n + i];
+					inverse->values[(size_t)i * n + j] = factor->values[(size_t)j * n + i];
+				}
+				inverse_diagonal[j] = factor->values[(size_t)j * n + j];
+			}
+		} else {
+			dtrtri_(&uplo, &diag, &n, factor->values, &n, &info_in);
+			for (int i = 0; i < n; i++) inverse_diagonal[i] = 0.0;
+			for (int j = 0; j < n; j++) {
+				for (int i = 0; i <= j; i++) inverse_diagonal[i] += factor->values[(size_t)j * n + i] * factor->values[(size_t)j * n + i];
+			}
+		}
+	} else {
+		// A nearly singular A with very weak regularization may not factor;
+		// fall back on the (pseudo)inverse from an eigendecomposition.
+		printf("Regularized FM normal matrix is not numerically positive definite; using its eigendecomposition.\n"); fflush(stdout);
+		double* scaled_rhs = new double[n];
+		double* eigenvalues = new double[n];
+		for (int i = 0; i < n; i++) scaled_rhs[i] = rhs[i] * scaling[i];
+		form_scaled_bayesian_normal_matrix(n, normal_matrix, regularization, scaling, factor);
+		calculate_dense_eigendecomposition(n, factor, eigenvalues);
+		calculate_shifted_eigendecomposition_inverse(mat, n, factor, eigenvalues, 0.0, scaled_rhs, solution, inverse_diagonal, inverse);
+		delete [] scaled_rhs;
+		delete [] eigenvalues;
+	}
+	
+	// Undo the scaling.
+	double trace_product = (double)(n);
+	for (int i = 0; i < n; i++) {
+		solution[i] *= scaling[i];
+		inverse_diagonal[i] *= scaling[i] * scaling[i];
+		trace_product -= regularization[i] * inverse_diagonal[i];
+	}
+	if (inverse != NULL) {
+		for (int j = 0; j < n; j++) {
+			for (int i = 0; i < n; i++) inverse->values[(size_t)j * n + i] *= scaling[i] * scaling[j];
+		}
+	}
+	delete [] scaling;
+	return trace_product;
+}
+
+// Copy D (A + diag(regularization)) D into scaled_matrix for the diagonal scaling D.
+
+void form_scaled_bayesian_normal_matrix(const int n, dense_matrix* const normal_matrix, const double* const regularization, const double* const scaling, dense_matrix* const scaled_matrix)
+{
+	for (int j = 0; j < n; j++) {
+		for (int i = 0; i < n; i++) {
+			scaled_matrix->values[(size_t)j * n + i] = normal_matrix->values[(size_t)j * n + i] * scaling[i] * scaling[j];
+		}
+		scaled_matrix->values[(size_t)j * n + j] += regularization[j] * scaling[j] * scaling[j];
+	}
+}
+
+void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
 {
     double* dd_bak;
-    double ttx;
     double* dd1;
     
     // Solve for master
     solve_dense_fm_normal_equations(mat);
     
+    // Add any frames still waiting in the last batch to the estimates.
+    reduce_bootstrapping_batch(mat);
+    
     //Solve for bootstrapping_estimates.
     double* backup_rhs = new double[mat->fm_matrix_columns];
-    double* h = new double[mat->fm_matrix_columns];
     
     // Store a temporary backup of the normal form target vector if it
     // should be output later, since it could be changed in this routine 
@@ -3162,20 +3634,8 @@ void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
         // Read in a stored normal form matrix and normal form target vector for
         // iterative calculations
         
-        FILE* mat_in = open_file("result.in", "rb");
         dd1 = new double[mat->fm_matrix_columns];
-        
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            for (int k = 0; k <= j; k++) {
-                fread(&ttx, sizeof(double), 1, mat_in);
-                mat->dense_fm_normal_matrix->assign_scalar(k, j, ttx);
-            }
-        }
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            fread(&ttx, sizeof(double), 1, mat_in);
-            dd1[j] = ttx;
-        }
-        fclose(mat_in);
+        read_iterative_reference_equations(mat, dd1);
         
         // The target for an iterative calculation is the difference between the targets
         // for this trajectory and the previous trajectory.
@@ -3187,92 +3647,55 @@ void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
     
         // Save the results in binary form for parallel runs.
         if (mat->output_style >= 2) {
-            FILE* mat_out = open_file("result.out", "wb");
+            ResultFileWriter mat_out("result.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, mat->bootstrapping_num_estimates);
             for (int j = 0; j < mat->bootstrapping_num_estimates; j++) {
-            	for (int i = 0; i < mat->fm_matrix_columns; i++) {
-                	fwrite(&mat->bootstrapping_dense_fm_normal_matrices[j]->values[i * mat->fm_matrix_columns], sizeof(double), i + 1, mat_out);
-            	}
-            	fwrite(&mat->bootstrapping_dense_fm_normal_rhs_vectors[j][0], sizeof(double), mat->fm_matrix_columns, mat_out);
+            	mat_out.write_section(kResultNormalMatrix, j, &mat->bootstrapping_packed_normal_matrices[j * mat->bootstrapping_packed_size], mat->bootstrapping_packed_size);
+            	mat_out.write_section(kResultNormalRHS, j, &mat->bootstrapping_dense_fm_normal_rhs_vectors[j][0], mat->fm_matrix_columns);
             }
             double inv_norm = 1.0/mat->normalization;
-            fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-	        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-            fclose(mat_out);
+            mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+	        mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+            mat_out.close();
             // If no other output was desired, terminate the program successfully.
             if (mat->output_style == 3) exit(EXIT_SUCCESS);
         }
     }
 	
-    for (int k = 0; k < mat->bootstrapping_num_estimates; k++) {
-    
-		// Copy over symmetric off-diagonal values in normal matrix;
-	    for (int i = 0; i < mat->fm_matrix_columns; i++) {
-	        for (int j = 0; j < i; j++) {
-    	        mat->bootstrapping_dense_fm_normal_matrices[k]->assign_scalar(i, j, mat->bootstrapping_dense_fm_normal_matrices[k]->get_scalar(j , i));
-        	}
-    	}
-
-    	// Apply vector regularization.
-    	if (mat->regularization_style == 2) {
-	    	printf("Regularizing FM normal equations (estimate %d).\n", k);
-    		fflush(stdout);
-        	for (int i = 0; i < mat->fm_matrix_columns; i++) {
-    	       	mat->bootstrapping_dense_fm_normal_matrices[k]->add_scalar(i, i, mat->regularization_vector[i]);
-        	}
-        }
-
-	    // Precondition the normal matrix using the root-of-sum-of-squares 
-    	// of the columns as column scaling factors.
-    	printf("Preconditioning FM normal equations (estimate %d).\n", k);
-    	fflush(stdout);
-		calculate_and_apply_dense_preconditioning(mat, mat->bootstrapping_dense_fm_normal_matrices[k], h);
-	    
-    	// Apply Tikhonov regularization.
-    	if (mat->regularization_style == 1) {
-	    	printf("Regularizing FM normal equations (estimate %d).\n", k);
-    		fflush(stdout);
-        	double squared_regularization_parameter;
-        	squared_regularization_parameter = mat->tikhonov_regularization_param * mat->tikhonov_regularization_param;
-        	for (int i = 0; i < mat->fm_matrix_columns; i++) {
-    	       	mat->bootstrapping_dense_fm_normal_matrices[k]->add_scalar(i, i, squared_regularization_parameter);
-        	}
-        }
+    // The estimates are independent, so they are solved concurrently,
+    // each worker thread taking every n_workers-th estimate. Each solve holds
+    // its own normal matrix and an SVD workspace (generously, another matrix),
+    // and runs LAPACK on a single thread when several solves run at once.
+    printf("Solving FM normal equations for %d bootstrapping estimates.\n", mat->bootstrapping_num_estimates);
+    fflush(stdout);
+    double* singular_values = new double[(size_t)mat->fm_matrix_columns * mat->bootstrapping_num_estimates];
+    int n_threads = get_num_memory_bounded_threads(mat, 2 * (size_t)mat->fm_matrix_columns * mat->fm_matrix_columns * sizeof(double));
+    int n_workers = (n_threads < mat->bootstrapping_num_estimates) ? n_threads : mat->bootstrapping_num_estimates;
+    std::vector<std::thread> workers;
+    for (int w = 0; w < n_workers; w++) {
+    	workers.push_back(std::thread([mat, w, n_workers, backup_rhs, singular_values]() {
+    		#if _mkl_flag == 1
+    		if (n_workers > 1) mkl_set_num_threads_local(1);
+    		#endif
+    		for (int k = w; k < mat->bootstrapping_num_estimates; k += n_workers) {
+    			solve_dense_bootstrapping_estimate(mat, k, backup_rhs, &singular_values[(size_t)k * mat->fm_matrix_columns]);
+    		}
+    	}));
+    }
+    for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
     
-    	// Solve the normal equation by singular value decomposition using LAPACK routines.
-    	printf("Computing singular value decomposition of preconditioned, regularized FM normal equations (estimate %d).\n", k);
-    	fflush(stdout);
-    	double* singular_values = new double[mat->fm_matrix_columns];
-    	calculate_dense_svd(mat, mat->fm_matrix_columns, mat->bootstrapping_dense_fm_normal_matrices[k], mat->bootstrapping_dense_fm_normal_rhs_vectors[k], singular_values);
-    	
-    	// Print singular values.
-    	printf("Printing FM singular values (estimate %d).\n", k);
-    	fflush(stdout);
-    	FILE* solution_file = open_file("sol_info.out", "a");
+    // Print singular values.
+    printf("Printing FM singular values of bootstrapping estimates.\n");
+    fflush(stdout);
+    FILE* solution_file = open_file("sol_info.out", "a");
+    for (int k = 0; k < mat->bootstrapping_num_estimates; k++) {
     	fprintf(solution_file, "Singular vector %d:\n", k);
     	for (int i = 0; i < mat->fm_matrix_columns; i++) {
-    	    fprintf(solution_file, "%le\n", singular_values[i]);
-    	}
-    	fclose(solution_file);
-   	
-   	   	// Clean up the heap-allocated temps.
-    	 delete [] singular_values;
-
-	    // Calculate the final results from the singular values.
-	    printf("Calculating final FM results (estimate %d).\n", k);
-    	fflush(stdout);    
-    	for (int i = 0; i < mat->fm_matrix_columns; i++) {
-    	    mat->bootstrap_solutions[k][i] = mat->bootstrapping_dense_fm_normal_rhs_vectors[k][i] * h[i];
-    	}
-    	
-    	// Calculate and output the residual if requested.
-    	if (mat->output_residual == 1) {
-	    	double residual = calculate_dense_residual(mat, mat->bootstrapping_dense_fm_normal_matrices[k], backup_rhs, mat->bootstrap_solutions[k], mat->normalization);
-	    	printf ("Estimate %d: residual %lf\n", k, residual);
+    	    fprintf(solution_file, "%le\n", singular_values[(size_t)k * mat->fm_matrix_columns + i]);
     	}
-	}
+    }
+    fclose(solution_file);
+    delete [] singular_values;
 	
-    // Free the preconditioner
-    delete [] h;
     delete [] backup_rhs;
     
     // For iterative calculations, the solution is a difference, so the computed quantity
@@ -3299,11 +3722,65 @@ void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
     // Clean up the heap-allocated matrix temps required for 
     // optional more-detailed output.
     for (int k = 0; k < mat->bootstrapping_num_estimates; k++) {
-	    delete mat->bootstrapping_dense_fm_normal_matrices[k];
     	delete [] mat->bootstrapping_dense_fm_normal_rhs_vectors[k];
 	}
 	delete [] mat->bootstrapping_dense_fm_normal_rhs_vectors;
-    delete [] mat->bootstrapping_dense_fm_normal_matrices;
+    delete [] mat->bootstrapping_packed_normal_matrices;
+    delete [] mat->bootstrapping_frame_batch;
+    delete [] mat->bootstrapping_batch_weights;
+    delete mat->bootstrapping_frame_normal_matrix;
+}
+
+// Solve the normal equations of a single bootstrapping estimate, storing its
+// singular values in singular_values. Estimates may be solved concurrently.
+
+void solve_dense_bootstrapping_estimate(MATRIX_DATA* const mat, const int k, double* const backup_rhs, double* const singular_values)
+{
+	// Expand this estimate's normal matrix and copy over symmetric off-diagonal values;
+	dense_matrix* normal_matrix = new dense_matrix(mat->fm_matrix_columns, mat->fm_matrix_columns);
+	unpack_bootstrapping_normal_matrix(mat, k, normal_matrix);
+	for (int i = 0; i < mat->fm_matrix_columns; i++) {
+		for (int j = 0; j < i; j++) {
+			normal_matrix->assign_scalar(i, j, normal_matrix->get_scalar(j , i));
+		}
+	}
+
+	// Apply vector regularization.
+	if (mat->regularization_style == 2) {
+		for (int i = 0; i < mat->fm_matrix_columns; i++) {
+			normal_matrix->add_scalar(i, i, mat->regularization_vector[i]);
+		}
+	}
+
+	// Precondition the normal matrix using the root-of-sum-of-squares 
+	// of the columns as column scaling factors.
+	double* h = new double[mat->fm_matrix_columns];
+	calculate_and_apply_dense_preconditioning(mat, normal_matrix, h);
+	
+	// Apply Tikhonov regularization.
+	if (mat->regularization_style == 1) {
+		double squared_regularization_parameter;
+		squared_regularization_parameter = mat->tikhonov_regularization_param * mat->tikhonov_regularization_param;
+		for (int i = 0; i < mat->fm_matrix_columns; i++) {
+			normal_matrix->add_scalar(i, i, squared_regularization_parameter);
+		}
+	}
+
+	// Solve the normal equation by singular value decomposition using LAPACK routines.
+	calculate_dense_svd(mat, mat->fm_matrix_columns, normal_matrix, mat->bootstrapping_dense_fm_normal_rhs_vectors[k], singular_values);
+
+	// Calculate the final results from the singular values.
+	for (int i = 0; i < mat->fm_matrix_columns; i++) {
+		mat->bootstrap_solutions[k][i] = mat->bootstrapping_dense_fm_normal_rhs_vectors[k][i] * h[i];
+	}
+	
+	// Calculate and output the residual if requested.
+	if (mat->output_residual == 1) {
+		double residual = calculate_dense_residual(mat, normal_matrix, backup_rhs, mat->bootstrap_solutions[k], mat->normalization);
+		printf ("Estimate %d: residual %lf\n", k, residual);
+	}
+	delete [] h;
+	delete normal_matrix;
 }
 
 // All the individual frame-block matrices have now been accumulated into a single matrix
@@ -3312,7 +3789,11 @@ void solve_dense_fm_normal_bootstrapping_equations(MATRIX_DATA* const mat)
 
 void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat)
 {
-    int i, j;
+    int i;
+    
+    // Compose any frame blocks still waiting in the last batch.
+    reduce_accumulation_batch(mat);
+    
     for (i = 0; i < mat->accumulation_matrix_columns; i++) {
         mat->dense_fm_normal_rhs_vector[i] = mat->dense_fm_matrix->values[mat->fm_matrix_columns * mat->accumulation_matrix_rows + i];
     }
@@ -3320,21 +3801,62 @@ void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat)
     
     // Save the results in binary form and exit if no other output is desired.
     if (mat->output_style >= 2) {
-        FILE* mat_out;
-        mat_out = open_file("final_equations.out", "wb");
-        for (i = 0; i < mat->fm_matrix_columns; i++) {
-            fwrite(&mat->dense_fm_matrix->values[i * mat->accumulation_matrix_rows], sizeof(double), i + 1, mat_out);
+        int n_estimates = (mat->bootstrapping_flag == 1) ? mat->bootstrapping_num_estimates : 0;
+        ResultFileWriter mat_out("final_equations.out", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, mat->n_frames, n_estimates);
+        write_packed_upper_triangle(&mat_out, kResultAccumulationMatrix, -1, mat->dense_fm_matrix->values, mat->fm_matrix_columns, mat->accumulation_matrix_rows);
+        mat_out.write_section(kResultNormalRHS, -1, &mat->dense_fm_normal_rhs_vector[0], mat->accumulation_matrix_columns);
+        for (int k = 0; k < n_estimates; k++) {
+        	double* estimate_values = mat->bootstrapping_dense_fm_normal_matrices[k]->values;
+        	write_packed_upper_triangle(&mat_out, kResultAccumulationMatrix, k, estimate_values, mat->fm_matrix_columns, mat->accumulation_matrix_columns);
+        	mat_out.write_section(kResultNormalRHS, k, &estimate_values[mat->fm_matrix_columns * mat->accumulation_matrix_columns], mat->accumulation_matrix_columns);
         }
-        fwrite(&mat->dense_fm_normal_rhs_vector[0], sizeof(double), mat->accumulation_matrix_columns, mat_out);
         double inv_norm = 1.0/mat->normalization;
-        fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-        fclose(mat_out);
+        mat_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+        mat_out.write_section(kResultInverseNormalization, -1, &inv_norm, 1);
+        mat_out.close();
         
         if (mat->output_style == 3) exit(EXIT_SUCCESS);
     }
     
-    double resid = mat->dense_fm_matrix->values[(mat->accumulation_matrix_columns - 1) * mat->accumulation_matrix_rows + mat->accumulation_matrix_columns - 1];
+    double* singular_values = new double[mat->fm_matrix_columns];
+    mat->fm_solution = std::vector<double>(mat->fm_matrix_columns);
+    double resid = solve_accumulation_triangle(mat, mat->dense_fm_matrix->values, mat->accumulation_matrix_rows, mat->dense_fm_normal_rhs_vector, mat->fm_solution, singular_values);
+    
+    // Print singular values to file.
+    FILE* solution_file;
+    solution_file = open_file("sol_info.out", "a");
+    fprintf(solution_file, "Singular vector:\n");
+    for (i = 0; i < mat->fm_matrix_columns; i++) {
+        fprintf(solution_file, "%le\n", singular_values[i]);
+    }
+    
+    // Print the Euclidean norm of the solution and and print the residual
+    double xnorm = 0.0;
+    for (i = 0; i < mat->fm_matrix_columns; i++) {
+        xnorm += mat->fm_solution[i] * mat->fm_solution[i];
+    }
+    fprintf(solution_file, "Solution 2-norm:\n%le\n", xnorm);
+    fprintf(solution_file, "Residual 2-norm:\n%le\n", resid);
+    
+    // Deallocate the remaining temps.
+    fclose(solution_file);
+    delete [] singular_values;
+    delete [] mat->dense_fm_normal_rhs_vector;
+    delete mat->dense_fm_matrix;
+}
+
+// Solve the least squares problem held in the leading accumulation_matrix_columns
+// rows of an accumulated R factor (with leading dimension stride), whose last
+// column is the transformed target vector. The preconditioned triangle is
+// overwritten and rhs receives the target column. Returns the residual.
+
+double solve_accumulation_triangle(MATRIX_DATA* const mat, double* const values, int stride, double* const rhs, std::vector<double> &solution, double* const singular_values)
+{
+    int i, j;
+    for (i = 0; i < mat->accumulation_matrix_columns; i++) {
+        rhs[i] = values[mat->fm_matrix_columns * stride + i];
+    }
+    double resid = values[(mat->accumulation_matrix_columns - 1) * stride + mat->accumulation_matrix_columns - 1];
     
     // Precondition the accumulation matrix using the root-of-sum-of-squares of the columns
     // as column scaling factors.
@@ -3344,7 +3866,7 @@ void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat)
     
     for (i = 0; i < mat->fm_matrix_columns; i++) {
         for (j = 0; j < mat->fm_matrix_columns; j++) {
-            h[j] += mat->dense_fm_matrix->values[j * mat->accumulation_matrix_rows + i] * mat->dense_fm_matrix->values[j * mat->accumulation_matrix_rows + i];
+            h[j] += values[j * stride + i] * values[j * stride + i];
         }
     }
     
@@ -3355,7 +3877,7 @@ void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat)
     
     for (i = 0; i < mat->fm_matrix_columns; i++) {
         for (j = 0; j < mat->fm_matrix_columns; j++) {
-            mat->dense_fm_matrix->values[j * mat->accumulation_matrix_rows + i] *= h[j];
+            values[j * stride + i] *= h[j];
         }
     }
     
@@ -3364,143 +3886,71 @@ void solve_accumulation_form_fm_equations(MATRIX_DATA* const mat)
     // determine the size of the needed workspace, then that workspace is allocated, then the
     // routine is run again with a sufficient workspace to perform SVD.
 
-    double* singular_values = new double[mat->fm_matrix_columns];
     int onei = 1;
     int irank_in, info_in;
     int lapack_setup_flag = -1;
     double* lapack_temp_workspace = new double[1];
-    dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->dense_fm_normal_rhs_vector, &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
+    dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, values, &stride, rhs, &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
     lapack_setup_flag = lapack_temp_workspace[0];
     delete [] lapack_temp_workspace;
     lapack_temp_workspace = new double[lapack_setup_flag];
-    dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, mat->dense_fm_matrix->values, &mat->accumulation_matrix_rows, mat->dense_fm_normal_rhs_vector, &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
+    dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, values, &stride, rhs, &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
     delete [] lapack_temp_workspace;
     
-    // Print singular values to file.
-    FILE* solution_file;
-    solution_file = open_file("sol_info.out", "a");
-    fprintf(solution_file, "Singular vector:\n");
-    for (i = 0; i < mat->fm_matrix_columns; i++) {
-        fprintf(solution_file, "%le\n", singular_values[i]);
-    }
-    
     // Calculate final results from the singular value decomposition.
-    mat->fm_solution = std::vector<double>(mat->fm_matrix_columns);
-    for (i = 0; i < mat->fm_matrix_columns; i++) {
-        mat->fm_solution[i] = mat->dense_fm_normal_rhs_vector[i] * h[i];
-    }
-    
-    // Print the Euclidean norm of the solution and and print the residual
-    double xnorm = 0.0;
     for (i = 0; i < mat->fm_matrix_columns; i++) {
-        xnorm += mat->fm_solution[i] * mat->fm_solution[i];
+        solution[i] = rhs[i] * h[i];
     }
-    fprintf(solution_file, "Solution 2-norm:\n%le\n", xnorm);
-    fprintf(solution_file, "Residual 2-norm:\n%le\n", resid);
-    
-    // Deallocate the remaining temps.
-    fclose(solution_file);
-    delete [] singular_values;
     delete [] h;
-    delete [] mat->dense_fm_normal_rhs_vector;
-    delete mat->dense_fm_matrix;
+    return resid;
 }
 
 void solve_accumulation_form_bootstrapping_equations(MATRIX_DATA* const mat)
 {
-    int i, j, k;
-
- 	for (k = 0; k < mat->bootstrapping_num_estimates; k++) {
-	    for (i = 0; i < mat->accumulation_matrix_columns; i++) {
-    	    mat->bootstrapping_dense_fm_normal_rhs_vectors[k][i] = mat->bootstrapping_dense_fm_normal_matrices[k]->values[mat->fm_matrix_columns * mat->accumulation_matrix_rows + i];
-    	}
-    	set_accumulation_matrix_to_zero(mat, mat->bootstrapping_dense_fm_normal_matrices[k]);
-	}
-	    
-   	if (mat->output_style >= 2) {
-       	FILE* mat_out = open_file("final_equations.out", "wb");
-	
-		for (k = 0; k < mat->bootstrapping_num_estimates; k++) {
-			// Save the results in binary form and exit if no other output is desired.
-    	   	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	   	fwrite(&mat->bootstrapping_dense_fm_normal_matrices[k]->values[i * mat->accumulation_matrix_rows], sizeof(double), i + 1, mat_out);
-       	 	}
-        	fwrite(&mat->bootstrapping_dense_fm_normal_rhs_vectors[k][0], sizeof(double), mat->accumulation_matrix_columns, mat_out);        
-    	}    
-     	double inv_norm = 1.0/mat->normalization;
-        fwrite(&mat->force_sq_total, sizeof(double), 1, mat_out);
-        fwrite(&inv_norm, sizeof(double), 1, mat_out);
-    	fclose(mat_out);
-	    if (mat->output_style == 3) exit(EXIT_SUCCESS);
-	}
-    	
-   	for (k = 0; k < mat->bootstrapping_num_estimates; k++) {
-
-    	double resid = mat->bootstrapping_dense_fm_normal_matrices[k]->values[(mat->accumulation_matrix_columns - 1) * mat->accumulation_matrix_rows + mat->accumulation_matrix_columns - 1];
+    int i, k;
     
-    	// Precondition the accumulation matrix using the root-of-sum-of-squares of the columns
-    	// as column scaling factors.
-    	double* h = new double[mat->fm_matrix_columns]();
+    // Solve for master; this also composes the last batch of frame blocks into the estimates
+    // and saves them in final_equations.out.
+    solve_accumulation_form_fm_equations(mat);
     
-    	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	for (j = 0; j < mat->fm_matrix_columns; j++) {
-            	h[j] += mat->bootstrapping_dense_fm_normal_matrices[k]->values[j * mat->accumulation_matrix_rows + i] * mat->bootstrapping_dense_fm_normal_matrices[k]->values[j * mat->accumulation_matrix_rows + i];
-        	}
-    	}
-    
-    	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	if (h[i] < VERYSMALL) h[i] = 1.0;
-        	else h[i] = 1.0 / sqrt(h[i]);
-    	}
-    
-    	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	for (j = 0; j < mat->fm_matrix_columns; j++) {
-            	mat->bootstrapping_dense_fm_normal_matrices[k]->values[j * mat->accumulation_matrix_rows + i] *= h[j];
-        	}
-    	}
+    // The estimates are independent, so they are solved concurrently,
+    // each worker thread taking every n_workers-th estimate.
+    printf("Solving accumulated FM equations for %d bootstrapping estimates.\n", mat->bootstrapping_num_estimates);
+    fflush(stdout);
+    double* singular_values = new double[(size_t)mat->fm_matrix_columns * mat->bootstrapping_num_estimates];
+    double* resids = new double[mat->bootstrapping_num_estimates];
+    int n_threads = get_num_worker_threads(mat);
+    int n_workers = (n_threads < mat->bootstrapping_num_estimates) ? n_threads : mat->bootstrapping_num_estimates;
+    std::vector<std::thread> workers;
+    for (int w = 0; w < n_workers; w++) {
+    	workers.push_back(std::thread([mat, w, n_workers, singular_values, resids]() {
+    		for (int k = w; k < mat->bootstrapping_num_estimates; k += n_workers) {
+    			resids[k] = solve_accumulation_triangle(mat, mat->bootstrapping_dense_fm_normal_matrices[k]->values, mat->accumulation_matrix_columns, mat->bootstrapping_dense_fm_normal_rhs_vectors[k], mat->bootstrap_solutions[k], &singular_values[(size_t)k * mat->fm_matrix_columns]);
+    		}
+    	}));
+    }
+    for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
     
-    	// Solve the normal equation by singular value decomposition using LAPACK routines.
-    	// The SVD routine works in two modes: first, the routine is run with a dummy workspace to
-	    // determine the size of the needed workspace, then that workspace is allocated, then the
-    	// routine is run again with a sufficient workspace to perform SVD.
-
-    	double* singular_values = new double[mat->fm_matrix_columns];
-    	int onei = 1;
-    	int irank_in, info_in;
-    	int lapack_setup_flag = -1;
-    	double* lapack_temp_workspace = new double[1];
-    	dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, mat->bootstrapping_dense_fm_normal_matrices[k]->values, &mat->accumulation_matrix_rows, mat->bootstrapping_dense_fm_normal_rhs_vectors[k], &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
-    	lapack_setup_flag = lapack_temp_workspace[0];
-    	delete [] lapack_temp_workspace;
-    	lapack_temp_workspace = new double[lapack_setup_flag];
-    	dgelss_(&mat->fm_matrix_columns, &mat->fm_matrix_columns, &onei, mat->bootstrapping_dense_fm_normal_matrices[k]->values, &mat->accumulation_matrix_rows, mat->bootstrapping_dense_fm_normal_rhs_vectors[k], &mat->fm_matrix_columns, singular_values, &mat->rcond, &irank_in, lapack_temp_workspace, &lapack_setup_flag, &info_in);
-    	delete [] lapack_temp_workspace;
-    
-    	// Print singular values to file.
-    	FILE* solution_file;
-    	solution_file = open_file("sol_info.out", "a");
-    	fprintf(solution_file, "Singular vector:\n");
-    	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	fprintf(solution_file, "%le\n", singular_values[i]);
-    	}
-
-    	// Calculate final results from the singular value decomposition.
+    // Print singular values, solution norms, and residuals to file.
+    FILE* solution_file = open_file("sol_info.out", "a");
+    for (k = 0; k < mat->bootstrapping_num_estimates; k++) {
+    	fprintf(solution_file, "Singular vector %d:\n", k);
     	for (i = 0; i < mat->fm_matrix_columns; i++) {
-    	    mat->bootstrap_solutions[k][i] = mat->bootstrapping_dense_fm_normal_rhs_vectors[k][i] * h[i];
+        	fprintf(solution_file, "%le\n", singular_values[(size_t)k * mat->fm_matrix_columns + i]);
     	}
-    
-    	// Print the Euclidean norm of the solution and and print the residual
     	double xnorm = 0.0;
     	for (i = 0; i < mat->fm_matrix_columns; i++) {
-        	xnorm += mat->fm_solution[i] * mat->fm_solution[i];
+        	xnorm += mat->bootstrap_solutions[k][i] * mat->bootstrap_solutions[k][i];
     	}
     	fprintf(solution_file, "Solution 2-norm:\n%le\n", xnorm);    
-    	fprintf(solution_file, "Residual 2-norm:\n%le\n", resid);
+    	fprintf(solution_file, "Residual 2-norm:\n%le\n", resids[k]);
+    }
+    fclose(solution_file);
     
-    	// Deallocate the remaining temps.
-    	fclose(solution_file);
-    	delete [] singular_values;
-    	delete [] h;
+    // Deallocate the remaining temps.
+    delete [] singular_values;
+    delete [] resids;
+    for (k = 0; k < mat->bootstrapping_num_estimates; k++) {
     	delete [] mat->bootstrapping_dense_fm_normal_rhs_vectors[k];
     	delete mat->bootstrapping_dense_fm_normal_matrices[k];
 	}
@@ -3550,128 +4000,311 @@ int read_res_av_file(std::string* &filenames)
 	return n_batch;
 }
 
+// Determine how many worker threads to use for shared-memory routines.
+// A non-positive num_threads in control.in means use every available core.
+
+int get_num_worker_threads(MATRIX_DATA* const mat)
+{
+	if (mat->num_threads > 0) return mat->num_threads;
+	int n_cores = (int)std::thread::hardware_concurrency();
+	return (n_cores > 0) ? n_cores : 1;
+}
+
+// Determine how many worker threads to use when each holds bytes_per_thread
+// of its own temporaries: as many as get_num_worker_threads allows, but no more
+// than fit in half of the physical memory that is free, and at least one.
+
+int get_num_memory_bounded_threads(MATRIX_DATA* const mat, const size_t bytes_per_thread)
+{
+	int n_threads = get_num_worker_threads(mat);
+	size_t free_bytes = 0;
+#if defined(_SC_AVPHYS_PAGES) && defined(_SC_PAGESIZE)
+	long n_pages = sysconf(_SC_AVPHYS_PAGES);
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (n_pages > 0 && page_size > 0) free_bytes = (size_t)n_pages * (size_t)page_size;
+#endif
+	// Leave the thread count alone if the free memory is unknown.
+	if (free_bytes == 0 || bytes_per_thread == 0) return n_threads;
+	size_t max_threads = (free_bytes / 2) / bytes_per_thread;
+	if (max_threads < 1) max_threads = 1;
+	if ((size_t)n_threads > max_threads) {
+		printf("Using %d instead of %d threads to fit their temporaries in memory.\n", (int)max_threads, n_threads);
+		fflush(stdout);
+		n_threads = (int)max_threads;
+	}
+	return n_threads;
+}
+
+// Legacy result files that end with the normal form vector are given an
+// inverse normalization of 1, so they are weighted equally with each other.
+
+void warn_legacy_result_file_normalization(const char* filename)
+{
+	printf("Warning: %s does not record force_sq_total or its normalization; it is weighted equally with other such files.\n", filename);
+	fflush(stdout);
+}
+
+// Add the normal form equations stored in one dense result file to a
+// partial sum laid out as: the packed upper triangle of the normal matrix,
+// the normal form vector, force_sq_total, the inverse normalization, and the
+// number of frames. The matrix and vector are "un-normalized" by the file's
+// weighted number of frames as they are added.
+
+void accumulate_dense_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum)
+{
+	size_t n_cols = mat->fm_matrix_columns;
+	size_t n_triangle = n_cols * (n_cols + 1) / 2;
+	const double* triangle;
+	const double* rhs;
+	double force_sq_total, inv_norm, n_frames;
+	
+	ResultFileReader result_in(filename);
+	if (result_in.legacy_format == 1) {
+		// Headerless files hold the same values back to back; the number of frames is not recorded.
+		// The oldest ones also lack force_sq_total and the inverse normalization.
+		if (result_in.file_size / sizeof(double) == n_triangle + n_cols) {
+			warn_legacy_result_file_normalization(filename);
+			triangle = result_in.get_legacy_values(n_triangle + n_cols);
+			rhs = triangle + n_triangle;
+			force_sq_total = 0.0;
+			inv_norm = 1.0;
+		} else {
+			triangle = result_in.get_legacy_values(n_triangle + n_cols + 2);
+			rhs = triangle + n_triangle;
+			force_sq_total = rhs[n_cols];
+			inv_norm = rhs[n_cols + 1];
+		}
+		n_frames = 0.0;
+	} else {
+		result_in.check_compatibility(mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash);
+		triangle = result_in.get_section(kResultNormalMatrix, -1, n_triangle);
+		rhs = result_in.get_section(kResultNormalRHS, -1, n_cols);
+		force_sq_total = *result_in.get_section(kResultForceSqTotal, -1, 1);
+		inv_norm = *result_in.get_section(kResultInverseNormalization, -1, 1);
+		n_frames = (double)result_in.header.n_frames;
+	}
+	
+	for (size_t j = 0; j < n_triangle; j++) partial_sum[j] += inv_norm * triangle[j];
+	for (size_t j = 0; j < n_cols; j++) partial_sum[n_triangle + j] += inv_norm * rhs[j];
+	partial_sum[n_triangle + n_cols] += force_sq_total;
+	partial_sum[n_triangle + n_cols + 1] += inv_norm;
+	partial_sum[n_triangle + n_cols + 2] += n_frames;
+}
+
+// Add the blockwise solution sum and normalization factors stored in one
+// sparse result file to a partial sum holding the same two vectors followed
+// by the number of frames.
+
+void accumulate_sparse_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum)
+{
+	size_t n_cols = mat->fm_matrix_columns;
+	const double* solution;
+	const double* normalization_factors;
+	double n_frames;
+	
+	ResultFileReader result_in(filename);
+	if (result_in.legacy_format == 1) {
+		solution = result_in.get_legacy_values(2 * n_cols);
+		normalization_factors = solution + n_cols;
+		n_frames = 0.0;
+	} else {
+		result_in.check_compatibility(mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash);
+		solution = result_in.get_section(kResultSolution, -1, n_cols);
+		normalization_factors = result_in.get_section(kResultNormalizationFactors, -1, n_cols);
+		n_frames = (double)result_in.header.n_frames;
+	}
+	
+	for (size_t j = 0; j < n_cols; j++) {
+		partial_sum[j] += solution[j];
+		partial_sum[n_cols + j] += normalization_factors[j];
+	}
+	partial_sum[2 * n_cols] += n_frames;
+}
+
+// Compose the R factor stored in one accumulation result file with a partial
+// sum laid out as: the square R factor (including the transformed target
+// vector as its last column), force_sq_total, the inverse normalization, and
+// the number of frames.
+
+void accumulate_accumulation_result_file(MATRIX_DATA* const mat, const char* filename, double* const partial_sum)
+{
+	int n = mat->accumulation_matrix_columns;
+	size_t n_triangle = (size_t)mat->fm_matrix_columns * (mat->fm_matrix_columns + 1) / 2;
+	const double* triangle;
+	const double* rhs;
+	double force_sq_total, inv_norm, n_frames;
+	
+	ResultFileReader result_in(filename);
+	if (result_in.legacy_format == 1) {
+		// Headerless files hold the same values back to back; the number of frames is not recorded.
+		// The oldest ones also lack force_sq_total and the inverse normalization.
+		if (result_in.file_size / sizeof(double) == n_triangle + n) {
+			warn_legacy_result_file_normalization(filename);
+			triangle = result_in.get_legacy_values(n_triangle + n);
+			rhs = triangle + n_triangle;
+			force_sq_total = 0.0;
+			inv_norm = 1.0;
+		} else {
+			triangle = result_in.get_legacy_values(n_triangle + n + 2);
+			rhs = triangle + n_triangle;
+			force_sq_total = rhs[n];
+			inv_norm = rhs[n + 1];
+		}
+		n_frames = 0.0;
+	} else {
+		result_in.check_compatibility(mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash);
+		triangle = result_in.get_section(kResultAccumulationMatrix, -1, n_triangle);
+		rhs = result_in.get_section(kResultNormalRHS, -1, n);
+		force_sq_total = *result_in.get_section(kResultForceSqTotal, -1, 1);
+		inv_norm = *result_in.get_section(kResultInverseNormalization, -1, 1);
+		n_frames = (double)result_in.header.n_frames;
+	}
+	
+	double* factor = new double[(size_t)n * n]();
+	read_packed_upper_triangle(triangle, factor, mat->fm_matrix_columns, n);
+	memcpy(&factor[(size_t)mat->fm_matrix_columns * n], rhs, n * sizeof(double));
+	merge_triangular_factors(n, partial_sum, n, factor);
+	delete [] factor;
+	
+	size_t n_factor = (size_t)n * n;
+	partial_sum[n_factor] += force_sq_total;
+	partial_sum[n_factor + 1] += inv_norm;
+	partial_sum[n_factor + 2] += n_frames;
+}
+
+// Combine two partial sums of dense or sparse result files.
+
+void add_partial_sums(MATRIX_DATA* const mat, double* const target, double* const source, const size_t record_size)
+{
+	for (size_t j = 0; j < record_size; j++) target[j] += source[j];
+}
+
+// Combine two partial sums of accumulation result files; the source is overwritten.
+
+void merge_accumulation_partial_sums(MATRIX_DATA* const mat, double* const target, double* const source, const size_t record_size)
+{
+	size_t n_factor = (size_t)mat->accumulation_matrix_columns * mat->accumulation_matrix_columns;
+	merge_triangular_factors(mat->accumulation_matrix_columns, target, mat->accumulation_matrix_columns, source);
+	for (size_t j = n_factor; j < record_size; j++) target[j] += source[j];
+}
+
+// Add files first_file to last_file - 1 into partial_sum.
+
+void reduce_result_file_range(MATRIX_DATA* const mat, const std::string* filenames, const int first_file, const int last_file, accumulate_result_file accumulate_file, double* const partial_sum)
+{
+	for (int i = first_file; i < last_file; i++) {
+		(*accumulate_file)(mat, filenames[i].c_str(), partial_sum);
+	}
+}
+
+// Combine the contents of a whole batch of result files into total.
+// Each worker thread reduces a contiguous range of files into its own
+// partial sum, reading each file through a memory mapping; the partial sums
+// are then combined in a pairwise tree with the pairs of each level combined
+// concurrently. Each worker holds one partial sum in memory, so the number of
+// workers is also bounded by the free memory when combining very large matrices.
+
+void reduce_result_file_batch(MATRIX_DATA* const mat, const std::string* filenames, const int n_batch, const size_t record_size, accumulate_result_file accumulate_file, combine_partial_sums combine, double* const total)
+{
+	int n_threads = get_num_memory_bounded_threads(mat, record_size * sizeof(double));
+	int n_workers = (n_threads < n_batch) ? n_threads : n_batch;
+	if (n_workers < 1) return;
+	
+	double** partial_sums = new double*[n_workers];
+	std::vector<std::thread> workers;
+	for (int w = 0; w < n_workers; w++) {
+		partial_sums[w] = new double[record_size]();
+		int first_file = (int)(((long)w * n_batch) / n_workers);
+		int last_file = (int)(((long)(w + 1) * n_batch) / n_workers);
+		workers.push_back(std::thread(reduce_result_file_range, mat, filenames, first_file, last_file, accumulate_file, partial_sums[w]));
+	}
+	for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	
+	for (int stride = 1; stride < n_workers; stride *= 2) {
+		workers.clear();
+		for (int w = 0; w + stride < n_workers; w += 2 * stride) {
+			workers.push_back(std::thread(combine, mat, partial_sums[w], partial_sums[w + stride], record_size));
+		}
+		for (unsigned w = 0; w < workers.size(); w++) workers[w].join();
+	}
+	
+	(*combine)(mat, total, partial_sums[0], record_size);
+	for (int w = 0; w < n_workers; w++) delete [] partial_sums[w];
+	delete [] partial_sums;
+}
+
 // Read the results of a batch of dense-matrix-based FM
 // calculations and add them together as if they were the
 // results of blocks of an earlier trajectory.
 
 void read_binary_dense_fm_matrix(MATRIX_DATA* const mat)
 {
-    double matrix_element;
-    double inv_norm_sum = 0.0;
-    double inv_norm;
-
 	// Read the number of files to combine in this batch
     // and the file names for each.
     std::string* filenames;
     int n_batch = read_res_av_file(filenames);
 
-    // Read each file's dense matrix, adding them together element-by-
-    // element to get a final set of normal form equations.
-    // Each matrix is "un-normalized" by its number of frames before accumulating.
-    FILE* single_binary_matrix_input;
-	dense_matrix* read_matrix = new dense_matrix(mat->fm_matrix_columns, mat->fm_matrix_columns);
-	double* read_rhs = new double[mat->fm_matrix_columns];
-    for (int i = 0; i < n_batch; i++) {
-        // Read the new normal form matrix.
-        // Stored as an upper traingular matrix because it is symmetric.
-        single_binary_matrix_input = open_file(filenames[i].c_str(), "rb");
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            for (int k = 0; k <= j; k++) {
-                fread(&matrix_element, sizeof(double), 1, single_binary_matrix_input);
-                read_matrix->assign_scalar(k, j, matrix_element);
-            }
-        }
-
-        // Read the new normal form vector.
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            fread(&matrix_element, sizeof(double), 1, single_binary_matrix_input);
-            read_rhs[j] = matrix_element;
-        }
-        
-        // Read the force_sq_total value
-        fread(&matrix_element, sizeof(double), 1, single_binary_matrix_input);
-        mat->force_sq_total += matrix_element;
-        
-        // Read the inverse normalization
-        fread(&matrix_element, sizeof(double), 1, single_binary_matrix_input);
-        inv_norm = matrix_element;
-        inv_norm_sum += inv_norm;
-        
-        // Add the new normal form matrix to the existing one.
-        // This process "unnormalizes" each element as it is added.
-        // Stored as an upper traingular matrix because it is symmetric.
-         for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            for (int k = 0; k <= j; k++) {
-            	mat->dense_fm_normal_matrix->add_scalar(k, j, inv_norm * read_matrix->get_scalar(k, j));
-            }
-        }
-        
-        // Add the new normal form vector to the existing one.
-        // This process "unnormalizes" each element as it is added.
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            mat->dense_fm_normal_rhs_vector[j] += inv_norm * read_rhs[j];
-        }
-        fclose(single_binary_matrix_input);
-    }
+    // Sum the (un-normalized) normal form equations of every file.
+    size_t n_cols = mat->fm_matrix_columns;
+    size_t n_triangle = n_cols * (n_cols + 1) / 2;
+    size_t record_size = n_triangle + n_cols + 3;
+    double* batch_total = new double[record_size]();
+    reduce_result_file_batch(mat, filenames, n_batch, record_size, accumulate_dense_result_file, add_partial_sums, batch_total);
     delete [] filenames;
-    delete [] read_rhs;
-    delete read_matrix;
+    
+    mat->force_sq_total += batch_total[n_triangle + n_cols];
+    double inv_norm_sum = batch_total[n_triangle + n_cols + 1];
+    if (batch_total[n_triangle + n_cols + 2] > 0.0) mat->n_frames = (int)batch_total[n_triangle + n_cols + 2];
      
     // Normalize the normal matrix and RHS vector by the total number of frames.
  	set_normalization(mat, 1.0/inv_norm_sum);
+ 	size_t counter = 0;
 	for (int j = 0; j < mat->fm_matrix_columns; j++) {
 		for (int k = 0; k <= j; k++) {
-			mat->dense_fm_normal_matrix->assign_scalar(k, j, mat->normalization * mat->dense_fm_normal_matrix->get_scalar(k, j));
+			mat->dense_fm_normal_matrix->assign_scalar(k, j, mat->normalization * (mat->dense_fm_normal_matrix->get_scalar(k, j) + batch_total[counter]));
+			counter++;
 		}
 	}
 	for (int j = 0; j < mat->fm_matrix_columns; j++) {
-		mat->dense_fm_normal_rhs_vector[j] = mat->normalization * mat->dense_fm_normal_rhs_vector[j];
+		mat->dense_fm_normal_rhs_vector[j] = mat->normalization * (mat->dense_fm_normal_rhs_vector[j] + batch_total[counter]);
+		counter++;
 	}
+	delete [] batch_total;
 	    
     // The lower triangular portions of the symmetric normal form matrix
 	// filled in during during the solve routine.
 }
 
 // Read the results of a batch of accumulation-matrix-based FM
-// calculations and add them together as if they were the
-// results of blocks of an earlier trajectory.
-
-// Works only for trivial batches of one block each; the primary use
-// is to allow for more sophisticated regularization elsewhere in this
-// program.
+// calculations and combine them as if they were the
+// results of blocks of an earlier trajectory. The R factors of the
+// files are composed with each other as in the tall-skinny QR used
+// while building them, so the batch is equivalent to a single run
+// over all of their frames.
 
 void read_binary_accumulation_fm_matrix(MATRIX_DATA* const mat)
 {
-    printf("The use of combinefm with the accumulation matrix type is not supported!\n"); 
-	delete mat->dense_fm_matrix;
-    mat->dense_fm_matrix = new dense_matrix(mat->accumulation_matrix_columns, mat->accumulation_matrix_columns);
-
   	// Read the number of files to combine in this batch
     // and the file names for each.
-	double read_value;
     std::string* filenames;
     int n_batch = read_res_av_file(filenames);
-  	if (n_batch > 1) {
-        printf("Can not read more than one block for the sequential accumulation algorithm!\n");
-        exit(EXIT_FAILURE);
-    }
     
-    FILE* single_binary_matrix_input = open_file(filenames[0].c_str(), "rb");
-    for (int j = 0; j < mat->fm_matrix_columns; j++) {
-        for (int k = 0; k <= j; k++) {
-            fread(&read_value, sizeof(double), 1, single_binary_matrix_input);
-            mat->dense_fm_matrix->assign_scalar(k, j, read_value);
-        }
-    }
-
-    for (int j = 0; j < mat->fm_matrix_columns; j++) mat->dense_fm_matrix->assign_scalar(mat->fm_matrix_columns, j, 0.0);
-
-    for (int j = 0; j < mat->accumulation_matrix_columns; j++) {
-        fread(&read_value, sizeof(double), 1, single_binary_matrix_input);
-        mat->dense_fm_normal_rhs_vector[j] = read_value;
-    }
-    fclose(single_binary_matrix_input);
+    // Compose the R factors of every file.
+    int n = mat->accumulation_matrix_columns;
+    size_t n_factor = (size_t)n * n;
+    size_t record_size = n_factor + 3;
+    double* batch_total = new double[record_size]();
+    reduce_result_file_batch(mat, filenames, n_batch, record_size, accumulate_accumulation_result_file, merge_accumulation_partial_sums, batch_total);
     delete [] filenames;
+    
+    mat->force_sq_total += batch_total[n_factor];
+    if (batch_total[n_factor + 2] > 0.0) mat->n_frames = (int)batch_total[n_factor + 2];
+    set_normalization(mat, 1.0 / batch_total[n_factor + 1]);
+    
+    // Add the batch to the accumulated R factor.
+    merge_triangular_factors(n, mat->dense_fm_matrix->values, mat->accumulation_matrix_rows, batch_total);
+    mat->accumulation_row_shift = n;
+    delete [] batch_total;
 }
 
 // Read the results of a batch of sparse-matrix-based FM
@@ -3681,36 +4314,71 @@ void read_binary_accumulation_fm_matrix(MATRIX_DATA* const mat)
 void read_binary_sparse_fm_matrix(MATRIX_DATA* const mat)
 {
     printf("The use of combinefm with the sparse matrix type is not supported!\n"); 
-	FILE *single_block_solution_file;
-    
-    // Allocate memory for a single block's worth of temp data.
-    double* single_block_normalization_factors = new double[mat->fm_matrix_columns];
     
     // Read the number of files to combine in this batch
     // and the file names for each.
     std::string* filenames;
     int n_batch = read_res_av_file(filenames);
 
-    // For each file in the batch, read the appropriate file
-    // for the solution of that batch (not normalized) and the
-    // normalization factors for that solution.
-    for (int i = 0; i < n_batch; i++) {
-        single_block_solution_file = open_file(filenames[i].c_str(), "rb");
-        fread(mat->block_fm_solution, sizeof(double), mat->fm_matrix_columns, single_block_solution_file);
-        fread(single_block_normalization_factors, sizeof(double), mat->fm_matrix_columns, single_block_solution_file);
-        fclose(single_block_solution_file);
-        
-        // Add that to the accumulating solution in this program
-        for (int j = 0; j < mat->fm_matrix_columns; j++) {
-            mat->fm_solution[j] += mat->block_fm_solution[j];
-            mat->fm_solution_normalization_factors[j] += single_block_normalization_factors[j];
-        }
+    // Each file in the batch starts with the solution of that batch
+    // (not normalized) followed by the normalization factors for that
+    // solution; sum both over the whole batch.
+    double* batch_total = new double[2 * mat->fm_matrix_columns + 1]();
+    reduce_result_file_batch(mat, filenames, n_batch, 2 * mat->fm_matrix_columns + 1, accumulate_sparse_result_file, add_partial_sums, batch_total);
+    if (batch_total[2 * mat->fm_matrix_columns] > 0.0) mat->n_frames = (int)batch_total[2 * mat->fm_matrix_columns];
+    
+    // Add that to the accumulating solution in this program
+    for (int j = 0; j < mat->fm_matrix_columns; j++) {
+        mat->fm_solution[j] += batch_total[j];
+        mat->fm_solution_normalization_factors[j] += batch_total[mat->fm_matrix_columns + j];
     }
     
-    delete [] single_block_normalization_factors;
+    delete [] batch_total;
     delete [] filenames;
 }
 
+// Read the normal form matrix and target vector stored by a previous
+// calculation (its result.out renamed to result.in) for iterative force matching.
+
+void read_iterative_reference_equations(MATRIX_DATA* const mat, double* const in_rhs)
+{
+	size_t n_cols = mat->fm_matrix_columns;
+	size_t n_triangle = n_cols * (n_cols + 1) / 2;
+	const double* triangle;
+	const double* rhs;
+	
+	ResultFileReader result_in("result.in");
+	if (result_in.legacy_format == 1) {
+		triangle = result_in.get_legacy_values(n_triangle + n_cols);
+		rhs = triangle + n_triangle;
+	} else {
+		result_in.check_compatibility(mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash);
+		triangle = result_in.get_section(kResultNormalMatrix, -1, n_triangle);
+		rhs = result_in.get_section(kResultNormalRHS, -1, n_cols);
+	}
+	
+	size_t counter = 0;
+	for (int j = 0; j < mat->fm_matrix_columns; j++) {
+		for (int k = 0; k <= j; k++) {
+			mat->dense_fm_normal_matrix->assign_scalar(k, j, triangle[counter]);
+			counter++;
+		}
+	}
+	for (int j = 0; j < mat->fm_matrix_columns; j++) in_rhs[j] = rhs[j];
+}
+
+// Write the upper triangle of a column-major matrix with leading dimension
+// stride as a packed section, column by column.
+
+void write_packed_upper_triangle(ResultFileWriter* const mat_out, const ResultSectionType section_type, const int estimate, const double* values, const int n_cols, const int stride)
+{
+	mat_out->begin_section(section_type, estimate, (uint64_t)n_cols * (n_cols + 1) / 2);
+	for (int i = 0; i < n_cols; i++) {
+		mat_out->write_values(&values[(size_t)i * stride], i + 1);
+	}
+	mat_out->end_section();
+}
+
 // Read the vector of regularization coefficients.
 
 void read_regularization_vector(MATRIX_DATA* const mat)
@@ -3742,3 +4410,128 @@ void write_iteration(const double* alpha_vec, const double beta, std::vector<dou
 
 	fprintf(res_fp, "Iteration %d: %lf\n", iteration, residual);
 }
+
+//--------------------------------------------------------------------
+// Checkpointing routines
+//--------------------------------------------------------------------
+
+// Copy a packed upper triangle (as written by write_packed_upper_triangle)
+// into a column-major matrix with leading dimension stride.
+
+void read_packed_upper_triangle(const double* packed, double* const values, const int n_cols, const int stride)
+{
+	for (int i = 0; i < n_cols; i++) {
+		memcpy(&values[(size_t)i * stride], packed, (i + 1) * sizeof(double));
+		packed += i + 1;
+	}
+}
+
+// Save everything accumulated over the first n_blocks_completed frame blocks.
+// The file is written under a temporary name and then renamed so that an
+// interruption while writing never leaves a damaged checkpoint behind.
+
+void write_fm_checkpoint(MATRIX_DATA* const mat, const int n_blocks_completed, const int n_trajectory_frames_read)
+{
+	int n_estimates = (mat->bootstrapping_flag == 1) ? mat->bootstrapping_num_estimates : 0;
+	double state[3] = {(double)n_blocks_completed, (double)mat->frames_per_traj_block, (double)n_trajectory_frames_read};
+	
+	ResultFileWriter checkpoint_out("checkpoint.out.tmp", mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash, n_trajectory_frames_read, n_estimates);
+	checkpoint_out.write_section(kResultCheckpointState, -1, state, 3);
+	checkpoint_out.write_section(kResultForceSqTotal, -1, &mat->force_sq_total, 1);
+	
+	switch (mat->matrix_type) {
+	case kDense:
+		write_packed_upper_triangle(&checkpoint_out, kResultNormalMatrix, -1, mat->dense_fm_normal_matrix->values, mat->fm_matrix_columns, mat->fm_matrix_columns);
+		checkpoint_out.write_section(kResultNormalRHS, -1, mat->dense_fm_normal_rhs_vector, mat->fm_matrix_columns);
+		reduce_bootstrapping_batch(mat);
+		for (int i = 0; i < n_estimates; i++) {
+			checkpoint_out.write_section(kResultNormalMatrix, i, &mat->bootstrapping_packed_normal_matrices[i * mat->bootstrapping_packed_size], mat->bootstrapping_packed_size);
+			checkpoint_out.write_section(kResultNormalRHS, i, mat->bootstrapping_dense_fm_normal_rhs_vectors[i], mat->fm_matrix_columns);
+		}
+		break;
+	case kSparse:
+		checkpoint_out.write_section(kResultSolution, -1, &mat->fm_solution[0], mat->fm_matrix_columns);
+		checkpoint_out.write_section(kResultNormalizationFactors, -1, mat->fm_solution_normalization_factors, mat->fm_matrix_columns);
+		for (int i = 0; i < n_estimates; i++) {
+			checkpoint_out.write_section(kResultSolution, i, &mat->bootstrap_solutions[i][0], mat->fm_matrix_columns);
+		}
+		break;
+	case kAccumulation:
+		reduce_accumulation_batch(mat);
+		write_packed_upper_triangle(&checkpoint_out, kResultAccumulationMatrix, -1, mat->dense_fm_matrix->values, mat->accumulation_matrix_columns, mat->accumulation_matrix_rows);
+		for (int i = 0; i < n_estimates; i++) {
+			write_packed_upper_triangle(&checkpoint_out, kResultAccumulationMatrix, i, mat->bootstrapping_dense_fm_normal_matrices[i]->values, mat->accumulation_matrix_columns, mat->accumulation_matrix_columns);
+		}
+		break;
+	default:
+		printf("Checkpointing is not supported for matrix_type %d.\n", mat->matrix_type);
+		exit(EXIT_FAILURE);
+	}
+	checkpoint_out.close();
+	
+	if (rename(get_file_path("checkpoint.out.tmp").c_str(), get_file_path("checkpoint.out").c_str()) != 0) {
+		printf("Failed to replace checkpoint.out with the new checkpoint.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Restore the accumulated equations from checkpoint.out and return the
+// number of frame blocks they cover; the number of trajectory frames
+// consumed to produce them is returned in n_trajectory_frames_read.
+
+int read_fm_checkpoint(MATRIX_DATA* const mat, int* const n_trajectory_frames_read)
+{
+	int n_estimates = (mat->bootstrapping_flag == 1) ? mat->bootstrapping_num_estimates : 0;
+	ResultFileReader checkpoint_in("checkpoint.out");
+	if (checkpoint_in.legacy_format == 1) {
+		printf("File checkpoint.out is not an FM checkpoint.\n");
+		exit(EXIT_FAILURE);
+	}
+	checkpoint_in.check_compatibility(mat->matrix_type, mat->fm_matrix_columns, mat->basis_layout_hash);
+	if (checkpoint_in.header.matrix_type != mat->matrix_type || checkpoint_in.header.n_estimates != n_estimates) {
+		printf("Checkpoint was written with matrix_type %d and %d bootstrapping estimates; the current calculation uses matrix_type %d and %d.\n", checkpoint_in.header.matrix_type, checkpoint_in.header.n_estimates, mat->matrix_type, n_estimates);
+		exit(EXIT_FAILURE);
+	}
+	
+	const double* state = checkpoint_in.get_section(kResultCheckpointState, -1, 3);
+	int n_blocks_completed = (int)state[0];
+	if ((int)state[1] != mat->frames_per_traj_block) {
+		printf("Checkpoint was written with block_size %d but the current calculation uses %d.\n", (int)state[1], mat->frames_per_traj_block);
+		exit(EXIT_FAILURE);
+	}
+	*n_trajectory_frames_read = (int)state[2];
+	mat->force_sq_total = *checkpoint_in.get_section(kResultForceSqTotal, -1, 1);
+	
+	switch (mat->matrix_type) {
+	case kDense:
+		read_packed_upper_triangle(checkpoint_in.get_section(kResultNormalMatrix, -1, (uint64_t)mat->fm_matrix_columns * (mat->fm_matrix_columns + 1) / 2), mat->dense_fm_normal_matrix->values, mat->fm_matrix_columns, mat->fm_matrix_columns);
+		memcpy(mat->dense_fm_normal_rhs_vector, checkpoint_in.get_section(kResultNormalRHS, -1, mat->fm_matrix_columns), mat->fm_matrix_columns * sizeof(double));
+		for (int i = 0; i < n_estimates; i++) {
+			memcpy(&mat->bootstrapping_packed_normal_matrices[i * mat->bootstrapping_packed_size], checkpoint_in.get_section(kResultNormalMatrix, i, mat->bootstrapping_packed_size), mat->bootstrapping_packed_size * sizeof(double));
+			memcpy(mat->bootstrapping_dense_fm_normal_rhs_vectors[i], checkpoint_in.get_section(kResultNormalRHS, i, mat->fm_matrix_columns), mat->fm_matrix_columns * sizeof(double));
+		}
+		break;
+	case kSparse:
+		memcpy(&mat->fm_solution[0], checkpoint_in.get_section(kResultSolution, -1, mat->fm_matrix_columns), mat->fm_matrix_columns * sizeof(double));
+		memcpy(mat->fm_solution_normalization_factors, checkpoint_in.get_section(kResultNormalizationFactors, -1, mat->fm_matrix_columns), mat->fm_matrix_columns * sizeof(double));
+		for (int i = 0; i < n_estimates; i++) {
+			memcpy(&mat->bootstrap_solutions[i][0], checkpoint_in.get_section(kResultSolution, i, mat->fm_matrix_columns), mat->fm_matrix_columns * sizeof(double));
+		}
+		break;
+	case kAccumulation: {
+		uint64_t n_packed = (uint64_t)mat->accumulation_matrix_columns * (mat->accumulation_matrix_columns + 1) / 2;
+		read_packed_upper_triangle(checkpoint_in.get_section(kResultAccumulationMatrix, -1, n_packed), mat->dense_fm_matrix->values, mat->accumulation_matrix_columns, mat->accumulation_matrix_rows);
+		for (int i = 0; i < n_estimates; i++) {
+			read_packed_upper_triangle(checkpoint_in.get_section(kResultAccumulationMatrix, i, n_packed), mat->bootstrapping_dense_fm_normal_matrices[i]->values, mat->accumulation_matrix_columns, mat->accumulation_matrix_columns);
+		}
+		
+		// New rows go below the restored R factor.
+		mat->accumulation_row_shift = mat->accumulation_matrix_columns;
+		break;
+	}
+	default:
+		printf("Checkpointing is not supported for matrix_type %d.\n", mat->matrix_type);
+		exit(EXIT_FAILURE);
+	}
+	return n_blocks_completed;
+}
@@ -8,9 +8,11 @@
 #ifndef _matrix_h
 #define _matrix_h
 
+#include <cstdint>
 #include <vector>
 
 #include "external_matrix_routines.h"
+#include "misc.h"
 
 #ifndef DIMENSION
 #define DIMENSION 3
@@ -18,6 +20,7 @@
 
 struct CG_MODEL_DATA;
 struct ControlInputs;
+struct PerformanceProfile;
 
 typedef void (*accumulate_forces)(InteractionClassComputer* const info, const int first_nonzero_basis_index, const std::vector<double> &basis_fn_vals, const int n_body, const int* particle_ids, std::array<double, DIMENSION>* const &derivatives, MATRIX_DATA * const mat);
 typedef void (*accumulate_table_forces)(InteractionClassComputer* const info, const double &table_fn_val, const int n_body, const int* particle_ids, std::array<double, DIMENSION>* const &derivatives, MATRIX_DATA * const mat);
@@ -95,7 +98,7 @@ struct csr_matrix {
 	inline void write_file(FILE* fh) const {
 		fprintf(fh, "%d %d %d\n", n_rows, n_cols, max_entries);
 		for (int i = 0; i < row_sizes[n_rows]; i++) {
-			fprintf(fh, "%lf ", values[i]);
+			fprintf(fh, "%.17g ", values[i]);
 		}
 		fprintf(fh, "\n");
 		for (int i = 0; i < row_sizes[n_rows]; i++) {
@@ -233,7 +236,7 @@ struct dense_matrix {
     	}
     }
 
-    void assign_vector(const int row, const int col, const std::array<double, DIMENSION> &x) {
+    void assign_vector(const int row, const int col, const std::array<frame_real, DIMENSION> &x) {
     	for(int i = 0; i < DIMENSION; i++) {
     		values[ col * n_rows + row + i] = x[i];
     	}
@@ -278,6 +281,11 @@ struct MATRIX_DATA {
     int virial_constraint_rows;                     // Rows specifically for virial constraints
     int frames_per_traj_block;              		// Number of frames to read in a single block of FM matrix construction
     int position_dimension;							// The number of elements needed to specify each particle's position.
+    int n_frames;									// Number of trajectory frames contributing to the equations
+    int checkpoint_interval;						// Number of frame blocks between checkpoints written during FM; 0 for none
+    int restart_flag;								// 1 to resume FM from checkpoint.out; 0 otherwise
+    uint64_t basis_layout_hash;						// Identifies the column layout in binary result files; see result_file.h
+    PerformanceProfile* profile;					// Phase timers and counters; NULL unless performance_output_flag is set
 
     // For dense-matrix-based calculations
     dense_matrix* dense_fm_matrix;
@@ -312,11 +320,24 @@ struct MATRIX_DATA {
 	dense_matrix** bootstrapping_dense_fm_normal_matrices;
 	csr_matrix** bootstrapping_sparse_fm_normal_matrices;
 	std::vector<double>* bootstrap_solutions;
+	
+	// Dense normal matrices of the bootstrapping estimates (matrix_type 0 and 3) are
+	// stored as packed upper triangles, one column per estimate. Each frame's normal
+	// matrix is packed once into a batch, and a full batch is added to every
+	// estimate with a single matrix product against the frames' bootstrapping weights.
+	size_t bootstrapping_packed_size;				// Number of values in one packed normal matrix
+	int bootstrapping_batch_capacity;				// Number of frames buffered before reducing them into the estimates
+	int bootstrapping_batch_count;					// Number of frames currently buffered
+	double* bootstrapping_frame_batch;				// Packed normal matrices of the buffered frames, one column per frame
+	double* bootstrapping_batch_weights;			// Weight of each buffered frame in each estimate (frame-major columns per estimate)
+	double* bootstrapping_packed_normal_matrices;	// Packed normal matrices of the estimates, one column per estimate
+	dense_matrix* bootstrapping_frame_normal_matrix;	// Normal matrix of the current frame, reused for every frame
 
     // For sparse-matrix-based calculations
     int max_nonzero_normal_elements;                // Total number of nonzero values in the sparse normal matrix
 	int min_nonzero_normal_elements;				// Lower bound for safe size of sparse normal matrix
 	int num_sparse_threads;							// Number of threads for sparse solver
+	int num_threads;								// Number of worker threads for shared-memory routines (0 for all cores)
 	int itnlim;										// Maximum number of iterative refinement
 	double sparse_safety_factor;					// % to oversize the next frame-block's normal matrix from the current one (matrix_type = 4)
 	struct linked_list_sparse_matrix_row_head* ll_sparse_matrix_row_heads;      // A linked-list-based sparse matrix
@@ -331,17 +352,26 @@ struct MATRIX_DATA {
     int accumulation_matrix_columns;
     int accumulation_row_shift;
     int accumulation_target_forces_location;
-    int lapack_setup_flag;                          // Temp for LAPACK SVD and QR routines
-    double* lapack_temp_workspace;                  // Temp for LAPACK SVD and QR routines
-    double* lapack_tau;                             // Temp for LAPACK SVD and QR routines
+    
+    // Frame blocks of an accumulation-matrix-based calculation are buffered in a
+    // batch. The blocks of a full batch are QR factored concurrently, and their R
+    // factors are combined pairwise in a tree before being added to the accumulated
+    // R factor (and to those of the bootstrapping estimates).
+    int accumulation_batch_capacity;				// Number of frame blocks buffered before they are factored
+    int accumulation_batch_count;					// Number of frame blocks currently buffered
+    int* accumulation_batch_block_indices;			// Trajectory block index of each buffered block
+    double* accumulation_frame_batch;				// FM matrix rows of each buffered block
+    double* accumulation_batch_factors;				// Square R factor of each buffered block
 
 	// Optional extras for residual, regularization, and bayesian calculations
 	int output_residual;							// 1 to calculate the residual; 0 otherwise
 	double force_sq_total;							
 	int bayesian_flag;								// 1 to use Bayesian MS-CG to calculate regularization and interactions
 	int bayesian_max_iter;
+	int bayesian_alpha_style;						// 0 for one alpha per basis function; 1 for a single alpha (decomposes the normal matrix once)
     int regularization_style;                       // 0 to use no regularization; 1 to calculate results using single scalar regularization; 2 to calculate results using a set of regularization parameters in file lambda.in
 	double tikhonov_regularization_param;           // Parameter for Tikhonov regularization. (regularization_style = 1)
+	int regularization_scan_flag;					// 1 to also solve for each scalar Tikhonov parameter in regularization_scan.in (dense normal equations only)
 	double* regularization_vector;					// Vector for regularization_style 2.
 
     // SVD routine parameter
@@ -351,6 +381,7 @@ struct MATRIX_DATA {
     int output_style;                       // 0 to output only tables; 2 to output tables and binary block equations; 3 to output only binary block equations
     int output_normal_equations_rhs_flag;   // 1 to output the final right hand side vector of the MS-CG normal equations as well as force tables; 0 otherwise
     int output_solution_flag;               // 0 to not output the solution vector; 1 to output the solution vector in x.out
+    int output_archive_flag;                // 0 to write one file per table; 1 to write the interaction output files into tables.tar
 
 	// Constructors and destructors
 	MATRIX_DATA(ControlInputs* const control_input, CG_MODEL_DATA *const cg);
@@ -375,8 +406,9 @@ struct MATRIX_DATA {
 			delete [] block_fm_solution;
 			delete [] dense_fm_rhs_vector;
 		} else if (matrix_type == kAccumulation) {
-			delete [] lapack_temp_workspace;
-			delete [] lapack_tau;
+			delete [] accumulation_batch_block_indices;
+			delete [] accumulation_frame_batch;
+			delete [] accumulation_batch_factors;
 		} else if (matrix_type == kSparseNormal) {
 			delete [] ll_sparse_matrix_row_heads;
 			delete [] dense_fm_rhs_vector;
@@ -451,10 +483,25 @@ void allocate_bootstrapping(MATRIX_DATA* mat, ControlInputs* const control_input
 // Target (RHS) vector calculation routines
 
 void add_target_virials_from_trajectory(MATRIX_DATA* const mat, double *pressure_constraint_rhs_vector);
-void add_target_force_from_trajectory(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<double, DIMENSION>* const &f);
+void add_target_force_from_trajectory(int shift_i, int site_i, MATRIX_DATA* const mat, std::array<frame_real, DIMENSION>* const &f);
 
 // Read serialized, partially-completed post-frameblock matrix calculation intermediates
 
 void read_binary_matrix(MATRIX_DATA* const mat);
 
+// Save and restore the equations accumulated over the frame blocks processed so far
+// so that an interrupted FM calculation can be resumed.
+
+void write_fm_checkpoint(MATRIX_DATA* const mat, const int n_blocks_completed, const int n_trajectory_frames_read);
+int read_fm_checkpoint(MATRIX_DATA* const mat, int* const n_trajectory_frames_read);
+
+// Number of worker threads to use for shared-memory routines.
+
+int get_num_worker_threads(MATRIX_DATA* const mat);
+
+// As above, but reduced so that threads holding bytes_per_thread of temporaries
+// each fit in the free memory.
+
+int get_num_memory_bounded_threads(MATRIX_DATA* const mat, const size_t bytes_per_thread);
+
 #endif
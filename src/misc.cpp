@@ -22,13 +22,34 @@ const double MAX_INPUT_FORCE_VALUE = 1000.0; // Filter some noisy data
 const int MAX_CG_TYPE_NAME_LENGTH = 24; // Max length for CG type names
 const double DEGREES_PER_RADIAN = 180.0 / M_PI;
 
+// The file directory of the calling thread.
+
+static thread_local std::string file_directory;
+
+std::string get_file_path(const char* file_name)
+{
+	if (file_directory.empty() || file_name[0] == '/') return std::string(file_name);
+	return file_directory + "/" + file_name;
+}
+
+FileDirectoryScope::FileDirectoryScope(const std::string& directory) : previous_directory(file_directory)
+{
+	file_directory = directory;
+}
+
+FileDirectoryScope::~FileDirectoryScope()
+{
+	file_directory = previous_directory;
+}
+
 // An error-catching wrapper for fopen.
 
 FILE* open_file(const char* file_name, const char* mode)
 {
-    FILE* filepointer = fopen(file_name, mode);
+    std::string file_path = get_file_path(file_name);
+    FILE* filepointer = fopen(file_path.c_str(), mode);
     if (filepointer == NULL) {
-        fprintf(stderr, "Failed to open file %s.\n", file_name);
+        fprintf(stderr, "Failed to open file %s.\n", file_path.c_str());
         fflush(stderr);
         exit(EXIT_FAILURE);
     }
@@ -492,9 +513,10 @@ int match_type(std::string &source, char** name, const int n_types)
 
 void check_and_open_in_stream(std::ifstream &in_stream, const char* filename) 
 {
-	in_stream.open(filename, std::ifstream::in);
+	std::string file_path = get_file_path(filename);
+	in_stream.open(file_path.c_str(), std::ifstream::in);
     if (in_stream.fail()) {
-		fprintf(stderr, "Problem opening file %s\n", filename);
+		fprintf(stderr, "Problem opening file %s\n", file_path.c_str());
 		fflush(stderr);
 		exit(EXIT_FAILURE);
 	}
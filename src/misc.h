@@ -11,6 +11,21 @@
 typedef float real;
 typedef real rvec[3];
 
+// Precision of the positions and forces stored for each trajectory frame.
+// Building with -D"_single_precision_frames=1" keeps them in single precision,
+// as GROMACS trajectories store them, halving the memory traffic of the
+// geometry and cell list phases; distances, basis functions, and matrix
+// accumulation are still computed in double precision.
+#ifndef _single_precision_frames
+#define _single_precision_frames 0
+#endif
+
+#if _single_precision_frames == 1
+typedef float frame_real;
+#else
+typedef double frame_real;
+#endif
+
 #include <fstream>
 #include <string>
 #include "stdio.h"
@@ -31,6 +46,21 @@ extern const double DEGREES_PER_RADIAN;
 // Miscellaneous utility functions
 //-------------------------------------------------------------
 
+// Library handles can keep their input and output files in a directory of
+// their own. The directory is set for the calling thread only, so handles
+// used on different threads do not share it. Relative file names passed to
+// open_file, check_and_open_in_stream, and get_file_path are taken relative
+// to it; absolute names and an empty directory leave them unchanged.
+std::string get_file_path(const char* file_name);
+
+// Set the file directory of the calling thread until the scope ends.
+class FileDirectoryScope {
+	std::string previous_directory;
+public:
+	FileDirectoryScope(const std::string& directory);
+	~FileDirectoryScope();
+};
+
 // An error-catching wrapper for fopen.
 FILE* open_file(const char* file_name, const char* mode);
 
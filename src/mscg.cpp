@@ -9,32 +9,72 @@
 // This file provides the library interface to the multi-scale coarse-graining (MS-CG)
 // code, which is also referred to as the force matching (FM) code. 
 // The order in which functions are intended to be called for FM is the following:
-// mscg_startup_part1
+// mscg_startup_part1 (or mscg_startup_part1_in_directory)
 // setup_topology_and_frame
 // setup_bond_topology, setup_angle_topology, and setup_dihedral_topology
 // either setup_exclusion_topology or generate_exclusion_topology
 // mscg_startup_part2
-// mscg_process_frame for each frame
-// mscg_solve_and output.
+// optionally, mscg_set_async to queue frames for a builder thread
+// mscg_process_frame (or mscg_process_frame_strided) for each frame,
+// or mscg_process_frames for batches of frames
+// mscg_solve_and output (or mscg_solve, optionally without output files),
+// then optionally the mscg_get_* functions to retrieve the results.
 // Additional functions are provided for updating or modifying certain information
 // after the data is initially set using one of the functions before or during 
 // mscg_startup_part2.
 
 // The order in which functions are intended to be called for range finding is the following:
-// rangefinder_startup_part1
+// rangefinder_startup_part1 (or rangefinder_startup_part1_in_directory)
 // setup_topology_and_frame
 // setup_bond_topology, setup_angle_topology, and setup_dihedral_topology
 // either setup_exclusion_topology or generate_exclusion_topology
 // rangefinder_startup_part2
-// rangefinder_process_frame for each frame
+// optionally, rangefinder_set_async to queue frames for a builder thread
+// rangefinder_process_frame (or rangefinder_process_frame_strided) for each frame,
+// or rangefinder_process_frames for batches of frames
 // rangefinder_solve_and output.
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 #include "mscg.h"
 
 // Prototype function definition for functions called internal to this file
 void finish_fix_reading(FrameSource *const frame_source);
 inline void dynamic_state_sampling_error(void);
 
+// The positions, forces, and cell lists of one frame.
+// The cell lists are kept between frames and are only set up again
+// when the box or the number of sites changes.
+struct FrameBuffer {
+	FrameConfig* frame_config;
+	PairCellList pair_cell_list;
+	ThreeBCellList three_body_cell_list;
+	int cell_lists_are_current;			// 0 until the cell lists are set up for the current box and number of sites
+};
+
+// Frames submitted in async mode wait here until the builder thread adds them
+// to the FM matrix. Slots are used in ring order; each holds a copy of a frame.
+struct FrameQueue {
+	int capacity;							// Number of frame slots; 0 when frames are processed as they are submitted
+	int frame_size;							// Number of position (or force) components in a frame
+	std::vector<double> x;					// Positions of the frame in each slot, one frame after another
+	std::vector<double> f;
+	std::vector<double> box_half_lengths;	// Box of the frame in each slot
+	std::vector<double> weights;			// Statistical weight of the frame in each slot, if one was given
+	std::vector<int> has_weight;
+	double current_box_half_lengths[DIMENSION];	// Box for frames submitted without one
+	int head;								// Slot of the oldest frame that has not been processed
+	int n_queued;							// Number of frames submitted and not yet processed
+	bool stop;								// Set to end the builder thread once the queue is empty
+	std::mutex mutex;
+	std::condition_variable changed;		// Notified when frames are queued or processed and on stop
+	std::thread builder;
+};
+
 // Data structure holding all MSCG information.
 // It is passed to the driver function (LAMMPS fix) as an opaque pointer.
 struct MSCG_struct {
@@ -47,16 +87,56 @@ struct MSCG_struct {
     CG_MODEL_DATA *cg;  			// CG model parameters and data
     ControlInputs *control_input;	// Input settings read from control.in
     MATRIX_DATA *mat;				// Matrix storage structure
+    FrameBuffer frame_buffers[2];	// The first holds the frame_source's FrameConfig; the second is only used to prepare frames of a batch ahead
+    std::array<frame_real, DIMENSION>* frame_config_x;	// FrameConfig's own arrays while it points into the caller's arrays; NULL otherwise
+    std::array<frame_real, DIMENSION>* frame_config_f;
+    FrameQueue frame_queue;			// Frames waiting to be processed in async mode
+    std::string directory;			// Directory holding this handle's input and output files; empty for the working directory
+    std::vector<double> solution;	// Results kept by mscg_solve for the mscg_get_* functions
+    std::vector<InteractionResult> interaction_results;
 };
 
+void process_prepared_frame(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer, const double* const frame_weight);
+void set_up_cell_lists(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer);
+template <typename T> void set_frame_box(FrameBuffer* const frame_buffer, const T* const box_half_lengths);
+void set_up_pipeline_frame_buffer(MSCG_struct* const mscg_struct);
+void prepare_batch_frame(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer, double* const x, double* const f, double* const box_half_lengths);
+void attach_frame_arrays(MSCG_struct* const mscg_struct, double* const x, double* const f, const int site_stride, const int component_stride, const bool use_caller_arrays);
+void detach_frame_arrays(MSCG_struct* const mscg_struct);
+bool positions_in_primary_image(const int n_sites, const double* const x, const real* const simulation_box_half_lengths);
+void process_frame_run(MSCG_struct* const mscg_struct, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights);
+void allocate_frame_queue(MSCG_struct* const mscg_struct);
+void enqueue_frames(MSCG_struct* const mscg_struct, const int n_frames, double* const x, double* const f, const int site_stride, const int component_stride, double* const box_half_lengths, double* const weights);
+void run_frame_builder(MSCG_struct* const mscg_struct);
+void stop_frame_builder(MSCG_struct* const mscg_struct);
+InteractionResult* get_interaction_result(MSCG_struct* const mscg_struct, const int index);
+
 // This function starts the MSCG process by allocating memory for the mscg_struct
 // and reading information from the control.in file.
 // It should be called first.
 void* mscg_startup_part1(void* void_in) 
+{
+	return mscg_startup_part1_in_directory(void_in, NULL);
+}
+
+// This variant of mscg_startup_part1 reads all input files from, and writes
+// all output files to, the given directory instead of the working directory.
+// Handles started in different directories do not share any files or other
+// state, so they can fit different models at the same time on different threads.
+void* mscg_startup_part1_in_directory(void* void_in, const char* directory)
 {	
     // Begin to compute the total run time
     MSCG_struct* mscg_struct = new MSCG_struct;
     mscg_struct->start_cputime = clock();	
+    if (directory != NULL) mscg_struct->directory = directory;
+    FileDirectoryScope directory_scope(mscg_struct->directory);
+    for (int i = 0; i < 2; i++) {
+    	mscg_struct->frame_buffers[i].frame_config = NULL;
+    	mscg_struct->frame_buffers[i].cell_lists_are_current = 0;
+    }
+    mscg_struct->frame_config_x = NULL;
+    mscg_struct->frame_config_f = NULL;
+    mscg_struct->frame_queue.capacity = 0;
 	
 	mscg_struct->frame_source = new FrameSource;
     FrameSource *p_frame_source = mscg_struct->frame_source;
@@ -89,7 +169,12 @@ void* mscg_startup_part1(void* void_in)
 // it is a thin wrapper of mscg_setup_part1
 void* rangefinder_startup_part1(void* void_in)
 {
-	void_in = mscg_startup_part1(void_in);
+	return rangefinder_startup_part1_in_directory(void_in, NULL);
+}
+
+void* rangefinder_startup_part1_in_directory(void* void_in, const char* directory)
+{
+	void_in = mscg_startup_part1_in_directory(void_in, directory);
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
 	if (mscg_struct->control_input->three_body_flag != 0) {
         printf("Rangefinder does not support three body nonbonded interaction ranges.\n");
@@ -116,6 +201,7 @@ void* mscg_startup_part2(void* void_in)
 	int n_blocks = 0;
 
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FileDirectoryScope directory_scope(mscg_struct->directory);
 	FrameSource *p_frame_source = mscg_struct->frame_source;
     ControlInputs *p_control_input = mscg_struct->control_input;
 	CG_MODEL_DATA *p_cg = mscg_struct->cg;
@@ -221,7 +307,7 @@ void* mscg_startup_part2(void* void_in)
 
     // Record the dimensions of the matrix after initialization in a
     // solution file.
-    FILE* solution_file = fopen("sol_info.out", "w");
+    FILE* solution_file = fopen(get_file_path("sol_info.out").c_str(), "w");
     fprintf(solution_file, "fm_matrix_rows:%d; fm_matrix_columns:%d;\n",
             mscg_struct->mat->fm_matrix_rows, mscg_struct->mat->fm_matrix_columns);
     fclose(solution_file);
@@ -240,6 +326,7 @@ void* mscg_startup_part2(void* void_in)
 void* rangefinder_startup_part2(void* void_in)
 {
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FileDirectoryScope directory_scope(mscg_struct->directory);
     int total_frame_samples = mscg_struct->control_input->n_frames;
 	int n_blocks = 0;
 
@@ -299,142 +386,193 @@ void* rangefinder_startup_part2(void* void_in)
 // Process each frame of the trajectory to build the MSCG matrix.
 // This function should be called after mscg_setup_part2, but before
 // mscg_solve_and_output.
+// The x and f arrays hold the x, y, and z components of each site in turn;
+// they are copied, so the caller's arrays are not modified.
 void* mscg_process_frame(void* void_in, double* const x, double* const f)
-{       		
+{
+	return mscg_process_frames(void_in, 1, x, f, NULL, NULL);
+}
+
+// Process a frame as mscg_process_frame does, but reading the caller's arrays
+// in place: component j of site i is x[i * site_stride + j * component_stride]
+// (and likewise for f). Flat arrays use (3, 1), structure-of-arrays buffers
+// use (1, n_cg_sites), and other strides select sites from larger arrays.
+// Flat arrays are used directly without copying, except that positions
+// outside the primary periodic image are copied into the library's own array
+// before they are wrapped, so x and f are never modified; other layouts are
+// gathered into the library's own arrays. In async mode, the frame is
+// always gathered into the queue.
+void* mscg_process_frame_strided(void* void_in, double* const x, double* const f, const int site_stride, const int component_stride)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FrameBuffer* frame_buffer = &mscg_struct->frame_buffers[0];
+	if (mscg_struct->frame_queue.capacity > 0) {
+		enqueue_frames(mscg_struct, 1, x, f, site_stride, component_stride, NULL, NULL);
+		return (void*)(mscg_struct);
+	}
+
+	attach_frame_arrays(mscg_struct, x, f, site_stride, component_stride, true);
+	set_up_cell_lists(mscg_struct, frame_buffer);
+	prepare_frame_for_fm(mscg_struct->cg, frame_buffer->frame_config, frame_buffer->pair_cell_list, frame_buffer->three_body_cell_list, mscg_struct->mat->profile);
+	process_prepared_frame(mscg_struct, frame_buffer, NULL);
+	detach_frame_arrays(mscg_struct);
+
+	return (void*)(mscg_struct);
+}
+
+// Process a batch of n_frames consecutive frames as mscg_process_frame would
+// one at a time. The frames are stored one after the other in x and f, each
+// laid out as for mscg_process_frame, and are copied.
+// If box_half_lengths is not NULL, it holds 3 box half lengths for each frame;
+// otherwise, the box set by setup_topology_and_frame or update_frame_config is
+// used throughout. If weights is not NULL, it holds a statistical weight for
+// each frame that is used in place of the weight read from frame_weights.in;
+// this requires use_statistical_reweighting in control.in.
+// When more than one worker thread is available (num_threads in control.in),
+// each frame is copied, wrapped, and sorted into cell lists on a second thread
+// while the frame before it is added to the FM matrix.
+// In async mode (see mscg_set_async), the frames are copied into the queue
+// and this returns as soon as they are queued.
+void* mscg_process_frames(void* void_in, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights)
+{
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
 	FrameSource *p_frame_source = mscg_struct->frame_source;
-	CG_MODEL_DATA *p_cg = mscg_struct->cg;
+	if (n_frames <= 0) return (void*)(mscg_struct);
+	if ( (weights != NULL) && (p_frame_source->use_statistical_reweighting != 1) ) {
+		printf("Frame weights can only be passed to mscg_process_frames when use_statistical_reweighting is set in control.in.\n");
+		exit(EXIT_FAILURE);
+	}
 
-	// Convert 1D x and f arrays into rvec array
-	FrameConfig* p_frame_config = p_frame_source->frame_config;
-	for(int i = 0; i < p_frame_config->current_n_sites; i++) {
-		for(int j = 0; j < 3; j++) {
-			p_frame_config->x[i][j] = x[i*3 + j];
-			p_frame_config->f[i][j] = f[i*3 + j];
-		}
-	}	
-	
-	// Initialize the cell linked lists for finding neighbors in the provided frames;
-    // NVT trajectories are assumed, so this only needs to be done once.
-    PairCellList pair_cell_list = PairCellList();
-    ThreeBCellList three_body_cell_list = ThreeBCellList();
-    pair_cell_list.init(p_cg->pair_nonbonded_interactions.cutoff, p_frame_source);
-    if (p_cg->three_body_nonbonded_interactions.class_subtype > 0) {
-        double max_cutoff = 0.0;
-        for (int i = 0; i < p_cg->three_body_nonbonded_interactions.get_n_defined(); i++) {
-            max_cutoff = fmax(max_cutoff, p_cg->three_body_nonbonded_interactions.three_body_nonbonded_cutoffs[i]);
-        }
-        three_body_cell_list.init(max_cutoff, p_frame_source);
-    }
+	if (mscg_struct->frame_queue.capacity > 0) enqueue_frames(mscg_struct, n_frames, x, f, DIMENSION, 1, box_half_lengths, weights);
+	else process_frame_run(mscg_struct, n_frames, x, f, box_half_lengths, weights);
+	return (void*)(mscg_struct);
+}
 
-    // The trajectory_block_frame_index is incremented for each frame-sample processed.
-    // When this index reaches the block size (frames_per_traj_block),
-    // The end-of-frame-block routines are called.
-    // Then, the trajectory_block_index is incremented.
-    mscg_struct->curr_frame++;
- 	int traj_frame_num = mscg_struct->traj_frame_num;
-	int trajectory_block_frame_index = mscg_struct->trajectory_block_frame_index;
-	int times_sampled = 1;
-    
-    // If reweighting is being used, scale the block of the FM matrix for this frame
-    // by the appropriate weighting factor
-    if (p_frame_source->use_statistical_reweighting == 1) {
-       printf("Reweighting entries for trajectory frame %d. ", traj_frame_num);
-       mscg_struct->mat->current_frame_weight = p_frame_source->frame_weights[traj_frame_num];
+// Process consecutive frames stored one after the other in x and f,
+// preparing each on a second thread while the one before it is built
+// if more than one worker thread is available.
+void process_frame_run(MSCG_struct* const mscg_struct, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights)
+{
+	FileDirectoryScope directory_scope(mscg_struct->directory);
+	int frame_size = mscg_struct->frame_source->frame_config->current_n_sites * DIMENSION;
+	bool pipelined = (n_frames > 1) && (get_num_worker_threads(mscg_struct->mat) > 1);
+	int n_buffers = 1;
+	if (pipelined) {
+		set_up_pipeline_frame_buffer(mscg_struct);
+		n_buffers = 2;
 	}
-            
-    //Skip processing frame if frame weight is 0.
-    if (p_frame_source->use_statistical_reweighting && mscg_struct->mat->current_frame_weight == 0.0) {
-    	traj_frame_num++;
-    	if (p_frame_source->dynamic_state_sampling != 0) times_sampled = p_frame_source->dynamic_state_samples_per_frame;
-    	mscg_struct->trajectory_block_frame_index += times_sampled;
-    	
-    	if(trajectory_block_frame_index >= mscg_struct->mat->frames_per_traj_block) {
-    		// Print status and do end-of-block computations before wiping the blockwise matrix and beginning anew.
-        	printf("\r%d (%d) frames have been sampled. ", p_frame_source->current_frame_n, (mscg_struct->mat->trajectory_block_index + 1) * mscg_struct->mat->frames_per_traj_block);
-        	fflush(stdout);
-        	(*mscg_struct->mat->do_end_of_frameblock_matrix_manipulations)(mscg_struct->mat);
-        	(*mscg_struct->mat->set_fm_matrix_to_zero)(mscg_struct->mat);
-        	trajectory_block_frame_index=0;
-        	mscg_struct->mat->trajectory_block_index++;
-        }
 
-    } else {
-    
-    	// Apply virial constraint, if appropriate.
-        add_target_virials_from_trajectory(mscg_struct->mat, mscg_struct->frame_source->pressure_constraint_rhs_vector);
+	std::thread preparer;
+	prepare_batch_frame(mscg_struct, &mscg_struct->frame_buffers[0], x, f, box_half_lengths);
+	for (int k = 0; k < n_frames; k++) {
+		FrameBuffer* frame_buffer = &mscg_struct->frame_buffers[k % n_buffers];
+		FrameBuffer* next_frame_buffer = &mscg_struct->frame_buffers[(k + 1) % n_buffers];
+		double* next_box_half_lengths = (box_half_lengths == NULL) ? NULL : box_half_lengths + (k + 1) * DIMENSION;
+		if (pipelined && (k + 1 < n_frames)) {
+			preparer = std::thread(prepare_batch_frame, mscg_struct, next_frame_buffer, x + (k + 1) * frame_size, f + (k + 1) * frame_size, next_box_half_lengths);
+		}
+		process_prepared_frame(mscg_struct, frame_buffer, (weights == NULL) ? NULL : weights + k);
+		if (k + 1 < n_frames) {
+			if (pipelined) preparer.join();
+			else prepare_batch_frame(mscg_struct, next_frame_buffer, x + (k + 1) * frame_size, f + (k + 1) * frame_size, next_box_half_lengths);
+		}
+	}
 
-    	// Otherwise, process this frame once unless dynamic_state_sampling is used, in which case it is resampled in this do-while loop.
-    	do {    
-			if (p_frame_source->dynamic_state_sampling != 0) p_frame_source->sampleTypesFromProbs();
-	    	calculate_frame_fm_matrix(p_cg, mscg_struct->mat, p_frame_config, pair_cell_list, three_body_cell_list, trajectory_block_frame_index);
-    		times_sampled++;
-    		traj_frame_num++;
-    		trajectory_block_frame_index++;
-    		
-     		if(trajectory_block_frame_index >= mscg_struct->mat->frames_per_traj_block) {
-    			// Print status and do end-of-block computations before wiping the blockwise matrix and beginning anew.
-        		printf("\r%d (%d) frames have been sampled. ", p_frame_source->current_frame_n, (mscg_struct->mat->trajectory_block_index + 1) * mscg_struct->mat->frames_per_traj_block);
-        		fflush(stdout);
-        		(*mscg_struct->mat->do_end_of_frameblock_matrix_manipulations)(mscg_struct->mat);
-        		(*mscg_struct->mat->set_fm_matrix_to_zero)(mscg_struct->mat);
-        		trajectory_block_frame_index=0;
-        		mscg_struct->mat->trajectory_block_index++;
-        	}
-		} while ( (p_frame_source->dynamic_state_sampling != 0) && (times_sampled < p_frame_source->dynamic_state_samples_per_frame) );
-    }
-	p_frame_source->current_frame_n++;
-	mscg_struct->traj_frame_num = traj_frame_num;
-	mscg_struct->trajectory_block_frame_index = trajectory_block_frame_index;
-    
-	return (void*)(mscg_struct);
+	// Keep the box of the last frame for the frames that follow.
+	if ((n_frames - 1) % n_buffers != 0) {
+		set_frame_box(&mscg_struct->frame_buffers[0], mscg_struct->frame_buffers[1].frame_config->simulation_box_half_lengths);
+	}
 }
 
 // Process each frame of the trajectory to search interaction ranges.
 // This function should be called after rangefinder_setup_part2, \
 // but before rangefinder_solve_and_output.
+// Since frames are processed in the same way for range finding
+// and force matching, these are thin wrappers of the mscg_ functions.
 
 void* rangefinder_process_frame(void* void_in, double* const x, double* const f)
+{
+	return mscg_process_frame(void_in, x, f);
+}
+
+void* rangefinder_process_frame_strided(void* void_in, double* const x, double* const f, const int site_stride, const int component_stride)
+{
+	return mscg_process_frame_strided(void_in, x, f, site_stride, component_stride);
+}
+
+void* rangefinder_process_frames(void* void_in, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights)
+{
+	return mscg_process_frames(void_in, n_frames, x, f, box_half_lengths, weights);
+}
+
+// Switch async mode on with room for queue_capacity frames, or off with 0.
+// In async mode, mscg_process_frame and its variants copy each frame into a
+// queue and return; a builder thread adds the queued frames to the FM matrix
+// in order, including the end-of-block computations. If the queue is full,
+// the call waits for a free slot. mscg_wait blocks until every queued frame
+// has been processed, and update_frame_config and mscg_solve_and_output wait
+// as well. Frames should be submitted from one thread at a time.
+// This function should be called after mscg_startup_part2.
+void* mscg_set_async(void* void_in, const int queue_capacity)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	stop_frame_builder(mscg_struct);
+	if (queue_capacity <= 0) return (void*)(mscg_struct);
+
+	queue->capacity = queue_capacity;
+	allocate_frame_queue(mscg_struct);
+	for (int i = 0; i < DIMENSION; i++) queue->current_box_half_lengths[i] = mscg_struct->frame_buffers[0].frame_config->simulation_box_half_lengths[i];
+	queue->stop = false;
+	queue->builder = std::thread(run_frame_builder, mscg_struct);
+	return (void*)(mscg_struct);
+}
+
+// Wait until every frame queued in async mode has been processed.
+void* mscg_wait(void* void_in)
 {
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	if (queue->capacity == 0) return (void*)(mscg_struct);
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	queue->changed.wait(lock, [queue]() { return queue->n_queued == 0; });
+	return (void*)(mscg_struct);
+}
+
+void* rangefinder_set_async(void* void_in, const int queue_capacity)
+{
+	return mscg_set_async(void_in, queue_capacity);
+}
+
+void* rangefinder_wait(void* void_in)
+{
+	return mscg_wait(void_in);
+}
+
+// Add a frame prepared in a frame buffer to the FM matrix (or the range finding
+// temps), doing the end-of-block computations when a block is complete.
+// If frame_weight is not NULL, it is used in place of the frame's weight from
+// frame_weights.in.
+void process_prepared_frame(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer, const double* const frame_weight)
+{
 	FrameSource *p_frame_source = mscg_struct->frame_source;
 	CG_MODEL_DATA *p_cg = mscg_struct->cg;
+	FrameConfig* p_frame_config = frame_buffer->frame_config;
 
-	// Convert 1D x and f arrays into rvec array
-	FrameConfig* p_frame_config = p_frame_source->frame_config;
-	for(int i = 0; i < p_frame_config->current_n_sites; i++) {
-		for(int j = 0; j < 3; j++) {
-			p_frame_config->x[i][j] = x[i*3 + j];
-			p_frame_config->f[i][j] = f[i*3 + j];
-		}
-	}	
-	
-	// Initialize the cell linked lists for finding neighbors in the provided frames;
-    // NVT trajectories are assumed, so this only needs to be done once.
-    PairCellList pair_cell_list = PairCellList();
-    ThreeBCellList three_body_cell_list = ThreeBCellList();
-    pair_cell_list.init(p_cg->pair_nonbonded_interactions.cutoff, p_frame_source);
-    if (p_cg->three_body_nonbonded_interactions.class_subtype > 0) {
-        double max_cutoff = 0.0;
-        for (int i = 0; i < p_cg->three_body_nonbonded_interactions.get_n_defined(); i++) {
-            max_cutoff = fmax(max_cutoff, p_cg->three_body_nonbonded_interactions.three_body_nonbonded_cutoffs[i]);
-        }
-        three_body_cell_list.init(max_cutoff, p_frame_source);
-    }
-        
     // The trajectory_block_frame_index is incremented for each frame-sample processed.
     // When this index reaches the block size (frames_per_traj_block),
     // The end-of-frame-block routines are called.
     // Then, the trajectory_block_index is incremented.
-	int traj_frame_num = mscg_struct->traj_frame_num;
+    mscg_struct->curr_frame++;
+ 	int traj_frame_num = mscg_struct->traj_frame_num;
 	int trajectory_block_frame_index = mscg_struct->trajectory_block_frame_index;
 	int times_sampled = 1;
-      
-  	// If reweighting is being used, scale the block of the FM matrix for this frame
+    
+    // If reweighting is being used, scale the block of the FM matrix for this frame
     // by the appropriate weighting factor
-    if (p_frame_source->use_statistical_reweighting) {
+    if (p_frame_source->use_statistical_reweighting == 1) {
        printf("Reweighting entries for trajectory frame %d. ", traj_frame_num);
-       mscg_struct->mat->current_frame_weight = p_frame_source->frame_weights[traj_frame_num];
+       mscg_struct->mat->current_frame_weight = (frame_weight != NULL) ? *frame_weight : p_frame_source->frame_weights[traj_frame_num];
 	}
             
     //Skip processing frame if frame weight is 0.
@@ -455,13 +593,13 @@ void* rangefinder_process_frame(void* void_in, double* const x, double* const f)
 
     } else {
     
-     	// Apply virial constraint, if appropriate.
+    	// Apply virial constraint, if appropriate.
         add_target_virials_from_trajectory(mscg_struct->mat, mscg_struct->frame_source->pressure_constraint_rhs_vector);
 
-	   	// Otherwise, process this frame once unless dynamic_state_sampling is used, in which case it is resampled in this do-while loop.
+    	// Otherwise, process this frame once unless dynamic_state_sampling is used, in which case it is resampled in this do-while loop.
     	do {    
 			if (p_frame_source->dynamic_state_sampling != 0) p_frame_source->sampleTypesFromProbs();
-	    	calculate_frame_fm_matrix(p_cg, mscg_struct->mat, p_frame_config, pair_cell_list, three_body_cell_list, trajectory_block_frame_index);
+	    	calculate_prepared_frame_fm_matrix(p_cg, mscg_struct->mat, p_frame_config, frame_buffer->pair_cell_list, frame_buffer->three_body_cell_list, trajectory_block_frame_index);
     		times_sampled++;
     		traj_frame_num++;
     		trajectory_block_frame_index++;
@@ -480,8 +618,6 @@ void* rangefinder_process_frame(void* void_in, double* const x, double* const f)
 	p_frame_source->current_frame_n++;
 	mscg_struct->traj_frame_num = traj_frame_num;
 	mscg_struct->trajectory_block_frame_index = trajectory_block_frame_index;
-    
-	return (void*)(mscg_struct);
 }
 
 // Solve the MSCG matrix to generate interactions
@@ -489,8 +625,19 @@ void* rangefinder_process_frame(void* void_in, double* const x, double* const f)
 // This function should be called last, after all frames
 // have been processed using mscg_process_frame.
 void* mscg_solve_and_output(void* void_in) 
+{
+	return mscg_solve(void_in, 1);
+}
+
+// Solve the MSCG matrix to generate interactions and keep the solution,
+// the coefficients, and the tabulated forces and potentials of the
+// interactions for the mscg_get_* functions.
+// The usual output files are only written if write_files is 1.
+void* mscg_solve(void* void_in, const int write_files)
 {
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FileDirectoryScope directory_scope(mscg_struct->directory);
+	stop_frame_builder(mscg_struct);
 	FrameSource *p_frame_source = mscg_struct->frame_source;
     ControlInputs *p_control_input = mscg_struct->control_input;
     MATRIX_DATA *mat = mscg_struct->mat;
@@ -502,11 +649,9 @@ void* mscg_solve_and_output(void* void_in)
 
     // Close the trajectory and free the relevant temp variables.
     p_frame_source->cleanup(p_frame_source);
+    delete mscg_struct->frame_buffers[1].frame_config;
 
     printf("Finished constructing FM equations.\n");
-    if (p_frame_source->bootstrapping_flag == 1) {
-		free_bootstrapping_weights(p_frame_source);
-	}
 	
 	// Check that the actual number of frames read matches
 	// the number specified in control.in
@@ -528,17 +673,37 @@ void* mscg_solve_and_output(void* void_in)
 
 	}
 	
+    // Record the number of frames in the complete frame blocks that were used,
+    // for the headers of result files.
+    int samples_per_frame = (p_frame_source->dynamic_state_sampling == 1) ? p_frame_source->dynamic_state_samples_per_frame : 1;
+    mat->n_frames = (mscg_struct->curr_frame * samples_per_frame / mat->frames_per_traj_block) * mat->frames_per_traj_block / samples_per_frame;
+	
     // Find the solution to the force-matching equations set up in
     // previous steps. The solution routines may also print out
     // singular values, residuals, raw matrix equations, etc. as
     // necessary.
     printf("Finishing FM.\n");
     mat->finish_fm(mat);
+    
+    // The bootstrapping weights are freed only now, since finish_fm adds
+    // the last buffered frame blocks of matrix_type 2 to the estimates.
+    if (p_frame_source->bootstrapping_flag == 1) {
+		free_bootstrapping_weights(p_frame_source);
+	}
+
+    // Keep the results for retrieval before the matrix is freed.
+    reinsert_periodic_solution_coefficients(p_cg, mat);
+    mscg_struct->solution = mat->fm_solution;
+    calculate_interaction_results(p_cg, mat, mscg_struct->interaction_results);
 
     // Write tabulated interaction files resulting from the basis set
     // coefficients found in the solution step.
-    printf("Writing final output.\n"); fflush(stdout);
-    write_fm_interaction_output_files(p_cg, mat);
+    if (write_files == 1) {
+    	printf("Writing final output.\n"); fflush(stdout);
+    	write_fm_solution_output_files(p_cg, mat);
+    } else {
+    	free_name(p_cg);
+    }
 	
 	if (p_frame_source->bootstrapping_flag == 1) {
 		delete [] mat->bootstrap_solutions;
@@ -560,9 +725,12 @@ void* mscg_solve_and_output(void* void_in)
 void* rangefinder_solve_and_output(void* void_in) 
 {
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FileDirectoryScope directory_scope(mscg_struct->directory);
+	stop_frame_builder(mscg_struct);
     
     // Close the trajectory and free the relevant temp variables.
     mscg_struct->frame_source->cleanup(mscg_struct->frame_source);
+    delete mscg_struct->frame_buffers[1].frame_config;
 
      // Free the space used to build the force-matching matrix that is
     // not necessary for the interaction range outputs.
@@ -602,6 +770,97 @@ void* rangefinder_solve_and_output(void* void_in)
 	return (void*)(mscg_struct);
 }
 
+// The following functions copy the results kept by mscg_solve (or
+// mscg_solve_and_output) into caller buffers, without the rounding of the
+// output files. Interactions are numbered from 0 in the order in which their
+// output files are written; three-body interactions are not included.
+
+// Number of values in the FM solution vector.
+int mscg_get_n_solution_values(void* void_in)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	return mscg_struct->solution.size();
+}
+
+// Copy the FM solution vector, with the coefficients of all interactions.
+void* mscg_get_solution(void* void_in, double* const solution)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	std::copy(mscg_struct->solution.begin(), mscg_struct->solution.end(), solution);
+	return (void*)(mscg_struct);
+}
+
+int mscg_get_n_interactions(void* void_in)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	return mscg_struct->interaction_results.size();
+}
+
+// Return the base name of an interaction's output files (e.g. "MeOH_MeOH"),
+// which remains valid as long as the handle.
+const char* mscg_get_interaction_name(void* void_in, const int index)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	return get_interaction_result(mscg_struct, index)->name.c_str();
+}
+
+// Describe the basis of an interaction: its class ('n', 'b', 'a', 'd', ...),
+// basis_type as in control.in, B-spline order, and cutoffs.
+void* mscg_get_interaction_basis(void* void_in, const int index, char* const class_id, int* const basis_type, int* const bspline_k, double* const lower_cutoff, double* const upper_cutoff)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	InteractionResult* result = get_interaction_result(mscg_struct, index);
+	*class_id = result->char_id;
+	*basis_type = result->basis_type;
+	*bspline_k = result->bspline_k;
+	*lower_cutoff = result->lower_cutoff;
+	*upper_cutoff = result->upper_cutoff;
+	return (void*)(mscg_struct);
+}
+
+int mscg_get_n_interaction_coefficients(void* void_in, const int index)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	return get_interaction_result(mscg_struct, index)->coeffs.size();
+}
+
+// Copy the basis function coefficients of an interaction.
+void* mscg_get_interaction_coefficients(void* void_in, const int index, double* const coeffs)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	InteractionResult* result = get_interaction_result(mscg_struct, index);
+	std::copy(result->coeffs.begin(), result->coeffs.end(), coeffs);
+	return (void*)(mscg_struct);
+}
+
+// Number of grid points in an interaction's table.
+int mscg_get_interaction_table_size(void* void_in, const int index)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	return get_interaction_result(mscg_struct, index)->table.axis_vals.size();
+}
+
+// Copy the grid, potential, and force of an interaction's table, as written
+// to its .table file (or its _sum.table file if it also has a tabulated part).
+void* mscg_get_interaction_table(void* void_in, const int index, double* const axis_vals, double* const potential_vals, double* const force_vals)
+{
+	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	InteractionTable* table = &get_interaction_result(mscg_struct, index)->table;
+	std::copy(table->axis_vals.begin(), table->axis_vals.end(), axis_vals);
+	std::copy(table->potential_vals.begin(), table->potential_vals.end(), potential_vals);
+	std::copy(table->force_vals.begin(), table->force_vals.end(), force_vals);
+	return (void*)(mscg_struct);
+}
+
+InteractionResult* get_interaction_result(MSCG_struct* const mscg_struct, const int index)
+{
+	if (index < 0 || index >= (int)(mscg_struct->interaction_results.size())) {
+		printf("Interaction %d was requested, but mscg_solve found %d interactions.\n", index, (int)(mscg_struct->interaction_results.size()));
+		exit(EXIT_FAILURE);
+	}
+	return &mscg_struct->interaction_results[index];
+}
+
 //-------------------------------------------------------------
 // Supporting functions for FrameConfig and FrameSource structs 
 // (adapted from trajectory_input.cpp).
@@ -617,6 +876,7 @@ void* setup_frame_config(void* void_in, const int n_cg_sites, int * cg_site_type
 	
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
 	mscg_struct->frame_source->frame_config = new FrameConfig(n_cg_sites);
+	mscg_struct->frame_buffers[0].frame_config = mscg_struct->frame_source->frame_config;
 	
 	// Set number of sites types.
 	mscg_struct->frame_source->frame_config->cg_site_types = cg_site_types;
@@ -644,12 +904,19 @@ void* update_frame_config(void* void_in, const int n_cg_sites, int * cg_site_typ
 {
 	assert(n_cg_sites > 0);	
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	
+	// Finish any frames queued in async mode before changing the frame.
+	int queue_capacity = mscg_struct->frame_queue.capacity;
+	stop_frame_builder(mscg_struct);
 	FrameConfig* p_frame_config = mscg_struct->frame_source->frame_config;
 	
 	// Resize frame config and the arrays only if the number of sites has changed.
 	if(p_frame_config->current_n_sites != n_cg_sites) {
 		delete p_frame_config;
 		p_frame_config = new FrameConfig(n_cg_sites);
+		mscg_struct->frame_source->frame_config = p_frame_config;
+		mscg_struct->frame_buffers[0].frame_config = p_frame_config;
+		mscg_struct->frame_buffers[0].cell_lists_are_current = 0;
 		
 		// Also, update other copies of n_cg_sites.
 		mscg_struct->cg->topo_data.n_cg_sites = n_cg_sites;
@@ -665,13 +932,233 @@ void* update_frame_config(void* void_in, const int n_cg_sites, int * cg_site_typ
 	
 	// Update number of particle types.
 	p_frame_config->cg_site_types = cg_site_types;
+	mscg_struct->cg->topo_data.cg_site_types = cg_site_types;
+	mscg_struct->cg->topo_data.revision++;
 	
-	// Update box size.
-	for (int i = 0; i < 3; i++) p_frame_config->simulation_box_half_lengths[i] = box_half_lengths[i];
+	// Update box size; the cell lists are set up again for the next frame if it changed.
+	set_frame_box(&mscg_struct->frame_buffers[0], box_half_lengths);
 
+	if (queue_capacity > 0) mscg_set_async(void_in, queue_capacity);
 	return (void*)(mscg_struct);
 }
 
+// Set up a frame buffer's cell lists used to find nonbonded neighbors for its
+// box and number of sites, unless they are already current. Each frame only
+// repopulates them.
+void set_up_cell_lists(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer)
+{
+	if (frame_buffer->cell_lists_are_current == 1) return;
+	CG_MODEL_DATA *p_cg = mscg_struct->cg;
+	FrameConfig* p_frame_config = frame_buffer->frame_config;
+
+    frame_buffer->pair_cell_list.init(p_cg->pair_nonbonded_interactions.cutoff, p_frame_config->simulation_box_half_lengths, p_frame_config->current_n_sites);
+    if (p_cg->three_body_nonbonded_interactions.class_subtype > 0) {
+        double max_cutoff = 0.0;
+        for (int i = 0; i < p_cg->three_body_nonbonded_interactions.get_n_defined(); i++) {
+            max_cutoff = fmax(max_cutoff, p_cg->three_body_nonbonded_interactions.three_body_nonbonded_cutoffs[i]);
+        }
+        frame_buffer->three_body_cell_list.init(max_cutoff, p_frame_config->simulation_box_half_lengths, p_frame_config->current_n_sites);
+    }
+    frame_buffer->cell_lists_are_current = 1;
+}
+
+// Set a frame buffer's box, marking its cell lists to be set up again if it changed.
+template <typename T> void set_frame_box(FrameBuffer* const frame_buffer, const T* const box_half_lengths)
+{
+	real* simulation_box_half_lengths = frame_buffer->frame_config->simulation_box_half_lengths;
+	for (int i = 0; i < DIMENSION; i++) {
+		if (simulation_box_half_lengths[i] != (real)(box_half_lengths[i])) frame_buffer->cell_lists_are_current = 0;
+		simulation_box_half_lengths[i] = box_half_lengths[i];
+	}
+}
+
+// Match the second frame buffer to the handle's frame before a pipelined batch.
+void set_up_pipeline_frame_buffer(MSCG_struct* const mscg_struct)
+{
+	FrameConfig* p_frame_config = mscg_struct->frame_buffers[0].frame_config;
+	FrameBuffer* pipeline_frame_buffer = &mscg_struct->frame_buffers[1];
+	if ( (pipeline_frame_buffer->frame_config != NULL) && (pipeline_frame_buffer->frame_config->current_n_sites != p_frame_config->current_n_sites) ) {
+		delete pipeline_frame_buffer->frame_config;
+		pipeline_frame_buffer->frame_config = NULL;
+	}
+	if (pipeline_frame_buffer->frame_config == NULL) {
+		pipeline_frame_buffer->frame_config = new FrameConfig(p_frame_config->current_n_sites);
+		pipeline_frame_buffer->cell_lists_are_current = 0;
+	}
+	pipeline_frame_buffer->frame_config->cg_site_types = p_frame_config->cg_site_types;
+	set_frame_box(pipeline_frame_buffer, p_frame_config->simulation_box_half_lengths);
+}
+
+// Copy a frame of a batch into a frame buffer, wrap its positions,
+// and sort them into the buffer's cell lists.
+void prepare_batch_frame(MSCG_struct* const mscg_struct, FrameBuffer* const frame_buffer, double* const x, double* const f, double* const box_half_lengths)
+{
+	FrameConfig* p_frame_config = frame_buffer->frame_config;
+	if (box_half_lengths != NULL) set_frame_box(frame_buffer, box_half_lengths);
+	for (int i = 0; i < p_frame_config->current_n_sites; i++) {
+		for (int j = 0; j < DIMENSION; j++) {
+			p_frame_config->x[i][j] = x[i * DIMENSION + j];
+			p_frame_config->f[i][j] = f[i * DIMENSION + j];
+		}
+	}
+	set_up_cell_lists(mscg_struct, frame_buffer);
+	prepare_frame_for_fm(mscg_struct->cg, p_frame_config, frame_buffer->pair_cell_list, frame_buffer->three_body_cell_list, NULL);
+}
+
+// Make the caller's x and f arrays the current frame. Component j of site i
+// is read from x[i * site_stride + j * component_stride] (and likewise for f).
+// If use_caller_arrays is set and the arrays are already laid out as FrameConfig
+// stores its own, the FrameConfig points into them until detach_frame_arrays is
+// called; otherwise they are copied into the FrameConfig. The caller's x is
+// only used directly if all of its positions already lie in the primary
+// periodic image, so that wrapping the frame never writes to it.
+void attach_frame_arrays(MSCG_struct* const mscg_struct, double* const x, double* const f, const int site_stride, const int component_stride, const bool use_caller_arrays)
+{
+	FrameConfig* p_frame_config = mscg_struct->frame_source->frame_config;
+	if (use_caller_arrays && (sizeof(std::array<frame_real, DIMENSION>) == DIMENSION * sizeof(double)) && (site_stride == DIMENSION) && (component_stride == 1)) {
+		mscg_struct->frame_config_x = p_frame_config->x;
+		mscg_struct->frame_config_f = p_frame_config->f;
+		p_frame_config->f = reinterpret_cast<std::array<frame_real, DIMENSION>*>(f);
+		if (positions_in_primary_image(p_frame_config->current_n_sites, x, p_frame_config->simulation_box_half_lengths)) {
+			p_frame_config->x = reinterpret_cast<std::array<frame_real, DIMENSION>*>(x);
+		} else {
+			for (int i = 0; i < p_frame_config->current_n_sites * DIMENSION; i++) {
+				p_frame_config->x[i / DIMENSION][i % DIMENSION] = x[i];
+			}
+		}
+		return;
+	}
+	
+	for (int i = 0; i < p_frame_config->current_n_sites; i++) {
+		for (int j = 0; j < DIMENSION; j++) {
+			p_frame_config->x[i][j] = x[i * site_stride + j * component_stride];
+			p_frame_config->f[i][j] = f[i * site_stride + j * component_stride];
+		}
+	}
+}
+
+// Check whether get_minimum_image would leave all n_sites positions of the
+// flat array x unchanged.
+bool positions_in_primary_image(const int n_sites, const double* const x, const real* const simulation_box_half_lengths)
+{
+	for (int i = 0; i < n_sites; i++) {
+		for (int j = 0; j < DIMENSION; j++) {
+			if (x[i * DIMENSION + j] < 0 || x[i * DIMENSION + j] >= 2.0 * simulation_box_half_lengths[j]) return false;
+		}
+	}
+	return true;
+}
+
+// Point the FrameConfig back at its own arrays after a frame read in place.
+void detach_frame_arrays(MSCG_struct* const mscg_struct)
+{
+	if (mscg_struct->frame_config_x == NULL) return;
+	FrameConfig* p_frame_config = mscg_struct->frame_source->frame_config;
+	p_frame_config->x = mscg_struct->frame_config_x;
+	p_frame_config->f = mscg_struct->frame_config_f;
+	mscg_struct->frame_config_x = NULL;
+	mscg_struct->frame_config_f = NULL;
+}
+
+// Size an empty queue's slots for the current number of sites.
+void allocate_frame_queue(MSCG_struct* const mscg_struct)
+{
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	queue->frame_size = mscg_struct->frame_buffers[0].frame_config->current_n_sites * DIMENSION;
+	queue->x.resize(queue->capacity * queue->frame_size);
+	queue->f.resize(queue->capacity * queue->frame_size);
+	queue->box_half_lengths.resize(queue->capacity * DIMENSION);
+	queue->weights.resize(queue->capacity);
+	queue->has_weight.resize(queue->capacity);
+	queue->head = 0;
+	queue->n_queued = 0;
+}
+
+// Copy frames into the queue for the builder thread, waiting for free slots
+// as needed. Frames are read with the same layout as mscg_process_frame_strided
+// and stored one after the other in x and f.
+void enqueue_frames(MSCG_struct* const mscg_struct, const int n_frames, double* const x, double* const f, const int site_stride, const int component_stride, double* const box_half_lengths, double* const weights)
+{
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	int n_sites = queue->frame_size / DIMENSION;
+	for (int k = 0; k < n_frames; k++) {
+		std::unique_lock<std::mutex> lock(queue->mutex);
+		queue->changed.wait(lock, [queue]() { return queue->n_queued < queue->capacity; });
+		int slot = (queue->head + queue->n_queued) % queue->capacity;
+		lock.unlock();
+		
+		// The builder does not read the slot until it is counted below.
+		double* frame_x = x + k * queue->frame_size;
+		double* frame_f = f + k * queue->frame_size;
+		double* slot_x = &queue->x[slot * queue->frame_size];
+		double* slot_f = &queue->f[slot * queue->frame_size];
+		if ( (site_stride == DIMENSION) && (component_stride == 1) ) {
+			memcpy(slot_x, frame_x, queue->frame_size * sizeof(double));
+			memcpy(slot_f, frame_f, queue->frame_size * sizeof(double));
+		} else {
+			for (int i = 0; i < n_sites; i++) {
+				for (int j = 0; j < DIMENSION; j++) {
+					slot_x[i * DIMENSION + j] = frame_x[i * site_stride + j * component_stride];
+					slot_f[i * DIMENSION + j] = frame_f[i * site_stride + j * component_stride];
+				}
+			}
+		}
+		if (box_half_lengths != NULL) {
+			for (int i = 0; i < DIMENSION; i++) queue->current_box_half_lengths[i] = box_half_lengths[k * DIMENSION + i];
+		}
+		for (int i = 0; i < DIMENSION; i++) queue->box_half_lengths[slot * DIMENSION + i] = queue->current_box_half_lengths[i];
+		queue->has_weight[slot] = (weights != NULL);
+		if (weights != NULL) queue->weights[slot] = weights[k];
+		
+		lock.lock();
+		queue->n_queued++;
+		queue->changed.notify_all();
+	}
+}
+
+// Process queued frames in order until stop_frame_builder is called and the
+// queue is empty. Consecutive slots are processed together as a run of frames,
+// using at most half of the queue so that new frames can be queued meanwhile.
+void run_frame_builder(MSCG_struct* const mscg_struct)
+{
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	std::unique_lock<std::mutex> lock(queue->mutex);
+	while (true) {
+		queue->changed.wait(lock, [queue]() { return queue->stop || (queue->n_queued > 0); });
+		if (queue->n_queued == 0) return;
+		
+		int first = queue->head;
+		int n_run = std::min(std::min(queue->n_queued, queue->capacity - first), std::max(1, queue->capacity / 2));
+		for (int k = 1; k < n_run; k++) {
+			if (queue->has_weight[first + k] != queue->has_weight[first]) {
+				n_run = k;
+				break;
+			}
+		}
+		double* run_weights = (queue->has_weight[first] != 0) ? &queue->weights[first] : NULL;
+		lock.unlock();
+		process_frame_run(mscg_struct, n_run, &queue->x[first * queue->frame_size], &queue->f[first * queue->frame_size], &queue->box_half_lengths[first * DIMENSION], run_weights);
+		lock.lock();
+		queue->head = (first + n_run) % queue->capacity;
+		queue->n_queued -= n_run;
+		queue->changed.notify_all();
+	}
+}
+
+// Process any queued frames and end the builder thread, leaving async mode.
+void stop_frame_builder(MSCG_struct* const mscg_struct)
+{
+	FrameQueue* queue = &mscg_struct->frame_queue;
+	if (queue->capacity == 0) return;
+	{
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		queue->stop = true;
+	}
+	queue->changed.notify_all();
+	queue->builder.join();
+	queue->capacity = 0;
+}
+
 // Clean-up function after all frames are read.
 void finish_fix_reading(FrameSource *const frame_source)
 {
@@ -692,6 +1179,7 @@ void finish_fix_reading(FrameSource *const frame_source)
 void* setup_topology_and_frame(void* void_in, int const n_cg_sites, int const n_cg_types, char ** type_names, int* cg_site_types, double* box_half_lengths)
 {
 	MSCG_struct* mscg_struct = (MSCG_struct*)(void_in);
+	FileDirectoryScope directory_scope(mscg_struct->directory);
 	CG_MODEL_DATA *p_cg = mscg_struct->cg;
     TopologyData* p_topo_data = &(p_cg->topo_data);
 
@@ -795,20 +1283,11 @@ void* set_bond_topology(void* void_in, unsigned** bond_partners, unsigned* bond_
     CG_MODEL_DATA *p_cg = mscg_struct->cg;
     TopologyData* p_topo_data = &(p_cg->topo_data);
 
-	// Delete pre-allocated arrays before assigning inputs to these pointers.
-	// This should only be done if it is the first time that this function is called.
-	if (p_topo_data->bond_list->modified == 0) {
-		for (int i = 0; i < p_cg->n_cg_sites; i++) delete [] p_topo_data->bond_list->partners_[i];
-		delete [] p_topo_data->bond_list->partners_;
-		delete [] p_topo_data->bond_list->partner_numbers_;
-	}
-	
-	// Indicate that these arrays should no longer be freed by the object delete.
-	p_topo_data->bond_list->modified = 1;	
-	// The number of partners each CG site has for this topological attribute.
-	p_topo_data->bond_list->partners_ = bond_partners;
-	// For a given CG site, it lists the CG site indices of all partnered particles (for this topological attribute).
-	p_topo_data->bond_list->partner_numbers_ = bond_partner_numbers;
+	// Use the caller's arrays in place of the pre-allocated ones,
+	// which are freed the first time that this function is called.
+	// The arrays are no longer freed by the object delete.
+	p_topo_data->bond_list->share_arrays(bond_partners, bond_partner_numbers);
+	p_topo_data->revision++;
 	
 	// Now, look through bond data to determine activation_flags
 	int cg_site1, cg_site2;
@@ -842,20 +1321,11 @@ void* set_angle_topology(void* void_in, unsigned** angle_partners, unsigned* ang
     CG_MODEL_DATA *p_cg = mscg_struct->cg;
     TopologyData* p_topo_data = &(p_cg->topo_data);
 
-	// Delete pre-allocated arrays before assigning inputs to these pointers.
-	// This should only be done if it is the first time that this function is called.
-	if (p_topo_data->angle_list->modified == 0) {
-		for (int i = 0; i < p_cg->n_cg_sites; i++) delete [] p_topo_data->angle_list->partners_[i];
-		delete [] p_topo_data->angle_list->partners_;
-		delete [] p_topo_data->angle_list->partner_numbers_;
-	}
-	
-	// Indicate that these arrays should no longer be freed by the object delete.
-	p_topo_data->angle_list->modified = 1;
-	// The number of partners each CG site has for this topological attribute.
-	p_topo_data->angle_list->partners_ = angle_partners;
-	// For a given CG site, it lists the CG site indices of all partnered particles (for this topological attribute).
-	p_topo_data->angle_list->partner_numbers_ = angle_partner_numbers;
+	// Use the caller's arrays in place of the pre-allocated ones,
+	// which are freed the first time that this function is called.
+	// The arrays are no longer freed by the object delete.
+	p_topo_data->angle_list->share_arrays(angle_partners, angle_partner_numbers);
+	p_topo_data->revision++;
 	
 	// Determine the angle type and set angle_type_activation_flags
 	int cg_site1, cg_site2, cg_site3;
@@ -897,19 +1367,11 @@ void* set_dihedral_topology(void* void_in, unsigned** dihedral_partners, unsigne
     CG_MODEL_DATA *p_cg = mscg_struct->cg;
     TopologyData* p_topo_data = &(p_cg->topo_data);
 
-	// Delete pre-allocated arrays before assigning inputs to these pointers.
-	// This should only be done if it is the first time that this function is called.
-	if (p_topo_data->dihedral_list->modified == 0) {
-		for (int i = 0; i < p_cg->n_cg_sites; i++) delete [] p_topo_data->dihedral_list->partners_[i];
-		delete [] p_topo_data->dihedral_list->partners_;
-		delete [] p_topo_data->dihedral_list->partner_numbers_;
-	}
-	
-	// Indicate that these arrays should no longer be freed by the object delete.
-	p_topo_data->dihedral_list->modified = 1;
-	// The number of partners each CG site has for this topological attribute.
-	p_topo_data->dihedral_list->partners_ = dihedral_partners;
-	p_topo_data->dihedral_list->partner_numbers_ = dihedral_partner_numbers;
+	// Use the caller's arrays in place of the pre-allocated ones,
+	// which are freed the first time that this function is called.
+	// The arrays are no longer freed by the object delete.
+	p_topo_data->dihedral_list->share_arrays(dihedral_partners, dihedral_partner_numbers);
+	p_topo_data->revision++;
 	
 	// Determine the dihedral type and set dihedral_type_activation_flags
 	int cg_site1, cg_site2, cg_site3, cg_site4;
@@ -956,20 +1418,10 @@ void* set_exclusion_topology(void* void_in, unsigned** exclusion_partners, unsig
     CG_MODEL_DATA *p_cg = mscg_struct->cg;
     TopologyData* p_topo_data = &(p_cg->topo_data);
 
-	// Delete pre-allocated arrays before assigning inputs to these pointers.
-	// This should only be done if it is the first time that this function is called.
-	if (p_topo_data->exclusion_list->modified == 0) {
-		for (int i = 0; i < p_cg->n_cg_sites; i++) delete [] p_topo_data->exclusion_list->partners_[i];
-		delete [] p_topo_data->exclusion_list->partners_;
-		delete [] p_topo_data->exclusion_list->partner_numbers_;
-	}
-	
-	// Indicate that these arrays should no longer be freed by the object delete.
-	p_topo_data->exclusion_list->modified = 1;
-	// The number of partners each CG site has for this topological attribute.
-	p_topo_data->exclusion_list->partners_ = exclusion_partners;
-	// For a given CG site, it lists the CG site indices of all partnered particles (for this topological attribute).
-	p_topo_data->exclusion_list->partner_numbers_ = exclusion_partner_numbers;
+	// Use the caller's arrays in place of the pre-allocated ones,
+	// which are freed the first time that this function is called.
+	// The arrays are no longer freed by the object delete.
+	p_topo_data->exclusion_list->share_arrays(exclusion_partners, exclusion_partner_numbers);
 	
 	return (void*)(mscg_struct);
 }
@@ -1069,6 +1521,8 @@ void* generate_angle_dihedral_and_exclusion_topology(void* void_in)
 	}
     printf("Automatically generated dihedral topology; %d dihedrals of %d dihedral types.\n", total_dihedrals/2, calc_n_active_interactions(p_topo_data->dihedral_type_activation_flags, calc_n_distinct_quadruples(p_topo_data->n_cg_types)));
 
+	p_topo_data->revision++;
+	
 	// Generate exclusion topology.
 	setup_excluded_list(p_topo_data, p_topo_data->exclusion_list, p_topo_data->excluded_style);
 	
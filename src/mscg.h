@@ -9,24 +9,29 @@
 // This file provides the library interface to the multi-scale coarse-graining (MS-CG)
 // code, which is also referred to as the force matching (FM) code. 
 // The order in which functions are intended to be called for FM is the following:
-// mscg_startup_part1
+// mscg_startup_part1 (or mscg_startup_part1_in_directory)
 // setup_topology_and_frame
 // setup_bond_topology, setup_angle_topology, and setup_dihedral_topology
 // either setup_exclusion_topology or generate_exclusion_topology
 // mscg_startup_part2
-// mscg_process_frame for each frame
-// mscg_solve_and output.
+// optionally, mscg_set_async to queue frames for a builder thread
+// mscg_process_frame (or mscg_process_frame_strided) for each frame,
+// or mscg_process_frames for batches of frames
+// mscg_solve_and output (or mscg_solve, optionally without output files),
+// then optionally the mscg_get_* functions to retrieve the results.
 // Additional functions are provided for updating or modifying certain information
 // after the data is initially set using one of the functions before or during 
 // mscg_startup_part2.
 
 // The order in which functions are intended to be called for range finding is the following:
-// rangefinder_startup_part1
+// rangefinder_startup_part1 (or rangefinder_startup_part1_in_directory)
 // setup_topology_and_frame
 // setup_bond_topology, setup_angle_topology, and setup_dihedral_topology
 // either setup_exclusion_topology or generate_exclusion_topology
 // rangefinder_startup_part2
-// rangefinder_process_frame for each frame
+// optionally, rangefinder_set_async to queue frames for a builder thread
+// rangefinder_process_frame (or rangefinder_process_frame_strided) for each frame,
+// or rangefinder_process_frames for batches of frames
 // rangefinder_solve_and output.
 
 #include <cassert>
@@ -48,12 +53,33 @@
 
 void* mscg_startup_part1(void* void_in);
 void* rangefinder_startup_part1(void* void_in);
+void* mscg_startup_part1_in_directory(void* void_in, const char* directory);
+void* rangefinder_startup_part1_in_directory(void* void_in, const char* directory);
 void* mscg_startup_part2(void* void_in);
 void* rangefinder_startup_part2(void* void_in);
 void* rangefinder_process_frame(void* void_in, double* const x, double* const f);
 void* mscg_process_frame(void* void_in, double* const x, double* const f);
+void* rangefinder_process_frame_strided(void* void_in, double* const x, double* const f, const int site_stride, const int component_stride);
+void* mscg_process_frame_strided(void* void_in, double* const x, double* const f, const int site_stride, const int component_stride);
+void* rangefinder_process_frames(void* void_in, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights);
+void* mscg_process_frames(void* void_in, const int n_frames, double* const x, double* const f, double* const box_half_lengths, double* const weights);
+void* rangefinder_set_async(void* void_in, const int queue_capacity);
+void* mscg_set_async(void* void_in, const int queue_capacity);
+void* rangefinder_wait(void* void_in);
+void* mscg_wait(void* void_in);
 void* mscg_solve_and_output(void* void_in);
 void* rangefinder_solve_and_output(void* void_in);
+void* mscg_solve(void* void_in, const int write_files);
+
+int mscg_get_n_solution_values(void* void_in);
+void* mscg_get_solution(void* void_in, double* const solution);
+int mscg_get_n_interactions(void* void_in);
+const char* mscg_get_interaction_name(void* void_in, const int index);
+void* mscg_get_interaction_basis(void* void_in, const int index, char* const class_id, int* const basis_type, int* const bspline_k, double* const lower_cutoff, double* const upper_cutoff);
+int mscg_get_n_interaction_coefficients(void* void_in, const int index);
+void* mscg_get_interaction_coefficients(void* void_in, const int index, double* const coeffs);
+int mscg_get_interaction_table_size(void* void_in, const int index);
+void* mscg_get_interaction_table(void* void_in, const int index, double* const axis_vals, double* const potential_vals, double* const force_vals);
 
 void* setup_frame_config(void* void_in, const int n_cg_sites, int * cg_site_types, double* box_half_lengths);
 void* update_frame_config(void* void_in, const int n_cg_sites, int * cg_site_types, double* box_half_lengths);
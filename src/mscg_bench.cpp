@@ -0,0 +1,822 @@
+//
+//  mscg_bench.cpp
+//
+//  The driver times the kernels of force matching and complete FM runs
+//  on synthetic systems generated in memory, then writes the timings as
+//  JSON so that they can be compared between builds and releases.
+//
+//  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <ftw.h>
+#include <unistd.h>
+
+#include "control_input.h"
+#include "external_matrix_routines.h"
+#include "force_computation.h"
+#include "fm_output.h"
+#include "geometry.h"
+#include "interaction_model.h"
+#include "matrix.h"
+#include "misc.h"
+#include "performance.h"
+#include "topology.h"
+#include "trajectory_input.h"
+
+const uint_fast32_t BENCH_RANDOM_SEED = 20160427;
+const double BENCH_JITTER_FRACTION = 0.1;		// Largest displacement of a site from its lattice position, in lattice spacings
+const double BENCH_BOND_CONSTANT = 100.0;		// Harmonic bond force constant of the bead-spring chains
+const size_t BENCH_MAX_RECORDED_PAIRS = 1 << 21;
+
+//-------------------------------------------------------------
+// Synthetic systems
+//-------------------------------------------------------------
+
+// Each system is a single site type on a jittered simple cubic lattice,
+// with target forces from a truncated Lennard-Jones potential (and, for the
+// bead-spring chains, harmonic bonds). Sites are numbered along a path
+// through the lattice that only ever steps to a neighboring lattice site,
+// so consecutive sites can be bonded into chains without overlaps.
+
+struct SyntheticSystemSpec {
+	const char* name;
+	double number_density;
+	int chain_length;					// Sites per molecule; 1 for simple liquids
+	double lj_sigma;
+	double pair_cutoff;					// Cutoff of both the target forces and the FM pair basis
+	double pair_lower_cutoff;
+	double pair_resolution;
+	double three_body_cutoff;			// Stillinger-Weber cutoff; 0 for no three-body interactions
+};
+
+static const SyntheticSystemSpec SYNTHETIC_SYSTEM_SPECS[] = {
+	{"lj", 0.8, 1, 1.0, 2.5, 0.6, 0.05, 0.0},				// Lennard-Jones liquid in reduced units
+	{"polymer", 0.85, 10, 1.0, 2.5, 0.6, 0.05, 0.0},		// Bead-spring chains of 10 beads with bonds and angles
+	{"water", 0.0334, 1, 2.8, 7.0, 1.8, 0.1, 3.7}			// One-site water with Stillinger-Weber three-body interactions (Angstroms)
+};
+static const int N_SYNTHETIC_SYSTEMS = sizeof(SYNTHETIC_SYSTEM_SPECS) / sizeof(SyntheticSystemSpec);
+
+struct SyntheticSystem {
+	SyntheticSystemSpec spec;
+	int n_sites;
+	int n_molecules;
+	int sites_per_side;
+	double lattice_spacing;
+	double box_length;
+	std::vector< std::vector< std::array<frame_real, DIMENSION> > > x;		// Positions of every frame
+	std::vector< std::vector< std::array<frame_real, DIMENSION> > > f;		// Target forces of every frame
+};
+
+// Solver configurations run end to end; each adds its lines to control.in.
+
+struct BenchSolver {
+	const char* name;
+	int matrix_type;
+	const char* control_lines;
+};
+
+static const BenchSolver BENCH_SOLVERS[] = {
+	{"fm_dense_svd", 0, ""},
+	{"fm_dense_tikhonov", 0, "regularization_style 1\nregularization_scalar 0.001\n"},
+	{"fm_dense_bayesian", 0, "bayesian_mscg_flag 1\nbayesian_max_iterations 5\n"},
+	{"fm_accumulation_qr", 2, ""},
+#if _mkl_flag == 1
+	{"fm_sparse", 1, ""},
+	{"fm_sparse_normal", 3, ""},
+	{"fm_sparse_sparse", 4, ""},
+#endif
+};
+static const int N_BENCH_SOLVERS = sizeof(BENCH_SOLVERS) / sizeof(BenchSolver);
+
+static const char* const FM_PHASE_NAMES[] = {"setup", "frames", "end_of_block", "solve", "output"};
+static const int N_FM_PHASES = sizeof(FM_PHASE_NAMES) / sizeof(char*);
+
+//-------------------------------------------------------------
+// Settings, models, and results
+//-------------------------------------------------------------
+
+struct BenchSettings {
+	int n_sites;
+	int n_frames;
+	int n_repeats;
+	int n_threads;
+	int keep_scratch_flag;
+	std::vector<int> systems;				// Indices into SYNTHETIC_SYSTEM_SPECS
+	std::string output_filename;
+	std::string log_filename;
+};
+
+// Everything newfm sets up for a calculation, built from the input files in
+// the current directory.
+
+struct BenchModel {
+	ControlInputs* control_input;
+	CG_MODEL_DATA* cg;
+	FrameSource* frame_source;
+	MATRIX_DATA* mat;
+	PairCellList pair_cell_list;
+	ThreeBCellList three_body_cell_list;
+};
+
+struct BenchResult {
+	std::string system;
+	std::string name;
+	std::string kind;						// "kernel" or "end_to_end"
+	double work;							// Amount of work done in each repetition, in work_unit
+	std::string work_unit;
+	std::vector<double> times;				// Wall time of each repetition
+	std::vector< std::vector<double> > phase_times;		// Wall time of each phase of each repetition (end_to_end only)
+	std::vector< std::pair<std::string, uint64_t> > counters;
+};
+
+struct RecordedPair {
+	int k;
+	int l;
+	double distance;
+};
+
+// State shared with the neighbor-walk callback.
+static uint64_t bench_pairs_in_cutoff;
+static std::vector<RecordedPair>* bench_recorded_pairs = NULL;
+
+// Internal prototypes.
+
+void report_bench_usage_error(const char* program_name);
+void parse_bench_arguments(const int argc, char* argv[], BenchSettings& settings);
+void set_up_synthetic_system(SyntheticSystem& system, const SyntheticSystemSpec& spec, const int n_sites_requested, const int n_frames);
+void calculate_reference_forces(const SyntheticSystem& system, const std::vector< std::array<frame_real, DIMENSION> >& x, std::vector< std::array<frame_real, DIMENSION> >& f);
+void write_bench_input_files(const SyntheticSystem& system, const BenchSettings& settings, const int matrix_type, const char* control_lines);
+void set_up_bench_model(BenchModel& model, const SyntheticSystem& system);
+void free_bench_model(BenchModel& model);
+void load_bench_frame(BenchModel& model, const SyntheticSystem& system, const int frame);
+void count_pair_in_cutoff(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths, MATRIX_DATA* const mat);
+void run_bench_kernels(const SyntheticSystem& system, const BenchSettings& settings, std::vector<BenchResult>& results, std::vector<int>& model_dimensions);
+void run_bench_fm(const SyntheticSystem& system, const BenchSettings& settings, const BenchSolver& solver, BenchResult& result);
+void summarize_times(const std::vector<double>& times, double& min_time, double& median_time, double& mean_time, double& max_time);
+void write_bench_json(const BenchSettings& settings, const std::vector<SyntheticSystem*>& systems, const std::vector< std::vector<int> >& dimensions, const std::vector<BenchResult>& results);
+int remove_scratch_entry(const char* path, const struct stat* status, int type, struct FTW* ftw_buffer);
+
+int main(int argc, char* argv[])
+{
+	BenchSettings settings;
+	parse_bench_arguments(argc, argv, settings);
+
+	// The library reads its inputs from the working directory, so each
+	// calculation's control.in, top.in, and range files are written to a
+	// scratch directory. Library output goes to the log file.
+	char original_directory[4096];
+	if (getcwd(original_directory, sizeof(original_directory)) == NULL) {
+		fprintf(stderr, "Failed to determine the working directory.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (settings.output_filename[0] != '/') settings.output_filename = std::string(original_directory) + "/" + settings.output_filename;
+	if (settings.log_filename[0] != '/') settings.log_filename = std::string(original_directory) + "/" + settings.log_filename;
+	const char* tmpdir = getenv("TMPDIR");
+	std::string scratch_template = std::string((tmpdir != NULL) ? tmpdir : "/tmp") + "/mscg_bench.XXXXXX";
+	std::vector<char> scratch_directory(scratch_template.begin(), scratch_template.end());
+	scratch_directory.push_back('\0');
+	if (mkdtemp(&scratch_directory[0]) == NULL || chdir(&scratch_directory[0]) != 0) {
+		fprintf(stderr, "Failed to create a scratch directory from %s.\n", scratch_template.c_str());
+		exit(EXIT_FAILURE);
+	}
+	fprintf(stderr, "Working in %s; library output is written to %s.\n", &scratch_directory[0], settings.log_filename.c_str());
+	if (freopen(settings.log_filename.c_str(), "w", stdout) == NULL) {
+		fprintf(stderr, "Failed to open log file %s.\n", settings.log_filename.c_str());
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<SyntheticSystem*> systems;
+	std::vector< std::vector<int> > dimensions;
+	std::vector<BenchResult> results;
+	for (unsigned s = 0; s < settings.systems.size(); s++) {
+		SyntheticSystem* system = new SyntheticSystem;
+		set_up_synthetic_system(*system, SYNTHETIC_SYSTEM_SPECS[settings.systems[s]], settings.n_sites, settings.n_frames);
+		fprintf(stderr, "System %s: %d sites in a box of side %g, %d frames.\n", system->spec.name, system->n_sites, system->box_length, settings.n_frames);
+		systems.push_back(system);
+
+		// Kernels in isolation.
+		std::vector<int> model_dimensions;
+		unsigned first_result = results.size();
+		run_bench_kernels(*system, settings, results, model_dimensions);
+		dimensions.push_back(model_dimensions);
+
+		// Complete force matching with each solver.
+		for (int i = 0; i < N_BENCH_SOLVERS; i++) {
+			BenchResult result;
+			run_bench_fm(*system, settings, BENCH_SOLVERS[i], result);
+			results.push_back(result);
+		}
+
+		for (unsigned i = first_result; i < results.size(); i++) {
+			double min_time, median_time, mean_time, max_time;
+			summarize_times(results[i].times, min_time, median_time, mean_time, max_time);
+			fprintf(stderr, "  %-24s %12.6f s (min %.6f s)\n", results[i].name.c_str(), median_time, min_time);
+		}
+	}
+
+	write_bench_json(settings, systems, dimensions, results);
+	fprintf(stderr, "Wrote %s.\n", settings.output_filename.c_str());
+
+	if (chdir(original_directory) != 0) {
+		fprintf(stderr, "Failed to return to %s.\n", original_directory);
+		exit(EXIT_FAILURE);
+	}
+	if (settings.keep_scratch_flag == 0) nftw(&scratch_directory[0], remove_scratch_entry, 16, FTW_DEPTH | FTW_PHYS);
+	for (unsigned s = 0; s < systems.size(); s++) delete systems[s];
+	return 0;
+}
+
+//-------------------------------------------------------------
+// Command line
+//-------------------------------------------------------------
+
+void report_bench_usage_error(const char* program_name)
+{
+	fprintf(stderr, "Usage: %s [-n sites] [-f frames] [-r repeats] [-t threads] [-s systems] [-o output.json] [-l log] [-k]\n", program_name);
+	fprintf(stderr, "  -n  approximate number of sites in each system (default 1000)\n");
+	fprintf(stderr, "  -f  number of frames (default 10)\n");
+	fprintf(stderr, "  -r  repetitions of each benchmark (default 3)\n");
+	fprintf(stderr, "  -t  num_threads for the FM routines; 0 uses all cores (default 0)\n");
+	fprintf(stderr, "  -s  comma-separated systems from lj, polymer, and water (default all)\n");
+	fprintf(stderr, "  -o  JSON results file (default mscg_bench.json)\n");
+	fprintf(stderr, "  -l  file collecting the output of the FM routines (default mscg_bench.log)\n");
+	fprintf(stderr, "  -k  keep the scratch directory\n");
+	exit(EXIT_FAILURE);
+}
+
+void parse_bench_arguments(const int argc, char* argv[], BenchSettings& settings)
+{
+	std::string system_list = "lj,polymer,water";
+	settings.n_sites = 1000;
+	settings.n_frames = 10;
+	settings.n_repeats = 3;
+	settings.n_threads = 0;
+	settings.keep_scratch_flag = 0;
+	settings.output_filename = "mscg_bench.json";
+	settings.log_filename = "mscg_bench.log";
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-k") == 0) {
+			settings.keep_scratch_flag = 1;
+			continue;
+		}
+		if (i + 1 >= argc || strlen(argv[i]) != 2 || argv[i][0] != '-') report_bench_usage_error(argv[0]);
+		const char* value = argv[++i];
+		switch (argv[i - 1][1]) {
+			case 'n': settings.n_sites = atoi(value); break;
+			case 'f': settings.n_frames = atoi(value); break;
+			case 'r': settings.n_repeats = atoi(value); break;
+			case 't': settings.n_threads = atoi(value); break;
+			case 's': system_list = value; break;
+			case 'o': settings.output_filename = value; break;
+			case 'l': settings.log_filename = value; break;
+			default: report_bench_usage_error(argv[0]);
+		}
+	}
+	if (settings.n_sites <= 0 || settings.n_frames <= 0 || settings.n_repeats <= 0 || settings.n_threads < 0) report_bench_usage_error(argv[0]);
+
+	size_t start = 0;
+	while (start <= system_list.size()) {
+		size_t end = system_list.find(',', start);
+		if (end == std::string::npos) end = system_list.size();
+		std::string name = system_list.substr(start, end - start);
+		int found = -1;
+		for (int i = 0; i < N_SYNTHETIC_SYSTEMS; i++) {
+			if (name == SYNTHETIC_SYSTEM_SPECS[i].name) found = i;
+		}
+		if (found < 0) {
+			fprintf(stderr, "Unknown system %s.\n", name.c_str());
+			report_bench_usage_error(argv[0]);
+		}
+		settings.systems.push_back(found);
+		start = end + 1;
+	}
+}
+
+//-------------------------------------------------------------
+// Generating systems
+//-------------------------------------------------------------
+
+void set_up_synthetic_system(SyntheticSystem& system, const SyntheticSystemSpec& spec, const int n_sites_requested, const int n_frames)
+{
+	system.spec = spec;
+	system.n_molecules = (n_sites_requested + spec.chain_length - 1) / spec.chain_length;
+	system.n_sites = system.n_molecules * spec.chain_length;
+	system.sites_per_side = (int)ceil(cbrt((double)system.n_sites) - 1.0e-9);
+	system.lattice_spacing = cbrt(1.0 / spec.number_density);
+	system.box_length = system.sites_per_side * system.lattice_spacing;
+	if (spec.pair_cutoff > 0.5 * system.box_length) {
+		fprintf(stderr, "The %s system needs more sites for its box to be twice as wide as the cutoff %g.\n", spec.name, spec.pair_cutoff);
+		exit(EXIT_FAILURE);
+	}
+
+	// Lattice positions, visited row by row with the direction of travel
+	// reversed on alternate rows and layers.
+	int m = system.sites_per_side;
+	double a = system.lattice_spacing;
+	std::vector< std::array<double, DIMENSION> > lattice(system.n_sites);
+	for (int i = 0; i < system.n_sites; i++) {
+		int ix = i % m;
+		int iy = (i / m) % m;
+		int iz = i / (m * m);
+		if ((i / m) % 2 == 1) ix = m - 1 - ix;
+		if (iz % 2 == 1) iy = m - 1 - iy;
+		lattice[i][0] = (ix + 0.5) * a;
+		lattice[i][1] = (iy + 0.5) * a;
+		lattice[i][2] = (iz + 0.5) * a;
+	}
+
+	std::mt19937 rng(BENCH_RANDOM_SEED);
+	std::uniform_real_distribution<double> jitter(-BENCH_JITTER_FRACTION * a, BENCH_JITTER_FRACTION * a);
+	system.x.resize(n_frames);
+	system.f.resize(n_frames);
+	for (int frame = 0; frame < n_frames; frame++) {
+		system.x[frame].resize(system.n_sites);
+		for (int i = 0; i < system.n_sites; i++) {
+			for (int d = 0; d < DIMENSION; d++) {
+				double position = lattice[i][d] + jitter(rng);
+				if (position < 0.0) position += system.box_length;
+				else if (position >= system.box_length) position -= system.box_length;
+				system.x[frame][i][d] = position;
+			}
+		}
+		calculate_reference_forces(system, system.x[frame], system.f[frame]);
+	}
+}
+
+// Truncated Lennard-Jones forces found with a cell list, excluding sites
+// separated by one or two bonds, plus harmonic bond forces.
+
+void calculate_reference_forces(const SyntheticSystem& system, const std::vector< std::array<frame_real, DIMENSION> >& x, std::vector< std::array<frame_real, DIMENSION> >& f)
+{
+	const SyntheticSystemSpec& spec = system.spec;
+	double box = system.box_length;
+	double cutoff2 = spec.pair_cutoff * spec.pair_cutoff;
+	double sigma2 = spec.lj_sigma * spec.lj_sigma;
+	int n_cells = std::max(1, (int)(box / spec.pair_cutoff));
+	std::vector<int> head(n_cells * n_cells * n_cells, -1);
+	std::vector<int> next(system.n_sites);
+	std::vector< std::array<int, DIMENSION> > site_cells(system.n_sites);
+
+	for (int i = 0; i < system.n_sites; i++) {
+		for (int d = 0; d < DIMENSION; d++) site_cells[i][d] = std::min(n_cells - 1, (int)(x[i][d] / box * n_cells));
+		int cell = (site_cells[i][2] * n_cells + site_cells[i][1]) * n_cells + site_cells[i][0];
+		next[i] = head[cell];
+		head[cell] = i;
+	}
+
+	f.assign(system.n_sites, std::array<frame_real, DIMENSION>());
+	std::vector<int> neighbor_cells;
+	for (int i = 0; i < system.n_sites; i++) {
+		// Boxes less than three cells wide would visit some cells twice.
+		neighbor_cells.clear();
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					int cx = (site_cells[i][0] + dx + n_cells) % n_cells;
+					int cy = (site_cells[i][1] + dy + n_cells) % n_cells;
+					int cz = (site_cells[i][2] + dz + n_cells) % n_cells;
+					neighbor_cells.push_back((cz * n_cells + cy) * n_cells + cx);
+				}
+			}
+		}
+		std::sort(neighbor_cells.begin(), neighbor_cells.end());
+		neighbor_cells.erase(std::unique(neighbor_cells.begin(), neighbor_cells.end()), neighbor_cells.end());
+
+		for (unsigned c = 0; c < neighbor_cells.size(); c++) {
+			for (int j = head[neighbor_cells[c]]; j >= 0; j = next[j]) {
+				if (j == i) continue;
+				if (spec.chain_length > 1 && i / spec.chain_length == j / spec.chain_length && abs(i - j) <= 2) continue;
+				double dist[DIMENSION];
+				double r2 = 0.0;
+				for (int d = 0; d < DIMENSION; d++) {
+					dist[d] = x[i][d] - x[j][d];
+					dist[d] -= box * round(dist[d] / box);
+					r2 += dist[d] * dist[d];
+				}
+				if (r2 >= cutoff2) continue;
+				double s6 = sigma2 * sigma2 * sigma2 / (r2 * r2 * r2);
+				double prefactor = 24.0 * (2.0 * s6 * s6 - s6) / r2;
+				for (int d = 0; d < DIMENSION; d++) f[i][d] += prefactor * dist[d];
+			}
+		}
+	}
+
+	// Bonds between consecutive sites of each chain.
+	if (spec.chain_length == 1) return;
+	for (int i = 0; i + 1 < system.n_sites; i++) {
+		if ((i + 1) % spec.chain_length == 0) continue;
+		double dist[DIMENSION];
+		double r2 = 0.0;
+		for (int d = 0; d < DIMENSION; d++) {
+			dist[d] = x[i][d] - x[i + 1][d];
+			dist[d] -= box * round(dist[d] / box);
+			r2 += dist[d] * dist[d];
+		}
+		double r = sqrt(r2);
+		double prefactor = -BENCH_BOND_CONSTANT * (r - system.lattice_spacing) / r;
+		for (int d = 0; d < DIMENSION; d++) {
+			f[i][d] += prefactor * dist[d];
+			f[i + 1][d] -= prefactor * dist[d];
+		}
+	}
+}
+
+// Write control.in, top.in, rmin.in, and rmin_b.in for a calculation on a system.
+
+void write_bench_input_files(const SyntheticSystem& system, const BenchSettings& settings, const int matrix_type, const char* control_lines)
+{
+	const SyntheticSystemSpec& spec = system.spec;
+
+	FILE* control_file = open_file("control.in", "w");
+	fprintf(control_file, "block_size 1\nstart_frame 1\nn_frames %d\n", settings.n_frames);
+	fprintf(control_file, "nonbonded_cutoff %g\nbasis_type 0\nprimary_output_style 0\n", spec.pair_cutoff);
+	fprintf(control_file, "output_solution_flag 0\noutput_spline_coeffs_flag 0\n");
+	fprintf(control_file, "pair_nonbonded_bspline_basis_order 4\npair_nonbonded_basis_set_resolution %g\npair_nonbonded_output_binwidth %g\n", spec.pair_resolution, 0.2 * spec.pair_resolution);
+	if (spec.chain_length > 1) {
+		fprintf(control_file, "pair_bond_bspline_basis_order 4\npair_bond_basis_set_resolution 0.02\npair_bond_output_binwidth 0.01\n");
+		fprintf(control_file, "angle_bspline_basis_order 4\nangle_basis_set_resolution 5.0\nangle_output_binwidth 1.0\n");
+	}
+	if (spec.three_body_cutoff > 0.0) {
+		fprintf(control_file, "three_body_nonbonded_style 2\nthree_body_nonbonded_exclusion_type 0\nthree_body_nonbonded_bspline_basis_order 4\nthree_body_nonbonded_basis_set_resolution 5.0\nthree_body_nonbonded_output_binwidth 1.0\nstillinger_weber_gamma 1.2\n");
+	}
+	fprintf(control_file, "excluded_style 2\nnum_threads %d\nmatrix_type %d\n%s", settings.n_threads, matrix_type, control_lines);
+	fclose(control_file);
+
+	FILE* topology_file = open_file("top.in", "w");
+	fprintf(topology_file, "cgsites %d\ncgtypes 1\n%s\n", system.n_sites, spec.name);
+	if (spec.three_body_cutoff > 0.0) fprintf(topology_file, "threebody 1\n1 1 1 %.9f %g\n", -1.0 / 3.0, spec.three_body_cutoff);
+	fprintf(topology_file, "moltypes 1\nmol %d %d\nsitetypes\n", spec.chain_length, (spec.chain_length > 1) ? 2 : 1);
+	for (int i = 0; i < spec.chain_length; i++) fprintf(topology_file, "1\n");
+	fprintf(topology_file, "bonds %d\n", spec.chain_length - 1);
+	for (int i = 1; i < spec.chain_length; i++) fprintf(topology_file, "%d %d\n", i, i + 1);
+	fprintf(topology_file, "system 1\n1 %d\n", system.n_molecules);
+	fclose(topology_file);
+
+	FILE* range_file = open_file("rmin.in", "w");
+	fprintf(range_file, "1 1 %g %g fm\n", spec.pair_lower_cutoff, spec.pair_cutoff);
+	fclose(range_file);
+
+	FILE* bonded_range_file = open_file("rmin_b.in", "w");
+	if (spec.chain_length > 1) {
+		fprintf(bonded_range_file, "1 1 %g %g fm\n", 0.5 * system.lattice_spacing, 1.5 * system.lattice_spacing);
+		fprintf(bonded_range_file, "1 1 1 30.0 180.0 fm\n");
+	}
+	fclose(bonded_range_file);
+}
+
+//-------------------------------------------------------------
+// Setting up calculations
+//-------------------------------------------------------------
+
+// Read the input files in the current directory and initialize the model,
+// matrix, and cell lists as newfm does, with an empty frame in place of a
+// trajectory.
+
+void set_up_bench_model(BenchModel& model, const SyntheticSystem& system)
+{
+	model.control_input = new ControlInputs;
+	model.cg = new CG_MODEL_DATA(model.control_input);
+	model.frame_source = new FrameSource;
+	copy_control_inputs_to_frd(model.control_input, model.frame_source);
+	read_topology_file(&model.cg->topo_data, model.cg);
+	read_all_interaction_ranges(model.cg);
+
+	model.frame_source->frame_config = new FrameConfig(system.n_sites, model.cg->topo_data.cg_site_types);
+	for (int d = 0; d < DIMENSION; d++) model.frame_source->frame_config->simulation_box_half_lengths[d] = 0.5 * system.box_length;
+
+	set_up_force_computers(model.cg);
+	model.mat = new MATRIX_DATA(model.control_input, model.cg);
+	model.mat->accumulation_row_shift = 0;
+	model.mat->trajectory_block_index = 0;
+
+	model.pair_cell_list = PairCellList();
+	model.three_body_cell_list = ThreeBCellList();
+	model.pair_cell_list.init(model.cg->pair_nonbonded_interactions.cutoff, model.frame_source);
+	if (model.cg->three_body_nonbonded_interactions.class_subtype > 0) {
+		double max_cutoff = 0.0;
+		for (int i = 0; i < model.cg->three_body_nonbonded_interactions.get_n_defined(); i++) {
+			max_cutoff = fmax(max_cutoff, model.cg->three_body_nonbonded_interactions.three_body_nonbonded_cutoffs[i]);
+		}
+		model.three_body_cell_list.init(max_cutoff, model.frame_source);
+	}
+}
+
+void free_bench_model(BenchModel& model)
+{
+	delete model.mat;
+	delete model.frame_source->frame_config;
+	delete model.frame_source;
+	delete model.cg;
+	delete model.control_input;
+}
+
+void load_bench_frame(BenchModel& model, const SyntheticSystem& system, const int frame)
+{
+	FrameConfig* frame_config = model.frame_source->frame_config;
+	memcpy(frame_config->x, &system.x[frame][0], system.n_sites * sizeof(std::array<frame_real, DIMENSION>));
+	memcpy(frame_config->f, &system.f[frame][0], system.n_sites * sizeof(std::array<frame_real, DIMENSION>));
+}
+
+//-------------------------------------------------------------
+// Benchmarks
+//-------------------------------------------------------------
+
+// Stand-in for the matrix element calculation of a pair: count the pairs
+// within the cutoff and, on request, record those within the basis range.
+
+void count_pair_in_cutoff(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real* simulation_box_half_lengths, MATRIX_DATA* const mat)
+{
+	int particle_ids[2] = {info->k, info->l};
+	double distance2;
+	calc_squared_distance(particle_ids, x, simulation_box_half_lengths, distance2);
+	if (distance2 >= info->cutoff2) return;
+	bench_pairs_in_cutoff++;
+	if (bench_recorded_pairs == NULL || bench_recorded_pairs->size() >= BENCH_MAX_RECORDED_PAIRS) return;
+	double distance = sqrt(distance2);
+	int index_among_defined = info->index_among_defined_intrxns;
+	if (distance < info->ispec->lower_cutoffs[index_among_defined] || distance > info->ispec->upper_cutoffs[index_among_defined]) return;
+	RecordedPair pair = {info->k, info->l, distance};
+	bench_recorded_pairs->push_back(pair);
+}
+
+// Time the hot kernels of matrix construction one at a time: building cell
+// lists, walking them for pairs, evaluating basis functions, inserting
+// elements into each kind of FM matrix, a full frame of matrix construction,
+// and the end-of-frame dsyrk that forms the dense normal equations.
+
+void run_bench_kernels(const SyntheticSystem& system, const BenchSettings& settings, std::vector<BenchResult>& results, std::vector<int>& model_dimensions)
+{
+	int n_frames = settings.n_frames;
+	write_bench_input_files(system, settings, 0, "");
+	BenchModel model;
+	set_up_bench_model(model, system);
+	MATRIX_DATA* mat = model.mat;
+	CG_MODEL_DATA* cg = model.cg;
+	InteractionClassComputer* pair_computer = &cg->pair_nonbonded_computer;
+	model_dimensions.push_back(mat->fm_matrix_rows);
+	model_dimensions.push_back(mat->fm_matrix_columns);
+
+	BenchResult base_result;
+	base_result.system = system.spec.name;
+	base_result.kind = "kernel";
+	base_result.counters.clear();
+
+	// Cell list construction.
+	BenchResult cell_list_result = base_result;
+	cell_list_result.name = "cell_list";
+	cell_list_result.work = (double)system.n_sites * n_frames;
+	cell_list_result.work_unit = "sites";
+	std::vector<PairCellList> frame_cell_lists(n_frames, model.pair_cell_list);
+	for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+		double elapsed = 0.0;
+		for (int frame = 0; frame < n_frames; frame++) {
+			std::array<frame_real, DIMENSION>* x = const_cast<std::array<frame_real, DIMENSION>*>(&system.x[frame][0]);
+			double start_time = get_wall_time();
+			frame_cell_lists[frame].populateList(system.n_sites, x);
+			if (cg->three_body_nonbonded_interactions.class_subtype > 0) model.three_body_cell_list.populateList(system.n_sites, x);
+			elapsed += get_wall_time() - start_time;
+		}
+		cell_list_result.times.push_back(elapsed);
+	}
+	results.push_back(cell_list_result);
+
+	// Walking the pair cell lists.
+	BenchResult walk_result = base_result;
+	walk_result.name = "neighbor_walk";
+	walk_result.work_unit = "pairs_in_cutoff";
+	std::vector<RecordedPair> recorded_pairs;
+	for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+		bench_pairs_in_cutoff = 0;
+		bench_recorded_pairs = (repeat == 0) ? &recorded_pairs : NULL;
+		double elapsed = 0.0;
+		for (int frame = 0; frame < n_frames; frame++) {
+			std::array<frame_real, DIMENSION>* x = const_cast<std::array<frame_real, DIMENSION>*>(&system.x[frame][0]);
+			double start_time = get_wall_time();
+			pair_computer->walk_neighbor_list(mat, count_pair_in_cutoff, cg->n_cg_types, cg->topo_data, frame_cell_lists[frame], x, model.frame_source->frame_config->simulation_box_half_lengths);
+			elapsed += get_wall_time() - start_time;
+		}
+		walk_result.times.push_back(elapsed);
+		walk_result.work = (double)bench_pairs_in_cutoff;
+	}
+	bench_recorded_pairs = NULL;
+	results.push_back(walk_result);
+
+	// Basis function evaluation at the recorded pair distances.
+	BenchResult basis_result = base_result;
+	basis_result.name = "basis_evaluation";
+	basis_result.work = (double)recorded_pairs.size();
+	basis_result.work_unit = "evaluations";
+	std::vector<double> basis_fn_vals = pair_computer->fm_basis_fn_vals;
+	std::vector<int> first_nonzero_basis_indices(recorded_pairs.size());
+	for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+		double start_time = get_wall_time();
+		for (unsigned p = 0; p < recorded_pairs.size(); p++) {
+			pair_computer->fm_s_comp->calculate_basis_fn_vals(0, recorded_pairs[p].distance, first_nonzero_basis_indices[p], basis_fn_vals);
+		}
+		basis_result.times.push_back(get_wall_time() - start_time);
+	}
+	results.push_back(basis_result);
+
+	// Insertion of the recorded pairs' matrix elements into each kind of matrix.
+	int basis_columns = pair_computer->ispec->interaction_column_indices[1] - pair_computer->ispec->interaction_column_indices[0];
+	int ref_column = pair_computer->interaction_class_column_index + pair_computer->ispec->interaction_column_indices[0];
+	std::vector<int> insertion_rows;
+	std::vector<int> insertion_columns;
+	for (unsigned p = 0; p < recorded_pairs.size(); p++) {
+		for (unsigned b = 0; b < basis_fn_vals.size(); b++) {
+			int column = ref_column + (first_nonzero_basis_indices[p] + b) % basis_columns;
+			insertion_rows.push_back(recorded_pairs[p].k);
+			insertion_columns.push_back(column);
+			insertion_rows.push_back(recorded_pairs[p].l);
+			insertion_columns.push_back(column);
+		}
+	}
+	std::vector<int> insertion_matrix_types;
+	insertion_matrix_types.push_back(0);
+	insertion_matrix_types.push_back(2);
+#if _mkl_flag == 1
+	insertion_matrix_types.push_back(1);
+#endif
+	for (unsigned t = 0; t < insertion_matrix_types.size(); t++) {
+		BenchModel insertion_model;
+		MATRIX_DATA* insertion_mat = mat;
+		if (insertion_matrix_types[t] != 0) {
+			write_bench_input_files(system, settings, insertion_matrix_types[t], "");
+			set_up_bench_model(insertion_model, system);
+			insertion_mat = insertion_model.mat;
+		}
+		BenchResult insertion_result = base_result;
+		insertion_result.name = (insertion_matrix_types[t] == 0) ? "insert_dense" : (insertion_matrix_types[t] == 2) ? "insert_accumulation" : "insert_sparse";
+		insertion_result.work = (double)insertion_rows.size();
+		insertion_result.work_unit = "matrix_elements";
+		double element[DIMENSION] = {0.1, -0.2, 0.3};
+		for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+			(*insertion_mat->set_fm_matrix_to_zero)(insertion_mat);
+			double start_time = get_wall_time();
+			for (unsigned e = 0; e < insertion_rows.size(); e++) {
+				(*insertion_mat->accumulate_fm_matrix_element)(insertion_rows[e], insertion_columns[e], element, insertion_mat);
+			}
+			insertion_result.times.push_back(get_wall_time() - start_time);
+		}
+		results.push_back(insertion_result);
+		if (insertion_matrix_types[t] != 0) free_bench_model(insertion_model);
+	}
+
+	// Complete construction of the dense FM matrix for each frame, followed
+	// by an untimed pass collecting the work counters.
+	BenchResult frame_result = base_result;
+	frame_result.name = "frame_fm_matrix";
+	frame_result.work = (double)n_frames;
+	frame_result.work_unit = "frames";
+	for (int repeat = 0; repeat <= settings.n_repeats; repeat++) {
+		PerformanceProfile* profile = (repeat == settings.n_repeats) ? new PerformanceProfile(1) : NULL;
+		mat->profile = profile;
+		(*mat->set_fm_matrix_to_zero)(mat);
+		double elapsed = 0.0;
+		for (int frame = 0; frame < n_frames; frame++) {
+			load_bench_frame(model, system, frame);
+			double start_time = get_wall_time();
+			calculate_frame_fm_matrix(cg, mat, model.frame_source->frame_config, model.pair_cell_list, model.three_body_cell_list, 0);
+			elapsed += get_wall_time() - start_time;
+		}
+		if (profile == NULL) {
+			frame_result.times.push_back(elapsed);
+		} else {
+			for (int i = 0; i < kNumCounters; i++) frame_result.counters.push_back(std::make_pair(std::string(get_performance_counter_name((PerformanceCounter)i)), profile->counters[i]));
+			mat->profile = NULL;
+			delete profile;
+		}
+	}
+	results.push_back(frame_result);
+
+	// Accumulation of the dense normal equations (dsyrk) for each frame.
+	BenchResult normal_form_result = base_result;
+	normal_form_result.name = "normal_form_dsyrk";
+	normal_form_result.work = (double)n_frames * mat->fm_matrix_rows * mat->fm_matrix_columns * (mat->fm_matrix_columns + 1.0);
+	normal_form_result.work_unit = "flops";
+	for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+		double start_time = get_wall_time();
+		for (int frame = 0; frame < n_frames; frame++) (*mat->do_end_of_frameblock_matrix_manipulations)(mat);
+		normal_form_result.times.push_back(get_wall_time() - start_time);
+	}
+	results.push_back(normal_form_result);
+
+	free_bench_model(model);
+}
+
+// Time a complete FM calculation with one solver, divided into phases as in
+// the perf.json written by newfm.
+
+void run_bench_fm(const SyntheticSystem& system, const BenchSettings& settings, const BenchSolver& solver, BenchResult& result)
+{
+	result.system = system.spec.name;
+	result.name = solver.name;
+	result.kind = "end_to_end";
+	result.work = (double)settings.n_frames;
+	result.work_unit = "frames";
+	write_bench_input_files(system, settings, solver.matrix_type, solver.control_lines);
+
+	for (int repeat = 0; repeat < settings.n_repeats; repeat++) {
+		std::vector<double> phase_times(N_FM_PHASES, 0.0);
+		double start_time = get_wall_time();
+		BenchModel model;
+		set_up_bench_model(model, system);
+		MATRIX_DATA* mat = model.mat;
+		double phase_start_time = get_wall_time();
+		phase_times[0] = phase_start_time - start_time;
+
+		for (mat->trajectory_block_index = 0; mat->trajectory_block_index < settings.n_frames; mat->trajectory_block_index++) {
+			(*mat->set_fm_matrix_to_zero)(mat);
+			load_bench_frame(model, system, mat->trajectory_block_index);
+			calculate_frame_fm_matrix(model.cg, mat, model.frame_source->frame_config, model.pair_cell_list, model.three_body_cell_list, 0);
+			double end_of_block_start_time = get_wall_time();
+			phase_times[1] += end_of_block_start_time - phase_start_time;
+			(*mat->do_end_of_frameblock_matrix_manipulations)(mat);
+			phase_start_time = get_wall_time();
+			phase_times[2] += phase_start_time - end_of_block_start_time;
+		}
+
+		mat->finish_fm(mat);
+		double output_start_time = get_wall_time();
+		phase_times[3] = output_start_time - phase_start_time;
+		write_fm_interaction_output_files(model.cg, mat);
+		double end_time = get_wall_time();
+		phase_times[4] = end_time - output_start_time;
+		free_bench_model(model);
+
+		result.times.push_back(end_time - start_time);
+		result.phase_times.push_back(phase_times);
+	}
+}
+
+//-------------------------------------------------------------
+// Output
+//-------------------------------------------------------------
+
+void summarize_times(const std::vector<double>& times, double& min_time, double& median_time, double& mean_time, double& max_time)
+{
+	std::vector<double> sorted_times = times;
+	std::sort(sorted_times.begin(), sorted_times.end());
+	int n = (int)sorted_times.size();
+	min_time = sorted_times[0];
+	max_time = sorted_times[n - 1];
+	median_time = (n % 2 == 1) ? sorted_times[n / 2] : 0.5 * (sorted_times[n / 2 - 1] + sorted_times[n / 2]);
+	mean_time = 0.0;
+	for (int i = 0; i < n; i++) mean_time += sorted_times[i] / n;
+}
+
+void write_bench_json(const BenchSettings& settings, const std::vector<SyntheticSystem*>& systems, const std::vector< std::vector<int> >& dimensions, const std::vector<BenchResult>& results)
+{
+	FILE* json_out = open_file(settings.output_filename.c_str(), "w");
+	fprintf(json_out, "{\n");
+	fprintf(json_out, "  \"requested_sites\": %d,\n  \"frames\": %d,\n  \"repeats\": %d,\n  \"threads\": %d,\n  \"mkl\": %d,\n", settings.n_sites, settings.n_frames, settings.n_repeats, settings.n_threads, _mkl_flag);
+	fprintf(json_out, "  \"systems\": [\n");
+	for (unsigned s = 0; s < systems.size(); s++) {
+		fprintf(json_out, "    {\"name\": \"%s\", \"sites\": %d, \"box_length\": %.6f, \"fm_matrix_rows\": %d, \"fm_matrix_columns\": %d}%s\n", systems[s]->spec.name, systems[s]->n_sites, systems[s]->box_length, dimensions[s][0], dimensions[s][1], (s + 1 < systems.size()) ? "," : "");
+	}
+	fprintf(json_out, "  ],\n");
+	fprintf(json_out, "  \"results\": [\n");
+	for (unsigned r = 0; r < results.size(); r++) {
+		const BenchResult& result = results[r];
+		double min_time, median_time, mean_time, max_time;
+		summarize_times(result.times, min_time, median_time, mean_time, max_time);
+		fprintf(json_out, "    {\"system\": \"%s\", \"name\": \"%s\", \"kind\": \"%s\", \"work\": %.0f, \"work_unit\": \"%s\", ", result.system.c_str(), result.name.c_str(), result.kind.c_str(), result.work, result.work_unit.c_str());
+		fprintf(json_out, "\"min\": %.9f, \"median\": %.9f, \"mean\": %.9f, \"max\": %.9f", min_time, median_time, mean_time, max_time);
+		if (result.phase_times.size() > 0) {
+			fprintf(json_out, ", \"phases\": {");
+			for (int p = 0; p < N_FM_PHASES; p++) {
+				std::vector<double> times;
+				for (unsigned i = 0; i < result.phase_times.size(); i++) times.push_back(result.phase_times[i][p]);
+				summarize_times(times, min_time, median_time, mean_time, max_time);
+				fprintf(json_out, "%s\"%s\": %.9f", (p > 0) ? ", " : "", FM_PHASE_NAMES[p], median_time);
+			}
+			fprintf(json_out, "}");
+		}
+		if (result.counters.size() > 0) {
+			fprintf(json_out, ", \"counters\": {");
+			for (unsigned i = 0; i < result.counters.size(); i++) {
+				fprintf(json_out, "%s\"%s\": %llu", (i > 0) ? ", " : "", result.counters[i].first.c_str(), (unsigned long long)result.counters[i].second);
+			}
+			fprintf(json_out, "}");
+		}
+		fprintf(json_out, "}%s\n", (r + 1 < results.size()) ? "," : "");
+	}
+	fprintf(json_out, "  ]\n");
+	fprintf(json_out, "}\n");
+	fclose(json_out);
+}
+
+int remove_scratch_entry(const char* path, const struct stat* status, int type, struct FTW* ftw_buffer)
+{
+	return remove(path);
+}
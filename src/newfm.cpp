@@ -9,7 +9,6 @@
 
 #include <cstdio>
 #include <cstdlib>
-#include <ctime>
 #include "control_input.h"
 #include "force_computation.h"
 #include "fm_output.h"
@@ -17,6 +16,7 @@
 #include "interaction_model.h"
 #include "matrix.h"
 #include "misc.h"
+#include "performance.h"
 #include "trajectory_input.h"
 
 void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameSource* const frame_source);
@@ -24,7 +24,8 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
 int main(int argc, char* argv[])
 {
     // Begin to compute the total run time
-    double start_cputime = clock();
+    double start_wall_time = get_wall_time();
+    double start_cpu_time = get_process_cpu_time();
     FrameSource frame_source;      // Trajectory frame data; see types.h
     
     //----------------------------------------------------------------
@@ -47,6 +48,11 @@ int main(int argc, char* argv[])
     ControlInputs control_input; 		// Control parameters read from control.in
 	CG_MODEL_DATA cg(&control_input);   // CG model parameters and data (InteractionClasses and Computers)
     copy_control_inputs_to_frd(&control_input, &frame_source);
+    
+    // Time each phase of the calculation if requested.
+    PerformanceProfile* profile = NULL;
+    if (control_input.performance_output_flag != 0) profile = new PerformanceProfile(control_input.performance_output_flag);
+    PhaseTimer setup_timer(profile, kPhaseSetup);
 
     // Read the topology file top.in to determine the definitions of
     // all molecules in the system and their topologies, then to 
@@ -102,7 +108,10 @@ int main(int argc, char* argv[])
     // read.
     printf("Beginning to read frames.\n");
     printf("Finding first frame...\n");
+    setup_timer.stop();
+    PhaseTimer first_frame_timer(profile, kPhaseFrameRead);
     frame_source.get_first_frame(&frame_source, cg.topo_data.n_cg_sites, cg.topo_data.cg_site_types);
+    first_frame_timer.stop();
 	if (frame_source.dynamic_state_sampling == 1) frame_source.sampleTypesFromProbs();
 	
     // Assign a host of function pointers in 'cg' new definitions
@@ -112,6 +121,8 @@ int main(int argc, char* argv[])
     // Initialize the force-matching matrix.
     printf("Initializing FM matrix.\n");
     MATRIX_DATA mat(&control_input, &cg);
+    mat.profile = profile;
+    if (profile != NULL) add_interaction_class_phases(&cg, profile);
     if (frame_source.use_statistical_reweighting == 1) {
         set_normalization(&mat, 1.0 / frame_source.total_frame_weights);
     }
@@ -144,26 +155,38 @@ int main(int argc, char* argv[])
     // not necessary for finding a solution to the final matrix
     // equations.
     printf("Finished constructing FM equations.\n");
-    if (frame_source.bootstrapping_flag == 1) {
-		free_bootstrapping_weights(&frame_source);
-	}
 	
     // Find the solution to the force-matching equations set up in
     // previous steps. The solution routines may also print out
     // singular values, residuals, raw matrix equations, etc. as
     // necessary.
     printf("Finishing FM.\n");
+    PhaseTimer solve_timer(profile, kPhaseSolve);
     mat.finish_fm(&mat);
+    solve_timer.stop();
+    
+    // The bootstrapping weights are freed only now, since finish_fm adds
+    // the last buffered frame blocks of matrix_type 2 to the estimates.
+    if (frame_source.bootstrapping_flag == 1) {
+		free_bootstrapping_weights(&frame_source);
+	}
 
     // Write tabulated interaction files resulting from the basis set
     // coefficients found in the solution step.
     printf("Writing final output.\n"); fflush(stdout);
+    PhaseTimer output_timer(profile, kPhaseOutput);
     write_fm_interaction_output_files(&cg, &mat);
+    output_timer.stop();
 	
     // Record the time and print total elapsed time for profiling purposes.
-    double end_cputime = clock();
-    double elapsed_cputime = ((double)(end_cputime - start_cputime)) / CLOCKS_PER_SEC;
-    printf("%f seconds used.\n", elapsed_cputime);
+    // CPU time is summed over all threads, so it can exceed the wall time.
+    if (profile != NULL) {
+        printf("Writing performance profile.\n");
+        profile->write("perf.json", "perf_trace.json");
+        mat.profile = NULL;
+        delete profile;
+    }
+    printf("%f seconds used (%f seconds of CPU time).\n", get_wall_time() - start_wall_time, get_process_cpu_time() - start_cpu_time);
     return 0;
 }
 
@@ -174,11 +197,29 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
     int total_frame_samples = frame_source->n_frames;
 	int traj_frame_num = 0;
 	int times_sampled = 1;
+	int first_block = 0;
 	double* ref_box_half_lengths = new double[frame_source->position_dimension];
     
     // Skip the desired number of frames before starting the matrix building loops.
     frame_source->move_to_start_frame(frame_source);
     
+    // When restarting, restore the equations saved in the last checkpoint and
+    // skip past the frames that were used to build them.
+    mat->accumulation_row_shift = 0;
+    if (mat->restart_flag == 1) {
+        printf("Restoring FM equations from checkpoint.out.\n");
+        first_block = read_fm_checkpoint(mat, &traj_frame_num);
+        PhaseTimer skip_timer(mat->profile, kPhaseFrameRead);
+        for (int i = 0; i < traj_frame_num; i++) {
+            if (i + 1 < traj_frame_num) read_stat = (*frame_source->get_junk_frame)(frame_source);
+            else read_stat = (*frame_source->get_next_frame)(frame_source);
+            if (read_stat == 0) {
+                printf("Failure attempting to skip frame %d while restarting. Check the trajectory file for errors.\n", i);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    
     // Perform initial generation of cell lists user for generating neighbor lists.
     // This list will only be rebuilt if the box dimensions change.
     
@@ -222,12 +263,14 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
 		}
 		n_blocks = total_frame_samples / mat->frames_per_traj_block;
 	}
-
-    mat->accumulation_row_shift = 0;
+	if (first_block >= n_blocks) {
+		printf("Checkpoint covers %d frame blocks, but only %d are requested.\n", first_block, n_blocks);
+		exit(EXIT_FAILURE);
+	}
 
     // For each block of frame samples.
     printf("Entering primary matrix-building loop.\n"); fflush(stdout);
-    for (mat->trajectory_block_index = 0; mat->trajectory_block_index < n_blocks; mat->trajectory_block_index++) {
+    for (mat->trajectory_block_index = first_block; mat->trajectory_block_index < n_blocks; mat->trajectory_block_index++) {
         
         // Wipe the matrix, then calculate the target virial for all frames in this block.
         (*mat->set_fm_matrix_to_zero)(mat);
@@ -265,6 +308,7 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
 				
 				// Redo cell list set-up and update reference box size if box has changed.
 				if (box_change == 1) {
+					PhaseTimer cell_list_timer(mat->profile, kPhaseCellList);
 	            	// Re-initialize the cell linked lists for finding neighbors in the provided frames;
   					pair_cell_list = PairCellList();
     				three_body_cell_list = ThreeBCellList();
@@ -303,6 +347,7 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
 				// Only do this if we are not currently process the last frame.
 				if ( ((trajectory_block_frame_index + 1) < mat->frames_per_traj_block) ||
 			         ((mat->trajectory_block_index + 1) < n_blocks) ) {
+					PhaseTimer frame_read_timer(mat->profile, kPhaseFrameRead);
 					read_stat = (*frame_source->get_next_frame)(frame_source);  
 				}
 				traj_frame_num++;
@@ -317,6 +362,7 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
 				// Only do this if we are not currently process the last frame.
 				if ( ((trajectory_block_frame_index + 1) < mat->frames_per_traj_block) ||
 			         ((mat->trajectory_block_index + 1) < n_blocks) ) {
+					PhaseTimer frame_read_timer(mat->profile, kPhaseFrameRead);
 					read_stat = (*frame_source->get_next_frame)(frame_source);  
 				}
 				frame_source->sampleTypesFromProbs();
@@ -328,11 +374,24 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
         // Print status and do end-of-block computations before wiping the blockwise matrix and beginning anew
         printf("\r%d (%d) frames have been sampled. ", frame_source->current_frame_n, (mat->trajectory_block_index + 1) * mat->frames_per_traj_block);
         fflush(stdout);
+        PhaseTimer end_of_block_timer(mat->profile, kPhaseEndOfBlock);
         (*mat->do_end_of_frameblock_matrix_manipulations)(mat);
+        end_of_block_timer.stop();
+        
+        // Periodically save the equations accumulated so far so that an interrupted run can be resumed.
+        if ( (mat->checkpoint_interval > 0) && ((mat->trajectory_block_index + 1) % mat->checkpoint_interval == 0) &&
+             ((mat->trajectory_block_index + 1) < n_blocks) ) {
+            PhaseTimer checkpoint_timer(mat->profile, kPhaseCheckpoint);
+            write_fm_checkpoint(mat, mat->trajectory_block_index + 1, traj_frame_num);
+        }
 	}
 
     printf("\nFinishing frame parsing.\n");
     
+    // Record the number of trajectory frames used, for the headers of result files.
+    if (frame_source->dynamic_state_sampling == 1) mat->n_frames = n_blocks * mat->frames_per_traj_block / frame_source->dynamic_state_samples_per_frame;
+    else mat->n_frames = n_blocks * mat->frames_per_traj_block;
+    
     // Close the trajectory and free the relevant temp variables.
     frame_source->cleanup(frame_source);
     delete [] ref_box_half_lengths;
@@ -0,0 +1,114 @@
+//
+//  performance.cpp
+//
+//
+//  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+#include "misc.h"
+#include "performance.h"
+
+static const char* const FIXED_PHASE_NAMES[kNumFixedPhases] = {"setup", "frame_read", "cell_list", "interactions", "basis_evaluation", "matrix_insertion", "end_of_block", "checkpoint", "solve", "output"};
+static const char* const COUNTER_NAMES[kNumCounters] = {"frames", "pairs_visited", "pairs_in_cutoff", "matrix_elements"};
+
+double get_process_cpu_time(void)
+{
+	struct timespec cpu_time;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu_time);
+	return (double)cpu_time.tv_sec + 1.0e-9 * (double)cpu_time.tv_nsec;
+}
+
+const char* get_performance_counter_name(const PerformanceCounter counter)
+{
+	return COUNTER_NAMES[counter];
+}
+
+PerformanceProfile::PerformanceProfile(const int performance_output_flag)
+{
+	trace_flag = (performance_output_flag == 2) ? 1 : 0;
+	for (int i = 0; i < kNumCounters; i++) counters[i] = 0;
+	for (int i = 0; i < kNumFixedPhases; i++) {
+		int cpu_timed = (i == kPhaseBasisEvaluation || i == kPhaseMatrixInsertion) ? 0 : 1;
+		PerformanceTimer timer = {FIXED_PHASE_NAMES[i], cpu_timed, 0, 0.0, 0.0};
+		timers.push_back(timer);
+	}
+	start_wall_time = get_wall_time();
+	start_cpu_time = get_process_cpu_time();
+}
+
+// Add a phase (e.g. one interaction class) and return its index.
+
+int PerformanceProfile::add_phase(const std::string& name)
+{
+	PerformanceTimer timer = {name, 1, 0, 0.0, 0.0};
+	timers.push_back(timer);
+	return (int)timers.size() - 1;
+}
+
+PhaseTimer::PhaseTimer(PerformanceProfile* const new_profile, const int new_phase) : profile(new_profile), phase(new_phase)
+{
+	if (profile == NULL) return;
+	start_wall_time = get_wall_time();
+	start_cpu_time = get_process_cpu_time();
+}
+
+PhaseTimer::~PhaseTimer()
+{
+	stop();
+}
+
+void PhaseTimer::stop(void)
+{
+	if (profile == NULL) return;
+	double wall_time = get_wall_time() - start_wall_time;
+	PerformanceTimer& timer = profile->timers[phase];
+	timer.n_calls++;
+	timer.wall_time += wall_time;
+	timer.cpu_time += get_process_cpu_time() - start_cpu_time;
+	if (profile->trace_flag == 1) {
+		PerformanceTraceEvent event = {phase, start_wall_time - profile->start_wall_time, wall_time};
+		profile->trace_events.push_back(event);
+	}
+	profile = NULL;
+}
+
+// Write the totals as JSON, and the trace in the Chrome trace event format
+// if one was recorded.
+
+void PerformanceProfile::write(const char* filename, const char* trace_filename)
+{
+	double total_wall_time = get_wall_time() - start_wall_time;
+	double total_cpu_time = get_process_cpu_time() - start_cpu_time;
+
+	FILE* perf_out = open_file(filename, "w");
+	fprintf(perf_out, "{\n");
+	fprintf(perf_out, "  \"wall_time\": %.9f,\n", total_wall_time);
+	fprintf(perf_out, "  \"cpu_time\": %.9f,\n", total_cpu_time);
+	fprintf(perf_out, "  \"phases\": [\n");
+	for (unsigned i = 0; i < timers.size(); i++) {
+		fprintf(perf_out, "    {\"name\": \"%s\", \"calls\": %ld, \"wall_time\": %.9f", timers[i].name.c_str(), timers[i].n_calls, timers[i].wall_time);
+		if (timers[i].cpu_timed == 1) fprintf(perf_out, ", \"cpu_time\": %.9f", timers[i].cpu_time);
+		fprintf(perf_out, "}%s\n", (i + 1 < timers.size()) ? "," : "");
+	}
+	fprintf(perf_out, "  ],\n");
+	fprintf(perf_out, "  \"counters\": {\n");
+	for (int i = 0; i < kNumCounters; i++) {
+		fprintf(perf_out, "    \"%s\": %llu%s\n", COUNTER_NAMES[i], (unsigned long long)counters[i], (i + 1 < kNumCounters) ? "," : "");
+	}
+	fprintf(perf_out, "  }\n");
+	fprintf(perf_out, "}\n");
+	fclose(perf_out);
+
+	if (trace_flag == 0) return;
+	FILE* trace_out = open_file(trace_filename, "w");
+	fprintf(trace_out, "{\"traceEvents\": [\n");
+	for (unsigned i = 0; i < trace_events.size(); i++) {
+		fprintf(trace_out, "  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}%s\n", timers[trace_events[i].phase].name.c_str(), 1.0e6 * trace_events[i].start, 1.0e6 * trace_events[i].duration, (i + 1 < trace_events.size()) ? "," : "");
+	}
+	fprintf(trace_out, "], \"displayTimeUnit\": \"ms\"}\n");
+	fclose(trace_out);
+}
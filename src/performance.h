@@ -0,0 +1,113 @@
+//
+//  performance.h
+//
+//
+//  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
+//
+
+#ifndef _performance_h
+#define _performance_h
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//-------------------------------------------------------------
+// Per-phase timers and counters for profiling FM runs
+//-------------------------------------------------------------
+
+// When performance_output_flag is set in control.in, the drivers time each
+// phase of the calculation and count the work done in it, then write the
+// totals to "perf.json" (and, for performance_output_flag 2, a Chrome trace
+// of the coarse phases to "perf_trace.json", viewable in chrome://tracing or
+// Perfetto). When the flag is not set, no profile is created and every
+// instrumentation point reduces to a test of a NULL pointer.
+
+enum PerformancePhase {
+	kPhaseSetup = 0,				// Reading control.in, topology, ranges, and tables
+	kPhaseFrameRead,				// Reading and skipping trajectory frames
+	kPhaseCellList,					// Building the cell lists used to find nonbonded neighbors
+	kPhaseInteractions,				// All interaction classes' calculate_interactions for a frame
+	kPhaseBasisEvaluation,			// Evaluating basis functions (timed per interaction; wall time only)
+	kPhaseMatrixInsertion,			// Adding basis function values to the FM matrix (timed per interaction; wall time only)
+	kPhaseEndOfBlock,				// End-of-frame-block matrix manipulations
+	kPhaseCheckpoint,				// Writing checkpoints
+	kPhaseSolve,					// Solving the FM equations
+	kPhaseOutput,					// Writing tabulated interactions and other final output
+	kNumFixedPhases					// Interaction-class phases are numbered from here
+};
+
+enum PerformanceCounter {
+	kCounterFrames = 0,				// Frame samples processed
+	kCounterPairsVisited,			// Nonbonded pairs examined in the cell lists
+	kCounterPairsInCutoff,			// Nonbonded pairs found within the cutoff
+	kCounterMatrixElements,			// Basis function value times derivative component products added to the FM matrix
+	kNumCounters
+};
+
+struct PerformanceTimer {
+	std::string name;
+	int cpu_timed;					// 0 for fine-grained phases timed by the wall clock only
+	long n_calls;
+	double wall_time;
+	double cpu_time;
+};
+
+struct PerformanceTraceEvent {
+	int phase;
+	double start;					// Seconds since the profile was created
+	double duration;
+};
+
+struct PerformanceProfile {
+	int trace_flag;
+	double start_wall_time;
+	double start_cpu_time;
+	std::vector<PerformanceTimer> timers;
+	uint64_t counters[kNumCounters];
+	std::vector<PerformanceTraceEvent> trace_events;
+
+	PerformanceProfile(const int performance_output_flag);
+	int add_phase(const std::string& name);
+	void write(const char* filename, const char* trace_filename);
+};
+
+// Clocks used by the timers: a monotonic wall clock and the CPU time
+// used by all threads of the process.
+
+inline double get_wall_time(void) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+double get_process_cpu_time(void);
+
+// Name of a counter as written to perf.json.
+const char* get_performance_counter_name(const PerformanceCounter counter);
+
+// Time a phase from construction to destruction (or an earlier call to
+// stop). A NULL profile disables the timer.
+
+class PhaseTimer {
+	PerformanceProfile* profile;
+	int phase;
+	double start_wall_time;
+	double start_cpu_time;
+public:
+	PhaseTimer(PerformanceProfile* const new_profile, const int new_phase);
+	~PhaseTimer();
+	void stop(void);
+};
+
+inline void count_performance_event(PerformanceProfile* const profile, const PerformanceCounter counter, const uint64_t n = 1) {
+	if (profile != NULL) profile->counters[counter] += n;
+}
+
+// Add the wall time since start_wall_time to a fine-grained phase and return the current time.
+inline double add_phase_wall_time(PerformanceProfile* const profile, const int phase, const double start_wall_time) {
+	double now = get_wall_time();
+	profile->timers[phase].wall_time += now - start_wall_time;
+	profile->timers[phase].n_calls++;
+	return now;
+}
+
+#endif
@@ -5,6 +5,7 @@
 //  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
 //
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <cstring>
@@ -33,11 +34,15 @@ void allocate_and_initialize_density_computer_for_range_finding(DensityClassComp
 void setup_site_to_density_group_index_for_range(DensityClassSpec* iclass);
 
 // Functions for computing the full range of sampling of a given class of interaction in a given trajectory.
-void calc_isotropic_two_body_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_angular_three_body_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_dihedral_four_body_interaction_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void evaluate_density_sampling_range(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
-void calc_nothing(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_isotropic_two_body_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_angular_three_body_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_dihedral_four_body_interaction_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void evaluate_density_sampling_range(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+void calc_nothing(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat);
+
+// Worker-local copies of range finding computers for frame-parallel range finding.
+InteractionClassComputer* copy_range_finding_computer(InteractionClassComputer* const icomp);
+void delete_range_finding_computer(InteractionClassComputer* const icomp);
 
 void write_interaction_range_data_to_file(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat,  FILE* const nonbonded_spline_output_filep, FILE* const bonded_spline_output_filep, FILE* const density_interaction_output_filep);
 
@@ -51,9 +56,14 @@ void read_one_param_dist_file_pair(InteractionClassComputer* const icomp, char *
 void read_one_param_dist_file_other(InteractionClassComputer* const icomp, char ** const name, MATRIX_DATA* mat, const int index_among_defined_intrxns, int &counter, double num_of_pairs);
 
 // Output parameter distribution functions
+long long round_to_micro_units(const double value);
+long long greatest_common_divisor(long long a, long long b);
+long long get_whole_micro_units(const double length);
+void set_up_parameter_distributions_for_class(InteractionClassComputer* const icomp, char **name);
 void open_parameter_distribution_files_for_class(InteractionClassComputer* const icomp, char **name); 
 void close_parameter_distribution_files_for_class(InteractionClassComputer* const icomp);
-void remove_dist_files(InteractionClassComputer* const icomp, char **name);
+inline void record_parameter_sample(InteractionClassComputer* const icomp, const double param);
+void add_to_output_histogram(const double value, const unsigned long count, const double lower_cutoff, const double half_binwidth, const int num_bins, unsigned long* const bin_counts);
 void generate_parameter_distribution_histogram(InteractionClassComputer* const icomp, char **name);
 
 // Dummy implementations
@@ -107,6 +117,8 @@ void initialize_single_class_range_finding_temps(InteractionClassSpec *iclass, I
 	}
 	
     icomp->ispec = iclass;
+    // Ranges are sampled from every pair found in the cell list.
+    icomp->neighbor_cutoff2 = -1.0;
 	if (iclass->class_type == kPairNonbonded) {
         icomp->calculate_fm_matrix_elements = calc_isotropic_two_body_sampling_range;
     } else if (iclass->class_type == kPairBonded) {
@@ -130,6 +142,7 @@ void initialize_single_class_range_finding_temps(InteractionClassSpec *iclass, I
     } else if (iclass->class_type == kDensity) {
 		DensityClassComputer* dcomp = static_cast<DensityClassComputer*>(icomp);
 		dcomp->cutoff2 = iclass->cutoff * iclass->cutoff;
+		dcomp->neighbor_cutoff2 = dcomp->cutoff2 * (1.0 + 1.0e-12);
 		dcomp->process_density = evaluate_density_sampling_range;
 		dcomp->calculate_fm_matrix_elements = calc_nothing;
 		if (iclass->class_subtype == 1) { // Continuously varying (Gaussian) weight function
@@ -161,12 +174,18 @@ void initialize_single_class_range_finding_temps(InteractionClassSpec *iclass, I
 	char** name = select_name(iclass, topo_data->name);
 	if(iclass->output_parameter_distribution == 1 || iclass->output_parameter_distribution == 2 ){
 		if (iclass->class_type == kPairNonbonded || iclass->class_type == kPairBonded || 
-		           iclass->class_type == kAngularBonded || iclass->class_type == kDihedralBonded) {
-		    open_parameter_distribution_files_for_class(icomp, name);
+		           iclass->class_type == kAngularBonded || iclass->class_type == kDihedralBonded ||
+		           (iclass->class_type == kDensity && iclass->class_subtype > 0)) {
+		    set_up_parameter_distributions_for_class(icomp, name);
 		} else {
 			// do nothing here
 		}
 	}
+	
+	// Serial range finding samples directly into the class specification.
+	icomp->range_lower_cutoffs = iclass->lower_cutoffs;
+	icomp->range_upper_cutoffs = iclass->upper_cutoffs;
+	icomp->range_histograms = iclass->parameter_histograms;
 }
 
 void report_unrecognized_class_subtype(InteractionClassSpec *iclass)
@@ -179,16 +198,14 @@ void report_unrecognized_class_subtype(InteractionClassSpec *iclass)
 void allocate_and_initialize_density_computer_for_range_finding(DensityClassComputer* icomp) 
 {
 	DensityClassSpec* iclass = static_cast<DensityClassSpec*>(icomp->ispec);
-	// Allocate space to store density intermediate.
-	// This approach grabs enough memory for all cg sites to have all density values for all density groups.
-	// A more memory-efficient, but harder approach would be allocate each site's array based on the number of density groups needed at that site.
-	// The problem with this other approach is efficiently looking up which index to use.
-	icomp->density_values = new double[iclass->get_n_defined() * iclass->n_cg_sites]();
+	// Determine which densities are stored at sites of each type.
+	icomp->set_up_density_storage();
 	
 	// Allocate and compute constant calculation intermediates.
 	icomp->denomenator = new double[iclass->get_n_defined()]();
 	icomp->u_cutoff = new double[iclass->get_n_defined()]();
 	icomp->f_cutoff = new double[iclass->get_n_defined()]();
+	icomp->c0 = icomp->c2 = icomp->c4 = icomp->c6 = NULL;
 	
 	if(iclass->class_subtype == 1) {
 		for(int i = 0; i < iclass->get_n_defined(); i++) {
@@ -288,37 +305,37 @@ void setup_site_to_density_group_index_for_range(DensityClassSpec* iclass)
 
 //--------------------------------------------------------------------------
 
-void calc_isotropic_two_body_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_isotropic_two_body_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[2] = {icomp->k, icomp->l};
     double param;
     calc_distance(particle_ids, x, simulation_box_half_lengths, param);
 
-    if (icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] = param;
-    if (icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] = param;
 	
 	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) {
 		if (icomp->ispec->class_type == kPairBonded || icomp->ispec->class_type == kAngularBonded || icomp->ispec->class_type == kDihedralBonded) {
-			fprintf(icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns], "%lf\n", param);
+			record_parameter_sample(icomp, param);
 		} else if( (icomp->ispec->class_type == kPairNonbonded) && (param < icomp->ispec->cutoff)) {
-		 	fprintf(icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns], "%lf\n", param);
+		 	record_parameter_sample(icomp, param);
 		}
 	}
 }
 
-void calc_angular_three_body_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_angular_three_body_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
     int particle_ids[3] = {icomp->k, icomp->l, icomp->j}; // end indices (k, l) followed by center index (j)
     double param;
     calc_angle(particle_ids, x, simulation_box_half_lengths, param);
 
-    if (icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] = param;
-    if (icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] = param;
 	
-	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) fprintf(icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns], "%lf\n", param);
+	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) record_parameter_sample(icomp, param);
 }
 
-void calc_dihedral_four_body_interaction_sampling_range(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void calc_dihedral_four_body_interaction_sampling_range(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	if (mat->position_dimension != 3) {
     	printf("Dihedral calculations are currently only implemented for 3-dimensional systems.\n");
@@ -329,25 +346,189 @@ void calc_dihedral_four_body_interaction_sampling_range(InteractionClassComputer
     double param;
     calc_dihedral(particle_ids, x, simulation_box_half_lengths, param);
     
-    if (icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] = param;
-    if (icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] = param;
 	
-	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) fprintf(icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns], "%lf\n", param);
+	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) record_parameter_sample(icomp, param);
 }
 
-void evaluate_density_sampling_range(InteractionClassComputer* const info, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
+void evaluate_density_sampling_range(InteractionClassComputer* const info, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat)
 {
 	DensityClassComputer* icomp = static_cast<DensityClassComputer*>(info);
-	DensityClassSpec* ispec = static_cast<DensityClassSpec*>(icomp->ispec);	
-	double param = icomp->density_values[icomp->index_among_defined_intrxns * ispec->n_cg_sites + icomp->k];
+	double param = icomp->get_density_value(icomp->k, icomp->index_among_defined_intrxns);
 	
-	if (icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->ispec->lower_cutoffs[icomp->index_among_defined_intrxns] = param;
-    if (icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->ispec->upper_cutoffs[icomp->index_among_defined_intrxns] = param;
+	if (icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] > param) icomp->range_lower_cutoffs[icomp->index_among_defined_intrxns] = param;
+    if (icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] < param) icomp->range_upper_cutoffs[icomp->index_among_defined_intrxns] = param;
 	
-	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) fprintf(icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns], "%lf\n", param);
+	if (icomp->ispec->output_parameter_distribution == 1 || icomp->ispec->output_parameter_distribution == 2) record_parameter_sample(icomp, param);
 }
 
-void calc_nothing(InteractionClassComputer* const icomp, std::array<double, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat) {
+void calc_nothing(InteractionClassComputer* const icomp, std::array<frame_real, DIMENSION>* const &x, const real *simulation_box_half_lengths, MATRIX_DATA* const mat) {
+}
+
+//--------------------------------------------------------------------------
+
+// Frame-parallel range finding is used when frames can be sampled independently:
+// site types must not change from frame to frame (they are shared through the 
+// topology), and the raw parameter values must not be written out (their order 
+// in the *.dist files follows the trajectory).
+
+bool can_find_ranges_in_parallel(CG_MODEL_DATA* const cg, FrameSource* const frame_source)
+{
+	if (frame_source->dynamic_types != 0 || frame_source->dynamic_state_sampling != 0) return false;
+	if (cg->three_body_nonbonded_interactions.class_subtype > 0) return false;
+	std::list<InteractionClassSpec*>::iterator iclass_iterator;
+	for(iclass_iterator = cg->iclass_list.begin(); iclass_iterator != cg->iclass_list.end(); iclass_iterator++) {
+		if ((*iclass_iterator)->output_parameter_distribution == 2) return false;
+	}
+	return true;
+}
+
+RangeFindingWorker::RangeFindingWorker(CG_MODEL_DATA* const cg, const int frames_per_batch)
+{
+	for (int batch = 0; batch < 2; batch++) {
+		for (int i = 0; i < frames_per_batch; i++) frame_buffers[batch].push_back(new FrameConfig(cg->n_cg_sites));
+		n_buffered_frames[batch] = 0;
+	}
+	std::list<InteractionClassComputer*>::iterator icomp_iterator;
+	for(icomp_iterator = cg->icomp_list.begin(); icomp_iterator != cg->icomp_list.end(); icomp_iterator++) {
+		icomp_list.push_back(copy_range_finding_computer(*icomp_iterator));
+	}
+}
+
+RangeFindingWorker::~RangeFindingWorker()
+{
+	for (int batch = 0; batch < 2; batch++) {
+		for (unsigned i = 0; i < frame_buffers[batch].size(); i++) delete frame_buffers[batch][i];
+	}
+	std::list<InteractionClassComputer*>::iterator icomp_iterator;
+	for(icomp_iterator = icomp_list.begin(); icomp_iterator != icomp_list.end(); icomp_iterator++) {
+		delete_range_finding_computer(*icomp_iterator);
+	}
+}
+
+void RangeFindingWorker::store_frame(const int batch, FrameConfig* const frame_config)
+{
+	FrameConfig* buffer = frame_buffers[batch][n_buffered_frames[batch]];
+	buffer->current_n_sites = frame_config->current_n_sites;
+	std::copy(frame_config->x, frame_config->x + frame_config->current_n_sites, buffer->x);
+	std::copy(frame_config->simulation_box_half_lengths, frame_config->simulation_box_half_lengths + DIMENSION, buffer->simulation_box_half_lengths);
+	n_buffered_frames[batch]++;
+}
+
+// Sample the frames of one batch, following calculate_frame_fm_matrix.
+
+void RangeFindingWorker::sample_frames(const int batch, CG_MODEL_DATA* const cg, MATRIX_DATA* const mat)
+{
+	for (int f = 0; f < n_buffered_frames[batch]; f++) {
+		FrameConfig* frame_config = frame_buffers[batch][f];
+		
+		// Redo cell list set-up if the box has changed.
+		int box_change = cell_list_box_half_lengths.empty();
+		for (unsigned i = 0; i < cell_list_box_half_lengths.size(); i++) {
+			if ( fabs(cell_list_box_half_lengths[i] - frame_config->simulation_box_half_lengths[i]) > VERYSMALL_F ) {
+				box_change = 1;
+				break;
+			}
+		}
+		if (box_change == 1) {
+			pair_cell_list = PairCellList();
+			pair_cell_list.init(cg->pair_nonbonded_interactions.cutoff, frame_config->simulation_box_half_lengths, frame_config->current_n_sites);
+			cell_list_box_half_lengths.assign(frame_config->simulation_box_half_lengths, frame_config->simulation_box_half_lengths + mat->position_dimension);
+		}
+		
+		for (unsigned l = 0; l < cg->topo_data.n_cg_sites; l++) {
+			get_minimum_image(l, frame_config->x, frame_config->simulation_box_half_lengths);
+		}
+		pair_cell_list.populateList(frame_config->current_n_sites, frame_config->x);
+		
+		std::list<InteractionClassComputer*>::iterator icomp_iterator;
+		for(icomp_iterator = icomp_list.begin(); icomp_iterator != icomp_list.end(); icomp_iterator++) {
+			(*icomp_iterator)->calculate_interactions(mat, 0, 0, cg->n_cg_types, cg->topo_data, pair_cell_list, frame_config->x, frame_config->simulation_box_half_lengths);
+		}
+	}
+	n_buffered_frames[batch] = 0;
+}
+
+// Fold this worker's ranges and histograms into the class specifications.
+
+void RangeFindingWorker::reduce_ranges(void)
+{
+	std::list<InteractionClassComputer*>::iterator icomp_iterator;
+	for(icomp_iterator = icomp_list.begin(); icomp_iterator != icomp_list.end(); icomp_iterator++) {
+		InteractionClassComputer* icomp = *icomp_iterator;
+		InteractionClassSpec* ispec = icomp->ispec;
+		for (int i = 0; i < ispec->get_n_defined(); i++) {
+			if (ispec->lower_cutoffs[i] > icomp->range_lower_cutoffs[i]) ispec->lower_cutoffs[i] = icomp->range_lower_cutoffs[i];
+			if (ispec->upper_cutoffs[i] < icomp->range_upper_cutoffs[i]) ispec->upper_cutoffs[i] = icomp->range_upper_cutoffs[i];
+			if (icomp->range_histograms != NULL) ispec->parameter_histograms[i].merge(icomp->range_histograms[i]);
+		}
+	}
+}
+
+// Copy a range finding computer set up by initialize_range_finding_temps, giving
+// the copy its own range and histogram arrays and its own density intermediates,
+// so that each computer frees only the arrays it owns.
+
+InteractionClassComputer* copy_range_finding_computer(InteractionClassComputer* const icomp)
+{
+	InteractionClassComputer* copy;
+	InteractionClassSpec* ispec = icomp->ispec;
+	if (ispec->class_type == kPairNonbonded) {
+		copy = new PairNonbondedClassComputer(*static_cast<PairNonbondedClassComputer*>(icomp));
+	} else if (ispec->class_type == kPairBonded) {
+		copy = new PairBondedClassComputer(*static_cast<PairBondedClassComputer*>(icomp));
+	} else if (ispec->class_type == kAngularBonded) {
+		copy = new AngularClassComputer(*static_cast<AngularClassComputer*>(icomp));
+	} else if (ispec->class_type == kDihedralBonded) {
+		copy = new DihedralClassComputer(*static_cast<DihedralClassComputer*>(icomp));
+	} else if (ispec->class_type == kDensity) {
+		DensityClassComputer* dcopy = new DensityClassComputer(*static_cast<DensityClassComputer*>(icomp));
+		if (ispec->class_subtype > 0 && ispec->get_n_defined() > 0) {
+			DensityClassComputer* dcomp = static_cast<DensityClassComputer*>(icomp);
+			dcopy->denomenator = new double[ispec->get_n_defined()];
+			dcopy->u_cutoff = new double[ispec->get_n_defined()];
+			dcopy->f_cutoff = new double[ispec->get_n_defined()];
+			std::copy(dcomp->denomenator, dcomp->denomenator + ispec->get_n_defined(), dcopy->denomenator);
+			std::copy(dcomp->u_cutoff, dcomp->u_cutoff + ispec->get_n_defined(), dcopy->u_cutoff);
+			std::copy(dcomp->f_cutoff, dcomp->f_cutoff + ispec->get_n_defined(), dcopy->f_cutoff);
+			if (ispec->class_subtype == 4) {
+				dcopy->c0 = new double[ispec->get_n_defined()];
+				dcopy->c2 = new double[ispec->get_n_defined()];
+				dcopy->c4 = new double[ispec->get_n_defined()];
+				dcopy->c6 = new double[ispec->get_n_defined()];
+				std::copy(dcomp->c0, dcomp->c0 + ispec->get_n_defined(), dcopy->c0);
+				std::copy(dcomp->c2, dcomp->c2 + ispec->get_n_defined(), dcopy->c2);
+				std::copy(dcomp->c4, dcomp->c4 + ispec->get_n_defined(), dcopy->c4);
+				std::copy(dcomp->c6, dcomp->c6 + ispec->get_n_defined(), dcopy->c6);
+			}
+		}
+		copy = dcopy;
+	} else {
+		printf("Parallel range finding does not support %s interactions.\n", ispec->get_full_name().c_str());
+		fflush(stdout);
+		exit(EXIT_FAILURE);
+	}
+	
+	int n_ranges = (ispec->get_n_defined() > 0) ? ispec->get_n_defined() : 1;
+	copy->range_lower_cutoffs = new double[n_ranges];
+	copy->range_upper_cutoffs = new double[n_ranges];
+	std::fill(copy->range_lower_cutoffs, copy->range_lower_cutoffs + n_ranges, VERYLARGE);
+	std::fill(copy->range_upper_cutoffs, copy->range_upper_cutoffs + n_ranges, -VERYLARGE);
+	copy->range_histograms = NULL;
+	if (ispec->parameter_histograms != NULL) {
+		copy->range_histograms = new ParameterHistogram[ispec->get_n_defined()];
+		for (int i = 0; i < ispec->get_n_defined(); i++) copy->range_histograms[i].fine_width = ispec->parameter_histograms[i].fine_width;
+	}
+	return copy;
+}
+
+void delete_range_finding_computer(InteractionClassComputer* const icomp)
+{
+	delete [] icomp->range_lower_cutoffs;
+	delete [] icomp->range_upper_cutoffs;
+	delete [] icomp->range_histograms;
+	delete icomp;
 }
 
 //--------------------------------------------------------------------------
@@ -397,12 +578,10 @@ void write_iclass_range_specifications(InteractionClassComputer* const icomp, ch
 		if(iclass->class_type == kDensity && iclass->class_subtype > 0) {
 			close_parameter_distribution_files_for_class(icomp);
 			generate_parameter_distribution_histogram(icomp, name); // name is set correctly in write_interaction_range_data_to_file
-			remove_dist_files(icomp, name);
 		} else if (iclass->class_type == kPairNonbonded || iclass->class_type == kPairBonded || 
 		           iclass->class_type == kAngularBonded || iclass->class_type == kDihedralBonded) {
 			close_parameter_distribution_files_for_class(icomp);
 			generate_parameter_distribution_histogram(icomp, name);
-			remove_dist_files(icomp, name);
 		} else {
 			// do nothing for these
 		}
@@ -459,7 +638,7 @@ void read_density_parameter_file(DensityClassSpec* const ispec)
 	std::string line;
 	std::string* elements = new std::string[5];
 	std::ifstream prm_stream;
-	prm_stream.open("den.prm", std::ifstream::in);
+	prm_stream.open(get_file_path("den.prm").c_str(), std::ifstream::in);
 	if (prm_stream.fail()) {
 		printf("Problem opening den.prm file!\n");
 		exit(EXIT_FAILURE);
@@ -485,38 +664,194 @@ void read_density_parameter_file(DensityClassSpec* const ispec)
 	delete [] elements;
 }
 
-void open_parameter_distribution_files_for_class(InteractionClassComputer* const icomp, char **name) 
+// Number of fine histogram bins accumulated per half-binwidth output histogram
+// bin when the output bin edges cannot all be made fine bin edges, and the most
+// used when they can.
+const int kParameterHistogramSubbins = 64;
+const int kMaxParameterHistogramSubbins = 1024;
+
+// Round a value to micro-units the way printf("%lf") does.
+
+long long round_to_micro_units(const double value)
+{
+	double scaled = value * 1.0e6;
+	if (fabs(scaled) < 1.0e12 && fabs(scaled - floor(scaled) - 0.5) > 1.0e-3) return (long long)nearbyint(scaled);
+	// Close to a tie, round the exact value as the text output does.
+	char text[400];
+	snprintf(text, sizeof(text), "%lf", value);
+	return llround(strtod(text, NULL) * 1.0e6);
+}
+
+void ParameterHistogram::add(const double value)
+{
+	if (value != value) return; // Skip NaN samples; they cannot be binned.
+	long long micro_value = round_to_micro_units(value);
+	if (!counts.empty()) {
+		add_value_to_grid(micro_value);
+		return;
+	}
+	if (values.empty()) {
+		min_value = micro_value;
+		max_value = micro_value;
+	} else {
+		min_value = std::min(min_value, micro_value);
+		max_value = std::max(max_value, micro_value);
+	}
+	values.push_back(micro_value);
+	if ((long long)values.size() * fine_width > max_value - min_value + fine_width) move_values_to_grid();
+}
+
+void ParameterHistogram::add_value_to_grid(const long long value)
+{
+	long long bin = value / fine_width;
+	if (bin * fine_width > value) bin--;
+	long offset = (long)(value - bin * fine_width);
+	int slot = (offset == 0) ? 0 : ((offset == fine_width - 1) ? 1 : 2);
+	add_to_grid((long)bin, slot, 1);
+}
+
+void ParameterHistogram::add_to_grid(const long bin, const int slot, const unsigned long count)
+{
+	int slots = get_slots_per_bin();
+	long n_bins = (long)counts.size() / slots;
+	if (counts.empty()) {
+		first_bin = bin;
+		counts.resize(slots, 0);
+	} else if (bin < first_bin) {
+		// Grow toward lower values with some slack so that a slowly drifting
+		// minimum does not shift the counts on every sample.
+		long extra = std::max(first_bin - bin, n_bins / 2);
+		counts.insert(counts.begin(), extra * slots, 0);
+		first_bin -= extra;
+	} else if (bin - first_bin >= n_bins) {
+		counts.resize((bin - first_bin + 1) * slots, 0);
+	}
+	counts[(bin - first_bin) * slots + slot] += count;
+}
+
+void ParameterHistogram::move_values_to_grid(void)
+{
+	for (unsigned j = 0; j < values.size(); j++) add_value_to_grid(values[j]);
+	std::vector<long long>().swap(values);
+}
+
+void ParameterHistogram::merge(const ParameterHistogram& other)
+{
+	if (!other.values.empty()) {
+		for (unsigned j = 0; j < other.values.size(); j++) {
+			if (counts.empty()) {
+				// Keep buffering the samples, as add would.
+				if (values.empty()) min_value = max_value = other.values[j];
+				min_value = std::min(min_value, other.values[j]);
+				max_value = std::max(max_value, other.values[j]);
+				values.push_back(other.values[j]);
+			} else {
+				add_value_to_grid(other.values[j]);
+			}
+		}
+		if (counts.empty() && (long long)values.size() * fine_width > max_value - min_value + fine_width) move_values_to_grid();
+	}
+	if (other.counts.empty()) return;
+	move_values_to_grid();
+	int slots = get_slots_per_bin();
+	for (unsigned j = 0; j < other.counts.size(); j++) {
+		if (other.counts[j] != 0) add_to_grid(other.first_bin + (long)(j / slots), (int)(j % slots), other.counts[j]);
+	}
+}
+
+// Greatest common divisor of two non-negative integers.
+
+long long greatest_common_divisor(long long a, long long b)
+{
+	while (b != 0) {
+		long long remainder = a % b;
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+// Convert a length to micro-units, returning 0 if it is not a whole number of them.
+
+long long get_whole_micro_units(const double length)
+{
+	long long micro_units = llround(length * 1.0e6);
+	if (fabs((double)micro_units - length * 1.0e6) > 1.0e-3) return 0;
+	return micro_units;
+}
+
+void set_up_parameter_distributions_for_class(InteractionClassComputer* const icomp, char **name)
 {
 	// The correct name is selected in calling function initialize_single_class_range_finding_temps
+    InteractionClassSpec* ispec = icomp->ispec;
+	double half_binwidth = 0.5 * ispec->get_fm_binwidth();
+	
+	// Pair nonbonded output bins are laid out down from the cutoff or from a
+	// multiple of the output binwidth, so every output bin edge is a multiple of
+	// the greatest common divisor of those and the half binwidth. Fine bins of
+	// that width keep the output histogram exact. The output bins of other
+	// classes are laid out from the largest sample, which is not known until
+	// the end, so their fine bins are single micro-units. When the widths are
+	// not whole micro-units, or would need too many fine bins, the fine bins
+	// are 1/64 of an output bin, and only samples within a fine bin of an
+	// output bin edge can be counted in the neighboring bin.
+	long long half_units = get_whole_micro_units(half_binwidth);
+	long fine_width = std::max(1L, (long)(half_binwidth * 1.0e6 / kParameterHistogramSubbins));
+	if (ispec->class_type != kPairNonbonded) {
+		if (half_units > 0) fine_width = 1;
+	} else {
+		long long grid = greatest_common_divisor(half_units, get_whole_micro_units(ispec->output_binwidth));
+		grid = greatest_common_divisor(grid, get_whole_micro_units(ispec->cutoff));
+		if (half_units > 0 && grid > 0 && half_units / grid <= kMaxParameterHistogramSubbins) fine_width = (long)grid;
+	}
+	
+	ispec->parameter_histograms = new ParameterHistogram[ispec->get_n_defined()];
+	for (int i = 0; i < ispec->get_n_defined(); i++) {
+		ispec->parameter_histograms[i].fine_width = fine_width;
+	}
+	// The individual sampled values are only written out on request.
+	if (ispec->output_parameter_distribution == 2) open_parameter_distribution_files_for_class(icomp, name);
+}
+
+void open_parameter_distribution_files_for_class(InteractionClassComputer* const icomp, char **name) 
+{
     InteractionClassSpec* ispec = icomp->ispec;
 	std::string filename;
 	ispec->output_range_file_handles = new FILE*[ispec->get_n_defined()];
 	
 	for (int i = 0; i < ispec->get_n_defined(); i++) {
 	 	filename = ispec->get_basename(name, i,  "_") + ".dist";
-  		ispec->output_range_file_handles[i] = open_file(filename.c_str(), "w");
+  		ispec->output_range_file_handles[i] = open_file(filename.c_str(), "wb");
 	}		
 }
 
 void close_parameter_distribution_files_for_class(InteractionClassComputer* const icomp) 
 {
     InteractionClassSpec* ispec = icomp->ispec;	
+    if (ispec->output_parameter_distribution != 2) return;
 	for (int i = 0; i < ispec->get_n_defined(); i++) {
 		fclose(ispec->output_range_file_handles[i]);
 	}
 	delete [] ispec->output_range_file_handles;
 }
 
-void remove_dist_files(InteractionClassComputer* const icomp, char **name) 
+inline void record_parameter_sample(InteractionClassComputer* const icomp, const double param)
 {
-	// Name is selected in calling function 2x up named write_interaction_range_data_to_file.
-    InteractionClassSpec* ispec = icomp->ispec;	
-    if(ispec->output_parameter_distribution != 1) return;
-    for (int i = 0; i < ispec->get_n_defined(); i++) {
-		// get name of dist file
-		std::string filename = ispec->get_basename(name, i, "_") + ".dist";
-		// remove file
-		remove(filename.c_str());
+	icomp->range_histograms[icomp->index_among_defined_intrxns].add(param);
+	// Raw values are written as native double-precision binary.
+	if (icomp->ispec->output_parameter_distribution == 2) fwrite(&param, sizeof(double), 1, icomp->ispec->output_range_file_handles[icomp->index_among_defined_intrxns]);
+}
+
+// Add samples with the given value to the output histogram bin containing it.
+
+void add_to_output_histogram(const double value, const unsigned long count, const double lower_cutoff, const double half_binwidth, const int num_bins, unsigned long* const bin_counts)
+{
+	int curr_bin = (int)(floor((value - lower_cutoff + VERYSMALL_F) / half_binwidth));
+	if( (curr_bin < num_bins) && (curr_bin >= 0) ) {
+		bin_counts[curr_bin] += count;
+	} else if (curr_bin > num_bins) {
+		printf("Warning: Bin %d is out-of-bounds. Array size: %d\n", curr_bin, num_bins);
+		fflush(stdout);
 	}
 }
 
@@ -526,11 +861,8 @@ void generate_parameter_distribution_histogram(InteractionClassComputer* const i
     InteractionClassSpec* ispec = icomp->ispec;	
 	
 	std::string filename;
-	std::ifstream dist_stream;
 	std::ofstream hist_stream;
 	int num_bins = 0;
-	int	curr_bin;
-	double value; 
 	double* bin_centers;
 	unsigned long* bin_counts;
 	for (int i = 0; i < ispec->get_n_defined(); i++) {
@@ -550,26 +882,25 @@ void generate_parameter_distribution_histogram(InteractionClassComputer* const i
 	      bin_centers[j] = bin_centers[j - 1] + (0.5 * ispec->get_fm_binwidth());
         }
 		
-		// Open distribution file
-	 	filename = ispec->get_basename(name, i, "_") + ".dist";
-		check_and_open_in_stream(dist_stream, filename.c_str()); 
-		
-		// Populate histogram by reading distribution file
-		dist_stream >> value;
-		while (!dist_stream.fail()) {
-		  curr_bin = (int)(floor((value - ispec->lower_cutoffs[i] + VERYSMALL_F) / (0.5 * ispec->get_fm_binwidth())));	
-			if( (curr_bin < num_bins) && (curr_bin >= 0) ) {
-				bin_counts[curr_bin]++;
-			} else if (curr_bin > num_bins) {
-				printf("Warning: Bin %d is out-of-bounds. Array size: %d\n", curr_bin, num_bins);
-				fflush(stdout);
-			}
-			dist_stream >> value;
+		// Populate histogram by assigning each group of samples counted during range
+		// finding to the output bin of one of its members. Output bin edges are
+		// multiples of the fine width or lie in the first or last micro-unit of a
+		// fine bin, so all the samples in a group fall in the same output bin.
+		const ParameterHistogram& histogram = ispec->parameter_histograms[i];
+		for (unsigned j = 0; j < histogram.values.size(); j++) {
+			add_to_output_histogram((double)histogram.values[j] / 1.0e6, 1, ispec->lower_cutoffs[i], 0.5 * ispec->get_fm_binwidth(), num_bins, bin_counts);
+		}
+		int slots = histogram.get_slots_per_bin();
+		for (unsigned j = 0; j < histogram.counts.size(); j++) {
+			if (histogram.counts[j] == 0) continue;
+			long long bin_start = (long long)(histogram.first_bin + (long)(j / slots)) * histogram.fine_width;
+			long long offset[3] = {0, histogram.fine_width - 1, histogram.fine_width / 2};
+			add_to_output_histogram((double)(bin_start + offset[j % slots]) / 1.0e6, histogram.counts[j], ispec->lower_cutoffs[i], 0.5 * ispec->get_fm_binwidth(), num_bins, bin_counts);
 		}
 
 		// Write histogram to file
 		filename = ispec->get_basename(name, i, "_") + ".hist";
-		hist_stream.open(filename, std::ofstream::out);
+		hist_stream.open(get_file_path(filename.c_str()).c_str(), std::ofstream::out);
 		hist_stream << "#center\tcounts\n";
 		for (int j = 0; j < num_bins; j++) {
 			hist_stream << bin_centers[j] << "\t" << bin_counts[j] << "\n";
@@ -577,10 +908,11 @@ void generate_parameter_distribution_histogram(InteractionClassComputer* const i
 		
 		// Close files
 		hist_stream.close();
-		dist_stream.close();
 		delete [] bin_centers;
 		delete [] bin_counts;
 	}
+	delete [] ispec->parameter_histograms;
+	ispec->parameter_histograms = NULL;
 }
 
 void calculate_BI(CG_MODEL_DATA* const cg, MATRIX_DATA* mat, FrameSource* const fs)
@@ -8,12 +8,69 @@
 #ifndef _range_finding_h
 #define _range_finding_h
 
+#include <list>
+#include <vector>
+
+#include "trajectory_input.h"
+
 struct CG_MODEL_DATA;
 struct MATRIX_DATA;
+struct InteractionClassComputer;
+
+// Histogram of the parameter values (distances, angles, dihedrals, or densities)
+// sampled for one defined interaction. Values are rounded to micro-units (1e-6),
+// the precision of the text files that were once binned instead, so that the
+// output histogram does not depend on how the samples were stored. Counts are
+// kept on a fixed grid of fine bins anchored at zero that grows to cover
+// whatever range is sampled, so histograms kept by different workers can be
+// merged bin by bin. Samples on the first or last micro-unit of a fine bin are
+// counted separately, since they may lie on either side of an output bin edge.
+// Until there are more samples than fine bins, the rounded values themselves
+// are kept instead. The output histogram is made once the final range of the
+// interaction, and so the position of its bin edges, is known.
+struct ParameterHistogram {
+	long fine_width;							// Width of the fine bins in micro-units
+	long first_bin;								// Grid index of the first fine bin counted
+	std::vector<unsigned long> counts;			// Counts on the first micro-unit, the last micro-unit, and inside each fine bin, in turn
+	std::vector<long long> values;				// Rounded samples, kept until they outnumber the fine bins
+	long long min_value;						// Smallest rounded sample kept in values
+	long long max_value;						// Largest rounded sample kept in values
+
+	ParameterHistogram() : fine_width(1), first_bin(0), min_value(0), max_value(0) {}
+	void add(const double value);
+	void merge(const ParameterHistogram& other);
+	
+	inline int get_slots_per_bin(void) const { return (fine_width < 3) ? (int)fine_width : 3; }
+	void add_value_to_grid(const long long value);
+	void add_to_grid(const long bin, const int slot, const unsigned long count);
+	void move_values_to_grid(void);
+};
 
 // Initialization of storage for the range value arrays and their computation
 void initialize_range_finding_temps(CG_MODEL_DATA* const cg);
 
+// Frame-parallel range finding. Each worker owns buffers for the frames it is
+// handed, its own cell list, and copies of the range finding computers that
+// sample into worker-local ranges and histograms. Frames are handed out in two
+// alternating batches so that one batch can be read while the other is
+// sampled. The workers' results are reduced into the interaction class
+// specifications once all frames have been sampled.
+struct RangeFindingWorker {
+	std::vector<FrameConfig*> frame_buffers[2];		// Buffers for the frames of each batch
+	int n_buffered_frames[2];						// Number of frames stored in each batch
+	PairCellList pair_cell_list;
+	std::vector<real> cell_list_box_half_lengths;	// Box the cell list was set up for; empty before the first frame
+	std::list<InteractionClassComputer*> icomp_list;	// Copies of the range finding computers, in the order of cg->icomp_list
+
+	RangeFindingWorker(CG_MODEL_DATA* const cg, const int frames_per_batch);
+	~RangeFindingWorker();
+	void store_frame(const int batch, FrameConfig* const frame_config);
+	void sample_frames(const int batch, CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
+	void reduce_ranges(void);
+};
+
+bool can_find_ranges_in_parallel(CG_MODEL_DATA* const cg, FrameSource* const frame_source);
+
 // Main output function
 void write_range_files(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
 
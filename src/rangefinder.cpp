@@ -11,6 +11,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <ctime>
+#include <thread>
+#include <vector>
 #include "control_input.h"
 #include "force_computation.h"
 #include "interaction_hashing.h"
@@ -22,6 +24,8 @@
 #include "fm_output.h"
 
 void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameSource* const frame_source);
+void find_ranges_in_parallel(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameSource* const frame_source, const int n_workers);
+void start_sampling_batch(std::vector<std::thread> &threads, std::vector<RangeFindingWorker*> &workers, const int batch, CG_MODEL_DATA* const cg, MATRIX_DATA* const mat);
 
 int main(int argc, char* argv[])
 {
@@ -63,7 +67,13 @@ int main(int argc, char* argv[])
     MATRIX_DATA mat(&control_input, &cg);
 
     printf("Beginning range finding.\n");
-    construct_full_fm_matrix(&cg, &mat, &fs);
+    int n_threads = get_num_worker_threads(&mat);
+    if (n_threads > 1 && can_find_ranges_in_parallel(&cg, &fs)) {
+        printf("Sampling frames with %d worker threads.\n", n_threads);
+        find_ranges_in_parallel(&cg, &mat, &fs, n_threads);
+    } else {
+        construct_full_fm_matrix(&cg, &mat, &fs);
+    }
     printf("Ending range finding.\n");
     
     printf("Writing final output.\n"); fflush(stdout);
@@ -258,3 +268,90 @@ void construct_full_fm_matrix(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, F
     delete [] ref_box_half_lengths;
     
 }
+
+// Sample the frames on several worker threads. Frames are read here, in order,
+// and handed round-robin to the workers; while the workers sample one batch of
+// frames, the next batch is read into their other set of frame buffers.
+
+void find_ranges_in_parallel(CG_MODEL_DATA* const cg, MATRIX_DATA* const mat, FrameSource* const frame_source, const int n_workers)
+{
+    const int frames_per_worker_batch = 4;
+    int total_frame_samples = frame_source->n_frames;
+    int read_stat = 1;
+    int batch = 0;
+    int n_batch_frames = 0;
+    std::vector<RangeFindingWorker*> workers;
+    std::vector<std::thread> threads;
+    
+    // Skip the desired number of frames before starting the sampling loop.
+    frame_source->move_to_start_frame(frame_source);
+    
+    // Keep the same restriction on the trajectory length as the serial loop.
+    if (mat->matrix_type != kDense && total_frame_samples % mat->frames_per_traj_block != 0) {
+        printf("Total number of frame samples %d is not divisible by block size %d.\n", total_frame_samples, mat->frames_per_traj_block);
+        exit(EXIT_FAILURE);
+    }
+    
+    for (int w = 0; w < n_workers; w++) workers.push_back(new RangeFindingWorker(cg, frames_per_worker_batch));
+    
+    printf("Entering primary matrix-building loop.\n"); fflush(stdout);
+    for (int traj_frame_num = 0; traj_frame_num < total_frame_samples; traj_frame_num++) {
+        
+        // Check that the last frame was read successfully (read at end of each iteration)
+        if (read_stat == 0) {
+            printf("Failure reading frame %d (%d). Check trajectory for errors.\n", frame_source->current_frame_n, traj_frame_num);
+            exit(EXIT_FAILURE);
+        }
+        
+        // Skip frames with a frame weight of 0.
+        if (frame_source->use_statistical_reweighting) {
+            printf("Reweighting entries for trajectory frame %d. ", traj_frame_num);
+        }
+        if (!(frame_source->use_statistical_reweighting && frame_source->frame_weights[traj_frame_num] == 0.0)) {
+            workers[n_batch_frames % n_workers]->store_frame(batch, frame_source->getFrameConfig());
+            n_batch_frames++;
+        }
+        
+        // Hand the batch to the workers once every worker's buffers are full.
+        if (n_batch_frames == n_workers * frames_per_worker_batch) {
+            start_sampling_batch(threads, workers, batch, cg, mat);
+            batch = 1 - batch;
+            n_batch_frames = 0;
+        }
+        
+        printf("\r%d (%d) frames have been sampled. ", frame_source->current_frame_n, traj_frame_num + 1);
+        fflush(stdout);
+        
+        // Read the next frame unless this was the last; the success of this
+        // read will be checked at the start of the next iteration of the loop.
+        if (traj_frame_num + 1 < total_frame_samples) {
+            read_stat = (*frame_source->get_next_frame)(frame_source);
+        }
+    }
+    
+    // Sample the last, partial batch and wait for the workers to finish.
+    if (n_batch_frames > 0) start_sampling_batch(threads, workers, batch, cg, mat);
+    for (unsigned w = 0; w < threads.size(); w++) threads[w].join();
+    
+    printf("\nFinishing frame parsing.\n");
+    
+    // Combine the ranges and histograms sampled by each worker.
+    for (int w = 0; w < n_workers; w++) {
+        workers[w]->reduce_ranges();
+        delete workers[w];
+    }
+    
+    // Close the trajectory and free the relevant temp variables.
+    frame_source->cleanup(frame_source);
+}
+
+// Wait for the workers to finish the previous batch, then start them on this one.
+
+void start_sampling_batch(std::vector<std::thread> &threads, std::vector<RangeFindingWorker*> &workers, const int batch, CG_MODEL_DATA* const cg, MATRIX_DATA* const mat)
+{
+    for (unsigned w = 0; w < threads.size(); w++) threads[w].join();
+    threads.clear();
+    for (unsigned w = 0; w < workers.size(); w++) {
+        threads.push_back(std::thread(&RangeFindingWorker::sample_frames, workers[w], batch, cg, mat));
+    }
+}
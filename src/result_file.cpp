@@ -0,0 +1,287 @@
+//
+//  result_file.cpp
+//
+//
+//  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <list>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "interaction_model.h"
+#include "misc.h"
+#include "result_file.h"
+
+static const char RESULT_FILE_MAGIC[8] = "MSCGRES";
+static const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+// Internal helper prototypes.
+
+uint64_t hash_word(uint64_t hash, const uint64_t word);
+uint64_t hash_double(uint64_t hash, const double value);
+
+//-------------------------------------------------------------
+// Checksums and hashes
+//-------------------------------------------------------------
+
+// A word-at-a-time FNV-1a hash: cheap enough to run over every value
+// written while still catching truncation, reordering, and bit flips.
+
+uint64_t hash_word(uint64_t hash, const uint64_t word)
+{
+	return (hash ^ word) * FNV_PRIME;
+}
+
+uint64_t hash_double(uint64_t hash, const double value)
+{
+	uint64_t word;
+	memcpy(&word, &value, sizeof(double));
+	return hash_word(hash, word);
+}
+
+uint64_t update_result_checksum(uint64_t checksum, const double* values, const uint64_t n_values)
+{
+	for (uint64_t i = 0; i < n_values; i++) checksum = hash_double(checksum, values[i]);
+	return checksum;
+}
+
+uint64_t calculate_basis_layout_hash(CG_MODEL_DATA* const cg)
+{
+	uint64_t hash = FNV_OFFSET_BASIS;
+	std::list<InteractionClassSpec*> iclass_list = cg->iclass_list;
+	iclass_list.push_back(&cg->three_body_nonbonded_interactions);
+
+	for (std::list<InteractionClassSpec*>::iterator iclass_iterator = iclass_list.begin(); iclass_iterator != iclass_list.end(); iclass_iterator++) {
+		InteractionClassSpec* ispec = *iclass_iterator;
+		hash = hash_word(hash, (uint64_t)ispec->class_subtype);
+		hash = hash_word(hash, (uint64_t)ispec->get_basis_type());
+		hash = hash_word(hash, (uint64_t)ispec->get_bspline_k());
+		hash = hash_double(hash, ispec->get_fm_binwidth());
+		hash = hash_word(hash, (uint64_t)ispec->n_defined);
+		hash = hash_word(hash, (uint64_t)ispec->interaction_column_indices.size());
+		for (unsigned i = 0; i < ispec->interaction_column_indices.size(); i++) {
+			hash = hash_word(hash, (uint64_t)ispec->interaction_column_indices[i]);
+		}
+
+		// The ranges of the force-matched interactions fix the positions of their basis functions.
+		if (ispec->defined_to_matched_intrxn_index_map.size() != (unsigned)ispec->n_defined) continue;
+		for (int i = 0; i < ispec->n_defined; i++) {
+			if (ispec->defined_to_matched_intrxn_index_map[i] == 0) continue;
+			hash = hash_double(hash, ispec->lower_cutoffs[i]);
+			hash = hash_double(hash, ispec->upper_cutoffs[i]);
+		}
+	}
+	return hash;
+}
+
+//-------------------------------------------------------------
+// Writing
+//-------------------------------------------------------------
+
+ResultFileWriter::ResultFileWriter(const char* new_filename, const int matrix_type, const int n_columns, const uint64_t basis_layout_hash, const int64_t n_frames, const int n_estimates) : filename(new_filename)
+{
+	memset(&header, 0, sizeof(ResultFileHeader));
+	memcpy(header.magic, RESULT_FILE_MAGIC, sizeof(header.magic));
+	header.version = RESULT_FILE_VERSION;
+	header.byte_order_mark = RESULT_FILE_BYTE_ORDER_MARK;
+	header.matrix_type = matrix_type;
+	header.n_columns = n_columns;
+	header.basis_layout_hash = basis_layout_hash;
+	header.n_frames = n_frames;
+	header.n_estimates = n_estimates;
+	section_offset = -1;
+
+	// The header is rewritten with the final section count on close.
+	fh = open_file(filename.c_str(), "wb");
+	fwrite(&header, sizeof(ResultFileHeader), 1, fh);
+}
+
+void ResultFileWriter::begin_section(const ResultSectionType section_type, const int estimate, const uint64_t n_values)
+{
+	if (section_offset >= 0) {
+		printf("Cannot begin a new section of %s before ending the previous one.\n", filename.c_str());
+		exit(EXIT_FAILURE);
+	}
+	section.section_type = section_type;
+	section.estimate = estimate;
+	section.n_values = n_values;
+	section.checksum = FNV_OFFSET_BASIS;
+	n_section_values_written = 0;
+
+	// The section header is rewritten with the final checksum when the section ends.
+	section_offset = ftell(fh);
+	fwrite(&section, sizeof(ResultSectionHeader), 1, fh);
+}
+
+void ResultFileWriter::write_values(const double* values, const uint64_t n_values)
+{
+	section.checksum = update_result_checksum(section.checksum, values, n_values);
+	if (fwrite(values, sizeof(double), n_values, fh) != n_values) {
+		printf("Failed to write %s.\n", filename.c_str());
+		exit(EXIT_FAILURE);
+	}
+	n_section_values_written += n_values;
+}
+
+void ResultFileWriter::end_section(void)
+{
+	if (n_section_values_written != section.n_values) {
+		printf("Section %u of %s should hold %lu values but %lu were written.\n", section.section_type, filename.c_str(), (unsigned long)section.n_values, (unsigned long)n_section_values_written);
+		exit(EXIT_FAILURE);
+	}
+	long end_offset = ftell(fh);
+	fseek(fh, section_offset, SEEK_SET);
+	fwrite(&section, sizeof(ResultSectionHeader), 1, fh);
+	fseek(fh, end_offset, SEEK_SET);
+	section_offset = -1;
+	header.n_sections++;
+}
+
+void ResultFileWriter::close(void)
+{
+	if (section_offset >= 0) end_section();
+	fseek(fh, 0, SEEK_SET);
+	fwrite(&header, sizeof(ResultFileHeader), 1, fh);
+	if (fclose(fh) != 0) {
+		printf("Failed to finish writing %s.\n", filename.c_str());
+		exit(EXIT_FAILURE);
+	}
+	fh = NULL;
+}
+
+//-------------------------------------------------------------
+// Reading
+//-------------------------------------------------------------
+
+ResultFileReader::ResultFileReader(const char* new_filename) : filename(new_filename)
+{
+	std::string file_path = get_file_path(new_filename);
+	int fd = open(file_path.c_str(), O_RDONLY);
+	struct stat file_stats;
+	if (fd < 0 || fstat(fd, &file_stats) != 0) {
+		fprintf(stderr, "Failed to open file %s.\n", file_path.c_str());
+		fflush(stderr);
+		exit(EXIT_FAILURE);
+	}
+	file_size = (size_t)file_stats.st_size;
+	if (file_size == 0) {
+		printf("Result file %s is empty.\n", new_filename);
+		exit(EXIT_FAILURE);
+	}
+	void* mapping = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapping == MAP_FAILED) {
+		printf("Failed to map result file %s.\n", new_filename);
+		exit(EXIT_FAILURE);
+	}
+	data = (const char*)mapping;
+
+	// Files without the magic string predate the versioned format.
+	memset(&header, 0, sizeof(ResultFileHeader));
+	if (file_size < sizeof(ResultFileHeader) || memcmp(data, RESULT_FILE_MAGIC, sizeof(header.magic)) != 0) {
+		legacy_format = 1;
+		return;
+	}
+	legacy_format = 0;
+	memcpy(&header, data, sizeof(ResultFileHeader));
+
+	if (header.byte_order_mark != RESULT_FILE_BYTE_ORDER_MARK) {
+		printf("Result file %s was written on a machine with a different byte order.\n", new_filename);
+		exit(EXIT_FAILURE);
+	}
+	if (header.version > RESULT_FILE_VERSION) {
+		printf("Result file %s uses format version %u; this build reads up to version %u.\n", new_filename, header.version, RESULT_FILE_VERSION);
+		exit(EXIT_FAILURE);
+	}
+	if (header.flags != 0) {
+		printf("Result file %s uses an encoding (flags %u) that this build does not support.\n", new_filename, header.flags);
+		exit(EXIT_FAILURE);
+	}
+
+	// Index the sections.
+	size_t offset = sizeof(ResultFileHeader);
+	for (int i = 0; i < header.n_sections; i++) {
+		ResultSectionHeader section;
+		if (offset + sizeof(ResultSectionHeader) > file_size) break;
+		memcpy(&section, data + offset, sizeof(ResultSectionHeader));
+		offset += sizeof(ResultSectionHeader);
+		if (section.n_values > (file_size - offset) / sizeof(double)) break;
+		sections.push_back(section);
+		section_offsets.push_back(offset);
+		offset += section.n_values * sizeof(double);
+	}
+	if ((int)sections.size() != header.n_sections) {
+		printf("Result file %s is truncated: found %d of %d sections.\n", new_filename, (int)sections.size(), header.n_sections);
+		exit(EXIT_FAILURE);
+	}
+}
+
+ResultFileReader::~ResultFileReader()
+{
+	munmap((void*)data, file_size);
+}
+
+// Stop if this file was produced by a calculation whose FM matrix columns
+// mean something different from those of the current calculation.
+
+void ResultFileReader::check_compatibility(const int matrix_type, const int n_columns, const uint64_t basis_layout_hash) const
+{
+	if (legacy_format == 1) return;
+
+	// Dense and sparse-accumulated dense normal equations are stored identically.
+	int file_matrix_type = (header.matrix_type == 3) ? 0 : header.matrix_type;
+	int current_matrix_type = (matrix_type == 3) ? 0 : matrix_type;
+	if (file_matrix_type != current_matrix_type) {
+		printf("Result file %s was written with matrix_type %d, which cannot be combined using matrix_type %d.\n", filename.c_str(), header.matrix_type, matrix_type);
+		exit(EXIT_FAILURE);
+	}
+	if (header.n_columns != n_columns) {
+		printf("Result file %s has %d FM matrix columns but the current model has %d.\n", filename.c_str(), header.n_columns, n_columns);
+		exit(EXIT_FAILURE);
+	}
+	if (header.basis_layout_hash != basis_layout_hash) {
+		printf("Result file %s was written with a different basis set or interaction ranges than the current model.\n", filename.c_str());
+		printf("Check that control.in, top.in, rmin.in, and rmin_b.in match the run that produced it.\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Return a pointer to the values of a section, verifying its length and checksum.
+
+const double* ResultFileReader::get_section(const ResultSectionType section_type, const int estimate, const uint64_t n_values) const
+{
+	for (unsigned i = 0; i < sections.size(); i++) {
+		if (sections[i].section_type != (uint32_t)section_type || sections[i].estimate != estimate) continue;
+
+		if (sections[i].n_values != n_values) {
+			printf("Section %d of result file %s holds %lu values; expected %lu.\n", section_type, filename.c_str(), (unsigned long)sections[i].n_values, (unsigned long)n_values);
+			exit(EXIT_FAILURE);
+		}
+		const double* values = (const double*)(data + section_offsets[i]);
+		if (update_result_checksum(FNV_OFFSET_BASIS, values, n_values) != sections[i].checksum) {
+			printf("Checksum mismatch in section %d of result file %s; the file is corrupt.\n", section_type, filename.c_str());
+			exit(EXIT_FAILURE);
+		}
+		return values;
+	}
+	printf("Result file %s has no section %d for estimate %d.\n", filename.c_str(), section_type, estimate);
+	exit(EXIT_FAILURE);
+}
+
+// Return the first n_values raw values of a legacy (headerless) file.
+
+const double* ResultFileReader::get_legacy_values(const uint64_t n_values) const
+{
+	if (n_values > file_size / sizeof(double)) {
+		printf("Expected %lu values in %s but only found %lu. Check that control.in matches the run that produced it.\n", (unsigned long)n_values, filename.c_str(), (unsigned long)(file_size / sizeof(double)));
+		exit(EXIT_FAILURE);
+	}
+	return (const double*)data;
+}
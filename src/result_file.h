@@ -0,0 +1,116 @@
+//
+//  result_file.h
+//
+//
+//  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
+//
+
+#ifndef _result_file_h
+#define _result_file_h
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+struct CG_MODEL_DATA;
+
+//-------------------------------------------------------------
+// Versioned binary container for intermediate FM results
+//-------------------------------------------------------------
+
+// The binary intermediates written for later combination (result.out,
+// final_equations.out) and the checkpoints written during FM (checkpoint.out) start with a fixed-size header describing the
+// calculation that produced them, followed by a sequence of sections.
+// Each section carries its own header with its contents, its length, and a
+// checksum of its values. Every header is a multiple of 8 bytes, so the
+// values of each section are aligned in the file and can be used directly
+// from a memory mapping.
+
+const uint32_t RESULT_FILE_VERSION = 1;
+const uint32_t RESULT_FILE_BYTE_ORDER_MARK = 0x01020304;
+
+enum ResultSectionType {
+	kResultNormalMatrix = 1,			// Upper triangle of the normal form matrix, packed column by column
+	kResultNormalRHS = 2,				// Normal form target vector (accumulation target vector for matrix_type 2)
+	kResultForceSqTotal = 3,			// Sum of squared target forces
+	kResultInverseNormalization = 4,	// Weighted number of frames
+	kResultSolution = 5,				// Un-normalized sum of blockwise solutions (matrix_type 1)
+	kResultNormalizationFactors = 6,	// Per-column normalization factors for the blockwise solution sum (matrix_type 1)
+	kResultAccumulationMatrix = 7,		// Upper triangle of the accumulated R factor, packed column by column (matrix_type 2)
+	kResultCheckpointState = 8			// Blocks completed, block size, and trajectory frames read (checkpoint.out only)
+};
+
+struct ResultFileHeader {
+	char magic[8];						// "MSCGRES"
+	uint32_t version;					// RESULT_FILE_VERSION of the writer
+	uint32_t byte_order_mark;			// RESULT_FILE_BYTE_ORDER_MARK in the byte order of the writer
+	int32_t matrix_type;
+	int32_t n_columns;					// Number of FM matrix columns (basis functions)
+	uint64_t basis_layout_hash;			// See calculate_basis_layout_hash
+	int64_t n_frames;					// Number of trajectory frames that contributed
+	int32_t n_sections;
+	int32_t n_estimates;				// Number of bootstrapping estimates stored; 0 if none
+	uint32_t flags;						// Encoding flags (e.g. compression); none are defined in version 1
+	uint32_t reserved[3];
+};
+
+struct ResultSectionHeader {
+	uint32_t section_type;				// A ResultSectionType
+	int32_t estimate;					// Bootstrapping estimate index; -1 for the full-trajectory results
+	uint64_t n_values;
+	uint64_t checksum;					// See update_result_checksum
+};
+
+// Streaming writer; sections are written one after another, and each
+// section's values may be supplied in any number of pieces.
+
+struct ResultFileWriter {
+	std::string filename;
+	FILE* fh;
+	ResultFileHeader header;
+	ResultSectionHeader section;
+	long section_offset;
+	uint64_t n_section_values_written;
+
+	ResultFileWriter(const char* new_filename, const int matrix_type, const int n_columns, const uint64_t basis_layout_hash, const int64_t n_frames, const int n_estimates);
+	void begin_section(const ResultSectionType section_type, const int estimate, const uint64_t n_values);
+	void write_values(const double* values, const uint64_t n_values);
+	void end_section(void);
+	void close(void);
+
+	inline void write_section(const ResultSectionType section_type, const int estimate, const double* values, const uint64_t n_values) {
+		begin_section(section_type, estimate, n_values);
+		write_values(values, n_values);
+		end_section();
+	}
+};
+
+// Reader over a memory-mapped result file. Files written before the versioned
+// format was introduced have no header; these are flagged as legacy_format
+// and their raw values can still be accessed with get_legacy_values.
+
+struct ResultFileReader {
+	std::string filename;
+	ResultFileHeader header;
+	int legacy_format;
+	size_t file_size;
+	const char* data;
+	std::vector<ResultSectionHeader> sections;
+	std::vector<size_t> section_offsets;
+
+	ResultFileReader(const char* new_filename);
+	~ResultFileReader();
+	void check_compatibility(const int matrix_type, const int n_columns, const uint64_t basis_layout_hash) const;
+	const double* get_section(const ResultSectionType section_type, const int estimate, const uint64_t n_values) const;
+	const double* get_legacy_values(const uint64_t n_values) const;
+};
+
+// Checksum used for result file sections.
+uint64_t update_result_checksum(uint64_t checksum, const double* values, const uint64_t n_values);
+
+// Hash of everything that determines the meaning of each FM matrix column:
+// which interactions are force matched, their basis sets, and their ranges.
+uint64_t calculate_basis_layout_hash(CG_MODEL_DATA* const cg);
+
+#endif
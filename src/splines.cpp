@@ -5,6 +5,7 @@
 //  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
 //
 
+#include <algorithm>
 #include <cassert>
 #include "splines.h"
 #include "interaction_model.h"
@@ -14,6 +15,10 @@ inline void check_bspline_size(const int control_points, const int order);
 inline double check_against_cutoffs(const double axis, const double lower_cutoff, const double upper_cutoff);
 inline void check_bspline_sizing(const size_t coeffs_size, const int first_nonzero_basis_index, const int index_among_matched_interactions, const int ici_index, const int tn, const size_t istart);
 
+// Helper functions for evaluating B-splines with uniform knots on a grid
+void calculate_bspline_interval_polynomials(gsl_bspline_workspace* const bw, const int bspline_k, const int interval, std::vector<double> &basis_polynomials);
+void evaluate_uniform_bsplines_on_grid(gsl_bspline_workspace* const bw, const int bspline_k, const int index_among_matched_interactions, const int first_coeff_index, const double lower_cutoff, const double upper_cutoff, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals, std::vector< std::vector<double> >* const derivs);
+
 // Helper functions for setting up periodic splines
 inline void adjust_splines_for_periodicity(const InteractionClassType class_type, const int n_coef, const std::vector<unsigned> defined_to_periodic_intrxn_index_map, std::vector<unsigned> &interaction_column_indices);
 inline void shift_remaining_indices(const int start, const int bspline_k, std::vector<unsigned> &interaction_column_indices, const int size);
@@ -76,6 +81,26 @@ double SplineComputer::get_param_less_lower_cutoff(const int index_among_defined
     return param_less_lower_cutoff;
 }
 
+// Evaluate the splines at each point of a grid. This default suits the
+// splines whose evaluate_spline uses no temporaries.
+void SplineComputer::evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals)
+{
+    vals.resize(spline_coeff_sets.size());
+    for (unsigned s = 0; s < spline_coeff_sets.size(); s++) {
+        vals[s].resize(axis_vals.size());
+        for (unsigned i = 0; i < axis_vals.size(); i++) {
+            vals[s][i] = evaluate_spline(index_among_defined, first_nonzero_basis_index, *spline_coeff_sets[s], axis_vals[i]);
+        }
+    }
+}
+
+void SplineComputer::evaluate_spline_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const std::vector<double> &axis_vals, std::vector<double> &vals)
+{
+    std::vector<const std::vector<double>*> spline_coeff_sets(1, &spline_coeffs);
+    std::vector< std::vector<double> > set_vals;
+    evaluate_splines_on_grid(index_among_defined, first_nonzero_basis_index, spline_coeff_sets, axis_vals, set_vals);
+    vals.swap(set_vals[0]);
+}
 
 BSplineComputer::BSplineComputer(InteractionClassSpec* ispec) : SplineComputer(ispec)
 {
@@ -149,6 +174,12 @@ double BSplineComputer::evaluate_spline(const int index_among_defined, const int
     return force;
 }
 
+void BSplineComputer::evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals)
+{
+    int index_among_matched_interactions = ispec_->defined_to_matched_intrxn_index_map[index_among_defined];
+    evaluate_uniform_bsplines_on_grid(bspline_workspaces[index_among_matched_interactions - 1], n_coef, index_among_matched_interactions, first_nonzero_basis_index + interaction_column_indices_[index_among_matched_interactions - 1], ispec_->lower_cutoffs[index_among_defined], ispec_->upper_cutoffs[index_among_defined], spline_coeff_sets, axis_vals, vals, NULL);
+}
+
 BSplineAndDerivComputer::BSplineAndDerivComputer(InteractionClassSpec* ispec) : SplineComputer(ispec)
 {
     int n_to_print_minus_bspline_k, ici_index;
@@ -265,6 +296,18 @@ double BSplineAndDerivComputer::evaluate_spline_deriv(const int index_among_defi
     return deriv;
 }
 
+void BSplineAndDerivComputer::evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals)
+{
+    int index_among_matched_interactions = ispec_->defined_to_matched_intrxn_index_map[index_among_defined];
+    evaluate_uniform_bsplines_on_grid(bspline_workspaces[index_among_matched_interactions - 1], n_coef, index_among_matched_interactions, first_nonzero_basis_index + interaction_column_indices_[index_among_matched_interactions - 1], ispec_->lower_cutoffs[index_among_defined], ispec_->upper_cutoffs[index_among_defined], spline_coeff_sets, axis_vals, vals, NULL);
+}
+
+void BSplineAndDerivComputer::evaluate_splines_and_derivs_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals, std::vector< std::vector<double> > &derivs)
+{
+    int index_among_matched_interactions = ispec_->defined_to_matched_intrxn_index_map[index_among_defined];
+    evaluate_uniform_bsplines_on_grid(bspline_workspaces[index_among_matched_interactions - 1], n_coef, index_among_matched_interactions, first_nonzero_basis_index + interaction_column_indices_[index_among_matched_interactions - 1], ispec_->lower_cutoffs[index_among_defined], ispec_->upper_cutoffs[index_among_defined], spline_coeff_sets, axis_vals, vals, &derivs);
+}
+
 LinearSplineComputer::LinearSplineComputer(InteractionClassSpec* ispec) : SplineComputer(ispec)
 {
 	// Override generic constructor settings
@@ -382,4 +425,103 @@ inline void adjust_splines_for_periodicity(const InteractionClassType class_type
 inline void shift_remaining_indices(const int start, const int bspline_k, std::vector<unsigned> &interaction_column_indices, const int size)
 {
 	for(int i = start; i < size; i++) interaction_column_indices[i] += bspline_k;
-}
\ No newline at end of file
+}
+
+// Expand the bspline_k B-splines that are nonzero on a knot interval as 
+// polynomials in the distance u from the interval's left knot, so that
+// basis function b is the sum over m of basis_polynomials[b * bspline_k + m] * u^m.
+// This is the Cox-de Boor recursion that GSL uses to evaluate the basis
+// functions at a point, carried out on polynomials instead of numbers.
+
+void calculate_bspline_interval_polynomials(gsl_bspline_workspace* const bw, const int bspline_k, const int interval, std::vector<double> &basis_polynomials)
+{
+    // Knots relative to the interval's left knot.
+    double left_knot = gsl_vector_get(bw->knots, interval);
+    std::vector<double> knots(2 * bspline_k);
+    for (int j = 0; j < 2 * bspline_k; j++) knots[j] = gsl_vector_get(bw->knots, interval + 1 - bspline_k + j) - left_knot;
+    // knots[bspline_k - 1] is the left knot and knots[bspline_k] the right one.
+    
+    std::vector<double> saved(bspline_k), term(bspline_k);
+    basis_polynomials.assign(bspline_k * bspline_k, 0.0);
+    basis_polynomials[0] = 1.0;
+    for (int j = 1; j < bspline_k; j++) {
+        std::fill(saved.begin(), saved.end(), 0.0);
+        for (int r = 0; r < j; r++) {
+            // left = u - knots[k - 1 - j + r + 1], right = knots[k + r] - u
+            double left = -knots[bspline_k - j + r];
+            double right = knots[bspline_k + r];
+            double denominator = right - knots[bspline_k - j + r];
+            for (int m = 0; m < bspline_k; m++) term[m] = basis_polynomials[r * bspline_k + m] / denominator;
+            for (int m = 0; m < bspline_k; m++) {
+                basis_polynomials[r * bspline_k + m] = saved[m] + right * term[m] - ((m > 0) ? term[m - 1] : 0.0);
+                saved[m] = left * term[m] + ((m > 0) ? term[m - 1] : 0.0);
+            }
+        }
+        for (int m = 0; m < bspline_k; m++) basis_polynomials[j * bspline_k + m] = saved[m];
+    }
+}
+
+// Evaluate a B-spline with uniform knots for each of several sets of 
+// coefficients at each point of a grid. The grid points are visited in 
+// order, and on each new knot interval the basis function polynomials are
+// combined with every set of coefficients at once (a bspline_k by bspline_k
+// matrix product) into one polynomial per set, which is then evaluated at 
+// the grid points in that interval. This replaces a basis function 
+// evaluation per point and set with one per interval.
+
+void evaluate_uniform_bsplines_on_grid(gsl_bspline_workspace* const bw, const int bspline_k, const int index_among_matched_interactions, const int first_coeff_index, const double lower_cutoff, const double upper_cutoff, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals, std::vector< std::vector<double> >* const derivs)
+{
+    int n_sets = spline_coeff_sets.size();
+    int n_points = axis_vals.size();
+    int last_interval = (int)gsl_bspline_ncoeffs(bw) - 1;
+    vals.resize(n_sets);
+    for (int s = 0; s < n_sets; s++) vals[s].resize(n_points);
+    if (derivs != NULL) {
+        derivs->resize(n_sets);
+        for (int s = 0; s < n_sets; s++) (*derivs)[s].resize(n_points);
+    }
+    
+    std::vector<double> basis_polynomials;
+    std::vector<double> spline_polynomials(n_sets * bspline_k);
+    int interval = -1;
+    for (int p = 0; p < n_points; p++) {
+        double axis_val = check_against_cutoffs(axis_vals[p], lower_cutoff, upper_cutoff);
+        
+        // Find the knot interval containing this point, starting from the last one.
+        int new_interval = (interval < 0) ? bspline_k - 1 : interval;
+        while (new_interval > bspline_k - 1 && axis_val < gsl_vector_get(bw->knots, new_interval)) new_interval--;
+        while (new_interval < last_interval && axis_val >= gsl_vector_get(bw->knots, new_interval + 1)) new_interval++;
+        
+        if (new_interval != interval) {
+            interval = new_interval;
+            calculate_bspline_interval_polynomials(bw, bspline_k, interval, basis_polynomials);
+            int istart = interval - bspline_k + 1;
+            std::fill(spline_polynomials.begin(), spline_polynomials.end(), 0.0);
+            for (int s = 0; s < n_sets; s++) {
+                const std::vector<double> &spline_coeffs = *spline_coeff_sets[s];
+                for (int b = 0; b < bspline_k; b++) {
+                    if ((int)spline_coeffs.size() <= first_coeff_index + istart + b) {
+                        check_bspline_sizing(spline_coeffs.size(), first_coeff_index, index_among_matched_interactions, 0, istart + b, istart);
+                        continue;
+                    }
+                    double coeff = spline_coeffs[first_coeff_index + istart + b];
+                    for (int m = 0; m < bspline_k; m++) spline_polynomials[s * bspline_k + m] += coeff * basis_polynomials[b * bspline_k + m];
+                }
+            }
+        }
+        
+        // Evaluate each set's polynomial and its derivative by Horner's rule.
+        double u = axis_val - gsl_vector_get(bw->knots, interval);
+        for (int s = 0; s < n_sets; s++) {
+            const double* polynomial = &spline_polynomials[s * bspline_k];
+            double val = polynomial[bspline_k - 1];
+            double deriv = 0.0;
+            for (int m = bspline_k - 2; m >= 0; m--) {
+                deriv = deriv * u + val;
+                val = val * u + polynomial[m];
+            }
+            vals[s][p] = val;
+            if (derivs != NULL) (*derivs)[s][p] = deriv;
+        }
+    }
+}
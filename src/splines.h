@@ -34,6 +34,12 @@ public:
     inline int get_n_coef(void) { return n_coef; };
     virtual void calculate_basis_fn_vals(const int index_among_defined, const double param_val, int &first_nonzero_basis_index, std::vector<double> &vals) = 0;
     virtual double evaluate_spline(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const double axis) = 0;
+    // Evaluate the spline at each of axis_vals, once for each set of 
+    // coefficients (such as the master solution and the bootstrap estimates).
+    // Unlike evaluate_spline, these can be called for different interactions
+    // of a class at the same time.
+    virtual void evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals);
+    void evaluate_spline_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const std::vector<double> &axis_vals, std::vector<double> &vals);
 };
 
 SplineComputer* set_up_fm_spline_comp(InteractionClassSpec *ispec);
@@ -51,6 +57,7 @@ public:
     
    virtual void calculate_basis_fn_vals(const int index_among_defined, const double param_val, int &first_nonzero_basis_index, std::vector<double> &vals);
    virtual double evaluate_spline(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const double axis);
+   virtual void evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals);
 };
 
 class BSplineAndDerivComputer : public SplineComputer {
@@ -69,6 +76,8 @@ public:
    void calculate_bspline_deriv_vals(const int index_among_defined, const double param_val, int &first_nonzero_basis_index, std::vector<double> &vals);
    virtual double evaluate_spline(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const double axis);
    double evaluate_spline_deriv(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<double> &spline_coeffs, const double axis); 
+   virtual void evaluate_splines_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals);
+   void evaluate_splines_and_derivs_on_grid(const int index_among_defined, const int first_nonzero_basis_index, const std::vector<const std::vector<double>*> &spline_coeff_sets, const std::vector<double> &axis_vals, std::vector< std::vector<double> > &vals, std::vector< std::vector<double> > &derivs);
 };
 
 class LinearSplineComputer : public SplineComputer {
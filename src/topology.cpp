@@ -5,10 +5,12 @@
 //  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
 //
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
 #include <fstream>
+#include <thread>
 #include <vector>
 
 #include "interaction_model.h"
@@ -27,12 +29,16 @@ int read_density_groups(TopologyData* topo_data, CG_MODEL_DATA* const cg, std::i
 int read_density_weights(TopologyData* topo_data, CG_MODEL_DATA* const cg, std::ifstream &top_in, int line_num);
 // Read a single molecule's topology specification.
 void read_molecule_definition(TopologyData* const mol, TopologyData* const cg, std::ifstream &top_in, int &line);
-// Determine appropriate non-bonded exclusions based on bonded topology and excluded_style setting
-bool new_excluded_partner(unsigned** const excluded_partners, const int location, const unsigned current_size, const unsigned new_site);
+// Determine how many worker threads to use when building topology lists.
+int get_num_topology_threads(TopologyData const* topo_data);
+// Collect the sorted, distinct sites excluded from nonbonded interactions with one site.
+void collect_excluded_partners(TopologyData const* topo_data, const unsigned site, const int excluded_style, std::vector<unsigned> &excluded, std::vector<unsigned> &visit_marks, std::vector<unsigned> &search_queue);
+// Fill every site's exclusions in parallel; returns the first site with too many exclusions or n_cg_sites.
+unsigned build_excluded_list(TopologyData const* topo_data, TopoList* const exclusion_list, const int excluded_style, int n_threads);
+// Report a site with more exclusions than the exclusion list can hold.
+void report_excluded_list_overflow(const unsigned n_excluded, const unsigned max_excluded_number, const int excluded_style);
 // Report an error in the topology input file.
 void report_topology_input_format_error(const int line, char *parameter_name);
-// Search function for molecular exclusion.
-void recursive_exclusion_search(TopologyData const* topo_data, TopoList* &exclusion_list, std::vector<int> &path_list);
 
 //---------------------------------------------------------------
 // Functions for managing TopoList structs
@@ -43,21 +49,32 @@ TopoList::TopoList(unsigned n_sites, unsigned partners_per, unsigned max_partner
     modified = 0;
     partner_numbers_ = new unsigned[n_sites_]();
     partners_ = new unsigned*[n_sites_];
+    partner_storage_ = new unsigned[size_t(n_sites_) * partners_per_ * max_partners_]();
     for (unsigned i = 0; i < n_sites_; i++) {
-        partners_[i] = new unsigned[partners_per_ * max_partners_]();
+        partners_[i] = partner_storage_ + size_t(i) * partners_per_ * max_partners_;
     }
 }
 
 TopoList::~TopoList() {
 	if (modified == 0) {
-    	for (unsigned i = 0; i < n_sites_; i++) {
-        	delete [] partners_[i];
-    	}
+    	delete [] partner_storage_;
     	delete [] partners_;
     	delete [] partner_numbers_;
 	}
 }
 
+void TopoList::share_arrays(unsigned** partners, unsigned* partner_numbers) {
+	if (modified == 0) {
+    	delete [] partner_storage_;
+    	delete [] partners_;
+    	delete [] partner_numbers_;
+	}
+	modified = 1;
+	partner_storage_ = NULL;
+	partners_ = partners;
+	partner_numbers_ = partner_numbers;
+}
+
 //---------------------------------------------------------------
 // Functions for managing TopologyData structs
 //---------------------------------------------------------------
@@ -112,6 +129,8 @@ void initialize_topology_data(TopologyData* const topo_data)
 	topo_data->exclusion_list = new TopoList(nsites, 1, get_max_exclusion_number(topo_data, topo_data->excluded_style));
 	// Read density exclusion list data structures.
 	topo_data->density_exclusion_list = new TopoList(nsites, 1, get_max_exclusion_number(topo_data, topo_data->density_excluded_style));
+	// Density groups are only read from top.in; until then, there are none.
+	topo_data->n_density_groups = 0;
 }
 
 // Free an initialized TopologyData struct.
@@ -246,7 +265,12 @@ void read_topology_file(TopologyData* topo_data, CG_MODEL_DATA* const cg)
     if (strcmp(parameter_name, "system") != 0) report_topology_input_format_error(line, parameter_name);
     
     // For each line in this section, add a given number of molecules
-    // of a given type to the system in order.
+    // of a given type to the system in order. Only the type and first
+    // site of each molecule are recorded here; the topology lists are
+    // filled from the molecule templates below.
+    std::vector<unsigned> molecule_types;
+    std::vector<unsigned> molecule_first_sites;
+    std::vector<bool> molecule_type_used(n_molecule_types, false);
     for (i = 0; i < block; i++) {
         // Get a number and type of molecules.
         check_and_read_next_line(top_in, buff, line);
@@ -254,39 +278,19 @@ void read_topology_file(TopologyData* topo_data, CG_MODEL_DATA* const cg)
         molecule_type--;
         total_cg_molecules += n_molecules_in_system;
         assert(total_cg_molecules <= cg->n_cg_sites);
+        if (molecule_type >= n_molecule_types) {
+            printf("Wrong format in top.in: line %d, molecule type %d is not defined.\n", line, molecule_type + 1);
+            exit(EXIT_FAILURE);
+        }
+        if (n_molecules_in_system > 0) molecule_type_used[molecule_type] = true;
         
-        // For each molecules of that type to add to the growing
-        // total system definition, add an appropriate number
-        // of CG sites to the topology lists using the molecule's
-        // topology as a guide.
         for (j = 0; j < n_molecules_in_system; j++) {
-            for (k = 0; k < mol[molecule_type].n_cg_sites; k++) {
-            	if (mol[molecule_type].bond_list->partner_numbers_[k] > topo_data->max_pair_bonds_per_site) {
-                	printf("Warning: Too many bonds (%d) to handle based on max_pair_bonds_per_site (%d) !\n", mol[molecule_type].bond_list->partner_numbers_[k], topo_data->max_pair_bonds_per_site);
-    				exit(EXIT_FAILURE);
-                }
-                if (mol[molecule_type].angle_list->partner_numbers_[k] > topo_data->max_angles_per_site) {
-                	printf("Warning: Too many bonds (%d) to handle based on max_angles_per_site (%d) !\n", mol[molecule_type].angle_list->partner_numbers_[k], topo_data->max_angles_per_site);
-    				exit(EXIT_FAILURE);
-                }
-                if (mol[molecule_type].dihedral_list->partner_numbers_[k] > topo_data->max_dihedrals_per_site) {
-                	printf("Warning: Too many bonds (%d) to handle based on max_dihedrals_per_site (%d) !\n", mol[molecule_type].dihedral_list->partner_numbers_[k], topo_data->max_dihedrals_per_site);
-    				exit(EXIT_FAILURE);
-                }
-                topo_data->cg_site_types[k + first_site_in_molecule] = mol[molecule_type].cg_site_types[k];
-                topo_data->bond_list->partner_numbers_[k + first_site_in_molecule] = mol[molecule_type].bond_list->partner_numbers_[k];
-                for (l = 0; l < mol[molecule_type].bond_list->partner_numbers_[k]; l++) {
-                    topo_data->bond_list->partners_[k + first_site_in_molecule][l] = mol[molecule_type].bond_list->partners_[k][l] + first_site_in_molecule;
-                }
-                topo_data->angle_list->partner_numbers_[k + first_site_in_molecule] = mol[molecule_type].angle_list->partner_numbers_[k];
-                for (l = 0; l < 2 * mol[molecule_type].angle_list->partner_numbers_[k]; l++) {
-                    topo_data->angle_list->partners_[k + first_site_in_molecule][l] = mol[molecule_type].angle_list->partners_[k][l] + first_site_in_molecule;
-                }
-                topo_data->dihedral_list->partner_numbers_[k + first_site_in_molecule] = mol[molecule_type].dihedral_list->partner_numbers_[k];
-                for (l = 0; l < 3 * mol[molecule_type].dihedral_list->partner_numbers_[k]; l++) {
-                    topo_data->dihedral_list->partners_[k + first_site_in_molecule][l] = mol[molecule_type].dihedral_list->partners_[k][l] + first_site_in_molecule;
-                }
+            if (first_site_in_molecule + mol[molecule_type].n_cg_sites > topo_data->n_cg_sites) {
+                printf("The system section of top.in defines more than %d CG sites.\n", topo_data->n_cg_sites);
+                exit(EXIT_FAILURE);
             }
+            molecule_types.push_back(molecule_type);
+            molecule_first_sites.push_back(first_site_in_molecule);
             first_site_in_molecule += mol[molecule_type].n_cg_sites;
         }
     }
@@ -296,9 +300,78 @@ void read_topology_file(TopologyData* topo_data, CG_MODEL_DATA* const cg)
         sscanf(topo_data->name[i], "%s", cg->name[i]);
     }
     
-	// Set-up appropriate bonded exclusions list from non-bonded interactions based on excluded_style
-	setup_excluded_list(topo_data, topo_data->exclusion_list, topo_data->excluded_style);
-	setup_excluded_list(topo_data, topo_data->density_exclusion_list, topo_data->density_excluded_style);
+    // Check each molecule type that appears in the system once, and set up
+    // its exclusions once. Bonds never join two molecules, so the exclusions
+    // of every copy of a molecule are those of its template shifted by the
+    // copy's first site.
+    int n_threads = get_num_topology_threads(topo_data);
+	printf("Setting up exclusion list for excluded_style %d.\n", topo_data->excluded_style);
+	printf("Setting up exclusion list for excluded_style %d.\n", topo_data->density_excluded_style);
+    for (i = 0; i < n_molecule_types; i++) {
+        if (!molecule_type_used[i]) continue;
+        for (k = 0; k < mol[i].n_cg_sites; k++) {
+            if (mol[i].bond_list->partner_numbers_[k] > topo_data->max_pair_bonds_per_site) {
+                printf("Warning: Too many bonds (%d) to handle based on max_pair_bonds_per_site (%d) !\n", mol[i].bond_list->partner_numbers_[k], topo_data->max_pair_bonds_per_site);
+                exit(EXIT_FAILURE);
+            }
+            if (mol[i].angle_list->partner_numbers_[k] > topo_data->max_angles_per_site) {
+                printf("Warning: Too many bonds (%d) to handle based on max_angles_per_site (%d) !\n", mol[i].angle_list->partner_numbers_[k], topo_data->max_angles_per_site);
+                exit(EXIT_FAILURE);
+            }
+            if (mol[i].dihedral_list->partner_numbers_[k] > topo_data->max_dihedrals_per_site) {
+                printf("Warning: Too many bonds (%d) to handle based on max_dihedrals_per_site (%d) !\n", mol[i].dihedral_list->partner_numbers_[k], topo_data->max_dihedrals_per_site);
+                exit(EXIT_FAILURE);
+            }
+        }
+        
+        delete mol[i].exclusion_list;
+        delete mol[i].density_exclusion_list;
+        mol[i].exclusion_list = new TopoList(mol[i].n_cg_sites, 1, topo_data->exclusion_list->max_partners_);
+        mol[i].density_exclusion_list = new TopoList(mol[i].n_cg_sites, 1, topo_data->density_exclusion_list->max_partners_);
+        if (topo_data->excluded_style != 0) {
+            k = build_excluded_list(&mol[i], mol[i].exclusion_list, topo_data->excluded_style, n_threads);
+            if (k < mol[i].n_cg_sites) report_excluded_list_overflow(mol[i].exclusion_list->partner_numbers_[k], topo_data->exclusion_list->max_partners_, topo_data->excluded_style);
+        }
+        if (topo_data->density_excluded_style != 0) {
+            k = build_excluded_list(&mol[i], mol[i].density_exclusion_list, topo_data->density_excluded_style, n_threads);
+            if (k < mol[i].n_cg_sites) report_excluded_list_overflow(mol[i].density_exclusion_list->partner_numbers_[k], topo_data->density_exclusion_list->max_partners_, topo_data->density_excluded_style);
+        }
+    }
+    
+    // Copy the templates into the system's topology lists. Each molecule
+    // only writes the rows of its own sites, so the molecules are divided
+    // among the worker threads.
+    auto copy_site_list = [](TopoList const* template_list, TopoList* system_list, const unsigned site, const unsigned first_site) {
+        unsigned n_values = template_list->partners_per_ * template_list->partner_numbers_[site];
+        system_list->partner_numbers_[site + first_site] = template_list->partner_numbers_[site];
+        for (unsigned value = 0; value < n_values; value++) {
+            system_list->partners_[site + first_site][value] = template_list->partners_[site][value] + first_site;
+        }
+    };
+    auto copy_molecules = [&](const unsigned first_molecule, const unsigned molecule_stride) {
+        for (size_t m = first_molecule; m < molecule_types.size(); m += molecule_stride) {
+            TopologyData const* molecule = &mol[molecule_types[m]];
+            unsigned first_site = molecule_first_sites[m];
+            for (unsigned site = 0; site < molecule->n_cg_sites; site++) {
+                topo_data->cg_site_types[site + first_site] = molecule->cg_site_types[site];
+                copy_site_list(molecule->bond_list, topo_data->bond_list, site, first_site);
+                copy_site_list(molecule->angle_list, topo_data->angle_list, site, first_site);
+                copy_site_list(molecule->dihedral_list, topo_data->dihedral_list, site, first_site);
+                copy_site_list(molecule->exclusion_list, topo_data->exclusion_list, site, first_site);
+                copy_site_list(molecule->density_exclusion_list, topo_data->density_exclusion_list, site, first_site);
+            }
+        }
+    };
+    if (n_threads > (int)(molecule_types.size())) n_threads = std::max((int)(molecule_types.size()), 1);
+    if (n_threads == 1) {
+        copy_molecules(0, 1);
+    } else {
+        std::vector<std::thread> workers;
+        for (l = 0; l < unsigned(n_threads); l++) {
+            workers.push_back(std::thread(copy_molecules, l, unsigned(n_threads)));
+        }
+        for (auto& worker : workers) worker.join();
+    }
 	
     // Close the file and free the memory used to store the temporary
     // single-molecule topologies.
@@ -771,118 +844,143 @@ void read_molecule_definition(TopologyData* const mol, TopologyData *topo_data,
     }
 }
 
-void recursive_exclusion_search(TopologyData const* topo_data, TopoList* &exclusion_list, std::vector<int> &path_list)
+int get_num_topology_threads(TopologyData const* topo_data)
 {
-	int path_size = path_list.size();
-	int base_id = path_list[0];
-	int last_id = path_list[path_size - 1];
-	int bond_partner_size = topo_data->bond_list->partner_numbers_[ path_list[path_size - 1] ];
-	int partner_id;
+	if (topo_data->num_threads > 0) return topo_data->num_threads;
+	int n_cores = (int)std::thread::hardware_concurrency();
+	return (n_cores > 0) ? n_cores : 1;
+}
+
+// Styles 2, 3, and 4 walk one, two, or three bonds out from the site;
+// style 5 excludes every site reachable through bonds, found by a breadth-first
+// search. visit_marks holds, for each site, one more than the last site whose
+// search reached it, so it never has to be cleared between sites.
+void collect_excluded_partners(TopologyData const* topo_data, const unsigned site, const int excluded_style, std::vector<unsigned> &excluded, std::vector<unsigned> &visit_marks, std::vector<unsigned> &search_queue)
+{
+	TopoList const* bond_list = topo_data->bond_list;
+	excluded.clear();
 	
-	for (int i = 0; i < bond_partner_size; i++) {
-		partner_id = topo_data->bond_list->partners_[last_id][i];
-		
-		// Check if this site is already excluded
-		if ((base_id != partner_id) &&
-		    (new_excluded_partner(exclusion_list->partners_, base_id, exclusion_list->partner_numbers_[base_id], partner_id) == true)) {
-	        exclusion_list->partners_[base_id][ exclusion_list->partner_numbers_[base_id] ] = partner_id;
-    	    exclusion_list->partner_numbers_[base_id]++;
- 	        
-            path_list.push_back(partner_id);
-            recursive_exclusion_search(topo_data, exclusion_list, path_list);
-            path_list.pop_back();
+	if (excluded_style == 5) {
+		visit_marks[site] = site + 1;
+		search_queue.clear();
+		search_queue.push_back(site);
+		for (size_t head = 0; head < search_queue.size(); head++) {
+			unsigned current_site = search_queue[head];
+			for (unsigned j = 0; j < bond_list->partner_numbers_[current_site]; j++) {
+				unsigned partner_site = bond_list->partners_[current_site][j];
+				if (visit_marks[partner_site] == site + 1) continue;
+				visit_marks[partner_site] = site + 1;
+				search_queue.push_back(partner_site);
+				excluded.push_back(partner_site);
+			}
+		}
+	} else {
+		// Loop over sites (cg_site1) bonded to that CG site.
+		for (unsigned j = 0; j < bond_list->partner_numbers_[site]; j++) {
+			unsigned cg_site1 = bond_list->partners_[site][j];
+			excluded.push_back(cg_site1);
+			if (excluded_style == 2) continue;
+			
+			// Loop over potential angles (cg_site2: bonded to cg_site1 which is bonded to site)
+			for (unsigned k = 0; k < bond_list->partner_numbers_[cg_site1]; k++) {
+				unsigned cg_site2 = bond_list->partners_[cg_site1][k];
+				
+				// Add this as an angle interaction as long as it does not loop back to the starting CG site.
+				if (cg_site2 == site) continue;
+				excluded.push_back(cg_site2);
+				
+				// If we need dihedrals, loop over all potential dihedrals (cg_site3: bonded to angle).
+				if (excluded_style != 4) continue;
+				for (unsigned l = 0; l < bond_list->partner_numbers_[cg_site2]; l++) {
+					unsigned cg_site3 = bond_list->partners_[cg_site2][l];
+					
+					// Add this as a dihedral interaction as long as it does not loop back to a CG site in the existing angle.
+					if ( (cg_site3 == site) || (cg_site3 == cg_site1) || (cg_site3 == cg_site2) ) continue;
+					excluded.push_back(cg_site3);
+				}
+			}
+		}
+	}
+	
+	std::sort(excluded.begin(), excluded.end());
+	excluded.erase(std::unique(excluded.begin(), excluded.end()), excluded.end());
+}
+
+// Each site's row only depends on the bond list, so the sites are divided
+// among the worker threads. A site with too many exclusions keeps its count
+// but not its partners.
+unsigned build_excluded_list(TopologyData const* topo_data, TopoList* const exclusion_list, const int excluded_style, int n_threads)
+{
+	unsigned n_sites = topo_data->n_cg_sites;
+	if (unsigned(n_threads) > n_sites) n_threads = std::max(int(n_sites), 1);
+	unsigned max_excluded_number = get_max_exclusion_number(topo_data, excluded_style);
+	std::vector<unsigned> first_overflow_sites(n_threads, n_sites);
+	
+	auto build_rows = [&](const int thread_index) {
+		std::vector<unsigned> excluded, search_queue;
+		std::vector<unsigned> visit_marks;
+		if (excluded_style == 5) visit_marks.assign(n_sites, 0);
+		for (unsigned i = thread_index; i < n_sites; i += n_threads) {
+			collect_excluded_partners(topo_data, i, excluded_style, excluded, visit_marks, search_queue);
+			exclusion_list->partner_numbers_[i] = excluded.size();
+			if (excluded.size() > max_excluded_number) {
+				if (first_overflow_sites[thread_index] == n_sites) first_overflow_sites[thread_index] = i;
+				continue;
+			}
+			std::copy(excluded.begin(), excluded.end(), exclusion_list->partners_[i]);
+		}
+	};
+	if (n_threads == 1) {
+		build_rows(0);
+	} else {
+		std::vector<std::thread> workers;
+		for (int t = 0; t < n_threads; t++) {
+			workers.push_back(std::thread(build_rows, t));
 		}
+		for (auto& worker : workers) worker.join();
+	}
+	return *std::min_element(first_overflow_sites.begin(), first_overflow_sites.end());
+}
+
+void report_excluded_list_overflow(const unsigned n_excluded, const unsigned max_excluded_number, const int excluded_style)
+{
+	if (excluded_style == 2 || excluded_style == 5) {
+		printf("Warning: Too many excluded interactions (%d) to handle based on max_pair_bonds_per_site (%d)!\n", n_excluded, max_excluded_number);
+	} else {
+		printf("Warning: Too many excluded interactions (%d) to handle based on max_pair_bonds_per_site, max_angles_per_site, and max_dihedrals_per_site (total %d)!\n", n_excluded, max_excluded_number);
 	}
+	exit(EXIT_FAILURE);
 }
 
+// Automatically determine topology to set appropriate
+// bond, angle, and/or dihedral exclusion as appropriate.
+// Each site's exclusions are stored in increasing order.
 void setup_excluded_list( TopologyData const* topo_data, TopoList* &exclusion_list, const int excluded_style) 
 {
-	// Automatically determine topology to set appropriate
-    // bond, angle, and/or dihedral exclusion as appropriate.
 	printf("Setting up exclusion list for excluded_style %d.\n", excluded_style);
-    if (excluded_style == 0) return;
+	if (excluded_style == 0) return;
 	
-	unsigned max_excluded_number = get_max_exclusion_number(topo_data, excluded_style);
-       
-    if (excluded_style == 5) {
-    	for (unsigned i = 0; i < topo_data->n_cg_sites; i++) {
-    		std::vector<int> path_list = {(int)(i)};
-    		recursive_exclusion_search(topo_data, exclusion_list, path_list);
-    		
-    		if ( exclusion_list->partner_numbers_[i] > max_excluded_number ) {
-    			printf("Warning: Too many excluded interactions (%d) to handle based on max_pair_bonds_per_site (%d)!\n", exclusion_list->partner_numbers_[i], max_excluded_number);
-    			exit(EXIT_FAILURE);
-    		}
-		}
-    	return;	
-    }
-            
-    // Loop over each CG site and its bonds to copy into exclusion list
-    for (unsigned i = 0; i < topo_data->n_cg_sites; i++) {
-        for (unsigned j = 0; j < topo_data->bond_list->partner_numbers_[i]; j++) {            
-            exclusion_list->partners_[i][ exclusion_list->partner_numbers_[i] ] = topo_data->bond_list->partners_[i][j];
-            exclusion_list->partner_numbers_[i]++;
-        }
-    
-    	if ( exclusion_list->partner_numbers_[i] > max_excluded_number ) {
-    		printf("Warning: Too many excluded interactions (%d) to handle based on max_pair_bonds_per_site (%d)!\n", exclusion_list->partner_numbers_[i], max_excluded_number);
-    		exit(EXIT_FAILURE);
-    	}
-    }
-    
-    // If we also need angles, check the sites bonded to known bonds and
-    // if we need dihedrals, check the sites bonded to know angles to add to exclusion list.
-    if (excluded_style == 2) return;
-    
-    // Loop over CG sites in the molecule
-    for (unsigned i = 0; i < topo_data->n_cg_sites; i++) {
-        
-        // Loop over sites (cg_site1) bonded to that CG site (i).
-        for (unsigned j = 0; j < topo_data->bond_list->partner_numbers_[i]; j++) {
-        
-            unsigned cg_site1 = topo_data->bond_list->partners_[i][j];
-    
-    		// Loop over potential angles (cg_site2: bonded to cg_site1 which is bonded to i)
-            for (unsigned k = 0; k < topo_data->bond_list->partner_numbers_[cg_site1]; k++) {
-                    
-                unsigned cg_site2 = topo_data->bond_list->partners_[cg_site1][k];
-                
-                //add this as an angle interaction as long as it does not loop back to the starting CG site
-                if (cg_site2 == i) continue; 
-                if ( new_excluded_partner(exclusion_list->partners_, i, exclusion_list->partner_numbers_[i], cg_site2) == true ) {
-	                exclusion_list->partners_[i][ exclusion_list->partner_numbers_[i] ] = cg_site2;
-    	            exclusion_list->partner_numbers_[i]++;
-        		}
-        		        
-                //if we need dihedrals, loop over all potential dihedrals (cg_site3: bonded to angle)
-                if (excluded_style == 4) {
-                	for(unsigned l = 0; l < topo_data->bond_list->partner_numbers_[cg_site2]; l++) {
-                		unsigned cg_site3 = topo_data->bond_list->partners_[cg_site2][l];
-                		
-                		//add this as a dihedral interaction as long as it does not loop back to a CG site in the existing angle
-                		if( (cg_site3 == i) || (cg_site3 == cg_site1) || (cg_site3 == cg_site2) ) continue;
-                		if ( new_excluded_partner(exclusion_list->partners_, i, exclusion_list->partner_numbers_[i], cg_site3) == true ) {
-                			exclusion_list->partners_[i][ exclusion_list->partner_numbers_[i] ] = cg_site3;
-               		 		exclusion_list->partner_numbers_[i]++;
-               		 	}
-               		}
-            	}
-            
-        	}
-        }
-        
-    	if ( exclusion_list->partner_numbers_[i] > max_excluded_number ) {
-    		printf("Warning: Too many excluded interactions (%d) to handle based on max_pair_bonds_per_site, max_angles_per_site, and max_dihedrals_per_site (total %d)!\n", exclusion_list->partner_numbers_[i], max_excluded_number);
-    		exit(EXIT_FAILURE);
-    	}
-    }
+	unsigned overflow_site = build_excluded_list(topo_data, exclusion_list, excluded_style, get_num_topology_threads(topo_data));
+	if (overflow_site < topo_data->n_cg_sites) {
+		report_excluded_list_overflow(exclusion_list->partner_numbers_[overflow_site], get_max_exclusion_number(topo_data, excluded_style), excluded_style);
+	}
 }
 
-bool new_excluded_partner(unsigned** const excluded_partners, const int location, const unsigned current_size, const unsigned new_site) {
-	for(unsigned i = 0; i < current_size; i++) {
-		if (excluded_partners[location][i] == new_site)	return false;
+void compile_bonded_interaction_list(TopoList const* topo_list, const unsigned n_sites, std::vector<int> &sites)
+{
+	unsigned n_body = topo_list->partners_per_ + 1;
+	sites.clear();
+	for (unsigned k = 0; k < n_sites; k++) {
+		for (unsigned kk = 0; kk < topo_list->partner_numbers_[k]; kk++) {
+			// The last partner of each entry is the other end site; the others are central sites.
+			unsigned const* partners = topo_list->partners_[k] + kk * topo_list->partners_per_;
+			unsigned l = partners[n_body - 2];
+			if (k >= l) continue;
+			sites.push_back(k);
+			sites.push_back(l);
+			for (unsigned p = 0; p < n_body - 2; p++) sites.push_back(partners[p]);
+		}
 	}
-	return true;
 }
 
 void report_topology_input_format_error(const int line, char *parameter_name)
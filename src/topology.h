@@ -8,6 +8,8 @@
 #ifndef _topology_h
 #define _topology_h
 
+#include <vector>
+
 struct CG_MODEL_DATA;
 
 struct TopoList {
@@ -18,6 +20,7 @@ struct TopoList {
     const unsigned max_partners_;	// The maximum number of partners (set in control.in).
     unsigned* partner_numbers_;		// The number of partners each CG site has for this topological attribute.
     unsigned** partners_;			// For a given CG site, it lists the CG site indices of all partnered particles (for this topological attribute).
+    unsigned* partner_storage_;		// A single block holding the rows of partners_ one after the other (partners_per_ * max_partners_ entries per site).
 
 	int modified;					// A flag indicating if the pointers for partners_ and partner_numbers_ arrays are shared (1 for yes, 0 for no).
 									// This is primarily useful in the LAMMPS fix when these arrays are allocated, freed, and owned by LAMMPS.
@@ -25,6 +28,9 @@ struct TopoList {
     inline TopoList() : TopoList(0, 0, 0) {}
     TopoList(unsigned n_sites, unsigned partners_per, unsigned max_partners);
     ~TopoList();
+    
+    // Free this list's own arrays (if it still has them) and use arrays owned by the caller instead.
+    void share_arrays(unsigned** partners, unsigned* partner_numbers);
 };
 
 // Struct responsible for keeping track of all cg site numbers, types, bonds,
@@ -52,6 +58,9 @@ struct TopologyData {
     int* angle_type_activation_flags;       // 0 if a given type of angular bonded interaction is active in the model; 1 otherwise
     int* dihedral_type_activation_flags;    // 0 if a given type of dihedral bonded interaction is active in the model; 1 otherwise
 	
+	int num_threads;					// Worker threads for building topology lists; 0 to use all available cores
+	int revision;						// Incremented whenever the bonded topology lists or site types are replaced
+	int site_types_vary;				// 1 if the site types are read from each frame (dynamic_types or dynamic_state_sampling); 0 otherwise
 	int excluded_style;					// 0 no exclusions; 2 exclude 1-2 bonded; 3 exclude 1-2 and 1-3 bonded; 4 exclude 1-2, 1-3 and 1-4 bonded interactions
 	int angle_format;
 	int dihedral_format;
@@ -72,6 +81,9 @@ struct TopologyData {
 		max_pair_bonds_per_site(max_bonds),
 		max_angles_per_site(max_angles),
 		max_dihedrals_per_site(max_dihedrals) {
+		num_threads = 0;
+		revision = 0;
+		site_types_vary = 0;
 		bond_list = angle_list = dihedral_list  = NULL;
 		exclusion_list = density_exclusion_list = NULL;
 		cg_site_types = NULL;
@@ -92,4 +104,9 @@ void initialize_topology_data(TopologyData* const topo_data);
 
 // Determine appropriate non-bonded exclusions based on bonded topology and exclusion_style setting (used for LAMMPS fix).
 void setup_excluded_list(TopologyData const* topo_data,  TopoList* &exclusion_list, const int excluded_style);
+
+// List each bond, angle, or dihedral of the first n_sites sites of a topology list once, as a row of
+// n_body site indices: k l for bonds, k l j for angles (j the center), and k l i j for dihedrals
+// (i and j the central bond), where k < l are the end sites. The rows follow the order of k.
+void compile_bonded_interaction_list(TopoList const* topo_list, const unsigned n_sites, std::vector<int> &sites);
 #endif
@@ -5,6 +5,7 @@
 //  Copyright (c) 2016 The Voth Group at The University of Chicago. All rights reserved.
 //
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
@@ -68,7 +69,7 @@ struct XRDData {
 		delete [] f;
 	};
 	
-	inline void convert_rvec_to_vector(std::array<double, DIMENSION>* &position, std::array<double, DIMENSION>* &force, const int n_cg_sites) {
+	inline void convert_rvec_to_vector(std::array<frame_real, DIMENSION>* &position, std::array<frame_real, DIMENSION>* &force, const int n_cg_sites) {
 		for (int i = 0; i < n_cg_sites; i++) {
 			for(int j = 0; j < DIMENSION; j++) {
 				position[i][j] = x[i][j];
@@ -894,7 +895,12 @@ int add_3B_stencil_element(const std::vector<int>& cell_number, const std::vecto
 
 void BaseCellList::init(const double cutoff, const FrameSource* const fr)
 {
-    setUpCellListCells(cutoff, fr->frame_config->simulation_box_half_lengths, fr->frame_config->current_n_sites);
+    init(cutoff, fr->frame_config->simulation_box_half_lengths, fr->frame_config->current_n_sites);
+}
+
+void BaseCellList::init(const double cutoff, const real* simulation_box_half_lengths, const int current_n_sites)
+{
+    setUpCellListCells(cutoff, simulation_box_half_lengths, current_n_sites);
     setUpCellListStencil();
 }
 
@@ -947,14 +953,43 @@ void BaseCellList::setUpCellListCells(const double cutoff, const real*  simulati
     
     head = std::vector<int>(size);
     list = std::vector<int>(current_n_sites);
+    setUpCellOrder();
+}
+
+// Order the cells along a Morton curve by interleaving the bits of their
+// indices in each dimension.
+
+void BaseCellList::setUpCellOrder(void)
+{
+	std::vector< std::pair<uint64_t, int> > keyed_cells(size);
+	for (int cell = 0; cell < size; cell++) {
+		uint64_t key = 0;
+		int remainder = cell;
+		for (int i = 0; i < DIMENSION; i++) {
+			uint64_t index = remainder % cell_number[i];
+			remainder /= cell_number[i];
+			for (int bit = 0; bit * DIMENSION + i < 64; bit++) {
+				key |= ((index >> bit) & 1) << (bit * DIMENSION + i);
+			}
+		}
+		keyed_cells[cell] = std::make_pair(key, cell);
+	}
+	std::sort(keyed_cells.begin(), keyed_cells.end());
+
+	cell_order = std::vector<int>(size);
+	cell_curve_position = std::vector<int>(size);
+	for (int p = 0; p < size; p++) {
+		cell_order[p] = keyed_cells[p].second;
+		cell_curve_position[keyed_cells[p].second] = p;
+	}
+	cell_offsets = std::vector<int>(size + 1);
 }
 
 // Populate the cell lists.
 
-void BaseCellList::populateList(const int n_particles, std::array<double, DIMENSION>* const &particle_positions)
+void BaseCellList::populateList(const int n_particles, std::array<frame_real, DIMENSION>* const &particle_positions)
 {
     assert(n_particles > 0);
-    int icell; // The index for the cell that a particle is in;
     
     // Pre-compute offsets in the cell array for steps in each dimension.
     hash_offset.resize(DIMENSION);
@@ -969,6 +1004,7 @@ void BaseCellList::populateList(const int n_particles, std::array<double, DIMENS
 		cell_inv[i] = 1.0 / cell_size[i];
 	}
 	
+	site_cells.resize(n_particles);
 	// If we are actually using cell_lists.
 	// // At the moment this is checked by only looking at the first dimension,
 	// // but if cell list use is NOT all-or-none then this check would be insufficient.
@@ -981,10 +1017,11 @@ void BaseCellList::populateList(const int n_particles, std::array<double, DIMENS
         for (int i = 0; i < n_particles; i++) {
 			// Determine each particles cell. 
 			// This "hash" for each cell refers to the cell's index since that data is stored in a flat array (x + y * x_offset + z * x_offset * y_offsets + ...).
-            icell = 0;
+            int icell = 0;
             for (int j = 0; j < DIMENSION; j++) {
             	icell += (int)( particle_positions[i][j] * cell_inv[j] ) * hash_offset[j];
             }
+            site_cells[i] = icell;
 			// Make this particle the head of its cell's list.
 			// This particle now "points" to the index that was previously the head of this cell's list (-1 if it is the first particle).
             list[i] = head[icell];
@@ -1001,7 +1038,31 @@ void BaseCellList::populateList(const int n_particles, std::array<double, DIMENS
             list[i] = i + 1;
         }
         list[n_particles - 1] = -1;
+        std::fill(site_cells.begin(), site_cells.end(), 0);
     }
+
+	// Sort the particles by the curve position of their cells, keeping the
+	// order of the linked lists within each cell (descending index, or
+	// ascending in the special case above).
+	std::fill(cell_offsets.begin(), cell_offsets.end(), 0);
+	for (int i = 0; i < n_particles; i++) {
+		cell_offsets[cell_curve_position[site_cells[i]] + 1]++;
+	}
+	for (int p = 0; p < size; p++) {
+		cell_offsets[p + 1] += cell_offsets[p];
+	}
+	sorted_sites.resize(n_particles);
+	sorted_positions.resize(DIMENSION * n_particles);
+	std::vector<int> next_slot(cell_offsets.begin(), cell_offsets.end() - 1);
+	int first = (cell_size[0] > 0.0) ? n_particles - 1 : 0;
+	int step = (cell_size[0] > 0.0) ? -1 : 1;
+	for (int n = 0, i = first; n < n_particles; n++, i += step) {
+		int slot = next_slot[cell_curve_position[site_cells[i]]]++;
+		sorted_sites[slot] = i;
+		for (int j = 0; j < DIMENSION; j++) {
+			sorted_positions[j * n_particles + slot] = particle_positions[i][j];
+		}
+	}
 }
 
 // Set up a pair list stencil.
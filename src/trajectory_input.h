@@ -45,21 +45,21 @@ typedef int (*add_stencil_element)(const std::vector<int> &cell_number, const st
 struct FrameConfig {
     int current_n_sites;                 // Total number of sites in this frame
     real* simulation_box_half_lengths;   // A list of half the box length in each dimension
-    std::array<double, DIMENSION>* x;    // A list of all CG particle positions for a single frame stored in a flat array, x,y,z components contiguous 
-    std::array<double, DIMENSION>* f;    // A list of all CG particle positions for a single frame stored in a flat array, x,y,z components contiguous    
+    std::array<frame_real, DIMENSION>* x;    // A list of all CG particle positions for a single frame stored in a flat array, x,y,z components contiguous 
+    std::array<frame_real, DIMENSION>* f;    // A list of all CG particle positions for a single frame stored in a flat array, x,y,z components contiguous    
 	int* cg_site_types;				   	 // A list of all CG particle types (used if dynamic_types = 1)
 	
 	inline FrameConfig(const int n_sites) {
 		current_n_sites = n_sites;
-		x = new std::array<double, DIMENSION>[current_n_sites + 1];
-		f = new std::array<double, DIMENSION>[current_n_sites + 1];
+		x = new std::array<frame_real, DIMENSION>[current_n_sites + 1];
+		f = new std::array<frame_real, DIMENSION>[current_n_sites + 1];
 		simulation_box_half_lengths = new real[DIMENSION];
 	};
 	
 	inline FrameConfig(const int n_sites, int* site_types) {
 		current_n_sites = n_sites;
-		x = new std::array<double, DIMENSION>[current_n_sites + 1];
-		f = new std::array<double, DIMENSION>[current_n_sites + 1];
+		x = new std::array<frame_real, DIMENSION>[current_n_sites + 1];
+		f = new std::array<frame_real, DIMENSION>[current_n_sites + 1];
 		simulation_box_half_lengths = new real[DIMENSION];
 		cg_site_types = site_types;		
 	};
@@ -177,7 +177,8 @@ class BaseCellList {
 
 public:
     void init(const double cutoff, const FrameSource* const fr);
-    void populateList(const int n_particles, std::array<double, DIMENSION>* const &particle_positions);
+    void init(const double cutoff, const real* simulation_box_half_lengths, const int current_n_sites);
+    void populateList(const int n_particles, std::array<frame_real, DIMENSION>* const &particle_positions);
     inline int get_stencil_size() const { return stencil_size; };
     inline double get_cell_size(int i) const {return cell_size[i]; };
     int size;					// The total number of cells to cover the simulation box.
@@ -187,6 +188,31 @@ public:
     std::vector<int> head;		// List of the first particle in each cell for all cells.
     std::vector<int> stencil;	// List of neighboring cells to look through during force computation.
     std::vector<int> hash_offset;
+
+    // The same assignment of particles to cells, with the cells ordered along a
+    // Morton (Z-order) space-filling curve and each cell's particles stored
+    // contiguously, so that walking the cells in curve order touches memory
+    // close to the previous cell's. Particles keep their original indices for
+    // everything outside the walk itself (types, exclusions, matrix rows).
+    std::vector<int> cell_order;			// Cell index at each position along the curve; set up with the cells.
+    std::vector<int> cell_curve_position;	// Position along the curve of each cell.
+    std::vector<int> cell_offsets;			// Particles of the cell at curve position p are sorted_sites[cell_offsets[p]] to sorted_sites[cell_offsets[p + 1] - 1].
+    std::vector<int> sorted_sites;			// Original particle indices in cell order.
+    std::vector<frame_real> sorted_positions;	// Positions in cell order, as DIMENSION consecutive arrays of one component each.
+
+    // Squared minimum-image distance between the particles at two positions
+    // in cell order, computed exactly as in the geometry routines.
+    inline double get_sorted_squared_distance(const int a, const int b, const real* simulation_box_half_lengths) const {
+    	int n_sorted = (int)sorted_sites.size();
+    	double rr2 = 0.0;
+    	for (int i = 0; i < DIMENSION; i++) {
+    		double displacement = (double)sorted_positions[i * n_sorted + b] - (double)sorted_positions[i * n_sorted + a];
+    		if (displacement > simulation_box_half_lengths[i]) displacement -= 2.0 * simulation_box_half_lengths[i];
+    		else if (displacement < -simulation_box_half_lengths[i]) displacement += 2.0 * simulation_box_half_lengths[i];
+    		rr2 += displacement * displacement;
+    	}
+    	return rr2;
+    }
 	
 protected:
     // The number of cells in each dimension.
@@ -195,7 +221,10 @@ protected:
     std::vector<double> cell_size;
 	int stencil_size;			// The number of neighboring cells surrounding a given cell that need to be searched through during force computation.
 
+    std::vector<int> site_cells;	// Cell of each particle in the current frame.
+
     void setUpCellListCells(const double cutoff, const real* simulation_box_half_lengths, const int current_n_sites);
+    void setUpCellOrder(void);
     virtual void setUpCellListStencil() = 0;
 };
 
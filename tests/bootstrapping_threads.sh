@@ -0,0 +1,33 @@
+#!/bin/sh
+# Solve bootstrapped accumulation (matrix_type 2) equations for the
+# examples/lammps_fm trajectory with one and with two worker threads, and
+# check that the master and bootstrapping force tables agree. With more
+# than one thread, frame blocks are factored in batches, the last of which
+# is reduced only when the equations are finished.
+#
+# Usage: bootstrapping_threads.sh NEWFM [REPOSITORY_ROOT]
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 NEWFM [REPOSITORY_ROOT]"
+	exit 2
+fi
+newfm=$1
+tests_dir=$(cd "$(dirname "$0")" && pwd)
+root=${2:-$tests_dir/..}
+example="$root/examples/lammps_fm"
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+for n_threads in 1 2; do
+	mkdir "$work/$n_threads" || exit 1
+	cp "$example/top.in" "$example/rmin.in" "$example/rmin_b.in" "$work/$n_threads/" || exit 1
+	sed 's/^matrix_type.*/matrix_type 2/' "$example/control.in" > "$work/$n_threads/control.in"
+	printf "\nbootstrapping_flag 1\nbootstrapping_num_estimates 4\nnum_threads %d\n" $n_threads >> "$work/$n_threads/control.in"
+	if ! (cd "$work/$n_threads" && "$newfm" -l "$example/MeOH_example.dat" > newfm.log 2>&1); then
+		tail -5 "$work/$n_threads/newfm.log"
+		echo "newfm failed with num_threads $n_threads."
+		exit 1
+	fi
+done
+sh "$tests_dir/compare_tables.sh" "$work/2/1_1.dat" "$work/1/1_1.dat" 1e-8
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Run combinefm on the result files bundled with examples/batch_fm and
+# check the combined MeOH_MeOH force table against the one in its output
+# directory.
+#
+# Usage: combinefm_batch_fm.sh COMBINEFM [REPOSITORY_ROOT]
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 COMBINEFM [REPOSITORY_ROOT]"
+	exit 2
+fi
+combinefm=$1
+tests_dir=$(cd "$(dirname "$0")" && pwd)
+root=${2:-$tests_dir/..}
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+cp -r "$root/examples/batch_fm/." "$work/" || exit 1
+rm -rf "$work/output"
+
+cd "$work" || exit 1
+if ! "$combinefm" > combinefm.log 2>&1; then
+	cat combinefm.log
+	echo "combinefm failed."
+	exit 1
+fi
+sh "$tests_dir/compare_tables.sh" MeOH_MeOH.dat "$root/examples/batch_fm/output/MeOH_MeOH.dat" 1e-6
@@ -0,0 +1,33 @@
+#!/bin/sh
+# Compare two tabulated force files (.dat) produced by MSCG.
+#
+# Usage: compare_tables.sh FILE REFERENCE TOLERANCE
+#
+# Rows are matched by their first column (the distance or angle). Every
+# remaining column of the matched rows must agree to within TOLERANCE
+# times the largest absolute value in the same columns of REFERENCE.
+# Exits with status 1 if they do not, or if the files share no rows.
+
+if [ $# -ne 3 ]; then
+	echo "Usage: $0 FILE REFERENCE TOLERANCE"
+	exit 2
+fi
+
+awk -v tol="$3" -v file="$1" -v ref="$2" '
+	FNR == NR { ref_row[$1] = $0; next }
+	($1 in ref_row) {
+		n = split(ref_row[$1], r)
+		for (i = 2; i <= NF && i <= n; i++) {
+			d = $i - r[i]; if (d < 0) d = -d
+			m = r[i]; if (m < 0) m = -m
+			if (d > max_diff) max_diff = d
+			if (m > max_ref) max_ref = m
+		}
+		n_common++
+	}
+	END {
+		if (n_common == 0) { printf("%s and %s have no rows in common.\n", file, ref); exit 1 }
+		limit = tol * max_ref
+		printf("%s: %d rows compared, largest difference %g (allowed %g).\n", file, n_common, max_diff, limit)
+		if (max_diff > limit) exit 1
+	}' "$2" "$1"
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Build the executables with double and with single precision frame
+# storage (MSCG_SINGLE_PRECISION_FRAMES), force match the examples/lammps_fm
+# and examples/validate-nb trajectories with each build, and check that
+# their force tables agree to within 0.1% of the largest force.
+#
+# Usage: single_precision_frames.sh WORK_DIR [CMAKE_ARGUMENT...]
+#
+# The builds are made in WORK_DIR/double and WORK_DIR/single; any further
+# arguments (for example -DGSL_ROOT_DIR=...) are passed to CMake when
+# configuring them.
+
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 WORK_DIR [CMAKE_ARGUMENT...]"
+	exit 2
+fi
+tests_dir=$(cd "$(dirname "$0")" && pwd)
+root=$(cd "$tests_dir/.." && pwd)
+mkdir -p "$1" || exit 1
+work=$(cd "$1" && pwd)
+shift
+tolerance=1e-3
+
+for precision in double single; do
+	if [ $precision = single ]; then flag=ON; else flag=OFF; fi
+	cmake -S "$root/src/CMake" -B "$work/$precision" -DMSCG_SINGLE_PRECISION_FRAMES=$flag "$@" > "$work/$precision.log" 2>&1 &&
+	cmake --build "$work/$precision" --target newfm >> "$work/$precision.log" 2>&1
+	if [ $? -ne 0 ]; then
+		tail -20 "$work/$precision.log"
+		echo "The $precision precision build failed."
+		exit 1
+	fi
+done
+
+status=0
+for example in lammps_fm:MeOH_example.dat validate-nb:LJ_sample75_20frames.dat; do
+	name=${example%%:*}
+	trajectory="$root/examples/$name/${example#*:}"
+	for precision in double single; do
+		run="$work/$name/$precision"
+		rm -rf "$run"
+		mkdir -p "$run" || exit 1
+		cp "$root/examples/$name/control.in" "$root/examples/$name/top.in" "$root/examples/$name"/rmin*.in "$run/" || exit 1
+		if ! (cd "$run" && "$work/$precision/newfm_no_gro.x" -l "$trajectory" > newfm.log 2>&1); then
+			tail -5 "$run/newfm.log"
+			echo "newfm ($precision precision) failed on $name."
+			exit 1
+		fi
+	done
+	sh "$tests_dir/compare_tables.sh" "$work/$name/single/1_1.dat" "$work/$name/double/1_1.dat" $tolerance || status=1
+done
+exit $status